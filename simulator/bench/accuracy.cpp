@@ -0,0 +1,357 @@
+#include "benchharness.h"
+#include "defs.h"
+#include "logger.h"
+#include "reference.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Accuracy of the engine's vehicle state precision (real in defs.h) against the reference engine, which computes
+ * in double. Standard scenarios - rings at free flow, in stop-and-go and with lanes to change, and generated
+ * cities of every layout with vehicles driving from road to road - start from the same saved state on both
+ * engines and are stepped side by side. Per scenario:
+ *
+ *      drift       position difference of the vehicles on the same road of both engines: the largest over the
+ *                  run, and the largest and the root mean square after the last step. Around a ring, the
+ *                  shorter way. Velocity: the largest difference over the run
+ *      off         vehicles on another road or lane than on the reference engine after the last step
+ *      collisions  vehicle steps overlapping the vehicle ahead on the lane (lights and obstacles aside), and the
+ *                  deepest overlap - per engine. None in the model: transfers only enter with a gap
+ *                  (Road::enterVehicle), and IDM keeps it. The engine's precision should not make any
+ *      changes     lane changes made, per engine
+ *
+ * A double build (the default) drifts by nothing: difftest checks that at --tolerance 0. The float build
+ * (-DSIMULATOR_FLOAT_STATE=ON) drifts: once the first lane change happens a step apart, trajectories part - what
+ * matters then is that there are still no collisions, and lane changes stay what the reference engine makes.
+ *
+ *      simulator_accuracy [--steps 1000] [--dt 0.5] [--threads 1] [--seed 1] [--max-drift m]
+ *
+ * Exit code 1 with --max-drift when a scenario drifts further, or when vehicles overlap on either engine - cities
+ * with transfers included.
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    unsigned steps = { 1000 };
+    double dt = { 0.5 };
+    unsigned threads = { 1 };
+    unsigned long seed = { 1 };
+    double maxDrift = { 0.0 };  // meters, 0 - not checked
+};
+
+struct Scenario
+{
+    std::string name;
+    std::string state;
+    bool transfers;
+};
+
+struct Sample
+{
+    roadID road;
+    unsigned lane;
+    double pos;
+    double velocity;
+};
+
+typedef std::map<int, Sample> Samples;
+
+// what one engine did over a run
+struct Tally
+{
+    unsigned long collisions = { 0 };
+    double deepestOverlap = { 0 };
+    unsigned long laneChanges = { 0 };
+};
+
+struct Report
+{
+    unsigned long vehicles = { 0 };
+    double maxDrift = { 0 };        // over the run
+    double endMaxDrift = { 0 };
+    double endRmsDrift = { 0 };
+    double maxVelocityDrift = { 0 };
+    unsigned long off = { 0 };
+    Tally reference;
+    Tally engine;
+};
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool used = true;
+
+        if (!value) {
+            used = false;
+        } else if (!strcmp(arg, "--steps")) {
+            options.steps = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--dt")) {
+            options.dt = atof(value);
+        } else if (!strcmp(arg, "--threads")) {
+            options.threads = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--seed")) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--max-drift")) {
+            options.maxDrift = atof(value);
+        } else {
+            used = false;
+        }
+
+        if (!used) {
+            fprintf(stderr, "usage: %s [--steps n] [--dt s] [--threads n] [--seed n] [--max-drift m]\n", argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+std::string saveState(const Simulator &sim)
+{
+    std::ostringstream out;
+    sim.saveState(out);
+    return out.str();
+}
+
+// a ring of density vehicles per km and lane at rest, as bench/ring.cpp runs it
+std::string ringState(double density, unsigned lanes, unsigned long seed)
+{
+    Simulator sim;
+    sim.addRoadNetToMap(bench::makeRings(1, 1000.0, lanes, 30, density, seed));
+    return saveState(sim);
+}
+
+std::string cityState(CitySpec::Layout layout, unsigned long seed)
+{
+    CitySpec spec;
+    spec.layout = layout;
+    spec.size = layout == CitySpec::motorway ? 6 : 4;
+    spec.demand = 40.0;
+    spec.seed = seed;
+
+    Simulator sim;
+    sim.addRoadNetToMap(generateCity(spec));
+    return saveState(sim);
+}
+
+std::vector<Scenario> standardScenarios(unsigned long seed)
+{
+    return {
+        { "ring 1 lane 20 veh/km", ringState(20, 1, seed), false },
+        { "ring 1 lane 80 veh/km", ringState(80, 1, seed), false },
+        { "ring 3 lanes 40 veh/km", ringState(40, 3, seed), false },
+        { "grid city", cityState(CitySpec::grid, seed), true },
+        { "radial city", cityState(CitySpec::radial, seed), true },
+        { "motorway city", cityState(CitySpec::motorway, seed), true },
+    };
+}
+
+// a vehicle as both engines see it
+struct Seen
+{
+    int id;
+    double pos;
+    double length;
+    double velocity;
+};
+
+typedef std::vector<std::vector<Seen>> Lanes;
+// length of the periodic roads, by id
+typedef std::map<roadID, double> Rings;
+
+/* samples of a road's vehicles, and its overlaps and the lane changes since the samples before, prev, added to
+ * tally. Overlaps go by position, whatever order the engine keeps the lane in - around the ring, ringLength
+ * meters long, 0 for an open road */
+void observe(roadID road, double ringLength, Lanes &lanes, const Samples &prev, Samples &samples, Tally &tally)
+{
+    for (unsigned laneIndex = 0; laneIndex < lanes.size(); ++laneIndex) {
+        std::vector<Seen> &lane = lanes[laneIndex];
+        for (const Seen &v : lane) {
+            samples[v.id] = Sample{ road, laneIndex, v.pos, v.velocity };
+
+            auto before = prev.find(v.id);
+            if (before != prev.end() && before->second.road == road && before->second.lane != laneIndex)
+                ++tally.laneChanges;
+        }
+
+        // lights and obstacles aside: they stand on the vehicles' way on purpose
+        lane.erase(std::remove_if(lane.begin(), lane.end(), [](const Seen &v) { return v.length <= 0; }), lane.end());
+        if (ringLength > 0)
+            for (Seen &v : lane)
+                v.pos = std::fmod(v.pos, ringLength);
+        std::sort(lane.begin(), lane.end(), [](const Seen &lhs, const Seen &rhs) { return lhs.pos > rhs.pos; });
+        for (size_t i = 0; i < lane.size(); ++i) {
+            if (i == 0 && (ringLength <= 0 || lane.size() < 2))
+                continue;
+            const Seen &leader = i > 0 ? lane[i - 1] : lane.back();
+            double leaderPos = i > 0 ? leader.pos : leader.pos + ringLength;
+            double gap = leaderPos - leader.length - lane[i].pos;
+            if (gap < 0) {
+                ++tally.collisions;
+                tally.deepestOverlap = std::max(tally.deepestOverlap, -gap);
+            }
+        }
+    }
+}
+
+void observe(const Simulator &sim, const Rings &rings, const Samples &prev, Samples &samples, Tally &tally)
+{
+    Lanes lanes;
+    for (auto &roadElement : sim.cityMap) {
+        lanes.clear();
+        for (auto &lane : roadElement.second.getVehicles()) {
+            lanes.emplace_back();
+            for (const Vehicle &v : lane)
+                lanes.back().push_back(Seen{ v.getId(), v.getPos(), v.getLength(), v.getVelocity() });
+        }
+        auto ring = rings.find(roadElement.first);
+        observe(roadElement.first, ring != rings.end() ? ring->second : 0.0, lanes, prev, samples, tally);
+    }
+}
+
+void observe(const reference::Engine &engine, const Rings &rings, const Samples &prev, Samples &samples,
+             Tally &tally)
+{
+    Lanes lanes;
+    for (const reference::Road &road : engine.getRoads()) {
+        lanes.clear();
+        for (auto &lane : road.lanes) {
+            lanes.emplace_back();
+            for (const reference::Vehicle &v : lane)
+                lanes.back().push_back(Seen{ v.id, v.xPos, v.length, v.velocity });
+        }
+        auto ring = rings.find(road.id);
+        observe(road.id, ring != rings.end() ? ring->second : 0.0, lanes, prev, samples, tally);
+    }
+}
+
+bool run(const Scenario &scenario, const Options &options, Report &report)
+{
+    Simulator sim;
+    reference::Engine engine;
+    std::istringstream simIn(scenario.state);
+    std::istringstream engineIn(scenario.state);
+    if (!sim.loadState(simIn) || !engine.loadState(engineIn)) {
+        fprintf(stderr, "%s: cannot load the scenario state\n", scenario.name.c_str());
+        return false;
+    }
+    sim.setWorkerThreads(options.threads);
+    sim.setTransfers(scenario.transfers);
+    engine.setTransfers(scenario.transfers);
+
+    Rings rings;
+    for (const reference::Road &road : engine.getRoads())
+        if (road.boundary == Road::periodic)
+            rings[road.id] = road.length;
+
+    Samples expected, actual, expectedBefore, actualBefore;
+    observe(engine, rings, Samples(), expected, report.reference);
+    observe(sim, rings, Samples(), actual, report.engine);
+    // overlaps the scenario starts with are not the engines'
+    report.reference = report.engine = Tally();
+    report.vehicles = expected.size();
+
+    for (unsigned step = 1; step <= options.steps; ++step) {
+        sim.update(options.dt);
+        engine.update(options.dt);
+
+        std::swap(expected, expectedBefore);
+        std::swap(actual, actualBefore);
+        expected.clear();
+        actual.clear();
+        observe(engine, rings, expectedBefore, expected, report.reference);
+        observe(sim, rings, actualBefore, actual, report.engine);
+
+        const bool last = step == options.steps;
+        double squares = 0.0;
+        unsigned long compared = 0;
+        for (auto &element : expected) {
+            auto found = actual.find(element.first);
+            const Sample &e = element.second;
+            if (found == actual.end() || found->second.road != e.road || found->second.lane != e.lane) {
+                report.off += last;
+                if (found == actual.end() || found->second.road != e.road)
+                    continue;
+            }
+
+            // around a ring the shorter way: a vehicle past the end on one engine only is just ahead
+            double drift = std::fabs(found->second.pos - e.pos);
+            auto ring = rings.find(e.road);
+            if (ring != rings.end())
+                drift = std::min(drift, std::fabs(ring->second - drift));
+            report.maxDrift = std::max(report.maxDrift, drift);
+            report.maxVelocityDrift = std::max(report.maxVelocityDrift, std::fabs(found->second.velocity - e.velocity));
+            if (last) {
+                report.endMaxDrift = std::max(report.endMaxDrift, drift);
+                squares += drift * drift;
+                ++compared;
+            }
+        }
+        // the engine's vehicles the reference engine doesn't have
+        if (last)
+            for (auto &element : actual)
+                report.off += !expected.count(element.first);
+        if (last && compared)
+            report.endRmsDrift = std::sqrt(squares / compared);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    printf("vehicle state: %s, %u steps of %g s, %u thread(s)\n", sizeof(real) == sizeof(float) ? "float" : "double",
+           options.steps, options.dt, options.threads);
+    printf("%-24s %8s %11s %11s %11s %10s %5s %13s %11s %13s\n", "scenario", "vehicles", "max dx m", "end max m",
+           "end rms m", "max dv m/s", "off", "collisions", "overlap m", "changes");
+    printf("%-24s %8s %11s %11s %11s %10s %5s %13s %11s %13s\n", "", "", "", "", "", "", "", "ref/engine",
+           "ref/engine", "ref/engine");
+
+    int status = 0;
+    for (const Scenario &scenario : standardScenarios(options.seed)) {
+        Report report;
+        if (!run(scenario, options, report)) {
+            status = 2;
+            continue;
+        }
+
+        ::Logger::flush();
+        printf("%-24s %8lu %11.3g %11.3g %11.3g %10.3g %5lu %6lu/%-6lu %5.2f/%-5.2f %6lu/%-6lu\n", scenario.name.c_str(),
+               report.vehicles, report.maxDrift, report.endMaxDrift, report.endRmsDrift, report.maxVelocityDrift,
+               report.off, report.reference.collisions, report.engine.collisions, report.reference.deepestOverlap,
+               report.engine.deepestOverlap, report.reference.laneChanges, report.engine.laneChanges);
+        fflush(stdout);
+
+        if (options.maxDrift > 0 && report.maxDrift > options.maxDrift) {
+            printf("  drifts %.3g m, over %.3g m\n", report.maxDrift, options.maxDrift);
+            status = std::max(status, 1);
+        }
+        if (report.engine.collisions > 0 || report.reference.collisions > 0) {
+            printf("  vehicles overlap\n");
+            status = std::max(status, 1);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,182 @@
+#include "alloccount.h"
+
+#include "logger.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Steady state allocation check: after a warm-up, a simulation step must not touch the heap.
+ * Several simulations share a host, and the allocator is where their threads meet.
+ * Runs medium generated cities of every layout, a set of ring roads and a loop of roads vehicles drive around
+ * from road to road (transfers), on one and on two threads - roads claimed as workers go and partitioned - and
+ * counts operator new calls (alloccount.h) over the measured steps. The logger thread is counted too: a last run
+ * logs from two threads and flushes, and formatting the messages must not allocate either.
+ * Exit code 1 if any step allocated.
+ *
+ *      simulator_alloccheck [--lanes 2000] [--warmup 100] [--steps 300]
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    unsigned long lanes = { 2000 };
+    unsigned warmup = { 100 };
+    unsigned steps = { 300 };
+};
+
+struct Scenario
+{
+    std::string name;
+    std::vector<Road> roads;
+    bool transfers;
+};
+
+// two lane rings, dense enough for stop-and-go waves and plenty of lane changes
+std::vector<Road> makeRings()
+{
+    std::vector<Road> rings;
+    for (roadID r = 0; r < 16; ++r) {
+        Road ring(r, 1000.0, 2, 30);
+        ring.setBoundary(Road::periodic);
+        for (unsigned lane = 0; lane < 2; ++lane)
+            for (unsigned i = 0; i < 40; ++i)
+                ring.addVehicle(Vehicle(i * 25.0 + lane * 7.0 + r, 5.0, 24.0 + (i % 7)), lane);
+        rings.push_back(ring);
+    }
+    return rings;
+}
+
+/* the rings cut into roads that lead one into the next: vehicles drive on from road to road (transfers), and
+ * queue at their lights, around a closed loop that keeps them all */
+std::vector<Road> makeLoop()
+{
+    const roadID roadsNo = 16;
+    std::vector<Road> loop;
+    for (roadID r = 0; r < roadsNo; ++r) {
+        Road road(r, 1000.0, 2, 30);
+        for (unsigned lane = 0; lane < 2; ++lane) {
+            road.addLaneConnection(lane, (r + 1) % roadsNo);
+            for (unsigned i = 0; i < 30; ++i)
+                road.addVehicle(Vehicle(i * 30.0 + lane * 7.0 + r, 5.0, 24.0 + (i % 7)), lane);
+        }
+        loop.push_back(road);
+    }
+    return loop;
+}
+
+// allocations during steps, after warmup steps
+uint64_t countStepAllocations(const Scenario &scenario, unsigned threads, bool partitioned, const Options &options)
+{
+    Simulator sim;
+    sim.addRoadNetToMap(std::vector<Road>(scenario.roads));
+    sim.setWorkerThreads(threads);
+    sim.setPartitioned(partitioned);
+    sim.setTransfers(scenario.transfers);
+
+    const double dt = 0.5;
+    for (unsigned step = 0; step < options.warmup; ++step)
+        sim.update(dt);
+
+    uint64_t before = bench::allocations();
+    for (unsigned step = 0; step < options.steps; ++step)
+        sim.update(dt);
+    return bench::allocations() - before;
+}
+
+/* messages from this thread and another one, both with their log rings already registered, then a flush: the
+ * allocations of the logger thread's drain pass */
+uint64_t countLoggingAllocations(unsigned messagesNo)
+{
+    std::atomic<int> phase(0);
+    std::thread other([&phase, messagesNo]() {
+        log_info("alloccheck: logging thread ready");
+        phase = 1;
+        while (phase != 2)
+            std::this_thread::yield();
+        for (unsigned i = 0; i < messagesNo; ++i)
+            log_info("alloccheck: logging thread message %u of %u", i + 1, messagesNo);
+        phase = 3;
+    });
+    log_info("alloccheck: main thread ready");
+    while (phase != 1)
+        std::this_thread::yield();
+    ::Logger::flush();
+
+    uint64_t before = bench::allocations();
+    phase = 2;
+    for (unsigned i = 0; i < messagesNo; ++i)
+        log_info("alloccheck: main thread message %u of %u", i + 1, messagesNo);
+    while (phase != 3)
+        std::this_thread::yield();
+    ::Logger::flush();
+    uint64_t allocations = bench::allocations() - before;
+
+    other.join();
+    return allocations;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--lanes") && hasValue) {
+            options.lanes = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--warmup") && hasValue) {
+            options.warmup = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--steps") && hasValue) {
+            options.steps = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--lanes n] [--warmup steps] [--steps n]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Scenario> scenarios;
+    const char *layoutNames[] = { "grid", "radial", "motorway" };
+    for (unsigned layout = 0; layout < 3; ++layout)
+        scenarios.push_back(Scenario{ layoutNames[layout],
+                                      generateCity(citySpecForLanes((CitySpec::Layout)layout, options.lanes)), false });
+    scenarios.push_back(Scenario{ "transfers", makeLoop(), true });
+    scenarios.push_back(Scenario{ "rings", makeRings(), false });
+
+    unsigned failed = 0;
+    for (const Scenario &scenario : scenarios) {
+        for (unsigned run = 0; run < 3; ++run) {
+            unsigned threads = run == 0 ? 1 : 2;
+            bool partitioned = run == 2;
+            uint64_t allocations = countStepAllocations(scenario, threads, partitioned, options);
+            ::Logger::flush();
+            printf("%-9s %7lu lanes %u thread(s)%s: %6lu allocations in %u steps after %u warm-up steps%s\n",
+                   scenario.name.c_str(), countLanes(scenario.roads), threads, partitioned ? " partitioned" : "",
+                   (unsigned long)allocations, options.steps, options.warmup, allocations ? "  FAILED" : "");
+            failed += allocations != 0;
+        }
+    }
+
+    const unsigned messagesNo = 16;
+    uint64_t allocations = countLoggingAllocations(messagesNo);
+    printf("logger    %u messages from 2 threads and a flush: %6lu allocations%s\n", 2 * messagesNo,
+           (unsigned long)allocations, allocations ? "  FAILED" : "");
+    failed += allocations != 0;
+
+    if (failed) {
+        fprintf(stderr, "%u run(s) allocated in the steady state\n", failed);
+        return 1;
+    }
+    return 0;
+}
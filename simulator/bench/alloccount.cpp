@@ -0,0 +1,70 @@
+#include "alloccount.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/* Global operator new replacement: counts every allocation of the process, library included.
+ * Only the benchmarks and checks link it - the simulator allocates through the standard one. */
+
+namespace
+{
+
+std::atomic<uint64_t> allocationsNo(0);
+
+void *countedAllocation(std::size_t size)
+{
+    allocationsNo.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+uint64_t bench::allocations()
+{
+    return allocationsNo.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size)
+{
+    return countedAllocation(size);
+}
+
+void *operator new[](std::size_t size)
+{
+    return countedAllocation(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    allocationsNo.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    allocationsNo.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
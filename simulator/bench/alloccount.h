@@ -0,0 +1,16 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+#include <cstdint>
+
+namespace bench
+{
+
+/* Allocation counting hook: executables that link alloccount.cpp replace the global operator new and count
+ * every allocation of the process, the simulator library and the standard library included.
+ * allocations() - operator new calls made so far; take the difference around the code under test */
+uint64_t allocations();
+
+} // namespace bench
+
+#endif // ALLOCCOUNT_H
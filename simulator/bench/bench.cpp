@@ -0,0 +1,257 @@
+#include "benchharness.h"
+
+#include "mobil.h"
+#include "rng.h"
+#include "road.h"
+#include "simulator.h"
+#include "trafficlight.h"
+#include "vehicle.h"
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/* Microbenchmarks of the core kernels: IDM, MOBIL, lane lookup, lane sorting, the road step,
+ * traffic lights and output. Items are vehicle-steps unless the benchmark says otherwise.
+ *
+ *      simulator_bench [--filter road_update] [--csv out.csv] [--min-time 0.5]
+ */
+
+using namespace simulator;
+using bench::Harness;
+using bench::doNotOptimize;
+
+namespace
+{
+
+const double roadLength = 2000.0;   // meters
+const unsigned maxSpeed = 20;       // m/s
+const unsigned long seed = 20240601;
+
+std::string params(unsigned lanes, unsigned density)
+{
+    return "lanes=" + std::to_string(lanes) + " density=" + std::to_string(density);
+}
+
+/* a lane of evenly spread vehicles (density per km, a little jitter), sorted like Road::indexRoad */
+std::vector<Vehicle> makeLane(unsigned density, unsigned laneIndex)
+{
+    CounterRng rng(seed);
+    double spacing = 1000.0 / density;
+    unsigned vehiclesNo = roadLength / spacing;
+
+    std::vector<Vehicle> lane;
+    for (unsigned i = vehiclesNo; i-- > 0; ) {
+        double pos = i * spacing + 0.3 * spacing * rng.uniform(laneIndex, i, 0, 0);
+        double desiredSpeed = maxSpeed * (0.8 + 0.4 * rng.uniform(laneIndex, i, 0, 1));
+        lane.push_back(Vehicle(pos, 5.0, desiredSpeed));
+    }
+    return lane;
+}
+
+Road makeRoad(roadID id, unsigned lanes, unsigned density)
+{
+    Road road(id, roadLength, lanes, maxSpeed);
+    for (unsigned lane = 0; lane < lanes; ++lane)
+        for (const Vehicle &v : makeLane(density, id * lanes + lane))
+            road.addVehicle(v, lane);
+    road.indexRoad();
+    return road;
+}
+
+// ostream that formats everything and writes nothing
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+void benchAcceleration(Harness &harness)
+{
+    for (unsigned density : { 10u, 60u }) {
+        std::vector<Vehicle> lane = makeLane(density, 0);
+        harness.run("vehicle_acceleration", "density=" + std::to_string(density), 1000, [&](unsigned steps) {
+            double sum = 0.0;
+            for (unsigned step = 0; step < steps; ++step)
+                for (size_t i = 1; i < lane.size(); ++i)
+                    sum += lane[i].getNewAcceleration(lane[i - 1]);
+            doNotOptimize(sum);
+            return (uint64_t)steps * (lane.size() - 1);
+        });
+    }
+}
+
+void benchCanChangeLane(Harness &harness)
+{
+    for (unsigned density : { 10u, 60u }) {
+        std::vector<Vehicle> lane = makeLane(density, 0);
+        std::vector<Vehicle> nextLane = makeLane(density, 1);
+        Vehicle none(0.0, 0.0, 0.0);
+
+        // the neighbours each vehicle would have - looked up once, only MOBIL is timed
+        std::vector<int> leaders;
+        for (const Vehicle &v : lane)
+            leaders.push_back(getNextLaneLeaderPos(v, nextLane));
+
+        harness.run("vehicle_can_change_lane", "density=" + std::to_string(density), 1000, [&](unsigned steps) {
+            unsigned changes = 0;
+            for (unsigned step = 0; step < steps; ++step)
+                for (size_t i = 1; i < lane.size(); ++i) {
+                    int leader = leaders[i];
+                    const Vehicle &newLeader = leader >= 0 ? nextLane[leader] : none;
+                    const Vehicle &newFollower = (size_t)(leader + 1) < nextLane.size() ? nextLane[leader + 1] : none;
+                    changes += lane[i].canChangeLane(lane[i - 1], newLeader, newFollower);
+                }
+            doNotOptimize(changes);
+            return (uint64_t)steps * (lane.size() - 1);
+        });
+    }
+}
+
+// the same decisions as vehicle_can_change_lane, a lane at a time: gather, gap check and kernel are timed
+void benchMobilBatch(Harness &harness)
+{
+    for (unsigned density : { 10u, 60u }) {
+        std::vector<Vehicle> lane = makeLane(density, 0);
+        std::vector<Vehicle> nextLane = makeLane(density, 1);
+        const std::vector<Vehicle> *targetLanes[2] = { &nextLane, nullptr };
+        MobilBatch batch;
+
+        harness.run("mobil_batch", "density=" + std::to_string(density), 1000, [&](unsigned steps) {
+            unsigned changes = 0;
+            for (unsigned step = 0; step < steps; ++step) {
+                batch.clear();
+                for (size_t i = 1; i < lane.size(); ++i)
+                    batch.add(lane[i], lane[i].getMotion(), lane[i - 1], targetLanes);
+                batch.evaluate();
+                for (size_t i = 0; i < batch.size(); ++i)
+                    changes += batch.wantsChange(i, MobilBatch::left);
+            }
+            doNotOptimize(changes);
+            return (uint64_t)steps * (lane.size() - 1);
+        });
+    }
+}
+
+void benchNextLaneLeader(Harness &harness)
+{
+    for (unsigned density : { 10u, 60u, 150u }) {
+        std::vector<Vehicle> lane = makeLane(density, 0);
+        std::vector<Vehicle> nextLane = makeLane(density, 1);
+        harness.run("next_lane_leader_pos", "density=" + std::to_string(density), 1000, [&](unsigned steps) {
+            long sum = 0;
+            for (unsigned step = 0; step < steps; ++step)
+                for (const Vehicle &v : lane)
+                    sum += getNextLaneLeaderPos(v, nextLane);
+            doNotOptimize(sum);
+            return (uint64_t)steps * lane.size();
+        });
+    }
+}
+
+void benchIndexRoad(Harness &harness)
+{
+    for (unsigned lanes : { 1u, 3u }) {
+        for (unsigned density : { 10u, 60u }) {
+            Road road = makeRoad(0, lanes, density);
+            // lanes are already sorted - the common case at every step
+            harness.run("road_index", params(lanes, density), 100, [&](unsigned steps) {
+                for (unsigned step = 0; step < steps; ++step)
+                    road.indexRoad();
+                return (uint64_t)steps * road.getVehiclesNo();
+            });
+        }
+    }
+}
+
+void benchRoadUpdate(Harness &harness)
+{
+    std::map<roadID, Road> noRoads;
+
+    for (unsigned lanes : { 1u, 2u, 3u, 4u }) {
+        for (unsigned density : { 10u, 30u, 60u }) {
+            const Road initial = makeRoad(0, lanes, density);
+            Road road;
+            // every batch starts from the same density: vehicles queue at the light and don't leave the road
+            harness.run("road_update", params(lanes, density), 20, [&](unsigned steps) {
+                uint64_t vehicleSteps = 0;
+                for (unsigned step = 0; step < steps; ++step) {
+                    vehicleSteps += road.getVehiclesNo();
+                    road.update(0.5, noRoads);
+                }
+                return vehicleSteps;
+            }, [&]() { road = initial; });
+        }
+    }
+}
+
+void benchTrafficLights(Harness &harness)
+{
+    std::vector<TrafficLight> lights;
+    for (unsigned i = 0; i < 1024; ++i)
+        lights.push_back(TrafficLight(10 + i % 7, 1, 30 + i % 11, (TrafficLight::LightColor)(i % 3)));
+
+    // items are lights
+    harness.run("traffic_light_update", "lights=1024", 1000, [&](unsigned steps) {
+        for (unsigned step = 0; step < steps; ++step)
+            for (TrafficLight &light : lights)
+                light.update(0.5);
+        doNotOptimize(lights.front().getColor());
+        return (uint64_t)steps * lights.size();
+    });
+}
+
+void benchSerialize(Harness &harness)
+{
+    Simulator sim;
+    for (roadID id = 0; id < 16; ++id) {
+        sim.addRoadToMap(makeRoad(id, 3, 30));
+    }
+
+    unsigned vehiclesNo = 0;
+    for (auto &roadElement : sim.cityMap)
+        vehiclesNo += roadElement.second.getVehiclesNo();
+
+    NullBuffer nullBuffer;
+    std::ostream out(&nullBuffer);
+
+    // items are serialized vehicles
+    harness.run("serialize_v1", "roads=16 lanes=3 density=30", 10, [&](unsigned steps) {
+        for (unsigned step = 0; step < steps; ++step)
+            sim.serialize_v1(step * 0.5, out);
+        return (uint64_t)steps * vehiclesNo;
+    });
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Harness harness;
+    if (!harness.parseArguments(argc, argv))
+        return 1;
+
+    struct Benchmark
+    {
+        const char *name;
+        void (*run)(Harness &);
+    } benchmarks[] = {
+        { "vehicle_acceleration", benchAcceleration },
+        { "vehicle_can_change_lane", benchCanChangeLane },
+        { "mobil_batch", benchMobilBatch },
+        { "next_lane_leader_pos", benchNextLaneLeader },
+        { "road_index", benchIndexRoad },
+        { "road_update", benchRoadUpdate },
+        { "traffic_light_update", benchTrafficLights },
+        { "serialize_v1", benchSerialize },
+    };
+
+    for (const Benchmark &benchmark : benchmarks) {
+        if (!harness.selected(benchmark.name))
+            continue;
+        benchmark.run(harness);
+    }
+
+    return 0;
+}
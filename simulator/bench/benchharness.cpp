@@ -0,0 +1,142 @@
+#include "benchharness.h"
+#include "logger.h"
+#include "rng.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace bench
+{
+
+Harness::~Harness()
+{
+    if (csv)
+        fclose(csv);
+}
+
+bool Harness::parseArguments(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--filter") && hasValue) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time") && hasValue) {
+            minSeconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--csv") && hasValue) {
+            csv = fopen(argv[++i], "w");
+            if (!csv) {
+                fprintf(stderr, "Cannot create %s\n", argv[i]);
+                return false;
+            }
+            fprintf(csv, "benchmark,params,ns_per_item,min_ns_per_item,allocs_per_step,items_per_step\n");
+        } else {
+            fprintf(stderr, "usage: %s [--filter text] [--csv file] [--min-time seconds]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Harness::selected(const std::string &name) const
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+void Harness::run(const std::string &name, const std::string &params, unsigned stepsPerBatch,
+                  const Kernel &kernel, const Reset &reset)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    if (!selected(name))
+        return;
+
+    // warm up caches, the branch predictor and any lazy allocation
+    if (reset)
+        reset();
+    kernel(stepsPerBatch);
+
+    std::vector<double> batchNsPerItem;
+    uint64_t allocs = 0;
+    uint64_t steps = 0;
+    uint64_t items = 0;
+    double elapsed = 0.0;
+
+    while (batchNsPerItem.size() < minBatches || elapsed < minSeconds) {
+        if (reset)
+            reset();
+
+        uint64_t allocsBefore = allocations();
+        Clock::time_point start = Clock::now();
+        uint64_t batchItems = kernel(stepsPerBatch);
+        Clock::time_point end = Clock::now();
+        allocs += allocations() - allocsBefore;
+
+        double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        batchNsPerItem.push_back(batchItems ? ns / batchItems : ns);
+        elapsed += ns / 1e9;
+        steps += stepsPerBatch;
+        items += batchItems;
+    }
+
+    std::sort(batchNsPerItem.begin(), batchNsPerItem.end());
+
+    // the setup's log messages go out before the row
+    ::Logger::flush();
+    if (results.empty())
+        printf("%-28s %-24s %12s %12s %12s %10s\n",
+               "benchmark", "params", "ns/item", "min ns/item", "allocs/step", "items/step");
+
+    Result result;
+    result.name = name;
+    result.params = params;
+    result.nsPerItem = batchNsPerItem[batchNsPerItem.size() / 2];
+    result.nsPerItemMin = batchNsPerItem.front();
+    result.allocsPerStep = (double)allocs / steps;
+    result.items = items / steps;
+    results.push_back(result);
+
+    printf("%-28s %-24s %12.2f %12.2f %12.2f %10lu\n", name.c_str(), params.c_str(),
+           result.nsPerItem, result.nsPerItemMin, result.allocsPerStep, (unsigned long)result.items);
+    fflush(stdout);
+    if (csv)
+        fprintf(csv, "%s,%s,%.3f,%.3f,%.3f,%lu\n", name.c_str(), params.c_str(),
+                result.nsPerItem, result.nsPerItemMin, result.allocsPerStep, (unsigned long)result.items);
+}
+
+const std::vector<Harness::Result>& Harness::getResults() const
+{
+    return results;
+}
+
+std::vector<simulator::Road> makeRings(unsigned roadsNo, double length, unsigned lanes, unsigned maxSpeed,
+                                       double density, uint64_t seed)
+{
+    using namespace simulator;
+    const double vehicleLength = 5.0;
+
+    CounterRng rng(seed);
+    unsigned perLane = std::max(1.0, std::floor(density * length / 1000.0));
+    double spacing = length / perLane;
+    double jitter = std::max(0.0, std::min(0.2 * spacing, spacing - vehicleLength - 1.0));
+
+    std::vector<Road> rings;
+    for (unsigned r = 0; r < roadsNo; ++r) {
+        Road ring(r, length, lanes, maxSpeed);
+        ring.setBoundary(Road::periodic);
+        for (unsigned lane = 0; lane < lanes; ++lane) {
+            for (unsigned i = 0; i < perLane; ++i) {
+                uint32_t vehicle = lane * perLane + i;
+                double pos = i * spacing + jitter * (rng.uniform(r, vehicle, 0, 0) - 0.5);
+                double desiredSpeed = maxSpeed * (0.85 + 0.3 * rng.uniform(r, vehicle, 0, 1));
+                ring.addVehicle(Vehicle(std::max(0.0, pos), vehicleLength, desiredSpeed), lane);
+            }
+        }
+        rings.push_back(ring);
+    }
+    return rings;
+}
+
+} // namespace bench
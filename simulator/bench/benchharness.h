@@ -0,0 +1,81 @@
+#ifndef BENCHHARNESS_H
+#define BENCHHARNESS_H
+
+#include "alloccount.h"
+#include "road.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+// keep the compiler from dropping a computed value
+template <class T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* Harness
+ * Times a kernel in batches of steps and reports the median time per item (a vehicle-step for vehicle
+ * kernels, a light or a serialized vehicle for the others) and the allocations per step.
+ *
+ * A kernel is a function running n steps and returning the number of items it processed. An optional reset
+ * brings the state back before every batch, outside the timed part - e.g. a fresh copy of the road,
+ * so a batch always starts from the same density.
+ */
+class Harness
+{
+public:
+    struct Result
+    {
+        std::string name;
+        std::string params;
+        double nsPerItem;       // median over batches
+        double nsPerItemMin;
+        double allocsPerStep;
+        uint64_t items;         // items per step
+    };
+
+    typedef std::function<uint64_t(unsigned steps)> Kernel;
+    typedef std::function<void()> Reset;
+
+private:
+    std::string filter;
+    double minSeconds = { 0.2 };
+    unsigned minBatches = { 5 };
+    FILE *csv = { nullptr };
+    std::vector<Result> results;
+
+public:
+    Harness() = default;
+    ~Harness();
+
+    Harness(const Harness &) = delete;
+    Harness &operator=(const Harness &) = delete;
+
+    // --filter text, --csv file, --min-time seconds. False on bad arguments
+    bool parseArguments(int argc, char *argv[]);
+
+    // false if the benchmark is filtered out - skip its setup too
+    bool selected(const std::string &name) const;
+
+    void run(const std::string &name, const std::string &params, unsigned stepsPerBatch,
+             const Kernel &kernel, const Reset &reset = Reset());
+
+    const std::vector<Result>& getResults() const;
+};
+
+/* roadsNo rings (Road::periodic) of length meters, with density vehicles per km and lane at rest: evenly spaced with
+ * some jitter, desired speeds around maxSpeed. Drawn from seed, the same on every run and every engine - the
+ * ring benchmark's workload, and the accuracy check's */
+std::vector<simulator::Road> makeRings(unsigned roadsNo, double length, unsigned lanes, unsigned maxSpeed,
+                                       double density, uint64_t seed);
+
+} // namespace bench
+
+#endif // BENCHHARNESS_H
@@ -0,0 +1,611 @@
+#include "config.h"
+#include "lanechange.h"
+#include "logger.h"
+#include "reference.h"
+#include "rng.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Differential test of the engine against the reference engine (reference.h).
+ * Random scenarios - generated cities of every layout, with extra vehicles thrown in at random positions,
+ * speeds and driver parameters, overlaps included, and some roads turned into rings - are stepped on both
+ * engines side by side. After every step each vehicle's road, lane, position, velocity and acceleration must
+ * agree within the tolerance. The overlaps brake vehicles to a stop within a step, so every run goes through the
+ * stop at zero velocity (Vehicle::update) - part of the model, on both engines.
+ * --transfers: vehicles drive on from road to road (Simulator::setTransfers) - they must change roads at the same
+ * step, onto the same road and lane. --lane-policy: which vehicles consider a lane change (lanechange.h), on both
+ * engines. --no-batch: the engine evaluates MOBIL one vehicle at a time,
+ * --no-prefilter: in full on every target lane. The reference engine does both, so a clean run with the batches
+ * and the prefilter on shows them exact. --simultaneous: every lane change of a road decided before any is made
+ * (LaneChangePolicy::simultaneous) - with threads, the lanes of the heavy roads are shared between them.
+ * --segment-length: with --simultaneous, roads at least twice as long move in segments (Config::roadSegmentLength).
+ * Segments change the results - a segment's first vehicle follows a coasted copy of its leader - so every step of
+ * a clean scenario is also made with and without them on the reference engine, and the rms distance between the
+ * two must stay within --max-segment-drift.
+ * A scenario's routes are drawn from its seed (Simulator::setSeed); with --transfers the scenarios run again on the
+ * engine with the next seed as well, and some vehicle must end up on another road.
+ *
+ * The first divergence of every vehicle is reported. The first divergent scenario is then minimized - down to
+ * the roads and vehicles it needs - and written as a state file that both engines load:
+ *
+ *      simulator_difftest [--scenarios 50] [--steps 200] [--dt 0.5] [--threads 1] [--seed 1] [--tolerance 1e-9]
+ *                         [--transfers] [--lane-policy exhaustive] [--no-prefilter] [--no-batch]
+ *                         [--simultaneous] [--segment-length 2000] [--max-segment-drift 0.05]
+ *                         [--output difftest_min.state]
+ *      simulator_difftest --replay difftest_min.state --steps n [--threads n] [--transfers] [--lane-policy name]
+ *
+ * Exit code 1 on a divergence. An optimized path is mergeable only when this runs clean.
+ * A float build (SIMULATOR_FLOAT_STATE, defs.h) rounds differently from the reference engine by design: it needs a
+ * --tolerance, and bench/accuracy.cpp tells how far it drifts.
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    unsigned scenarios = { 50 };
+    unsigned steps = { 200 };
+    double dt = { 0.5 };
+    unsigned threads = { 1 };
+    unsigned long seed = { 1 };
+    double tolerance = { 1e-9 };    // relative, absolute below 1
+    unsigned maxReports = { 10 };   // divergent vehicles printed per scenario
+    bool transfers = { false };
+    std::string lanePolicy = { "exhaustive" };
+    bool prefilter = { true };
+    bool batched = { true };
+    bool simultaneous = { false };
+    double segmentLength = { Config::roadSegmentLength };
+    double maxSegmentDrift = { 0.05 };  // rms meters a step, segmented against whole roads
+    std::string output = { "difftest_min.state" };
+    std::string replay;
+};
+
+struct Sample
+{
+    roadID road;
+    unsigned lane;
+    double pos;
+    double velocity;
+    double acceleration;
+};
+
+struct Divergence
+{
+    unsigned step;      // after this many steps
+    int vehicle;
+    std::string what;
+    Sample expected;    // reference engine
+    Sample actual;
+    bool missing;       // the vehicle is on one side only
+};
+
+typedef std::map<int, Sample> Samples;
+
+Samples samples(const Simulator &sim)
+{
+    Samples result;
+    for (auto &roadElement : sim.cityMap) {
+        unsigned laneIndex = 0;
+        for (auto &lane : roadElement.second.getVehicles()) {
+            for (const Vehicle &v : lane)
+                result[v.getId()] = Sample{ roadElement.first, laneIndex, v.getPos(), v.getVelocity(), v.getAcceleration() };
+            ++laneIndex;
+        }
+    }
+    return result;
+}
+
+Samples samples(const reference::Engine &engine)
+{
+    Samples result;
+    for (const reference::Road &road : engine.getRoads()) {
+        unsigned laneIndex = 0;
+        for (auto &lane : road.lanes) {
+            for (const reference::Vehicle &v : lane)
+                result[v.id] = Sample{ road.id, laneIndex, v.xPos, v.velocity, v.acceleration };
+            ++laneIndex;
+        }
+    }
+    return result;
+}
+
+bool close(double expected, double actual, double tolerance)
+{
+    if (std::isnan(expected) || std::isnan(actual))
+        return std::isnan(expected) && std::isnan(actual);
+    return std::fabs(expected - actual) <= tolerance * std::max(1.0, std::fabs(expected));
+}
+
+// what differs between two samples of a vehicle, empty if nothing
+std::string compare(const Sample &expected, const Sample &actual, double tolerance)
+{
+    if (expected.road != actual.road)
+        return "road";
+    if (expected.lane != actual.lane)
+        return "lane";
+    if (!close(expected.pos, actual.pos, tolerance))
+        return "position";
+    if (!close(expected.velocity, actual.velocity, tolerance))
+        return "velocity";
+    if (!close(expected.acceleration, actual.acceleration, tolerance))
+        return "acceleration";
+    return std::string();
+}
+
+/* step both engines from state and collect the first divergence of every vehicle, in step order.
+ * firstOnly - stop at the first divergent step (minimizer) */
+std::vector<Divergence> run(const std::string &state, unsigned steps, const Options &options, bool firstOnly)
+{
+    std::vector<Divergence> divergences;
+
+    Simulator sim;
+    reference::Engine engine;
+    std::istringstream simIn(state);
+    std::istringstream engineIn(state);
+    if (!sim.loadState(simIn) || !engine.loadState(engineIn)) {
+        fprintf(stderr, "Cannot load the scenario state\n");
+        return divergences;
+    }
+    sim.setWorkerThreads(options.threads);
+    sim.setTransfers(options.transfers);
+    engine.setTransfers(options.transfers);
+
+    std::map<int, bool> diverged;
+    for (unsigned step = 1; step <= steps; ++step) {
+        sim.update(options.dt);
+        engine.update(options.dt);
+
+        Samples expected = samples(engine);
+        Samples actual = samples(sim);
+
+        for (auto &element : expected) {
+            if (diverged.count(element.first))
+                continue;
+            auto found = actual.find(element.first);
+            Divergence d = { step, element.first, "", element.second, element.second, false };
+            if (found == actual.end()) {
+                d.what = "missing";
+                d.missing = true;
+            } else {
+                d.actual = found->second;
+                d.what = compare(element.second, found->second, options.tolerance);
+            }
+            if (!d.what.empty()) {
+                diverged[d.vehicle] = true;
+                divergences.push_back(d);
+            }
+        }
+        for (auto &element : actual) {
+            if (diverged.count(element.first) || expected.count(element.first))
+                continue;
+            diverged[element.first] = true;
+            divergences.push_back(Divergence{ step, element.first, "unexpected", element.second, element.second, true });
+        }
+
+        if (firstOnly && !divergences.empty())
+            break;
+    }
+    return divergences;
+}
+
+void printDivergence(const Divergence &d)
+{
+    if (d.missing) {
+        printf("  step %u vehicle %d: %s (road %lu lane %u pos %.6f)\n", d.step, d.vehicle, d.what.c_str(),
+               (unsigned long)d.expected.road, d.expected.lane, d.expected.pos);
+        return;
+    }
+    printf("  step %u vehicle %d: %s\n"
+           "      reference: road %lu lane %u pos %.9f v %.9f a %.9f\n"
+           "      engine:    road %lu lane %u pos %.9f v %.9f a %.9f\n",
+           d.step, d.vehicle, d.what.c_str(),
+           (unsigned long)d.expected.road, d.expected.lane, d.expected.pos, d.expected.velocity, d.expected.acceleration,
+           (unsigned long)d.actual.road, d.actual.lane, d.actual.pos, d.actual.velocity, d.actual.acceleration);
+}
+
+std::string saveState(const reference::Engine &engine)
+{
+    std::ostringstream out;
+    engine.saveState(out);
+    return out.str();
+}
+
+/* a random scenario: a small generated city, then extra vehicles anywhere on its roads - moving, with their own
+ * driver parameters, overlapping the population and each other. Everything but the city goes through the
+ * reference engine's state, so the scenario reaches both engines the same way */
+std::string makeScenario(unsigned long seed)
+{
+    CounterRng rng = CounterRng::forStream(seed, 0);
+
+    CitySpec spec;
+    spec.layout = (CitySpec::Layout)rng.uniformInt(0, 2, 0, 0, 1);
+    spec.size = rng.uniformInt(2, spec.layout == CitySpec::motorway ? 6 : 4, 0, 0, 2);
+    spec.lanes = rng.uniformInt(1, 4, 0, 0, 3);
+    spec.blockLength = rng.uniformInt(60, 300, 0, 0, 4);
+    spec.demand = rng.uniformInt(5, 150, 0, 0, 5);
+    spec.green = rng.uniformInt(5, 40, 0, 0, 6);
+    spec.yellow = rng.uniformInt(1, 4, 0, 0, 7);
+    spec.seed = seed;
+
+    Simulator sim;
+    sim.setSeed(seed);
+    std::vector<Road> roads = generateCity(spec);
+    sim.addRoadNetToMap(std::move(roads));
+    std::ostringstream city;
+    sim.saveState(city);
+
+    reference::Engine engine;
+    std::istringstream in(city.str());
+    engine.loadState(in);
+
+    int nextId = 0;
+    for (const reference::Road &road : engine.getRoads())
+        for (auto &lane : road.lanes)
+            for (const reference::Vehicle &v : lane)
+                nextId = std::max(nextId, v.id + 1);
+
+    CounterRng extras = CounterRng::forStream(seed, 1);
+    for (reference::Road &road : engine.getRoads()) {
+        // every fourth road or so is a ring
+        if (extras.uniformInt(0, 3, road.id, 0, 2) == 0)
+            road.boundary = reference::Road::periodic;
+
+        unsigned vehiclesNo = extras.uniformInt(0, 3 * road.lanesNo, road.id, 0, 0);
+        for (unsigned i = 0; i < vehiclesNo; ++i) {
+            uint32_t field = 0;
+            auto uniform = [&](double lo, double hi) { return lo + (hi - lo) * extras.uniform(road.id, i + 1, 0, field++); };
+
+            reference::Vehicle v;
+            v.id = nextId++;
+            v.type = Vehicle::vehicle;
+            v.length = uniform(2.5, 18.0);
+            v.xOrig = v.xPos = uniform(0.0, road.length);
+            v.v0 = uniform(5.0, 35.0);
+            v.velocity = uniform(0.0, v.v0);
+            v.s = -1.0;
+            v.acceleration = uniform(-2.0, 1.5);
+            v.aggressivity = uniform(0.0, 1.0);
+            v.T = uniform(0.8, 2.0);
+            v.a = uniform(0.8, 2.5);
+            v.b = uniform(1.5, 4.0);
+            v.s0 = uniform(0.5, 3.0);
+            v.delta = 4.0;
+            v.freeRoadDistance = uniform(50.0, 200.0);
+            v.politeness = uniform(0.0, 1.0);
+            v.bSafe = uniform(2.0, 6.0);
+            v.aThr = uniform(0.0, 0.5);
+            v.itinerary.push_back(road.id);
+            v.roadTime = 0.0;
+            // some still in the cooldown after a lane change
+            v.laneChangeSteps = extras.uniformInt(0, 7, road.id, i + 1, 2);
+            road.lanes[extras.uniformInt(0, road.lanesNo - 1, road.id, i + 1, 1)].push_back(v);
+        }
+    }
+    return saveState(engine);
+}
+
+/* smallest scenario that still diverges: the roads it needs - the divergent road alone if that's enough - then
+ * the vehicles it needs, removed in halving chunks down to one at a time */
+reference::Engine minimize(const std::string &state, const Divergence &first, const Options &options)
+{
+    reference::Engine engine;
+    std::istringstream in(state);
+    engine.loadState(in);
+
+    unsigned steps = first.step;
+    auto diverges = [&](const reference::Engine &candidate) {
+        return !run(saveState(candidate), steps, options, true).empty();
+    };
+
+    std::vector<reference::Road> &roads = engine.getRoads();
+
+    reference::Engine alone = engine;
+    alone.getRoads().clear();
+    for (const reference::Road &road : roads)
+        if (road.id == first.expected.road)
+            alone.getRoads().push_back(road);
+    if (diverges(alone)) {
+        engine = alone;
+    } else {
+        for (size_t r = roads.size(); r-- > 0; ) {
+            reference::Engine candidate = engine;
+            candidate.getRoads().erase(candidate.getRoads().begin() + r);
+            if (diverges(candidate))
+                engine = candidate;
+        }
+    }
+
+    for (size_t r = 0; r < engine.getRoads().size(); ++r) {
+        for (size_t l = 0; l < engine.getRoads()[r].lanes.size(); ++l) {
+            size_t chunk = engine.getRoads()[r].lanes[l].size();
+            while (chunk > 0) {
+                bool removed = false;
+                for (size_t begin = 0; begin < engine.getRoads()[r].lanes[l].size(); ) {
+                    reference::Engine candidate = engine;
+                    auto &lane = candidate.getRoads()[r].lanes[l];
+                    lane.erase(lane.begin() + begin, lane.begin() + std::min(begin + chunk, lane.size()));
+                    if (diverges(candidate)) {
+                        engine = candidate;
+                        removed = true;
+                    } else {
+                        begin += chunk;
+                    }
+                }
+                if (!removed || chunk == 1)
+                    chunk /= 2;
+            }
+        }
+    }
+    return engine;
+}
+
+void describe(const reference::Engine &engine)
+{
+    printf("minimal scenario: %zu road(s)\n", engine.getRoads().size());
+    const char *colors[] = { "green", "yellow", "red" };
+    for (const reference::Road &road : engine.getRoads()) {
+        printf("  road %lu: %.1f m, %u lane(s), max speed %u m/s\n", (unsigned long)road.id, road.length,
+               road.lanesNo, road.maxSpeed);
+        for (size_t l = 0; l < road.lanes.size(); ++l) {
+            if (l < road.lights.size()) {
+                const reference::TrafficLight &light = road.lights[l];
+                printf("    lane %zu: light %s for %.2f s (green %.1f yellow %.1f red %.1f)\n", l,
+                       light.color >= 0 && light.color < 3 ? colors[light.color] : "?", light.counter,
+                       light.times[0], light.times[1], light.times[2]);
+            }
+            for (const reference::Vehicle &v : road.lanes[l])
+                printf("      vehicle %d: pos %.6f v %.6f a %.6f length %.2f v0 %.2f T %.2f a %.2f b %.2f s0 %.2f\n",
+                       v.id, v.xPos, v.velocity, v.acceleration, v.length, v.v0, v.T, v.a, v.b, v.s0);
+        }
+    }
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool used = true;
+
+        if (!strcmp(arg, "--transfers")) {
+            options.transfers = true;
+            continue;
+        } else if (!strcmp(arg, "--no-prefilter")) {
+            options.prefilter = false;
+            continue;
+        } else if (!strcmp(arg, "--no-batch")) {
+            options.batched = false;
+            continue;
+        } else if (!strcmp(arg, "--simultaneous")) {
+            options.simultaneous = true;
+            continue;
+        } else if (!value) {
+            used = false;
+        } else if (!strcmp(arg, "--scenarios")) {
+            options.scenarios = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--steps")) {
+            options.steps = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--dt")) {
+            options.dt = atof(value);
+        } else if (!strcmp(arg, "--threads")) {
+            options.threads = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--seed")) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--tolerance")) {
+            options.tolerance = atof(value);
+        } else if (!strcmp(arg, "--max-reports")) {
+            options.maxReports = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--segment-length")) {
+            options.segmentLength = atof(value);
+        } else if (!strcmp(arg, "--max-segment-drift")) {
+            options.maxSegmentDrift = atof(value);
+        } else if (!strcmp(arg, "--lane-policy")) {
+            LaneChangePolicy policy;
+            used = parseLaneChangePolicy(value, policy);
+            options.lanePolicy = value;
+        } else if (!strcmp(arg, "--output")) {
+            options.output = value;
+        } else if (!strcmp(arg, "--replay")) {
+            options.replay = value;
+        } else {
+            used = false;
+        }
+
+        if (!used) {
+            fprintf(stderr, "usage: %s [--scenarios n] [--steps n] [--dt s] [--threads n] [--seed n] [--tolerance x]\n"
+                            "       [--max-reports n] [--transfers] [--lane-policy exhaustive|throttled] [--no-prefilter]\n"
+                            "       [--no-batch] [--simultaneous] [--segment-length m] [--max-segment-drift m]\n"
+                            "       [--output file] [--replay file]\n", argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// vehicles on another road after the steps of a scenario with its route seed and with routeSeed (transfers on)
+unsigned rerouted(const std::string &state, uint64_t routeSeed, const Options &options)
+{
+    Simulator sims[2];
+    for (Simulator &sim : sims) {
+        std::istringstream in(state);
+        sim.loadState(in);
+        sim.setTransfers(true);
+    }
+    sims[1].setSeed(routeSeed);
+    for (Simulator &sim : sims)
+        for (unsigned step = 0; step < options.steps; ++step)
+            sim.update(options.dt);
+
+    Samples own = samples(sims[0]);
+    Samples other = samples(sims[1]);
+    unsigned moved = 0;
+    for (auto &element : own) {
+        auto found = other.find(element.first);
+        moved += found == other.end() || found->second.road != element.second.road;
+    }
+    return moved;
+}
+
+/* how far segments move the vehicles of a scenario in a step from where whole roads put them, on the reference
+ * engine: every step of the whole road run is made again with segments, and the position differences - rms and
+ * largest - the largest velocity difference and the vehicles that end the step on another road or lane are kept.
+ * The largest come from the vehicles the scenarios put on top of each other, which brake hard behind a leader
+ * braking hard - the halo, coasted, doesn't. Over a run the differences grow like any other: a vehicle that makes
+ * the light in one run waits in the other */
+struct SegmentDrift
+{
+    double maxDrift = { 0.0 };
+    double maxVelocityDrift = { 0.0 };
+    double squares = { 0.0 };
+    unsigned long off = { 0 };
+    unsigned long vehicleSteps = { 0 };
+};
+
+void segmentDrift(const std::string &state, const Options &options, SegmentDrift &drift)
+{
+    reference::Engine engine;
+    std::istringstream in(state);
+    engine.loadState(in);
+    engine.setTransfers(options.transfers);
+
+    for (unsigned step = 1; step <= options.steps; ++step) {
+        reference::Engine segmented = engine;
+        Config::roadSegmentLength = options.segmentLength;
+        segmented.update(options.dt);
+        Config::roadSegmentLength = 0.0;
+        engine.update(options.dt);
+
+        Samples expected = samples(engine);
+        Samples actual = samples(segmented);
+        for (auto &element : expected) {
+            auto found = actual.find(element.first);
+            ++drift.vehicleSteps;
+            if (found == actual.end() || found->second.road != element.second.road ||
+                found->second.lane != element.second.lane) {
+                ++drift.off;
+                continue;
+            }
+            double dx = std::fabs(found->second.pos - element.second.pos);
+            drift.squares += dx * dx;
+            drift.maxDrift = std::max(drift.maxDrift, dx);
+            drift.maxVelocityDrift = std::max(drift.maxVelocityDrift,
+                                              std::fabs(found->second.velocity - element.second.velocity));
+        }
+    }
+    Config::roadSegmentLength = options.segmentLength;
+}
+
+// divergences of one scenario, printed. True if it ran clean
+bool check(const std::string &name, const std::string &state, const Options &options,
+           std::vector<Divergence> &divergences)
+{
+    divergences = run(state, options.steps, options, false);
+    ::Logger::flush();
+    if (divergences.empty()) {
+        printf("%-24s ok\n", name.c_str());
+        return true;
+    }
+
+    printf("%-24s DIVERGED: %zu vehicle(s), first after step %u\n", name.c_str(), divergences.size(),
+           divergences.front().step);
+    for (size_t i = 0; i < divergences.size() && i < options.maxReports; ++i)
+        printDivergence(divergences[i]);
+    if (divergences.size() > options.maxReports)
+        printf("  ... %zu more\n", divergences.size() - options.maxReports);
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+    parseLaneChangePolicy(options.lanePolicy, Config::laneChangePolicy);
+    Config::laneChangePolicy.prefilter = options.prefilter;
+    Config::laneChangePolicy.batched = options.batched;
+    Config::laneChangePolicy.simultaneous = options.simultaneous;
+    Config::roadSegmentLength = options.segmentLength;
+
+    std::vector<Divergence> divergences;
+
+    if (!options.replay.empty()) {
+        std::ifstream in(options.replay, std::ios::binary);
+        if (!in) {
+            fprintf(stderr, "Cannot read %s\n", options.replay.c_str());
+            return 2;
+        }
+        std::string state((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return check(options.replay, state, options, divergences) ? 0 : 1;
+    }
+
+    unsigned long reroutedNo = 0;
+    const bool segmented = options.simultaneous && options.segmentLength > 0;
+    SegmentDrift drift;
+    for (unsigned s = 0; s < options.scenarios; ++s) {
+        unsigned long seed = options.seed + s;
+        std::string state = makeScenario(seed);
+        if (check("scenario seed " + std::to_string(seed), state, options, divergences)) {
+            if (options.transfers)
+                reroutedNo += rerouted(state, seed + 1, options);
+            if (segmented)
+                segmentDrift(state, options, drift);
+            continue;
+        }
+
+        reference::Engine minimal = minimize(state, divergences.front(), options);
+        std::string minimalState = saveState(minimal);
+        std::vector<Divergence> remaining = run(minimalState, options.steps, options, true);
+
+        describe(minimal);
+        if (!remaining.empty())
+            printDivergence(remaining.front());
+
+        std::ofstream out(options.output, std::ios::binary);
+        out << minimalState;
+        printf("written to %s - replay: %s --replay %s --steps %u --dt %g --threads %u%s --lane-policy %s%s%s%s --segment-length %g\n",
+               options.output.c_str(), argv[0], options.output.c_str(),
+               remaining.empty() ? options.steps : remaining.front().step, options.dt, options.threads,
+               options.transfers ? " --transfers" : "", options.lanePolicy.c_str(),
+               options.prefilter ? "" : " --no-prefilter", options.batched ? "" : " --no-batch",
+               options.simultaneous ? " --simultaneous" : "", options.segmentLength);
+        return 1;
+    }
+    printf("%u scenario(s), %u steps each: no divergence\n", options.scenarios, options.steps);
+    if (segmented) {
+        double rms = drift.vehicleSteps ? std::sqrt(drift.squares / drift.vehicleSteps) : 0.0;
+        printf("segments of %g m against whole roads, a step at a time: vehicles %.6f m apart rms (at most %g), up "
+               "to %.3f m and %.3f m/s; %lu of %lu vehicle steps on another road or lane\n", options.segmentLength, rms,
+               options.maxSegmentDrift, drift.maxDrift, drift.maxVelocityDrift, drift.off, drift.vehicleSteps);
+        if (rms > options.maxSegmentDrift) {
+            printf("segments move the vehicles too far from where whole roads put them\n");
+            return 1;
+        }
+    }
+    if (options.transfers) {
+        printf("with the next route seed: %lu vehicle(s) on another road\n", reroutedNo);
+        if (reroutedNo == 0) {
+            printf("the route seed doesn't change the routes\n");
+            return 1;
+        }
+    }
+    return 0;
+}
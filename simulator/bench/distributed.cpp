@@ -0,0 +1,209 @@
+#include "binaryio.h"
+#include "distributed.h"
+#include "logger.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Distributed run with every rank on this host (distributed.h): a process per rank, over unix sockets - or TCP on
+ * localhost with --tcp. The ranks step a generated city - of --seed, which seeds the routes too - with vehicles
+ * driving from road to road; rank 0 gathers the final state and the driver checks it against the same city stepped
+ * by a single process Simulator.
+ * Per rank it reports its roads, the vehicles and bytes it exchanged, and the time it computed and waited.
+ *
+ *      simulator_distributed [--ranks 4] [--layout grid] [--lanes 20000] [--steps 300] [--dt 0.5]
+ *                            [--rebalance 100] [--tolerance 0.1] [--tcp port] [--seed 1]
+ *
+ * --rebalance n: the ranks compare their measured costs every n steps and move roads around past the tolerance.
+ * Exit code 1 if the states differ or a rank failed.
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    unsigned ranks = { 4 };
+    CitySpec::Layout layout = { CitySpec::grid };
+    unsigned long lanes = { 20000 };
+    unsigned steps = { 300 };
+    double dt = { 0.5 };
+    unsigned rebalance = { 100 };
+    double tolerance = { 0.1 };
+    unsigned tcpPort = { 0 };       // 0 - unix sockets
+    unsigned long seed = { 1 };
+};
+
+// what rank 0 hands back to the driver
+struct Outcome
+{
+    uint64_t hash;
+    double seconds;
+};
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool used = true;
+
+        if (!value) {
+            used = false;
+        } else if (!strcmp(arg, "--ranks")) {
+            options.ranks = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--layout")) {
+            if (!strcmp(value, "grid"))
+                options.layout = CitySpec::grid;
+            else if (!strcmp(value, "radial"))
+                options.layout = CitySpec::radial;
+            else if (!strcmp(value, "motorway"))
+                options.layout = CitySpec::motorway;
+            else
+                used = false;
+        } else if (!strcmp(arg, "--lanes")) {
+            options.lanes = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--steps")) {
+            options.steps = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--dt")) {
+            options.dt = atof(value);
+        } else if (!strcmp(arg, "--rebalance")) {
+            options.rebalance = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--tolerance")) {
+            options.tolerance = atof(value);
+        } else if (!strcmp(arg, "--tcp")) {
+            options.tcpPort = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--seed")) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else {
+            used = false;
+        }
+
+        if (!used) {
+            fprintf(stderr, "usage: %s [--ranks n] [--layout grid|radial|motorway] [--lanes n] [--steps n] [--dt s]\n"
+                            "       [--rebalance steps] [--tolerance x] [--tcp port] [--seed n]\n", argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// one rank, in its own process. Rank 0 writes the Outcome to result
+int runRank(unsigned r, const std::vector<std::string> &addresses, const Options &options, int result)
+{
+    Rank rank(r, addresses);
+    if (!rank.connect())
+        return 1;
+    rank.setRebalance(options.rebalance, options.tolerance);
+    rank.setSeed(options.seed);
+    rank.load(generateCity(citySpecForLanes(options.layout, options.lanes, options.seed)));
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned step = 0; step < options.steps; ++step)
+        if (!rank.update(options.dt))
+            return 1;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream state;
+    if (!rank.gatherState(&state))
+        return 1;
+
+    const Rank::Stats &stats = rank.getStats();
+    ::Logger::flush();
+    printf("rank %u: %6zu roads, %5zu boundary, %u neighbour(s), %7u vehicles | sent %8lu received %8lu vehicles, "
+           "%7.2f MB out | compute %7.3f s, wait %7.3f s | %lu rebalance(s), %lu road(s) moved out\n",
+           r, rank.getRoadsNo(), rank.getBoundaryRoadsNo(), rank.getNeighboursNo(), rank.getVehiclesNo(),
+           (unsigned long)stats.vehiclesSent, (unsigned long)stats.vehiclesReceived, stats.bytesSent / 1e6,
+           stats.computeSeconds, stats.waitSeconds, (unsigned long)stats.rebalances, (unsigned long)stats.roadsMoved);
+    fflush(stdout);
+
+    if (r == 0) {
+        Outcome outcome = { fnv1a(state.str()), seconds };
+        if (write(result, &outcome, sizeof(outcome)) != sizeof(outcome))
+            return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    std::vector<std::string> addresses;
+    for (unsigned r = 0; r < options.ranks; ++r)
+        addresses.push_back(options.tcpPort ? "127.0.0.1:" + std::to_string(options.tcpPort + r)
+                                            : "unix:/tmp/simulator_rank_" + std::to_string(getpid()) + "_" +
+                                              std::to_string(r) + ".sock");
+
+    int result[2];
+    if (pipe(result) != 0) {
+        perror("pipe");
+        return 2;
+    }
+
+    // before anything logs: the children start without the logger's thread
+    std::vector<pid_t> children;
+    for (unsigned r = 0; r < options.ranks; ++r) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(result[0]);
+            exit(runRank(r, addresses, options, result[1]));
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 2;
+        }
+        children.push_back(pid);
+    }
+    close(result[1]);
+
+    unsigned failed = 0;
+    for (pid_t child : children) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    Outcome distributed = { 0, 0.0 };
+    bool reported = read(result[0], &distributed, sizeof(distributed)) == sizeof(distributed);
+    close(result[0]);
+    if (failed || !reported) {
+        fprintf(stderr, "%u rank(s) failed\n", failed);
+        return 1;
+    }
+
+    // the same city in one process
+    Simulator sim;
+    sim.setTransfers(true);
+    sim.setSeed(options.seed);
+    sim.addRoadNetToMap(generateCity(citySpecForLanes(options.layout, options.lanes, options.seed)));
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned step = 0; step < options.steps; ++step)
+        sim.update(options.dt);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t hash = sim.stateHash();
+
+    ::Logger::flush();
+    printf("%u ranks over %s: %u steps in %.3f s, one process: %.3f s\n", options.ranks,
+           options.tcpPort ? "tcp" : "unix sockets", options.steps, distributed.seconds, seconds);
+    printf("state hash: distributed %016lx, one process %016lx - %s\n", (unsigned long)distributed.hash,
+           (unsigned long)hash, distributed.hash == hash ? "equal" : "DIFFERENT");
+    return distributed.hash == hash ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+#include "config.h"
+#include "ensemble.h"
+#include "lanechange.h"
+#include "logger.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/* Ensemble check (ensemble.h).
+ *      - OnlineStat on a data set with a known mean, variance and 95% interval, and on random data against a
+ *        two pass mean and variance
+ *      - ensembles of a few ring roads, populated at random from the replication's stream, for a set of seeds,
+ *        with exhaustive and with throttled lane changes, on 1 and 4 threads: the check runs every replication
+ *        itself, and the ensemble must stop at the first replication where all three KPI intervals are tight,
+ *        with the same means and intervals. Throttling staggers vehicles by id: vehicles made on the workers
+ *        draw ids from a counter they share, and only a replication that numbers its own is the same on any
+ *        thread count
+ * Exit code 1 on any mismatch.
+ *
+ *      simulator_ensemblecheck [--seeds 4] [--steps 100] [--max 40]
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    unsigned seeds = { 4 };
+    int steps = { 100 };
+    unsigned maxReplications = { 40 };
+};
+
+unsigned failed = 0;
+
+void expect(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failed;
+    }
+}
+
+bool near(double a, double b, double tolerance = 1e-12)
+{
+    return std::fabs(a - b) <= tolerance * std::max(1.0, std::fabs(b));
+}
+
+void checkOnlineStat()
+{
+    OnlineStat empty;
+    expect(empty.count() == 0 && empty.variance() == 0.0 && empty.halfWidth() == HUGE_VAL, "empty OnlineStat");
+
+    OnlineStat one;
+    one.add(3.5);
+    expect(one.getMean() == 3.5 && one.variance() == 0.0 && one.halfWidth() == HUGE_VAL, "OnlineStat of one value");
+
+    // mean 5, sample variance 32 / 7, t(7) = 2.365
+    OnlineStat known;
+    for (double x : { 2.0, 4.0, 4.0, 4.0, 5.0, 5.0, 7.0, 9.0 })
+        known.add(x);
+    expect(known.count() == 8 && near(known.getMean(), 5.0), "known mean");
+    expect(near(known.variance(), 32.0 / 7.0), "known variance");
+    expect(near(known.halfWidth(), 2.365 * std::sqrt(32.0 / 7.0 / 8.0)), "known 95% interval (t, 7 df)");
+
+    // beyond 30 degrees of freedom the normal quantile; large offset - Welford keeps the variance where the
+    // naive sum of squares would lose it
+    CounterRng rng(7);
+    std::vector<double> values;
+    OnlineStat random;
+    for (unsigned i = 0; i < 1000; ++i) {
+        values.push_back(1e6 + rng.uniform(0, i, 0) * 10.0);
+        random.add(values.back());
+    }
+    double sum = 0;
+    for (double x : values)
+        sum += x;
+    double mean = sum / values.size();
+    double squares = 0;
+    for (double x : values)
+        squares += (x - mean) * (x - mean);
+    double variance = squares / (values.size() - 1);
+
+    expect(near(random.getMean(), mean), "Welford mean against two pass");
+    expect(near(random.variance(), variance, 1e-9), "Welford variance against two pass");
+    expect(near(random.halfWidth(), 1.96 * std::sqrt(variance / values.size()), 1e-9), "95% interval (normal, 999 df)");
+}
+
+// four two lane rings, without vehicles
+std::vector<Road> makeNetwork()
+{
+    std::vector<Road> network;
+    for (roadID r = 0; r < 4; ++r) {
+        Road ring(r, 1000.0, 2, 30);
+        ring.setBoundary(Road::periodic);
+        network.push_back(ring);
+    }
+    return network;
+}
+
+// a random number of vehicles per lane, evenly spaced, with random desired speeds
+void populate(std::vector<Road> &roadNet, const CounterRng &rng)
+{
+    for (Road &road : roadNet)
+        for (unsigned lane = 0; lane < road.getLanesNo(); ++lane) {
+            int vehiclesNo = rng.uniformInt(10, 50, road.getId(), 0, 0, lane);
+            double spacing = road.getLength() / vehiclesNo;
+            for (int i = 0; i < vehiclesNo; ++i)
+                road.addVehicle(Vehicle(i * spacing, 5.0, 20.0 + 10.0 * rng.uniform(road.getId(), i + 1, 0, lane)),
+                                lane);
+        }
+}
+
+// the KPIs of replication index, computed here the way Ensemble defines them
+ReplicationKPI replicate(const std::vector<Road> &network, unsigned index, const EnsembleConfig &config)
+{
+    std::vector<Road> roadNet = network;
+    populate(roadNet, CounterRng::forStream(config.seed, index));
+    int nextId = 0;
+    for (Road &road : roadNet)
+        nextId = road.numberVehicles(nextId);
+
+    Simulator simulator;
+    simulator.setSeed(CounterRng::streamSeed(config.seed, index));
+    simulator.addRoadNetToMap(std::move(roadNet));
+
+    double speedSum = 0;
+    double distance = 0;
+    unsigned long vehicleSteps = 0;
+    unsigned long stoppedSteps = 0;
+    for (int step = 0; step < config.steps; ++step) {
+        simulator.update(config.dt);
+        for (auto &roadElement : simulator.cityMap)
+            for (auto &lane : roadElement.second.getVehicles())
+                for (auto &vehicle : lane) {
+                    if (!vehicle.isVehicle())
+                        continue;
+                    speedSum += vehicle.getVelocity();
+                    distance += vehicle.getVelocity() * config.dt;
+                    stoppedSteps += vehicle.getVelocity() < Ensemble::stoppedSpeed ? 1 : 0;
+                    ++vehicleSteps;
+                }
+    }
+
+    ReplicationKPI kpi;
+    kpi.meanSpeed = speedSum / vehicleSteps;
+    kpi.stoppedShare = (double)stoppedSteps / vehicleSteps;
+    kpi.vehicleKm = distance / 1000.0;
+    return kpi;
+}
+
+bool isTight(const OnlineStat &stat, double relativeHalfWidth)
+{
+    return stat.halfWidth() <= relativeHalfWidth * std::fabs(stat.getMean());
+}
+
+bool sameStat(const OnlineStat &a, const OnlineStat &b)
+{
+    return a.count() == b.count() && a.getMean() == b.getMean() && a.variance() == b.variance() &&
+           a.halfWidth() == b.halfWidth();
+}
+
+void checkEnsemble(const Options &options)
+{
+    std::vector<Road> network = makeNetwork();
+    Ensemble ensemble(network, populate);
+
+    for (const char *policyName : { "exhaustive", "throttled" }) {
+        parseLaneChangePolicy(policyName, Config::laneChangePolicy);
+        for (unsigned long seed = 1; seed <= options.seeds; ++seed) {
+            EnsembleConfig config;
+            config.minReplications = 5;
+            config.maxReplications = options.maxReplications;
+            config.steps = options.steps;
+            config.dt = 0.5;
+            config.relativeHalfWidth = 0.05;
+            config.seed = seed;
+
+            // where it has to stop: the first replication, from the minimum on, with all three intervals tight
+            EnsembleResult expected;
+            for (unsigned i = 0; i < config.maxReplications && !expected.converged; ++i) {
+                ReplicationKPI kpi = replicate(network, i, config);
+                expected.meanSpeed.add(kpi.meanSpeed);
+                expected.stoppedShare.add(kpi.stoppedShare);
+                expected.vehicleKm.add(kpi.vehicleKm);
+                ++expected.replications;
+                expected.converged = expected.replications >= config.minReplications &&
+                                     isTight(expected.meanSpeed, config.relativeHalfWidth) &&
+                                     isTight(expected.stoppedShare, config.relativeHalfWidth) &&
+                                     isTight(expected.vehicleKm, config.relativeHalfWidth);
+            }
+
+            for (unsigned threads : { 1u, 4u }) {
+                config.threads = threads;
+                EnsembleResult result = ensemble.run(config);
+
+                ::Logger::flush();
+                printf("%-10s seed %lu, %u thread(s): %u replications (expected %u), %s, "
+                       "mean speed %.3f +/- %.3f m/s\n", policyName, seed, threads, result.replications, expected.replications,
+                       result.converged ? "converged" : "not converged",
+                       result.meanSpeed.getMean(), result.meanSpeed.halfWidth());
+
+                expect(result.replications == expected.replications, "early stop count");
+                expect(result.converged == expected.converged, "converged flag");
+                expect(result.diverged == 0, "no diverged replications");
+                expect(sameStat(result.meanSpeed, expected.meanSpeed), "mean speed statistics");
+                expect(sameStat(result.stoppedShare, expected.stoppedShare), "stopped share statistics");
+                expect(sameStat(result.vehicleKm, expected.vehicleKm), "vehicle km statistics");
+            }
+        }
+    }
+    Config::laneChangePolicy = exhaustiveLaneChanges();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--seeds") && hasValue) {
+            options.seeds = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--steps") && hasValue) {
+            options.steps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max") && hasValue) {
+            options.maxReplications = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--seeds n] [--steps n] [--max replications]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    checkOnlineStat();
+    checkEnsemble(options);
+
+    if (failed) {
+        fprintf(stderr, "%u check(s) failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
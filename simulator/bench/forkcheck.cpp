@@ -0,0 +1,145 @@
+#include "binaryio.h"
+#include "logger.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+/* Fork check (fork.h): a generated city is forked into three branches and stepped next to a simulator loaded
+ * from the same state.
+ *      - branch 0 is left alone: it only reads the shared trunk
+ *      - branch 1 takes private copies of every other road and doesn't change them
+ *      - branch 2 turns the lights of one road red
+ * After every step each road of branches 0 and 1, and of branch 2 but the road it changed, must be the same as the
+ * simulator's, byte for byte (Road::saveState). The changed road must not. A simulator with transfers on must
+ * refuse to fork.
+ * Exit code 1 on any mismatch.
+ *
+ *      simulator_forkcheck [--layout grid] [--lanes 2000] [--steps 200] [--dt 0.5] [--seed 1]
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    CitySpec::Layout layout = { CitySpec::grid };
+    unsigned long lanes = { 2000 };
+    unsigned steps = { 200 };
+    double dt = { 0.5 };
+    unsigned long seed = { 1 };
+};
+
+uint64_t roadHash(const Road &road)
+{
+    std::ostringstream state;
+    road.saveState(state);
+    return fnv1a(state.str());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--layout") && hasValue) {
+            const char *value = argv[++i];
+            options.layout = !strcmp(value, "radial") ? CitySpec::radial
+                           : !strcmp(value, "motorway") ? CitySpec::motorway : CitySpec::grid;
+        } else if (!strcmp(argv[i], "--lanes") && hasValue) {
+            options.lanes = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--steps") && hasValue) {
+            options.steps = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--dt") && hasValue) {
+            options.dt = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && hasValue) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--layout grid|radial|motorway] [--lanes n] [--steps n] [--dt s] [--seed n]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    // the forked simulator is never updated while its group lives - its twin is stepped instead
+    Simulator forked;
+    forked.setTransfers(false);
+    forked.addRoadNetToMap(generateCity(citySpecForLanes(options.layout, options.lanes, options.seed)));
+
+    Simulator stepped;
+    stepped.setTransfers(false);
+    std::stringstream state;
+    forked.saveState(state);
+    if (!stepped.loadState(state)) {
+        fprintf(stderr, "could not load the forked state\n");
+        return 1;
+    }
+
+    unsigned failed = 0;
+
+    forked.setTransfers(true);
+    if (forked.fork(3).getBranchesNo() != 0) {
+        fprintf(stderr, "a simulator with transfers forked\n");
+        ++failed;
+    }
+    forked.setTransfers(false);
+
+    ForkGroup group = forked.fork(3);
+
+    // the road branch 2 changes: the one with the most vehicles
+    roadID changed = forked.cityMap.begin()->first;
+    for (const auto &roadElement : forked.cityMap)
+        if (roadElement.second.getVehiclesNo() > forked.cityMap.at(changed).getVehiclesNo())
+            changed = roadElement.first;
+
+    unsigned index = 0;
+    for (const auto &roadElement : forked.cityMap)
+        if (index++ % 2 == 0)
+            group.branch(1).road(roadElement.first);
+
+    Road &red = group.branch(2).road(changed);
+    for (unsigned lane = 0; lane < red.getLanesNo(); ++lane)
+        red.setTrafficLightColor(lane, TrafficLight::red_light);
+
+    unsigned long mismatches = 0;
+    unsigned changedSteps = 0;
+    for (unsigned step = 0; step < options.steps; ++step) {
+        group.advance(1, options.dt);
+        stepped.update(options.dt);
+
+        for (const auto &roadElement : stepped.cityMap) {
+            roadID id = roadElement.first;
+            uint64_t expected = roadHash(roadElement.second);
+            for (unsigned b = 0; b < group.getBranchesNo(); ++b) {
+                bool same = roadHash(group.branch(b).getRoad(id)) == expected;
+                if (b == 2 && id == changed) {
+                    changedSteps += !same;
+                } else if (!same) {
+                    if (mismatches++ < 10)
+                        fprintf(stderr, "step %u: road %lu of branch %u (%s) differs from the simulator's\n", step + 1,
+                                (unsigned long)id, b, group.branch(b).isPrivate(id) ? "private" : "shared");
+                }
+            }
+        }
+    }
+
+    ::Logger::flush();
+    printf("%zu roads, %u steps: branch 1 %zu private roads, branch 2 changed road %lu - differed %u step(s); "
+           "%lu mismatch(es)\n", stepped.cityMap.size(), options.steps, group.branch(1).privateRoadsNo(),
+           (unsigned long)changed, changedSteps, mismatches);
+
+    if (changedSteps == 0) {
+        fprintf(stderr, "the changed road never differed - branch 2 isn't stepping its own copy\n");
+        ++failed;
+    }
+    failed += mismatches != 0;
+    return failed ? 1 : 0;
+}
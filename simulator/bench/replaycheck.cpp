@@ -0,0 +1,170 @@
+#include "config.h"
+#include "lanechange.h"
+#include "logger.h"
+#include "replay.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+/* Replay round trip (replay.h): a generated city is recorded for a number of steps with vehicles driving from road
+ * to road, throttled lane changes decided simultaneously and short road segments, with spawned vehicles, signal
+ * overrides and incidents before and after the middle checkpoint. The log goes through save/load, the process
+ * settings go back to their defaults, and then
+ *      - the second half is replayed from the middle checkpoint, and every hash stored for it must match
+ *      - the whole run is replayed in parallel windows, one per checkpoint interval
+ *      - logs with the transfers or the lane change policy changed must diverge - a replay does run the model of
+ *        the log, not the process's
+ *      - the process settings are the defaults again after every replay
+ * Exit code 1 on any mismatch.
+ *
+ *      simulator_replaycheck [--layout grid] [--lanes 2000] [--steps 200] [--seed 1]
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    CitySpec::Layout layout = { CitySpec::grid };
+    unsigned long lanes = { 2000 };
+    unsigned steps = { 200 };
+    unsigned long seed = { 1 };
+};
+
+unsigned failed = 0;
+
+void expect(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failed;
+    }
+}
+
+ReplayLog record(const Options &options)
+{
+    Simulator sim;
+    sim.setTransfers(true);
+    sim.addRoadNetToMap(generateCity(citySpecForLanes(options.layout, options.lanes, options.seed)));
+
+    std::vector<roadID> roads;
+    for (const auto &roadElement : sim.cityMap)
+        roads.push_back(roadElement.first);
+
+    const uint32_t hashInterval = 10;
+    ReplayRecorder recorder(sim, 0.5, hashInterval, options.steps / 2);
+    for (unsigned step = 0; step < options.steps; ++step) {
+        // inputs on both sides of the middle checkpoint, and right at it
+        if (step % 30 == 5)
+            recorder.spawnVehicle(roads[step % roads.size()], 0, Vehicle(1.0, 5.0, 25.0));
+        if (step % 40 == 0)
+            recorder.overrideSignal(roads[(step * 7) % roads.size()], 0, TrafficLight::red_light);
+        if (step % 50 == 20 || step == options.steps / 2)
+            recorder.addIncident(roads[(step * 13) % roads.size()], 0, 100.0);
+        recorder.update();
+    }
+    return recorder.getLog();
+}
+
+// replay [fromStep, toStep) and compare the state at every hashed step with the log's hash
+unsigned replayHashes(const ReplayLog &log, uint32_t fromStep, uint32_t toStep, bool &ok)
+{
+    unsigned matched = 0;
+    ok = replayWindow(log, fromStep, toStep, [&](uint32_t step, const Simulator &state) {
+        uint32_t done = step + 1;
+        if (done % log.hashInterval == 0)
+            matched += state.stateHash() == log.hashes[done / log.hashInterval - 1];
+    });
+    return matched;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--layout") && hasValue) {
+            const char *value = argv[++i];
+            options.layout = !strcmp(value, "radial") ? CitySpec::radial
+                           : !strcmp(value, "motorway") ? CitySpec::motorway : CitySpec::grid;
+        } else if (!strcmp(argv[i], "--lanes") && hasValue) {
+            options.lanes = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--steps") && hasValue) {
+            options.steps = std::max(20ul, strtoul(argv[++i], nullptr, 10)) / 20 * 20;
+        } else if (!strcmp(argv[i], "--seed") && hasValue) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--layout grid|radial|motorway] [--lanes n] [--steps n] [--seed n]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // the recorded model - none of it the default
+    const LaneChangePolicy defaultPolicy = Config::laneChangePolicy;
+    const double defaultSegmentLength = Config::roadSegmentLength;
+    Config::laneChangePolicy = throttledLaneChanges();
+    Config::laneChangePolicy.simultaneous = true;
+    Config::roadSegmentLength = 60.0;
+
+    ReplayLog recorded = record(options);
+
+    std::stringstream stored;
+    recorded.save(stored);
+    ReplayLog log;
+    expect(log.load(stored), "log loads back");
+    expect(log.transfers && log.laneChangePolicy.simultaneous && log.laneChangePolicy.cooldownSteps != 0 &&
+           log.roadSegmentLength == 60.0, "the model survives save/load");
+    expect(log.hashes == recorded.hashes && log.checkpoints.size() == 3 &&
+           log.events.size() == recorded.events.size(), "hashes, checkpoints and events survive save/load");
+
+    Config::laneChangePolicy = defaultPolicy;
+    Config::roadSegmentLength = defaultSegmentLength;
+
+    uint32_t middle = log.steps / 2;
+    bool ok = false;
+    unsigned matched = replayHashes(log, middle, log.steps, ok);
+    unsigned expected = (log.steps - middle) / log.hashInterval;
+    ::Logger::flush();
+    printf("%u steps, %zu events, %zu checkpoints: replay from step %u matched %u of %u hashes\n", log.steps,
+           log.events.size(), log.checkpoints.size(), middle, matched, expected);
+    expect(ok && matched == expected, "replay from the middle checkpoint matches every hash");
+    expect(Config::laneChangePolicy.cooldownSteps == defaultPolicy.cooldownSteps &&
+           Config::laneChangePolicy.simultaneous == defaultPolicy.simultaneous &&
+           Config::roadSegmentLength == defaultSegmentLength, "a replay gives the process settings back");
+
+    std::vector<std::pair<uint32_t, uint32_t>> windows;
+    for (size_t c = 0; c < log.checkpoints.size(); ++c)
+        windows.emplace_back(log.checkpoints[c].step,
+                             c + 1 < log.checkpoints.size() ? log.checkpoints[c + 1].step : log.steps);
+    expect(replayWindows(log, windows, [](uint32_t, const Simulator &) {}), "parallel windows replay the whole run");
+    expect(Config::laneChangePolicy.simultaneous == defaultPolicy.simultaneous &&
+           Config::roadSegmentLength == defaultSegmentLength, "parallel windows give the process settings back");
+
+    ReplayLog noTransfers = log;
+    noTransfers.transfers = false;
+    expect(!replayWindow(noTransfers, 0, log.steps, [](uint32_t, const Simulator &) {}),
+           "a log without transfers diverges");
+
+    ReplayLog exhaustive = log;
+    exhaustive.laneChangePolicy = exhaustiveLaneChanges();
+    expect(!replayWindow(exhaustive, 0, log.steps, [](uint32_t, const Simulator &) {}),
+           "a log with exhaustive lane changes diverges");
+
+    ::Logger::flush();
+    if (failed) {
+        fprintf(stderr, "%u check(s) failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
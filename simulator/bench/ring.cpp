@@ -0,0 +1,308 @@
+#include "benchharness.h"
+#include "config.h"
+#include "lanechange.h"
+#include "logger.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Ring road benchmark: periodic roads (Road::periodic) at fixed densities.
+ * Nothing enters or leaves a ring, so the workload stays the same for the whole run - a stable base for comparing
+ * engines - and the traffic settles into the model's steady state for that density: free flow, or stop-and-go
+ * waves travelling upstream. Per density it reports the engine throughput and how jammed the ring is.
+ *
+ *      simulator_ring [--densities 10,20,40,80] [--length 1000] [--lanes 1] [--roads 1] [--threads 1]
+ *                     [--steps 2000] [--warmup 500] [--dt 0.5] [--max-speed 30] [--seed 1] [--csv out.csv]
+ *                     [--lane-policy exhaustive] [--no-prefilter] [--no-batch] [--simultaneous]
+ *                     [--segment-length 2000]
+ *
+ * Vehicles start at rest, evenly spaced with a little jitter and a spread of desired speeds, which seeds the
+ * waves. Jams are runs of consecutive vehicles slower than a quarter of the speed limit.
+ * With more lanes, --lane-policy sets which vehicles consider a lane change (lanechange.h); the lane changes made
+ * are reported per vehicle and minute. --simultaneous: every lane change of a ring is decided before any is made, and
+ * with threads the lanes of a ring heavier than a thread's share are updated in parallel (Simulator::laneRoads) -
+ * cut into segments of --segment-length when the ring is at least twice as long.
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+const double jamSpeedShare = 0.25;  // of the speed limit - slower vehicles are in a jam
+const double stoppedSpeed = 0.5;    // m/s
+
+struct Options
+{
+    std::vector<double> densities = { 10, 20, 30, 40, 60, 80, 100, 120 };  // vehicles per km and lane
+    double length = { 1000.0 };
+    unsigned lanes = { 1 };
+    unsigned roads = { 1 };
+    unsigned threads = { 1 };
+    unsigned steps = { 2000 };
+    unsigned warmup = { 500 };
+    double dt = { 0.5 };
+    unsigned maxSpeed = { 30 };
+    unsigned long seed = { 1 };
+    unsigned sampleSteps = { 10 };  // jam statistics every this many steps
+    std::string csv;
+    std::string lanePolicy = { "exhaustive" };
+    bool prefilter = { true };
+    bool batched = { true };
+    bool simultaneous = { false };
+    double segmentLength = { Config::roadSegmentLength };
+};
+
+struct Result
+{
+    double density = { 0 };
+    unsigned long vehicles = { 0 };
+    double seconds = { 0 };
+    double vehicleStepsPerSecond = { 0 };
+    double meanSpeed = { 0 };       // m/s
+    double speedDeviation = { 0 };  // m/s, between vehicles
+    double flow = { 0 };            // vehicles per hour and lane
+    double stopped = { 0 };         // fraction of vehicles
+    double jamsPerKm = { 0 };
+    double laneChangesPerMinute = { 0 };  // per vehicle
+};
+
+struct Totals
+{
+    unsigned long samples = { 0 };
+    double speed = { 0 };
+    double speedSquares = { 0 };
+    double stopped = { 0 };
+    double jams = { 0 };
+};
+
+std::vector<double> parseDensities(const char *text)
+{
+    std::vector<double> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            values.push_back(atof(item.c_str()));
+    return values;
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool used = true;
+
+        if (!strcmp(arg, "--no-prefilter")) {
+            options.prefilter = false;
+            continue;
+        } else if (!strcmp(arg, "--no-batch")) {
+            options.batched = false;
+            continue;
+        } else if (!strcmp(arg, "--simultaneous")) {
+            options.simultaneous = true;
+            continue;
+        } else if (!value) {
+            used = false;
+        } else if (!strcmp(arg, "--segment-length")) {
+            options.segmentLength = atof(value);
+        } else if (!strcmp(arg, "--lane-policy")) {
+            LaneChangePolicy policy;
+            used = parseLaneChangePolicy(value, policy);
+            options.lanePolicy = value;
+        } else if (!strcmp(arg, "--densities")) {
+            options.densities = parseDensities(value);
+        } else if (!strcmp(arg, "--length")) {
+            options.length = std::max(100.0, atof(value));
+        } else if (!strcmp(arg, "--lanes")) {
+            options.lanes = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--roads")) {
+            options.roads = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--threads")) {
+            options.threads = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--steps")) {
+            options.steps = std::max(1ul, strtoul(value, nullptr, 10));
+        } else if (!strcmp(arg, "--warmup")) {
+            options.warmup = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--dt")) {
+            options.dt = atof(value);
+        } else if (!strcmp(arg, "--max-speed")) {
+            options.maxSpeed = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--seed")) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (!strcmp(arg, "--csv")) {
+            options.csv = value;
+        } else {
+            used = false;
+        }
+
+        if (!used) {
+            fprintf(stderr, "usage: %s [--densities veh/km,...] [--length m] [--lanes n] [--roads n] [--threads n]\n"
+                            "       [--steps n] [--warmup n] [--dt s] [--max-speed m/s] [--seed n] [--csv file]\n"
+                            "       [--lane-policy exhaustive|throttled] [--no-prefilter] [--no-batch]\n"
+                            "       [--simultaneous] [--segment-length m]\n",
+                    argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// speeds and jams of the current state, added to totals
+void sample(const Simulator &sim, double jamSpeed, Totals &totals)
+{
+    std::vector<std::pair<double, double>> lane; // position, velocity
+    for (auto &roadElement : sim.cityMap) {
+        for (auto &vehicles : roadElement.second.getVehicles()) {
+            lane.clear();
+            for (const Vehicle &v : vehicles) {
+                lane.push_back(std::make_pair(v.getPos(), v.getVelocity()));
+                totals.speed += v.getVelocity();
+                totals.speedSquares += v.getVelocity() * v.getVelocity();
+                totals.stopped += v.getVelocity() < stoppedSpeed;
+                ++totals.samples;
+            }
+            if (lane.empty())
+                continue;
+
+            // jams: runs of slow vehicles around the ring. A run through the start of the lane is one jam
+            std::sort(lane.begin(), lane.end());
+            unsigned jams = 0;
+            for (size_t i = 0; i < lane.size(); ++i)
+                if (lane[i].second < jamSpeed && (i == 0 || lane[i - 1].second >= jamSpeed))
+                    ++jams;
+            if (jams > 1 && lane.front().second < jamSpeed && lane.back().second < jamSpeed)
+                --jams;
+            totals.jams += jams;
+        }
+    }
+}
+
+unsigned long vehiclesNo(const Simulator &sim)
+{
+    unsigned long vehicles = 0;
+    for (auto &roadElement : sim.cityMap)
+        vehicles += roadElement.second.getVehiclesNo();
+    return vehicles;
+}
+
+unsigned long laneChangesNo(const Simulator &sim)
+{
+    unsigned long changes = 0;
+    for (auto &roadElement : sim.cityMap)
+        changes += roadElement.second.getCost().laneChanges;
+    return changes;
+}
+
+bool measure(double density, const Options &options, Result &result)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Simulator sim;
+    sim.addRoadNetToMap(bench::makeRings(options.roads, options.length, options.lanes, options.maxSpeed, density,
+                                         options.seed));
+    sim.setWorkerThreads(options.threads);
+
+    result.vehicles = vehiclesNo(sim);
+    result.density = result.vehicles / (options.roads * options.lanes * options.length / 1000.0);
+
+    for (unsigned step = 0; step < options.warmup; ++step)
+        sim.update(options.dt);
+
+    unsigned long laneChanges = laneChangesNo(sim);
+    Totals totals;
+    Clock::duration elapsed = Clock::duration::zero();
+    for (unsigned step = 0; step < options.steps; ++step) {
+        Clock::time_point start = Clock::now();
+        sim.update(options.dt);
+        elapsed += Clock::now() - start;
+
+        if (step % options.sampleSteps == 0)
+            sample(sim, jamSpeedShare * options.maxSpeed, totals);
+    }
+
+    if (vehiclesNo(sim) != result.vehicles) {
+        ::Logger::flush();
+        fprintf(stderr, "Density %.1f: %lu vehicles on the rings after the run, %lu at the start\n",
+                density, vehiclesNo(sim), result.vehicles);
+        return false;
+    }
+
+    result.seconds = std::chrono::duration<double>(elapsed).count();
+    result.vehicleStepsPerSecond = (double)result.vehicles * options.steps / result.seconds;
+
+    unsigned long snapshots = (options.steps + options.sampleSteps - 1) / options.sampleSteps;
+    result.meanSpeed = totals.speed / totals.samples;
+    result.speedDeviation = std::sqrt(std::max(0.0, totals.speedSquares / totals.samples -
+                                               result.meanSpeed * result.meanSpeed));
+    result.flow = result.density * result.meanSpeed * 3.6;
+    result.stopped = totals.stopped / totals.samples;
+    result.jamsPerKm = totals.jams / snapshots / (options.roads * options.lanes * options.length / 1000.0);
+    result.laneChangesPerMinute = (laneChangesNo(sim) - laneChanges) /
+                                  (result.vehicles * options.steps * options.dt / 60.0);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+    parseLaneChangePolicy(options.lanePolicy, Config::laneChangePolicy);
+    Config::laneChangePolicy.prefilter = options.prefilter;
+    Config::laneChangePolicy.batched = options.batched;
+    Config::laneChangePolicy.simultaneous = options.simultaneous;
+    Config::roadSegmentLength = options.segmentLength;
+
+    FILE *csv = nullptr;
+    if (!options.csv.empty()) {
+        csv = fopen(options.csv.c_str(), "w");
+        if (!csv) {
+            fprintf(stderr, "Cannot create %s\n", options.csv.c_str());
+            return 2;
+        }
+        fprintf(csv, "density,lanes,roads,threads,vehicles,steps,seconds,vehicle_steps_per_s,"
+                     "mean_speed,speed_deviation,flow,stopped,jams_per_km,lane_policy,lane_changes_per_minute\n");
+    }
+
+    printf("%8s %9s %14s %9s %9s %10s %8s %8s %10s\n",
+           "veh/km", "vehicles", "veh-steps/s", "v km/h", "sd km/h", "veh/h", "stopped", "jams/km", "lc/veh/min");
+
+    int status = 0;
+    for (double density : options.densities) {
+        Result result;
+        if (!measure(density, options, result)) {
+            status = 1;
+            continue;
+        }
+
+        ::Logger::flush();
+        printf("%8.1f %9lu %14.0f %9.1f %9.1f %10.0f %7.1f%% %8.2f %10.3f\n", result.density, result.vehicles,
+               result.vehicleStepsPerSecond, result.meanSpeed * 3.6, result.speedDeviation * 3.6, result.flow,
+               100 * result.stopped, result.jamsPerKm, result.laneChangesPerMinute);
+        fflush(stdout);
+
+        if (csv)
+            fprintf(csv, "%.3f,%u,%u,%u,%lu,%u,%.6f,%.1f,%.4f,%.4f,%.1f,%.4f,%.4f,%s,%.4f\n", result.density,
+                    options.lanes, options.roads, options.threads, result.vehicles, options.steps, result.seconds,
+                    result.vehicleStepsPerSecond, result.meanSpeed, result.speedDeviation, result.flow,
+                    result.stopped, result.jamsPerKm, options.lanePolicy.c_str(), result.laneChangesPerMinute);
+    }
+
+    if (csv)
+        fclose(csv);
+    return status;
+}
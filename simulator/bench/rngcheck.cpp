@@ -0,0 +1,94 @@
+#include "rng.h"
+
+#include <cstdint>
+#include <cstdio>
+
+/* Counter based random numbers (rng.h).
+ *      - Philox4x32-10 against the known-answer vectors of Random123 (kat_vectors): the zero, the all ones and the
+ *        digits of pi counter and key
+ *      - uniformBlock against uniform, draw by draw, and uniform and uniformInt in their ranges
+ * Exit code 1 on any mismatch.
+ *
+ *      simulator_rngcheck
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+unsigned failed = 0;
+
+void expect(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failed;
+    }
+}
+
+struct KnownAnswer
+{
+    const char *name;
+    uint32_t counter[4];    // road, vehicle, step, index
+    uint64_t seed;          // key: low word first
+    uint32_t expected[4];
+};
+
+const KnownAnswer knownAnswers[] = {
+    { "zero", { 0, 0, 0, 0 }, 0, { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+    { "all ones", { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, 0xffffffffffffffffULL,
+      { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+    { "pi", { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, 0x299f31d0a4093822ULL,
+      { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+};
+
+void checkKnownAnswers()
+{
+    for (const KnownAnswer &known : knownAnswers) {
+        CounterRng rng(known.seed);
+        CounterRng::Block b = rng.draw(known.counter[0], known.counter[1], known.counter[2], known.counter[3]);
+        bool same = true;
+        for (int i = 0; i < 4; ++i)
+            same = same && b.v[i] == known.expected[i];
+        printf("philox4x32-10 %-8s %08x %08x %08x %08x %s\n", known.name, b.v[0], b.v[1], b.v[2], b.v[3],
+               same ? "ok" : "WRONG");
+        expect(same, "Philox4x32-10 known answer");
+    }
+}
+
+void checkDraws()
+{
+    CounterRng rng(12345);
+    const unsigned count = 1000;
+    double block[count];
+    rng.uniformBlock(7, 100, 3, 1, count, block);
+
+    bool sameAsUniform = true;
+    bool inRange = true;
+    bool intsInRange = true;
+    for (unsigned i = 0; i < count; ++i) {
+        double u = rng.uniform(7, 100 + i, 3, 1);
+        sameAsUniform = sameAsUniform && block[i] == u;
+        inRange = inRange && u >= 0.0 && u < 1.0;
+        int n = rng.uniformInt(-3, 5, 7, i, 3);
+        intsInRange = intsInRange && n >= -3 && n <= 5;
+    }
+    expect(sameAsUniform, "uniformBlock draws what uniform does");
+    expect(inRange, "uniform in [0, 1)");
+    expect(intsInRange, "uniformInt in [lo, hi]");
+}
+
+} // namespace
+
+int main()
+{
+    checkKnownAnswers();
+    checkDraws();
+
+    if (failed) {
+        fprintf(stderr, "%u check(s) failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
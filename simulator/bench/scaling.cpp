@@ -0,0 +1,482 @@
+#include "config.h"
+#include "lanechange.h"
+#include "logger.h"
+#include "profiler.h"
+#include "simulator.h"
+#include "tests/citygen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+/* Scaling and performance regression driver.
+ * Runs generated cities (tests/citygen.h) over network sizes and thread counts and writes one CSV row per run:
+ * vehicle-steps per second, peak resident memory and the time of every profiler phase per step.
+ * With --baseline, every run is compared with the baseline row of the same layout, size and threads:
+ * a throughput drop or a memory growth past its threshold is a regression and the exit code is 1.
+ *
+ *      simulator_scaling --lanes 1000,10000 --threads 1,2,4 --output results.csv
+ *      simulator_scaling --lanes 1000,10000 --threads 1,2,4 --baseline results.csv --threshold 0.1
+ *
+ * Strong scaling (default): the same city on every thread count. --weak: lanes are per thread.
+ *
+ * Road layout (roadorder.h): every run of a city is repeated for each --road-order. Generated ids follow the
+ * layout of the city; --scatter-ids scrambles them like map data ids, which is where the order matters.
+ * When the kernel lets the process read hardware counters, the cache misses of the stepping thread are
+ * reported per vehicle step.
+ *
+ * --partitioned: every worker updates its own part of the network (partition.h). --pin: workers are kept on
+ * cpus, NUMA node by node (numa.h). --transfers: vehicles drive on from road to road (Simulator::setTransfers).
+ * The schedule is a column of the results and part of the baseline key.
+ *
+ * Lane change policies (lanechange.h): every run is repeated for each --lane-policy, exhaustive and throttled by
+ * default - throttled is a different model, so it is measured next to the default rather than instead of it.
+ * Throttled runs have a _throttled schedule; exhaustive ones keep the schedule names of older baselines.
+ */
+
+using namespace simulator;
+
+namespace
+{
+
+struct Options
+{
+    std::vector<CitySpec::Layout> layouts = { CitySpec::grid };
+    std::vector<unsigned long> lanes = { 1000, 10000 };
+    std::vector<unsigned> threads = { 1 };
+    std::vector<RoadOrder> roadOrders = { Config::roadOrder };
+    std::vector<std::string> lanePolicies = { "exhaustive", "throttled" };
+    bool weak = { false };
+    bool scatterIds = { false };
+    bool partitioned = { false };
+    bool pin = { false };
+    bool transfers = { false };
+    unsigned steps = { 100 };
+    unsigned warmup = { 10 };
+    unsigned repeat = { 3 };            // runs of each configuration - the fastest one is kept
+    double demand = { 20.0 };
+    unsigned long seed = { 1 };
+    std::string output = { "scaling.csv" };
+    std::string baseline;
+    double threshold = { 0.10 };        // allowed throughput drop
+    double memoryThreshold = { 0.20 };  // allowed memory growth
+};
+
+struct Run
+{
+    std::string layout;
+    unsigned long lanes = { 0 };
+    unsigned threads = { 0 };
+    RoadOrder roadOrder = { by_id };
+    std::string lanePolicy;
+    std::string schedule;
+    unsigned long roads = { 0 };
+    unsigned long vehicles = { 0 };
+    unsigned steps = { 0 };
+    double seconds = { 0 };
+    double vehicleStepsPerSecond = { 0 };
+    long maxRssKb = { 0 };
+    double cacheMissesPerVehicleStep = { -1 };  // of the calling thread. -1: no counters
+    double phaseMsPerStep[Profiler::phases_no] = {};
+};
+
+const char *layoutNames[] = { "grid", "radial", "motorway" };
+
+template <class T>
+std::vector<T> parseList(const char *text, T (*parse)(const std::string &))
+{
+    std::vector<T> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            values.push_back(parse(item));
+    return values;
+}
+
+unsigned long parseUnsigned(const std::string &text)
+{
+    return strtoul(text.c_str(), nullptr, 10);
+}
+
+unsigned parseThreads(const std::string &text)
+{
+    return std::max(1ul, strtoul(text.c_str(), nullptr, 10));
+}
+
+CitySpec::Layout parseLayout(const std::string &text)
+{
+    for (unsigned layout = 0; layout < 3; ++layout)
+        if (text == layoutNames[layout])
+            return (CitySpec::Layout)layout;
+    fprintf(stderr, "Unknown layout %s - using grid\n", text.c_str());
+    return CitySpec::grid;
+}
+
+std::string scheduleName(const Options &options, const std::string &lanePolicy)
+{
+    return std::string(options.partitioned ? "partitioned" : "dynamic") + (options.pin ? "_pinned" : "") +
+           (options.transfers ? "_transfers" : "") + (lanePolicy != "exhaustive" ? "_" + lanePolicy : "");
+}
+
+std::string parsePolicyName(const std::string &text)
+{
+    LaneChangePolicy policy;
+    if (parseLaneChangePolicy(text, policy))
+        return text;
+    fprintf(stderr, "Unknown lane change policy %s - using exhaustive\n", text.c_str());
+    return "exhaustive";
+}
+
+RoadOrder parseOrder(const std::string &text)
+{
+    RoadOrder order = Config::roadOrder;
+    if (!parseRoadOrder(text, order))
+        fprintf(stderr, "Unknown road order %s - using %s\n", text.c_str(), roadOrderName(order));
+    return order;
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool used = true;
+
+        if (!strcmp(arg, "--weak")) {
+            options.weak = true;
+            continue;
+        } else if (!strcmp(arg, "--scatter-ids")) {
+            options.scatterIds = true;
+            continue;
+        } else if (!strcmp(arg, "--partitioned")) {
+            options.partitioned = true;
+            continue;
+        } else if (!strcmp(arg, "--pin")) {
+            options.pin = true;
+            continue;
+        } else if (!strcmp(arg, "--transfers")) {
+            options.transfers = true;
+            continue;
+        } else if (!value) {
+            used = false;
+        } else if (!strcmp(arg, "--layouts")) {
+            options.layouts = parseList<CitySpec::Layout>(value, parseLayout);
+        } else if (!strcmp(arg, "--lanes")) {
+            options.lanes = parseList<unsigned long>(value, parseUnsigned);
+        } else if (!strcmp(arg, "--threads")) {
+            options.threads = parseList<unsigned>(value, parseThreads);
+        } else if (!strcmp(arg, "--road-order")) {
+            options.roadOrders = parseList<RoadOrder>(value, parseOrder);
+        } else if (!strcmp(arg, "--lane-policy")) {
+            options.lanePolicies = parseList<std::string>(value, parsePolicyName);
+        } else if (!strcmp(arg, "--steps")) {
+            options.steps = std::max(1ul, parseUnsigned(value));
+        } else if (!strcmp(arg, "--warmup")) {
+            options.warmup = parseUnsigned(value);
+        } else if (!strcmp(arg, "--repeat")) {
+            options.repeat = std::max(1ul, parseUnsigned(value));
+        } else if (!strcmp(arg, "--demand")) {
+            options.demand = atof(value);
+        } else if (!strcmp(arg, "--seed")) {
+            options.seed = parseUnsigned(value);
+        } else if (!strcmp(arg, "--output")) {
+            options.output = value;
+        } else if (!strcmp(arg, "--baseline")) {
+            options.baseline = value;
+        } else if (!strcmp(arg, "--threshold")) {
+            options.threshold = atof(value);
+        } else if (!strcmp(arg, "--memory-threshold")) {
+            options.memoryThreshold = atof(value);
+        } else {
+            used = false;
+        }
+
+        if (!used) {
+            fprintf(stderr, "usage: %s [--layouts grid,radial,motorway] [--lanes n,...] [--threads n,...] [--weak]\n"
+                            "       [--road-order id,hilbert,bfs] [--scatter-ids] [--partitioned] [--pin] [--transfers]\n"
+                            "       [--lane-policy exhaustive,throttled] [--steps n] [--warmup n] [--repeat n] [--demand veh/km] [--seed n]\n"
+                            "       [--output file.csv] [--baseline file.csv] [--threshold 0.1] [--memory-threshold 0.2]\n",
+                    argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+/* peak resident memory since the last reset, in kB. Linux resets the peak through clear_refs;
+ * elsewhere it's the peak of the whole process */
+void resetPeakMemory()
+{
+    if (FILE *clearRefs = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", clearRefs);
+        fclose(clearRefs);
+    }
+}
+
+long peakMemoryKb()
+{
+    if (FILE *status = fopen("/proc/self/status", "r")) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), status))
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(status);
+        if (kb >= 0)
+            return kb;
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+Run measure(const std::string &state, const Options &options, unsigned threads, RoadOrder order,
+            const std::string &lanePolicy)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    resetPeakMemory();
+    parseLaneChangePolicy(lanePolicy, Config::laneChangePolicy);
+
+    Simulator sim;
+    sim.setRoadOrder(order);
+    sim.setPartitioned(options.partitioned);
+    sim.setTransfers(options.transfers);
+    std::istringstream in(state);
+    sim.loadState(in);
+    sim.setWorkerThreads(threads, options.pin);
+
+    // partitioned runs warm up until the parts are cut again by measured costs, 64 steps in
+    const unsigned partitionedWarmup = 70;
+    const double dt = 0.5;
+    unsigned warmup = options.partitioned && threads > 1 ? std::max(options.warmup, partitionedWarmup) : options.warmup;
+    for (unsigned step = 0; step < warmup; ++step)
+        sim.update(dt);
+
+    Run run;
+    for (auto &roadElement : sim.cityMap)
+        run.lanes += roadElement.second.getLanesNo();
+    run.roads = sim.cityMap.size();
+    run.threads = threads;
+    run.roadOrder = order;
+    run.lanePolicy = lanePolicy;
+    run.schedule = scheduleName(options, lanePolicy);
+    run.steps = options.steps;
+
+    Profiler::reset();
+    uint64_t vehicleSteps = 0;
+    uint64_t cacheMisses = 0;
+    bool counting = true;
+    Clock::duration elapsed = Clock::duration::zero();
+    for (unsigned step = 0; step < options.steps; ++step) {
+        // only the update is timed: this walk over the map isn't part of the step
+        for (auto &roadElement : sim.cityMap)
+            vehicleSteps += roadElement.second.getVehiclesNo();
+
+        uint64_t countersStart[Profiler::counters_no];
+        counting = counting && Profiler::readCounters(countersStart);
+        Clock::time_point start = Clock::now();
+        sim.update(dt);
+        elapsed += Clock::now() - start;
+        uint64_t countersEnd[Profiler::counters_no];
+        if (counting && Profiler::readCounters(countersEnd))
+            cacheMisses += countersEnd[Profiler::cache_misses] - countersStart[Profiler::cache_misses];
+        PROFILE_END_STEP();
+    }
+    run.seconds = std::chrono::duration<double>(elapsed).count();
+    if (counting)
+        run.cacheMissesPerVehicleStep = (double)cacheMisses / vehicleSteps;
+
+    run.vehicles = vehicleSteps / options.steps;
+    run.vehicleStepsPerSecond = vehicleSteps / run.seconds;
+    run.maxRssKb = peakMemoryKb();
+
+    uint64_t ticks[Profiler::phases_no];
+    uint64_t calls[Profiler::phases_no];
+    Profiler::totals(ticks, calls);
+    for (unsigned phase = 0; phase < Profiler::phases_no; ++phase)
+        run.phaseMsPerStep[phase] = ticks[phase] / Profiler::ticksPerNs() / 1e6 / options.steps;
+
+    return run;
+}
+
+void writeHeader(FILE *out)
+{
+    fprintf(out, "layout,lanes,threads,roads,vehicles,steps,seconds,vehicle_steps_per_s,max_rss_kb");
+    for (unsigned phase = 0; phase < Profiler::phases_no; ++phase)
+        fprintf(out, ",%s_ms_per_step", Profiler::phaseName((Profiler::Phase)phase));
+    fprintf(out, ",road_order,cache_misses_per_vehicle_step,schedule,lane_policy\n");
+}
+
+void writeRun(FILE *out, const Run &run)
+{
+    fprintf(out, "%s,%lu,%u,%lu,%lu,%u,%.6f,%.1f,%ld", run.layout.c_str(), run.lanes, run.threads, run.roads,
+            run.vehicles, run.steps, run.seconds, run.vehicleStepsPerSecond, run.maxRssKb);
+    for (unsigned phase = 0; phase < Profiler::phases_no; ++phase)
+        fprintf(out, ",%.6f", run.phaseMsPerStep[phase]);
+    fprintf(out, ",%s,%.4f,%s,%s\n", roadOrderName(run.roadOrder), run.cacheMissesPerVehicleStep, run.schedule.c_str(),
+            run.lanePolicy.c_str());
+    fflush(out);
+}
+
+typedef std::tuple<std::string, unsigned long, unsigned, std::string, std::string> RunKey;
+
+/* layout, lanes, threads, road order, schedule -> (vehicle steps/s, max rss) of a results file written by this
+ * driver. Files from before road orders and schedules were measured ran in id order, dynamic */
+bool loadBaseline(const std::string &fileName, std::map<RunKey, std::pair<double, long>> &baseline)
+{
+    std::ifstream in(fileName);
+    if (!in) {
+        fprintf(stderr, "Cannot read baseline %s\n", fileName.c_str());
+        return false;
+    }
+
+    auto split = [](const std::string &line) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ','))
+            fields.push_back(field);
+        return fields;
+    };
+
+    // columns after the phases are found by name: files from builds with other phases have them elsewhere
+    std::string line;
+    std::getline(in, line);
+    std::vector<std::string> header = split(line);
+    auto column = [&header](const char *name) {
+        return (size_t)(std::find(header.begin(), header.end(), name) - header.begin());
+    };
+    const size_t orderField = column("road_order");
+    const size_t scheduleField = column("schedule");
+
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields = split(line);
+        if (fields.size() < 9)
+            continue;
+
+        RunKey key(fields[0], strtoul(fields[1].c_str(), nullptr, 10), strtoul(fields[2].c_str(), nullptr, 10),
+                   fields.size() > orderField ? fields[orderField] : roadOrderName(by_id),
+                   fields.size() > scheduleField ? fields[scheduleField] : "dynamic");
+        baseline[key] = std::make_pair(atof(fields[7].c_str()), atol(fields[8].c_str()));
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 2;
+
+    std::map<RunKey, std::pair<double, long>> baseline;
+    if (!options.baseline.empty() && !loadBaseline(options.baseline, baseline))
+        return 2;
+
+    FILE *out = fopen(options.output.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "Cannot create %s\n", options.output.c_str());
+        return 2;
+    }
+    writeHeader(out);
+
+    printf("%-9s %9s %-7s %-10s %7s %9s %14s %10s %12s %9s  %s\n", "layout", "lanes", "order", "policy", "threads",
+           "vehicles", "veh-steps/s", "rss MB", "misses/veh", "speedup", "baseline");
+
+    unsigned regressions = 0;
+    for (CitySpec::Layout layout : options.layouts) {
+        for (unsigned long lanes : options.lanes) {
+            std::string state;
+            unsigned long stateLanes = 0;
+
+            for (RoadOrder order : options.roadOrders) {
+                for (const std::string &lanePolicy : options.lanePolicies) {
+                    double singleThread = 0.0;
+                    for (unsigned threads : options.threads) {
+                        unsigned long cityLanes = options.weak ? lanes * threads : lanes;
+                        if (state.empty() || stateLanes != cityLanes) {
+                            CitySpec spec = citySpecForLanes(layout, cityLanes, options.seed);
+                            spec.demand = options.demand;
+                            spec.scatterIds = options.scatterIds;
+                            Simulator sim;
+                            std::vector<Road> roads = generateCity(spec);
+                            sim.addRoadNetToMap(std::move(roads));
+
+                            std::ostringstream saved;
+                            sim.saveState(saved);
+                            state = saved.str();
+                            stateLanes = cityLanes;
+                        }
+
+                        Run best;
+                        for (unsigned r = 0; r < options.repeat; ++r) {
+                            Run run = measure(state, options, threads, order, lanePolicy);
+                            if (run.vehicleStepsPerSecond > best.vehicleStepsPerSecond)
+                                best = run;
+                        }
+                        // key by the requested size: the generated city is only about that big
+                        best.layout = layoutNames[layout];
+                        best.lanes = lanes;
+                        writeRun(out, best);
+
+                        if (threads == options.threads.front())
+                            singleThread = best.vehicleStepsPerSecond / threads;
+
+                        std::string verdict = "-";
+                        auto found = baseline.find(RunKey(best.layout, best.lanes, best.threads, roadOrderName(order),
+                                                          best.schedule));
+                        if (!baseline.empty() && found == baseline.end()) {
+                            verdict = "new";
+                        } else if (found != baseline.end()) {
+                            double speed = best.vehicleStepsPerSecond / found->second.first - 1.0;
+                            double memory = found->second.second ? (double)best.maxRssKb / found->second.second - 1.0
+                                                                 : 0.0;
+                            char text[96];
+                            snprintf(text, sizeof(text), "%+.1f%% speed %+.1f%% memory", 100 * speed, 100 * memory);
+                            verdict = text;
+                            if (speed < -options.threshold || memory > options.memoryThreshold) {
+                                verdict += "  REGRESSION";
+                                ++regressions;
+                            }
+                        }
+
+                        char misses[32] = "-";
+                        if (best.cacheMissesPerVehicleStep >= 0)
+                            snprintf(misses, sizeof(misses), "%.3f", best.cacheMissesPerVehicleStep);
+
+                        Logger::flush();
+                        printf("%-9s %9lu %-7s %-10s %7u %9lu %14.0f %10.1f %12s %9.2f  %s\n", best.layout.c_str(),
+                               best.lanes, roadOrderName(order), lanePolicy.c_str(), best.threads, best.vehicles,
+                               best.vehicleStepsPerSecond, best.maxRssKb / 1024.0, misses,
+                               singleThread ? best.vehicleStepsPerSecond / singleThread : 0.0, verdict.c_str());
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    fclose(out);
+
+    if (regressions) {
+        fprintf(stderr, "FAILED: %u run(s) regressed past the thresholds (speed -%.0f%%, memory +%.0f%%)\n",
+                regressions, 100 * options.threshold, 100 * options.memoryThreshold);
+        return 1;
+    }
+    return 0;
+}
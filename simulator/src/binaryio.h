@@ -0,0 +1,120 @@
+#ifndef BINARYIO_H
+#define BINARYIO_H
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace simulator
+{
+
+/* Raw binary state I/O.
+ * Used for checkpoints and replay logs: files are read back on the same platform that wrote them,
+ * so plain native layout is enough - this is not an exchange format (see serialize_v1 for that).
+ */
+
+template<typename T>
+void writeBinary(std::ostream &out, const T &value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "writeBinary needs a trivially copyable type");
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+bool readBinary(std::istream &in, T &value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "readBinary needs a trivially copyable type");
+    return (bool)in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template<typename T, typename U>
+void writeBinary(std::ostream &out, const std::pair<T, U> &value)
+{
+    writeBinary(out, value.first);
+    writeBinary(out, value.second);
+}
+
+template<typename T, typename U>
+bool readBinary(std::istream &in, std::pair<T, U> &value)
+{
+    return readBinary(in, value.first) && readBinary(in, value.second);
+}
+
+template<typename T>
+void writeBinary(std::ostream &out, const std::vector<T> &values)
+{
+    writeBinary(out, (uint64_t)values.size());
+    for (const T &value : values)
+        writeBinary(out, value);
+}
+
+template<typename T>
+bool readBinary(std::istream &in, std::vector<T> &values)
+{
+    uint64_t size = 0;
+    if (!readBinary(in, size))
+        return false;
+
+    values.resize(size);
+    for (T &value : values)
+        if (!readBinary(in, value))
+            return false;
+    return true;
+}
+
+// fixed size arrays are stored like vectors - size first - so a member can switch between the two
+template<typename T, std::size_t N>
+void writeBinary(std::ostream &out, const std::array<T, N> &values)
+{
+    writeBinary(out, (uint64_t)N);
+    for (const T &value : values)
+        writeBinary(out, value);
+}
+
+template<typename T, std::size_t N>
+bool readBinary(std::istream &in, std::array<T, N> &values)
+{
+    uint64_t size = 0;
+    if (!readBinary(in, size) || size != N)
+        return false;
+
+    for (T &value : values)
+        if (!readBinary(in, value))
+            return false;
+    return true;
+}
+
+inline void writeBinary(std::ostream &out, const std::string &value)
+{
+    writeBinary(out, (uint64_t)value.size());
+    out.write(value.data(), value.size());
+}
+
+inline bool readBinary(std::istream &in, std::string &value)
+{
+    uint64_t size = 0;
+    if (!readBinary(in, size))
+        return false;
+
+    value.resize(size);
+    return (bool)in.read(&value[0], size);
+}
+
+/* FNV-1a - cheap 64 bit hash used to fingerprint simulation states */
+inline uint64_t fnv1a(const std::string &bytes, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+} // namespace simulator
+
+#endif // BINARYIO_H
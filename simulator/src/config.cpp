@@ -7,6 +7,16 @@ const double Config::DT = 0.5; // simulator will update at 0.5 seconds.
 
 const std::string Config::simpleRoadTestFName = "simple_road.dat";
 std::string Config::simulatorOuput = "output.dat";
+std::string Config::profileOutput = "";
+bool Config::profileCounters = false;
+std::string Config::traceOutput = "";
+unsigned Config::workerThreads = 1;
+bool Config::pinWorkers = false;
+bool Config::partitionedUpdates = false;
+RoadOrder Config::roadOrder = by_id;
+bool Config::roadTransfers = false;
+LaneChangePolicy Config::laneChangePolicy = LaneChangePolicy(); // exhaustive
+double Config::roadSegmentLength = 2000.0; // meters
 
 const double Config::trafficLightDistToRoadEnd = 1.0; // meters
 
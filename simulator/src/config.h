@@ -1,6 +1,9 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "lanechange.h"
+#include "roadorder.h"
+
 #include <string>
 
 namespace simulator
@@ -20,6 +23,46 @@ public:
     static std::string simulatorOuput;
     static const double DT;// simulator will update at 0.5 seconds.
 
+    // per step phase timings (Profiler). Empty - off, *.csv - text, anything else - binary
+    static std::string profileOutput;
+
+    // hardware counters (cycles, instructions, cache and branch misses) per phase, with the Profiler
+    static bool profileCounters;
+
+    // Chrome trace of the test run (Trace). Empty - off
+    static std::string traceOutput;
+
+    // worker threads updating roads. 1 - update on the calling thread
+    static unsigned workerThreads;
+
+    // keep every worker on a cpu, filling NUMA nodes one by one (numa.h)
+    static bool pinWorkers;
+
+    // a part of the network per worker, its lanes on the worker's node (Simulator::setPartitioned)
+    static bool partitionedUpdates;
+
+    /* memory layout and update order of the roads a simulator loads (roadorder.h). By id: as long as roads
+     * don't exchange vehicles a step streams through the roads in any order, and placing them costs a load */
+    static RoadOrder roadOrder;
+
+    /* vehicles drive on from road to road (Simulator::setTransfers). Off: every vehicle stays on the road it
+     * started on - the fixed workloads benchmarks and checks are built around */
+    static bool roadTransfers;
+
+    /* which vehicles consider a lane change in a step (lanechange.h). Part of the model, read by every road.
+     * Exhaustive by default. Throttled (throttledLaneChanges) skips vehicles, so it changes the traffic - fewer
+     * and later lane changes - and not only the time a step takes. It is about 10% faster on generated cities
+     * (simulator_scaling measures both), which doesn't pay for results that stop matching earlier runs,
+     * checkpoints and replay logs. A study that accepts the coarser model sets it here */
+    static LaneChangePolicy laneChangePolicy;
+
+    /* with simultaneous lane changes, roads at least twice this long (meters) are cut into segments of about this
+     * length that move in parallel (Road::moveLane). Part of the model: a segment's first vehicle follows its
+     * leader coasted through the step, not as it moved - bench/difftest.cpp bounds how far that takes it. 0 - never.
+     * Only laneChangePolicy.simultaneous cuts roads: one lane change at a time, a vehicle decides on the lanes as
+     * the vehicles ahead of it left them, so a road moves front to back, whole, whatever this is */
+    static double roadSegmentLength;
+
     // how far from the end of the road the traffic light should be positioned
     static const double trafficLightDistToRoadEnd; // = 1 meters
 };
@@ -7,6 +7,16 @@ namespace simulator
 {
 typedef unsigned long roadID;
 
+/* the hot vehicle state - position, velocity, acceleration and the driver model - and the IDM and MOBIL kernels
+ * computing on it. Positions count from the start of the road, so a float keeps a few millimeters on roads up to
+ * tens of kilometers: SIMULATOR_FLOAT_STATE builds it single precision - twice the vector width, half the memory
+ * traffic. The saved state stays double (bench/accuracy.cpp compares with the double reference engine) */
+#ifdef SIMULATOR_FLOAT_STATE
+typedef float real;
+#else
+typedef double real;
+#endif
+
 typedef std::pair<double, double> roadPosGeo;
 typedef std::pair<int, int> roadPosCard;
 } // namespace simulator
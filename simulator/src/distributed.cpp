@@ -0,0 +1,788 @@
+#include "distributed.h"
+#include "binaryio.h"
+#include "logger.h"
+#include "partition.h"
+#include "profiler.h"
+#include "roadorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <tuple>
+#include <utility>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace simulator
+{
+
+namespace
+{
+
+// kind, step, payload length
+const size_t headerSize = sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+// a peer that says nothing for this long is taken for dead
+const int silenceMs = 60 * 1000;
+
+double seconds(uint64_t ticks)
+{
+    return ticks / Profiler::ticksPerNs() / 1e9;
+}
+
+struct Address
+{
+    bool local = { false };     // unix socket at path, tcp at host:port otherwise
+    std::string path;
+    std::string host;
+    std::string port;
+};
+
+bool parseAddress(const std::string &text, Address &address)
+{
+    if (text.compare(0, 5, "unix:") == 0) {
+        address.local = true;
+        address.path = text.substr(5);
+        return !address.path.empty() && address.path.size() < sizeof(sockaddr_un::sun_path);
+    }
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos || colon + 1 == text.size())
+        return false;
+    address.host = text.substr(0, colon);
+    address.port = text.substr(colon + 1);
+    return true;
+}
+
+// a socket bound to (listen) or connected to address. -1 on failure, errno set
+int openSocket(const Address &address, bool listen)
+{
+    if (address.local) {
+        sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strncpy(un.sun_path, address.path.c_str(), sizeof(un.sun_path) - 1);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (listen)
+            unlink(address.path.c_str());
+        int result = listen ? bind(fd, (sockaddr *)&un, sizeof(un)) : ::connect(fd, (sockaddr *)&un, sizeof(un));
+        if (result < 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen ? AI_PASSIVE : 0;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(address.host.empty() ? nullptr : address.host.c_str(), address.port.c_str(), &hints, &found) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *candidate = found; candidate; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0)
+            continue;
+        int on = 1;
+        if (listen)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if ((listen ? bind(fd, candidate->ai_addr, candidate->ai_addrlen)
+                    : ::connect(fd, candidate->ai_addr, candidate->ai_addrlen)) == 0) {
+            // a step's messages are small and waited for: don't hold them back
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            break;
+        }
+        int error = errno;
+        close(fd);
+        fd = -1;
+        errno = error;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, void *data, size_t size)
+{
+    char *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+} // namespace
+
+Rank::Rank(unsigned rank, const std::vector<std::string> &addresses) :
+    rank(rank), addresses(addresses), peers(addresses.size())
+{
+}
+
+Rank::~Rank()
+{
+    for (Peer &peer : peers)
+        if (peer.socket >= 0)
+            close(peer.socket);
+    if (listener >= 0)
+        close(listener);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+bool Rank::connect(double timeoutSeconds)
+{
+    if (rank >= addresses.size()) {
+        log_error("Rank %u of %zu ranks", rank, addresses.size());
+        return false;
+    }
+
+    Address own;
+    if (!parseAddress(addresses[rank], own)) {
+        log_error("Rank %u: bad address %s - unix:/path or host:port", rank, addresses[rank].c_str());
+        Logger::flush(); // the message refers to addresses, gone with the rank
+        return false;
+    }
+    listener = openSocket(own, true);
+    if (listener < 0 || listen(listener, addresses.size()) < 0) {
+        log_error("Rank %u: cannot listen on %s: %s", rank, addresses[rank].c_str(), strerror(errno));
+        Logger::flush();
+        return false;
+    }
+    if (own.local)
+        unixPath = own.path;
+
+    uint64_t deadline = Profiler::ticks() + (uint64_t)(timeoutSeconds * 1e9 * Profiler::ticksPerNs());
+
+    // the ranks before this one listen already, or will soon
+    for (unsigned peer = 0; peer < rank; ++peer) {
+        Address address;
+        if (!parseAddress(addresses[peer], address)) {
+            log_error("Rank %u: bad address of rank %u: %s", rank, peer, addresses[peer].c_str());
+            Logger::flush();
+            return false;
+        }
+        int fd;
+        while ((fd = openSocket(address, false)) < 0) {
+            if (Profiler::ticks() > deadline) {
+                log_error("Rank %u: cannot connect to rank %u at %s: %s", rank, peer, addresses[peer].c_str(),
+                          strerror(errno));
+                Logger::flush();
+                return false;
+            }
+            usleep(10000);
+        }
+        uint32_t hello = rank;
+        if (!writeAll(fd, &hello, sizeof(hello))) {
+            log_error("Rank %u: rank %u hung up", rank, peer);
+            close(fd);
+            return false;
+        }
+        peers[peer].socket = fd;
+    }
+
+    for (unsigned accepted = rank + 1; accepted < addresses.size(); ++accepted) {
+        pollfd waiting = { listener, POLLIN, 0 };
+        int left = (int)std::max<int64_t>(0, (int64_t)(deadline - Profiler::ticks()) / Profiler::ticksPerNs() / 1e6);
+        int fd = -1;
+        uint32_t hello = 0;
+        if (poll(&waiting, 1, left) <= 0 || (fd = accept(listener, nullptr, nullptr)) < 0 ||
+                !readAll(fd, &hello, sizeof(hello)) || hello <= rank || hello >= addresses.size() ||
+                peers[hello].socket >= 0) {
+            log_error("Rank %u: %zu rank(s) after this one didn't connect", rank, addresses.size() - accepted);
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        peers[hello].socket = fd;
+    }
+
+    // from here on nothing waits on a single socket: steps write and read all of them together
+    for (Peer &peer : peers)
+        if (peer.socket >= 0)
+            fcntl(peer.socket, F_SETFL, fcntl(peer.socket, F_GETFL) | O_NONBLOCK);
+
+    log_info("Rank %u of %zu: connected", rank, addresses.size());
+    return true;
+}
+
+bool Rank::load(std::vector<Road> &&roads)
+{
+    network.clear();
+    for (Road &road : roads) {
+        roadID id = road.getId();
+        network.insert_or_assign(id, std::move(road));
+    }
+    roads.clear();
+
+    std::vector<const Road *> view;
+    std::vector<double> weights;
+    for (auto &roadElement : network) {
+        view.push_back(&roadElement.second);
+        weights.push_back(1.0 + roadElement.second.getLanesNo() * (double)roadElement.second.getLength());
+    }
+    Partition parts = partitionRoads(view, weights, addresses.size());
+
+    std::map<roadID, unsigned> newOwners;
+    size_t i = 0;
+    for (auto &roadElement : network) {
+        newOwners[roadElement.first] = parts.part[i++];
+        if (newOwners[roadElement.first] == rank)
+            roadElement.second.indexRoad();
+        else
+            roadElement.second.clearVehicles();
+    }
+    assign(newOwners);
+
+    log_info("Rank %u: %zu of %zu roads, %zu on the boundary, %u neighbour(s), %u vehicles", rank, getRoadsNo(),
+             network.size(), boundaryRoads.size(), getNeighboursNo(), getVehiclesNo());
+    return true;
+}
+
+void Rank::assign(const std::map<roadID, unsigned> &newOwners)
+{
+    owners = newOwners;
+    boundaryRoads.clear();
+    interiorRoads.clear();
+    for (Peer &peer : peers)
+        peer.neighbour = false;
+
+    for (auto &roadElement : network) {
+        unsigned owner = owners[roadElement.first];
+        bool boundary = false;
+        for (auto &laneConnections : roadElement.second.getConnections())
+            for (roadID next : laneConnections) {
+                auto nextOwner = owners.find(next);
+                if (nextOwner == owners.end() || nextOwner->second == owner)
+                    continue;
+                // either way: both ends of a connection see each other as neighbours
+                if (owner == rank) {
+                    boundary = true;
+                    peers[nextOwner->second].neighbour = true;
+                } else if (nextOwner->second == rank) {
+                    peers[owner].neighbour = true;
+                }
+            }
+        if (owner == rank)
+            (boundary ? boundaryRoads : interiorRoads).push_back(&roadElement.second);
+    }
+}
+
+void Rank::updateRoad(Road &road, double dt)
+{
+    unsigned vehiclesNo = road.getVehiclesNo();
+    uint64_t start = Profiler::ticks();
+    road.update(dt, network, &transfers, CounterRng::forStream(seed, step));
+    road.addUpdateCost(Profiler::ticks() - start, vehiclesNo);
+}
+
+void Rank::post(unsigned peer, Kind kind, const std::string &payload)
+{
+    std::ostringstream header;
+    writeBinary(header, (uint32_t)kind);
+    writeBinary(header, step);
+    writeBinary(header, (uint64_t)payload.size());
+
+    Peer &to = peers[peer];
+    if (to.written == to.out.size()) {
+        to.out.clear();
+        to.written = 0;
+    }
+    to.out += header.str();
+    to.out += payload;
+    stats.bytesSent += headerSize + payload.size();
+}
+
+bool Rank::sendPending()
+{
+    for (unsigned p = 0; p < peers.size(); ++p) {
+        Peer &peer = peers[p];
+        while (peer.written < peer.out.size()) {
+            ssize_t n = send(peer.socket, peer.out.data() + peer.written, peer.out.size() - peer.written, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0) {
+                log_error("Rank %u: cannot send to rank %u: %s", rank, p, strerror(errno));
+                return false;
+            }
+            peer.written += n;
+        }
+    }
+    return true;
+}
+
+bool Rank::complete(Kind kind, const std::vector<bool> &from, std::vector<std::string> &received)
+{
+    received.assign(peers.size(), std::string());
+    std::vector<bool> done(peers.size(), true);
+    for (unsigned p = 0; p < peers.size(); ++p)
+        done[p] = !from[p];
+
+    // a message that came in with an earlier read is taken first
+    auto take = [&](unsigned p) -> bool {
+        Peer &peer = peers[p];
+        if (done[p] || peer.in.size() < headerSize)
+            return true;
+        std::istringstream header(peer.in.substr(0, headerSize));
+        uint32_t messageKind = 0;
+        uint64_t messageStep = 0, length = 0;
+        readBinary(header, messageKind);
+        readBinary(header, messageStep);
+        readBinary(header, length);
+        if (messageKind != (uint32_t)kind || messageStep != step) {
+            log_error("Rank %u: rank %u is out of step: message %u of step %lu, expected %u of step %lu", rank, p,
+                      messageKind, (unsigned long)messageStep, (unsigned)kind, (unsigned long)step);
+            return false;
+        }
+        if (peer.in.size() < headerSize + length)
+            return true;
+        received[p] = peer.in.substr(headerSize, length);
+        peer.in.erase(0, headerSize + length);
+        stats.bytesReceived += headerSize + length;
+        done[p] = true;
+        return true;
+    };
+
+    std::vector<pollfd> waiting;
+    std::vector<unsigned> waitingPeers;
+    std::vector<bool> closed(peers.size(), false);
+    char buffer[1 << 16];
+    while (true) {
+        if (!sendPending())
+            return false;
+
+        waiting.clear();
+        waitingPeers.clear();
+        for (unsigned p = 0; p < peers.size(); ++p) {
+            if (!take(p))
+                return false;
+            // a rank that is done may go: what it sent before is still read
+            if (closed[p] && !done[p]) {
+                log_error("Rank %u: rank %u hung up", rank, p);
+                return false;
+            }
+            short events = (done[p] ? 0 : POLLIN) | (peers[p].written < peers[p].out.size() ? POLLOUT : 0);
+            if (events) {
+                waiting.push_back(pollfd{ peers[p].socket, events, 0 });
+                waitingPeers.push_back(p);
+            }
+        }
+        if (waiting.empty())
+            return true;
+
+        int ready = poll(waiting.data(), waiting.size(), silenceMs);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0) {
+            log_error("Rank %u: no message from %zu rank(s) for %d s", rank, waiting.size(), silenceMs / 1000);
+            return false;
+        }
+
+        for (size_t w = 0; w < waiting.size(); ++w) {
+            if (!(waiting[w].revents & (POLLIN | POLLHUP | POLLERR)) || done[waitingPeers[w]])
+                continue;
+            unsigned p = waitingPeers[w];
+            ssize_t n;
+            while ((n = recv(peers[p].socket, buffer, sizeof(buffer), 0)) > 0)
+                peers[p].in.append(buffer, n);
+            closed[p] = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        }
+    }
+}
+
+bool Rank::allExchange(Kind kind, const std::string &payload, std::vector<std::string> &received)
+{
+    std::vector<bool> everybody(peers.size(), true);
+    everybody[rank] = false;
+    for (unsigned p = 0; p < peers.size(); ++p)
+        if (p != rank)
+            post(p, kind, payload);
+    if (!complete(kind, everybody, received))
+        return false;
+    received[rank] = payload;
+    return true;
+}
+
+bool Rank::postTransfers(Kind kind, bool back)
+{
+    std::vector<std::ostringstream> outgoing(peers.size());
+    std::vector<uint64_t> counts(peers.size(), 0);
+    size_t kept = 0;
+    for (Road::Transfer &transfer : transfers) {
+        auto owner = owners.find(back ? transfer.from : transfer.to);
+        if (owner == owners.end() || owner->second == rank) {
+            if (&transfers[kept] != &transfer)
+                transfers[kept] = std::move(transfer);
+            ++kept;
+            continue;
+        }
+        std::ostringstream &out = outgoing[owner->second];
+        writeBinary(out, transfer.from);
+        writeBinary(out, transfer.to);
+        writeBinary(out, transfer.lane);
+        transfer.vehicle.saveState(out);
+        ++counts[owner->second];
+    }
+    transfers.erase(transfers.begin() + kept, transfers.end());
+
+    for (unsigned p = 0; p < peers.size(); ++p) {
+        if (!peers[p].neighbour)
+            continue;
+        std::ostringstream payload;
+        writeBinary(payload, counts[p]);
+        payload << outgoing[p].str();
+        post(p, kind, payload.str());
+        stats.vehiclesSent += counts[p];
+    }
+    return sendPending();
+}
+
+bool Rank::readTransfers(const std::vector<std::string> &received)
+{
+    for (unsigned p = 0; p < peers.size(); ++p) {
+        if (!peers[p].neighbour)
+            continue;
+        std::istringstream in(received[p]);
+        uint64_t count = 0;
+        readBinary(in, count);
+        for (uint64_t i = 0; i < count; ++i) {
+            Road::Transfer transfer = { 0, 0, 0, Vehicle(0.0, 0.0, 0.0) };
+            if (!(readBinary(in, transfer.from) && readBinary(in, transfer.to) && readBinary(in, transfer.lane) &&
+                  transfer.vehicle.loadState(in))) {
+                log_error("Rank %u: corrupted vehicles from rank %u", rank, p);
+                return false;
+            }
+            transfers.push_back(std::move(transfer));
+        }
+        stats.vehiclesReceived += count;
+    }
+    return true;
+}
+
+bool Rank::update(double dt)
+{
+    uint64_t start = Profiler::ticks();
+
+    for (Road *road : boundaryRoads)
+        updateRoad(*road, dt);
+
+    // vehicles for other ranks go now, the rest stays in transfers
+    if (!postTransfers(transfers_message, false))
+        return false;
+
+    for (Road *road : interiorRoads)
+        updateRoad(*road, dt);
+
+    uint64_t waitStart = Profiler::ticks();
+    std::vector<bool> neighbours(peers.size(), false);
+    for (unsigned p = 0; p < peers.size(); ++p)
+        neighbours[p] = peers[p].neighbour;
+    std::vector<std::string> received;
+    if (!complete(transfers_message, neighbours, received))
+        return false;
+    uint64_t waited = Profiler::ticks() - waitStart;
+
+    if (!readTransfers(received))
+        return false;
+    enterTransfers(transfers, network);
+
+    // the ones that didn't fit go back to the rank of their road - every neighbour answers, if only with none
+    if (!postTransfers(returns_message, true))
+        return false;
+    waitStart = Profiler::ticks();
+    if (!complete(returns_message, neighbours, received))
+        return false;
+    waited += Profiler::ticks() - waitStart;
+    if (!readTransfers(received))
+        return false;
+    holdTransfers(transfers, network);
+
+    runTime += dt;
+    ++step;
+    ++stats.steps;
+    stats.waitSeconds += seconds(waited);
+    stats.computeSeconds += seconds(Profiler::ticks() - start - waited);
+
+    if (rebalanceSteps && step % rebalanceSteps == 0)
+        return rebalance();
+    return true;
+}
+
+void Rank::setRebalance(unsigned steps, double tolerance)
+{
+    rebalanceSteps = steps;
+    rebalanceTolerance = tolerance;
+}
+
+void Rank::setSeed(uint64_t newSeed)
+{
+    seed = newSeed;
+}
+
+bool Rank::rebalance()
+{
+    unsigned ranksNo = addresses.size();
+
+    std::ostringstream costs;
+    writeBinary(costs, (uint64_t)(boundaryRoads.size() + interiorRoads.size()));
+    for (auto &roadElement : network)
+        if (owners[roadElement.first] == rank) {
+            writeBinary(costs, roadElement.first);
+            writeBinary(costs, std::max(1.0, roadElement.second.getCost().weight));
+        }
+    std::vector<std::string> received;
+    if (!allExchange(costs_message, costs.str(), received))
+        return false;
+
+    // every rank has the same weights now, and cuts the same parts from them
+    std::map<roadID, double> weightOf;
+    std::vector<double> rankCost(ranksNo, 0.0);
+    for (unsigned p = 0; p < ranksNo; ++p) {
+        std::istringstream in(received[p]);
+        uint64_t count = 0;
+        readBinary(in, count);
+        for (uint64_t i = 0; i < count; ++i) {
+            roadID id = 0;
+            double weight = 0.0;
+            if (!readBinary(in, id) || !readBinary(in, weight)) {
+                log_error("Rank %u: corrupted costs from rank %u", rank, p);
+                return false;
+            }
+            weightOf[id] = weight;
+            rankCost[p] += weight;
+        }
+    }
+
+    double total = 0.0;
+    for (double cost : rankCost)
+        total += cost;
+    double before = total > 0 ? *std::max_element(rankCost.begin(), rankCost.end()) * ranksNo / total : 1.0;
+    if (before <= 1.0 + rebalanceTolerance)
+        return true;
+
+    std::vector<const Road *> view;
+    std::vector<double> weights;
+    for (auto &roadElement : network) {
+        view.push_back(&roadElement.second);
+        weights.push_back(weightOf.count(roadElement.first) ? weightOf[roadElement.first] : 1.0);
+    }
+    Partition parts = partitionRoads(view, weights, ranksNo);
+
+    // parts to ranks: the largest overlaps first, so as little as possible moves
+    std::vector<std::vector<double>> overlap(ranksNo, std::vector<double>(ranksNo, 0.0));
+    size_t i = 0;
+    for (auto &roadElement : network) {
+        overlap[parts.part[i]][owners[roadElement.first]] += weights[i];
+        ++i;
+    }
+    std::vector<std::tuple<double, unsigned, unsigned>> pairs;
+    for (unsigned part = 0; part < ranksNo; ++part)
+        for (unsigned r = 0; r < ranksNo; ++r)
+            pairs.emplace_back(-overlap[part][r], part, r);
+    std::sort(pairs.begin(), pairs.end());
+    std::vector<int> rankOfPart(ranksNo, -1);
+    std::vector<bool> taken(ranksNo, false);
+    for (auto &pair : pairs) {
+        unsigned part = std::get<1>(pair), r = std::get<2>(pair);
+        if (rankOfPart[part] < 0 && !taken[r]) {
+            rankOfPart[part] = r;
+            taken[r] = true;
+        }
+    }
+
+    std::map<roadID, unsigned> newOwners;
+    std::vector<std::ostringstream> leaving(ranksNo);
+    std::vector<uint64_t> counts(ranksNo, 0);
+    i = 0;
+    for (auto &roadElement : network) {
+        unsigned owner = rankOfPart[parts.part[i++]];
+        newOwners[roadElement.first] = owner;
+        if (owners[roadElement.first] == rank && owner != rank) {
+            roadElement.second.saveState(leaving[owner]);
+            roadElement.second.clearVehicles();
+            ++counts[owner];
+            ++stats.roadsMoved;
+        }
+    }
+
+    std::vector<bool> everybody(ranksNo, true);
+    everybody[rank] = false;
+    for (unsigned p = 0; p < ranksNo; ++p) {
+        if (p == rank)
+            continue;
+        std::ostringstream payload;
+        writeBinary(payload, counts[p]);
+        payload << leaving[p].str();
+        post(p, roads_message, payload.str());
+    }
+    if (!complete(roads_message, everybody, received))
+        return false;
+
+    for (unsigned p = 0; p < ranksNo; ++p) {
+        if (p == rank)
+            continue;
+        std::istringstream in(received[p]);
+        uint64_t count = 0;
+        readBinary(in, count);
+        for (uint64_t r = 0; r < count; ++r) {
+            Road road;
+            if (!road.loadState(in)) {
+                log_error("Rank %u: corrupted road from rank %u", rank, p);
+                return false;
+            }
+            roadID id = road.getId();
+            network[id] = std::move(road);
+        }
+    }
+    assign(newOwners);
+    ++stats.rebalances;
+
+    log_info("Rank %u: rebalanced at step %lu, heaviest rank %.2f x average before, %.2f x cut. %zu roads, "
+             "%zu on the boundary, %u neighbour(s)", rank, (unsigned long)step, before, parts.imbalance(), getRoadsNo(),
+             boundaryRoads.size(), getNeighboursNo());
+    return true;
+}
+
+bool Rank::gatherState(std::ostream *out)
+{
+    std::ostringstream own;
+    writeBinary(own, (uint64_t)getRoadsNo());
+    for (auto &roadElement : network)
+        if (owners[roadElement.first] == rank)
+            roadElement.second.saveState(own);
+
+    if (rank != 0) {
+        post(0, state_message, own.str());
+        std::vector<std::string> none;
+        return complete(state_message, std::vector<bool>(peers.size(), false), none);
+    }
+
+    std::vector<bool> others(peers.size(), true);
+    others[0] = false;
+    std::vector<std::string> received;
+    if (!complete(state_message, others, received))
+        return false;
+    received[0] = own.str();
+
+    // in id order, like Simulator::saveState
+    std::map<roadID, Road> roads;
+    for (unsigned p = 0; p < peers.size(); ++p) {
+        std::istringstream in(received[p]);
+        uint64_t count = 0;
+        readBinary(in, count);
+        for (uint64_t r = 0; r < count; ++r) {
+            Road road;
+            if (!road.loadState(in)) {
+                log_error("Rank 0: corrupted state from rank %u", p);
+                return false;
+            }
+            roadID id = road.getId();
+            roads.emplace(id, std::move(road));
+        }
+    }
+    if (out) {
+        writeBinary(*out, runTime);
+        writeBinary(*out, seed);
+        writeBinary(*out, step);
+        writeBinary(*out, (uint64_t)roads.size());
+        for (auto &roadElement : roads)
+            roadElement.second.saveState(*out);
+    }
+    return true;
+}
+
+unsigned Rank::getRank() const
+{
+    return rank;
+}
+
+unsigned Rank::getRanksNo() const
+{
+    return addresses.size();
+}
+
+double Rank::getRunTime() const
+{
+    return runTime;
+}
+
+size_t Rank::getRoadsNo() const
+{
+    return boundaryRoads.size() + interiorRoads.size();
+}
+
+unsigned Rank::getVehiclesNo() const
+{
+    unsigned vehiclesNo = 0;
+    for (const Road *road : boundaryRoads)
+        vehiclesNo += road->getVehiclesNo();
+    for (const Road *road : interiorRoads)
+        vehiclesNo += road->getVehiclesNo();
+    return vehiclesNo;
+}
+
+size_t Rank::getBoundaryRoadsNo() const
+{
+    return boundaryRoads.size();
+}
+
+unsigned Rank::getNeighboursNo() const
+{
+    unsigned neighboursNo = 0;
+    for (const Peer &peer : peers)
+        neighboursNo += peer.neighbour;
+    return neighboursNo;
+}
+
+const Rank::Stats& Rank::getStats() const
+{
+    return stats;
+}
+
+const Rank::CityMap& Rank::getNetwork() const
+{
+    return network;
+}
+
+} // namespace simulator
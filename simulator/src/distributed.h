@@ -0,0 +1,164 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "road.h"
+#include "defs.h"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace simulator
+{
+
+/* Rank
+ * One process of a distributed simulation: the road network is split over processes - ranks - on one host or
+ * several, for regions that don't fit one process. Vehicles drive on from road to road (Simulator::setTransfers).
+ *
+ *  - every rank keeps the layout of the whole network: its own roads with their vehicles, the others empty
+ *    (Road::clearVehicles). Vehicles pick their next road from the layout, so they're routed like in one process
+ *  - parts: partitionRoads, by lane length at load - the same on every rank, whatever vehicles it was given -
+ *    then by measured cost when the ranks rebalance
+ *  - a step runs in lockstep with the ranks that share a connection with this one (neighbours):
+ *      1. the boundary roads - leading to a road of another rank - are updated first. The vehicles that left
+ *         them for another rank are sent off at once, as far as the sockets take them without waiting
+ *      2. the interior roads are updated while the messages travel
+ *      3. a message from every neighbour is read - an empty one if nothing crossed - and the vehicles that
+ *         stayed and that came in enter their roads (enterTransfers), in the same order as in one process
+ *      4. the ones that didn't fit go back to the rank they came from, again a message to every neighbour, and
+ *         stop where they left (holdTransfers)
+ *    so a distributed run ends in the state Simulator reaches with transfers, bit for bit
+ *  - rebalance: every few steps the ranks swap the measured cost of their roads. If the heaviest rank is too far
+ *    above the average, all of them cut the same new parts, and roads move to their new rank with their vehicles
+ *    and lights (Road::saveState). A new part goes to the rank that holds most of its cost already
+ *
+ * Traffic lights belong to their road, and no vehicle reads the lights of another road: only vehicles cross.
+ *
+ * Ranks talk over a full mesh of stream sockets, one address per rank: "unix:/path" or "host:port" (TCP).
+ * Rank r listens on its own address, connects to the ranks before it and accepts the ranks after it.
+ * See bench/distributed.cpp for all ranks on localhost.
+ */
+class Rank
+{
+public:
+    typedef std::map<roadID, Road> CityMap;
+
+    // since the rank was loaded
+    struct Stats
+    {
+        uint64_t steps = { 0 };
+        uint64_t vehiclesSent = { 0 };
+        uint64_t vehiclesReceived = { 0 };
+        uint64_t bytesSent = { 0 };
+        uint64_t bytesReceived = { 0 };
+        uint64_t rebalances = { 0 };        // new parts cut
+        uint64_t roadsMoved = { 0 };        // to other ranks
+        double computeSeconds = { 0.0 };    // updating roads and entering vehicles
+        double waitSeconds = { 0.0 };       // waiting for the neighbours once the own roads were done
+    };
+
+private:
+    enum Kind { transfers_message, returns_message, costs_message, roads_message, state_message };
+
+    struct Peer
+    {
+        int socket = { -1 };
+        bool neighbour = { false };
+        std::string out;            // framed messages not written yet
+        size_t written = { 0 };     // of out
+        std::string in;             // bytes read, up to the end of a message or more
+    };
+
+    unsigned rank;
+    std::vector<std::string> addresses;
+    std::vector<Peer> peers;        // by rank, this one's unused
+    int listener = { -1 };
+    std::string unixPath;           // to remove when the rank goes
+
+    CityMap network;
+    std::map<roadID, unsigned> owners;
+    std::vector<Road *> boundaryRoads;
+    std::vector<Road *> interiorRoads;
+    std::vector<Road::Transfer> transfers;
+
+    double runTime = { 0 };
+    uint64_t seed = { 0 };          // of the route draws, like Simulator::setSeed
+    uint64_t step = { 0 };
+    unsigned rebalanceSteps = { 0 };
+    double rebalanceTolerance = { 0.1 };
+    Stats stats;
+
+    // who owns what: boundary and interior roads, neighbours
+    void assign(const std::map<roadID, unsigned> &newOwners);
+
+    void updateRoad(Road &road, double dt);
+
+    // queues a message for a peer. Nothing is written yet
+    void post(unsigned peer, Kind kind, const std::string &payload);
+
+    // writes what the sockets take without blocking
+    bool sendPending();
+
+    /* writes everything queued, and reads until a message of kind came in from every rank in from - their payloads
+     * go to received, by rank. False if a peer closed, sent something else or stayed silent too long */
+    bool complete(Kind kind, const std::vector<bool> &from, std::vector<std::string> &received);
+
+    /* posts the transfers bound for a neighbour - by the rank of the road they go to, or back: of the road they came
+     * from - as a message of kind to every neighbour, empty if none. The rest stays in transfers */
+    bool postTransfers(Kind kind, bool back);
+
+    // appends the vehicles the neighbours sent to transfers. False if a message is corrupted
+    bool readTransfers(const std::vector<std::string> &received);
+
+    // all ranks: every rank gets everybody's payload
+    bool allExchange(Kind kind, const std::string &payload, std::vector<std::string> &received);
+
+    bool rebalance();
+
+public:
+    /* addresses: of every rank, this one's included. Nothing is opened before connect */
+    Rank(unsigned rank, const std::vector<std::string> &addresses);
+    ~Rank();
+
+    Rank(const Rank &) = delete;
+    Rank &operator=(const Rank &) = delete;
+
+    // sets up the mesh - every rank calls it. False, with an error, if a rank isn't there within timeoutSeconds
+    bool connect(double timeoutSeconds = 30.0);
+
+    /* the whole network, on every rank: the same roads, in any order. Vehicles are kept on this rank's roads only,
+     * so the roads of other ranks may come without them. roads is left empty */
+    bool load(std::vector<Road> &&roads);
+
+    // advance this rank's roads by dt - every rank calls it, with the same dt. False if the mesh broke
+    bool update(double dt);
+
+    /* every steps steps, cut new parts by measured cost if the heaviest rank costs more than (1 + tolerance) times
+     * the average. 0 - never. Every rank must set the same */
+    void setRebalance(unsigned steps, double tolerance = 0.1);
+
+    // seed of the route draws (Simulator::setSeed) - every rank must set the same, before the first update
+    void setSeed(uint64_t newSeed);
+
+    /* the state of the whole network in the Simulator::saveState format, written to out by rank 0 - every rank
+     * calls it, out is only used on rank 0 */
+    bool gatherState(std::ostream *out);
+
+    unsigned getRank() const;
+    unsigned getRanksNo() const;
+    double getRunTime() const;
+    size_t getRoadsNo() const;          // owned
+    unsigned getVehiclesNo() const;     // on the own roads
+    size_t getBoundaryRoadsNo() const;
+    unsigned getNeighboursNo() const;
+    const Stats& getStats() const;
+
+    // the whole network: this rank's roads with their vehicles, the others empty
+    const CityMap& getNetwork() const;
+};
+
+} // namespace simulator
+
+#endif // DISTRIBUTED_H
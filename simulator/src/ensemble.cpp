@@ -0,0 +1,186 @@
+#include "ensemble.h"
+#include "simulator.h"
+#include "logger.h"
+
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace simulator
+{
+
+const double Ensemble::stoppedSpeed = 1.0;
+
+void OnlineStat::add(double x)
+{
+    ++n;
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+}
+
+unsigned long OnlineStat::count() const
+{
+    return n;
+}
+
+double OnlineStat::getMean() const
+{
+    return mean;
+}
+
+double OnlineStat::variance() const
+{
+    return n > 1 ? m2 / (n - 1) : 0.0;
+}
+
+/* two sided 95% quantiles of Student's t distribution, for 1 to 30 degrees of freedom */
+static double tQuantile95(unsigned long df)
+{
+    static const double t95[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df == 0)
+        return HUGE_VAL;
+    return df <= 30 ? t95[df - 1] : 1.96;
+}
+
+double OnlineStat::halfWidth() const
+{
+    if (n < 2)
+        return HUGE_VAL;
+    return tQuantile95(n - 1) * std::sqrt(variance() / n);
+}
+
+static bool isTight(const OnlineStat &stat, double relativeHalfWidth)
+{
+    return stat.halfWidth() <= relativeHalfWidth * std::fabs(stat.getMean());
+}
+
+void EnsembleResult::print() const
+{
+    log_info("Ensemble: %u replications, %u diverged (%s)\n"
+             "\t mean speed:    %.3f +/- %.3f m/s\n"
+             "\t stopped share: %.4f +/- %.4f\n"
+             "\t vehicle km:    %.3f +/- %.3f km\n",
+             replications, diverged, converged ? "converged" : "not converged",
+             meanSpeed.getMean(), meanSpeed.halfWidth(),
+             stoppedShare.getMean(), stoppedShare.halfWidth(),
+             vehicleKm.getMean(), vehicleKm.halfWidth());
+}
+
+Ensemble::Ensemble(const std::vector<Road> &roadNet, Populate populateFn) :
+    network(roadNet), populate(populateFn)
+{
+}
+
+ReplicationKPI Ensemble::runReplication(unsigned index, const EnsembleConfig &config) const
+{
+    // independent stream per replication
+    CounterRng rng = CounterRng::forStream(config.seed, index);
+
+    std::vector<Road> roadNet = network;
+    populate(roadNet, rng);
+
+    // Vehicle ids come from a counter the workers share: numbered again, they are the same on any thread count
+    int nextId = 0;
+    for (Road &road : roadNet)
+        nextId = road.numberVehicles(nextId);
+
+    Simulator simulator;
+    simulator.setSeed(CounterRng::streamSeed(config.seed, index));
+    simulator.addRoadNetToMap(std::move(roadNet));
+
+    double speedSum = 0;
+    double distance = 0;
+    unsigned long vehicleSteps = 0;
+    unsigned long stoppedSteps = 0;
+
+    for (int step = 0; step < config.steps; ++step) {
+        simulator.update(config.dt);
+
+        for (auto &roadElement : simulator.cityMap)
+            for (auto &lane : roadElement.second.getVehicles())
+                for (auto &vehicle : lane) {
+                    if (!vehicle.isVehicle())
+                        continue;
+                    speedSum += vehicle.getVelocity();
+                    distance += vehicle.getVelocity() * config.dt;
+                    stoppedSteps += vehicle.getVelocity() < stoppedSpeed ? 1 : 0;
+                    ++vehicleSteps;
+                }
+    }
+
+    ReplicationKPI kpi;
+    if (vehicleSteps > 0) {
+        kpi.meanSpeed = speedSum / vehicleSteps;
+        kpi.stoppedShare = (double)stoppedSteps / vehicleSteps;
+    }
+    kpi.vehicleKm = distance / 1000.0;
+    return kpi;
+}
+
+EnsembleResult Ensemble::run(const EnsembleConfig &config) const
+{
+    EnsembleResult result;
+
+    unsigned threadsNo = config.threads ? config.threads : std::thread::hardware_concurrency();
+    if (threadsNo == 0)
+        threadsNo = 1;
+
+    std::atomic<unsigned> nextReplication(0);
+    std::atomic<bool> stop(false);
+
+    // finished replications waiting for the ones before them
+    std::mutex resultLock;
+    std::map<unsigned, ReplicationKPI> pending;
+
+    auto worker = [&]() {
+        while (!stop) {
+            unsigned index = nextReplication++;
+            if (index >= config.maxReplications)
+                return;
+
+            ReplicationKPI kpi = runReplication(index, config);
+
+            std::lock_guard<std::mutex> guard(resultLock);
+            pending[index] = kpi;
+
+            // aggregate in replication order so the stopping point doesn't depend on scheduling
+            while (!stop && !pending.empty() && pending.begin()->first == result.replications) {
+                const ReplicationKPI &next = pending.begin()->second;
+                if (std::isfinite(next.meanSpeed) && std::isfinite(next.vehicleKm)) {
+                    result.meanSpeed.add(next.meanSpeed);
+                    result.stoppedShare.add(next.stoppedShare);
+                    result.vehicleKm.add(next.vehicleKm);
+                } else {
+                    log_warning("Ensemble: replication %u diverged", result.replications);
+                    ++result.diverged;
+                }
+                pending.erase(pending.begin());
+                ++result.replications;
+
+                if (result.meanSpeed.count() >= config.minReplications &&
+                        isTight(result.meanSpeed, config.relativeHalfWidth) &&
+                        isTight(result.stoppedShare, config.relativeHalfWidth) &&
+                        isTight(result.vehicleKm, config.relativeHalfWidth)) {
+                    result.converged = true;
+                    stop = true;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threadsNo; ++i)
+        workers.emplace_back(worker);
+    for (std::thread &w : workers)
+        w.join();
+
+    return result;
+}
+
+} // namespace simulator
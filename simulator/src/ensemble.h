@@ -0,0 +1,101 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "road.h"
+#include "config.h"
+#include "rng.h"
+
+#include <functional>
+#include <vector>
+
+namespace simulator
+{
+
+/* Running mean/variance (Welford), so replications can be aggregated as they finish */
+class OnlineStat
+{
+    unsigned long n = { 0 };
+    double mean = { 0.0 };
+    double m2 = { 0.0 };
+
+public:
+    void add(double x);
+
+    unsigned long count() const;
+    double getMean() const;
+    double variance() const;
+
+    // half width of the 95% confidence interval of the mean (Student t)
+    double halfWidth() const;
+};
+
+/* KPIs collected for one replication */
+struct ReplicationKPI
+{
+    double meanSpeed = { 0.0 };     // m/s, averaged over all vehicle-steps
+    double stoppedShare = { 0.0 };  // share of vehicle-steps below stoppedSpeed
+    double vehicleKm = { 0.0 };     // total distance driven by all vehicles
+};
+
+struct EnsembleConfig
+{
+    unsigned minReplications = { 5 };
+    unsigned maxReplications = { 100 };
+    unsigned threads = { 0 };           // 0 - one per hardware thread
+
+    int steps = { Config::simulationTime };
+    double dt = { Config::DT };
+
+    // stop once the 95% interval of every KPI is within +/- relativeHalfWidth of its mean
+    double relativeHalfWidth = { 0.05 };
+
+    unsigned long seed = { 0 };
+};
+
+struct EnsembleResult
+{
+    unsigned replications = { 0 };
+    unsigned diverged = { 0 };      // replications whose state blew up (non finite KPIs) - not aggregated
+    bool converged = { false };
+
+    OnlineStat meanSpeed;
+    OnlineStat stoppedShare;
+    OnlineStat vehicleKm;
+
+    void print() const;
+};
+
+/* Ensemble
+ * Runs stochastic replications of a scenario concurrently and reports confidence intervals of their KPIs.
+ *
+ * All replications share the same read-only network (roads without vehicles). A replication copies it,
+ * adds its own population through the populate callback and is dropped as soon as its KPIs are collected,
+ * so memory scales with the number of threads, not with the number of replications.
+ *
+ * Replication i draws from its own counter based stream, CounterRng::forStream(seed, i) - its routes too
+ * (Simulator::setSeed) - its vehicles are numbered from 0 after populate (Road::numberVehicles), and results are
+ * aggregated in replication order: the result and the stopping point don't depend on the number of threads.
+ */
+class Ensemble
+{
+public:
+    typedef std::function<void(std::vector<Road> &roadNet, const CounterRng &rng)> Populate;
+
+    // vehicle-steps slower than this count as stopped
+    static const double stoppedSpeed; // 1 m/s
+
+private:
+    const std::vector<Road> &network;
+    Populate populate;
+
+    ReplicationKPI runReplication(unsigned index, const EnsembleConfig &config) const;
+
+public:
+    Ensemble(const std::vector<Road> &roadNet, Populate populateFn);
+
+    EnsembleResult run(const EnsembleConfig &config) const;
+};
+
+} // namespace simulator
+
+#endif // ENSEMBLE_H
@@ -0,0 +1,122 @@
+#include "fork.h"
+#include "logger.h"
+
+namespace simulator
+{
+
+ForkGroup::Branch::Branch(ForkGroup *owner) :
+    group(owner)
+{
+}
+
+Road &ForkGroup::Branch::road(roadID id)
+{
+    auto it = privateRoads.find(id);
+    if (it != privateRoads.end())
+        return it->second;
+
+    // first write to this road - this branch gets its own copy
+    return privateRoads.emplace(id, group->sharedRoad(id)).first->second;
+}
+
+const Road &ForkGroup::Branch::getRoad(roadID id) const
+{
+    auto it = privateRoads.find(id);
+    if (it != privateRoads.end())
+        return it->second;
+
+    return group->sharedRoad(id);
+}
+
+bool ForkGroup::Branch::isPrivate(roadID id) const
+{
+    return privateRoads.count(id) != 0;
+}
+
+size_t ForkGroup::Branch::privateRoadsNo() const
+{
+    return privateRoads.size();
+}
+
+void ForkGroup::Branch::advance(unsigned steps, double dt)
+{
+    for (unsigned step = 0; step < steps; ++step)
+        for (auto &roadElement : privateRoads)
+            roadElement.second.update(dt, privateRoads);
+}
+
+ForkGroup::ForkGroup(const CityMap &live, unsigned branchesNo) :
+    origin(live)
+{
+    branches.reserve(branchesNo);
+    for (unsigned i = 0; i < branchesNo; ++i)
+        branches.push_back(Branch(this));
+}
+
+ForkGroup::Branch &ForkGroup::branch(unsigned index)
+{
+    return branches[index];
+}
+
+unsigned ForkGroup::getBranchesNo() const
+{
+    return branches.size();
+}
+
+const Road &ForkGroup::sharedRoad(roadID id) const
+{
+    return trunkCopied ? trunk.at(id) : origin.at(id);
+}
+
+/* A road that every branch owns privately is never read from the trunk again. Don't copy or step it. */
+void ForkGroup::copyTrunk()
+{
+    for (auto &roadElement : origin) {
+        bool shared = false;
+        for (const Branch &b : branches)
+            shared = shared || !b.isPrivate(roadElement.first);
+
+        if (shared)
+            trunk.emplace_hint(trunk.end(), roadElement);
+    }
+    trunkCopied = true;
+}
+
+void ForkGroup::advanceTrunk(unsigned steps, double dt)
+{
+    for (unsigned step = 0; step < steps; ++step)
+        for (auto &roadElement : trunk)
+            roadElement.second.update(dt, trunk);
+}
+
+void ForkGroup::advance(unsigned steps, double dt)
+{
+    if (branches.empty())
+        return;
+
+    if (!trunkCopied) {
+        copyTrunk();
+    } else {
+        // drop trunk roads privatized by all branches since the last advance
+        for (auto it = trunk.begin(); it != trunk.end(); ) {
+            bool shared = false;
+            for (const Branch &b : branches)
+                shared = shared || !b.isPrivate(it->first);
+            it = shared ? std::next(it) : trunk.erase(it);
+        }
+    }
+
+    log_debug("Fork: advancing %u branches for %u steps. Shared roads: %lu", getBranchesNo(), steps, trunk.size());
+
+    if (!workers)
+        workers.reset(new WorkerPool(branches.size() + 1));
+
+    workers->run([this, steps, dt](unsigned worker) {
+        if (worker == 0)
+            advanceTrunk(steps, dt);
+        else
+            branches[worker - 1].advance(steps, dt);
+    });
+}
+
+} // namespace simulator
@@ -0,0 +1,102 @@
+#ifndef FORK_H
+#define FORK_H
+
+#include "road.h"
+#include "workerpool.h"
+#include "defs.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace simulator
+{
+
+/* ForkGroup
+ * Forks the current state of a simulation into several what-if branches
+ * ("what if we close this lane now?") that are stepped in parallel.
+ *
+ * Roads are copy-on-write at road granularity:
+ *      - forking copies nothing. The group only keeps a reference to the live map.
+ *      - roads nobody modified live once, in the group's trunk, and are stepped once for all branches.
+ *      - a branch gets its own copy of a road the first time it asks for it writable (Branch::road).
+ *
+ * This is exact because branches step their roads without transfers (Simulator::setTransfers): roads don't
+ * exchange vehicles, so a road that no branch touched evolves the same way in every branch. With transfers a
+ * modified road would change the roads downstream of it, step after step - Simulator::fork refuses to fork a
+ * simulator that has them on rather than hand out branches that quietly run a different model.
+ *
+ * The live map must not change while the group is alive - the trunk copies it on the first advance().
+ */
+class ForkGroup
+{
+public:
+    typedef std::map<roadID, Road> CityMap;
+
+    class Branch
+    {
+        friend class ForkGroup;
+
+        ForkGroup *group;
+
+        // roads this branch modified - private copies
+        CityMap privateRoads;
+
+        Branch(ForkGroup *owner);
+
+        void advance(unsigned steps, double dt);
+
+    public:
+        // writable access to a road - copies it from the trunk on first use
+        Road &road(roadID id);
+
+        // read-only view: private copy if the branch has one, shared trunk road otherwise
+        const Road &getRoad(roadID id) const;
+
+        bool isPrivate(roadID id) const;
+        size_t privateRoadsNo() const;
+    };
+
+private:
+    // the live simulation state at fork time
+    const CityMap &origin;
+
+    // shared roads, copied from origin on the first advance()
+    CityMap trunk;
+    bool trunkCopied = { false };
+
+    std::vector<Branch> branches;
+
+    // the trunk on worker 0 - the caller - and branch i on worker i + 1. Started on the first advance()
+    std::unique_ptr<WorkerPool> workers;
+
+    // the current trunk (or origin, before the first advance) state of a road
+    const Road &sharedRoad(roadID id) const;
+
+    // copy the roads that are still shared by at least one branch into the trunk
+    void copyTrunk();
+
+    void advanceTrunk(unsigned steps, double dt);
+
+public:
+    ForkGroup(const CityMap &live, unsigned branchesNo);
+
+    ForkGroup(const ForkGroup &) = delete;
+    ForkGroup &operator=(const ForkGroup &) = delete;
+
+    Branch &branch(unsigned index);
+    unsigned getBranchesNo() const;
+
+    /**
+     * @brief advance - run all branches for a number of steps.
+     *                  The trunk and every branch run on their own worker; they don't share any mutable road.
+     *                  A group without branches has nothing to run.
+     * @param steps   - number of steps to run
+     * @param dt      - update time
+     */
+    void advance(unsigned steps, double dt);
+};
+
+} // namespace simulator
+
+#endif // FORK_H
@@ -0,0 +1,47 @@
+#include "lanechange.h"
+
+#include <algorithm>
+
+namespace simulator
+{
+
+LaneChangePolicy exhaustiveLaneChanges()
+{
+    return LaneChangePolicy();
+}
+
+LaneChangePolicy throttledLaneChanges()
+{
+    LaneChangePolicy policy;
+    policy.pruneDistance = 50.0;
+    policy.cooldownSteps = 6;
+    policy.stagger = 2;
+    return policy;
+}
+
+bool parseLaneChangePolicy(const std::string &name, LaneChangePolicy &policy)
+{
+    if (name == "exhaustive")
+        policy = exhaustiveLaneChanges();
+    else if (name == "throttled")
+        policy = throttledLaneChanges();
+    else
+        return false;
+    return true;
+}
+
+size_t resolveLaneChanges(std::vector<LaneChangeIntent> &intents)
+{
+    // by gap, the winner first - a total order: ids are unique
+    std::sort(intents.begin(), intents.end(), [](const LaneChangeIntent &lhs, const LaneChangeIntent &rhs)
+    { return lhs.toLane != rhs.toLane ? lhs.toLane < rhs.toLane :
+             lhs.newLeaderPos != rhs.newLeaderPos ? lhs.newLeaderPos < rhs.newLeaderPos :
+             lhs.xPos != rhs.xPos ? lhs.xPos > rhs.xPos : lhs.vehicleId < rhs.vehicleId; });
+
+    size_t size = intents.size();
+    intents.erase(std::unique(intents.begin(), intents.end(), [](const LaneChangeIntent &lhs, const LaneChangeIntent &rhs)
+    { return lhs.toLane == rhs.toLane && lhs.newLeaderPos == rhs.newLeaderPos; }), intents.end());
+    return size - intents.size();
+}
+
+} // namespace simulator
@@ -0,0 +1,88 @@
+#ifndef LANECHANGE_H
+#define LANECHANGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace simulator
+{
+
+/* Which vehicles consider a lane change in a step (Road::performLaneChange, Config::laneChangePolicy).
+ * MOBIL (Vehicle::canChangeLane) is up to four IDM evaluations per target lane, for every vehicle behind the
+ * first of its lane - on multi-lane roads more than the car following itself.
+ *
+ *  pruneDistance - not with the leader more than this many meters ahead: it hardly slows the vehicle down.
+ *                  0 - at any distance
+ *  cooldownSteps - not within this many steps of the vehicle's last lane change, or of its creation
+ *  stagger       - a vehicle considers a change every stagger steps only, vehicles spread over them by id
+ *  prefilter     - a target lane is dropped before the new follower is evaluated when the change wouldn't pay
+ *                  even with the follower at its best (Vehicle::mayWantLane). Exact: it never drops a change
+ *                  MOBIL makes
+ *  simultaneous  - every lane decides its changes against the road as it was at the start of the step, and
+ *                  they're all made at once before any vehicle moves (resolveLaneChanges). Lanes don't see each
+ *                  other's changes during the step, so the lanes of a road can be worked on by several threads
+ *                  (Road::prepareLane) with the result of one. Off: lane by lane, a vehicle changing onto a lane
+ *                  not updated yet moves with it
+ *  batched       - MOBIL for all the followers of a lane at once, in vector registers (mobil.h,
+ *                  Road::updateFollowers). Exact as well. The prefilter is for one vehicle at a time: batches
+ *                  leave it out
+ *
+ * The first four change the traffic, and the reference engine follows them. The last two only change how fast
+ * the decisions are made. The default considers every vehicle every step, lane by lane.
+ */
+struct LaneChangePolicy
+{
+    double pruneDistance = { 0.0 };
+    unsigned cooldownSteps = { 0 };
+    unsigned stagger = { 1 };
+    bool prefilter = { true };
+    bool simultaneous = { false };
+    bool batched = { true };
+};
+
+// every vehicle, every step - the default
+LaneChangePolicy exhaustiveLaneChanges();
+
+// the leader within 50 m, 6 steps between changes, every other step
+LaneChangePolicy throttledLaneChanges();
+
+// exhaustive or throttled. False for any other name
+bool parseLaneChangePolicy(const std::string &name, LaneChangePolicy &policy);
+
+/* does a vehicle consider a lane change. stepsSinceChange: Vehicle::getStepsSinceLaneChange.
+ * leaderDistance: from the vehicle to its leader on its lane */
+inline bool considersLaneChange(const LaneChangePolicy &policy, uint32_t stepsSinceChange, int vehicleId,
+                                double leaderDistance)
+{
+    if (stepsSinceChange < policy.cooldownSteps)
+        return false;
+    if (policy.stagger > 1 && (stepsSinceChange + (uint32_t)vehicleId) % policy.stagger != 0)
+        return false;
+    return policy.pruneDistance <= 0 || leaderDistance <= policy.pruneDistance;
+}
+
+/* a lane change a vehicle decided on, not made yet (LaneChangePolicy::simultaneous). Lanes and indices as the
+ * road was when the changes were decided */
+struct LaneChangeIntent
+{
+    unsigned fromLane;
+    unsigned index;         // of the vehicle on fromLane
+    unsigned toLane;
+    int newLeaderPos;       // on toLane: the vehicle goes in right behind it. -1 - in front of the lane
+    double xPos;            // of the vehicle
+    int vehicleId;
+};
+
+/* the conflict stage of simultaneous lane changes. Two changes into the same gap - onto the same lane behind the
+ * same new leader, from either side or one behind the other - conflict: each checked the gap without the other.
+ * The vehicle further ahead changes, on a tie the lower id, and the other stays on its lane. The order the
+ * changes were decided in doesn't matter.
+ * intents: all the changes of a road. What's left are the changes to make, by target lane and gap.
+ * Returns how many were dropped */
+size_t resolveLaneChanges(std::vector<LaneChangeIntent> &intents);
+
+} // namespace simulator
+
+#endif // LANECHANGE_H
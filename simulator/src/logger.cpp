@@ -1,14 +1,191 @@
 #include "logger.h"
+#include "trace.h"
 
-#include <cstdio>
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/* Owns the rings of all threads and the background thread that formats their entries */
+class LogWriter
+{
+    std::mutex lock;
+    std::vector<std::unique_ptr<LogRing>> rings;
+    std::vector<LogRing *> freeRings;   // rings of exited threads, drained and ready for reuse
+
+    std::atomic<bool> stop = { false };
+    std::thread thread;
+
+    /* pending entries of one drain pass, formatted in timestamp order across threads - in the order collected
+     * when the timestamps are equal. Sized when a ring registers (acquire): a drain pass never allocates, the
+     * logger thread stays off the allocator the simulation threads use */
+    struct Pending
+    {
+        uint64_t timestamp;
+        size_t order;
+        const LogEntry *entry;
+    };
+    std::vector<Pending> pending;
+    std::vector<uint64_t> tails;  // tail of each ring at the start of the drain pass
+
+    void run()
+    {
+        simulator::Trace::setThreadName("logger");
+        while (!stop) {
+            if (!drain())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    static void write(const LogEntry &entry)
+    {
+        static const char *levelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+        int level = entry.site->level;
+        FILE *out = level == LOG_LEVEL_ERROR ? stderr : stdout;
+
+        const char *file = strrchr(entry.site->file, '/');
+        file = file ? file + 1 : entry.site->file;
+
+        time_t seconds = entry.timestamp / 1000000000ULL;
+        unsigned millis = (entry.timestamp / 1000000ULL) % 1000;
+        struct tm local;
+        localtime_r(&seconds, &local);
+        char timeStr[16];
+        strftime(timeStr, sizeof(timeStr), "%H:%M:%S", &local);
+
+        fprintf(out, "%s: %s.%03u %s:%d: ", levelNames[level], timeStr, millis, file, entry.site->line);
+        entry.format(out, entry);
+        fputc('\n', out);
+    }
+
+public:
+    LogWriter()
+    {
+        thread = std::thread(&LogWriter::run, this);
+    }
+
+    ~LogWriter()
+    {
+        stop = true;
+        thread.join();
+        drain();
+    }
+
+    LogRing *acquire()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!freeRings.empty()) {
+            LogRing *ring = freeRings.back();
+            freeRings.pop_back();
+            ring->orphaned = false;
+            return ring;
+        }
+        rings.push_back(std::unique_ptr<LogRing>(new LogRing()));
+        pending.reserve(rings.size() * LogRing::capacity);
+        tails.reserve(rings.size());
+        freeRings.reserve(rings.size());
+        return rings.back().get();
+    }
+
+    // format everything logged so far. Returns false if there was nothing to do
+    bool drain()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        pending.clear();
+        tails.resize(rings.size());
+        for (size_t i = 0; i < rings.size(); ++i) {
+            LogRing *ring = rings[i].get();
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped)
+                fprintf(stderr, "WARNING: logger ring full - %lu messages dropped\n", (unsigned long)dropped);
+
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            tails[i] = tail;
+            for (; head != tail; ++head) {
+                const LogEntry &entry = ring->slots[head & (LogRing::capacity - 1)];
+                pending.push_back(Pending{ entry.timestamp, pending.size(), &entry });
+            }
+        }
+
+        if (!pending.empty()) {
+            TRACE_SCOPE("log_io");
+
+            // not stable_sort - it takes a temporary buffer from the heap
+            std::sort(pending.begin(), pending.end(), [](const Pending &lhs, const Pending &rhs) {
+                return lhs.timestamp != rhs.timestamp ? lhs.timestamp < rhs.timestamp : lhs.order < rhs.order;
+            });
+            for (const Pending &p : pending)
+                write(*p.entry);
+
+            fflush(stdout);
+            fflush(stderr);
+        }
+
+        // hand the slots back to the producers
+        for (size_t i = 0; i < rings.size(); ++i) {
+            LogRing *ring = rings[i].get();
+            ring->head.store(tails[i], std::memory_order_release);
+
+            bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+            if (orphaned && tails[i] == ring->tail.load(std::memory_order_acquire) &&
+                    std::find(freeRings.begin(), freeRings.end(), ring) == freeRings.end())
+                freeRings.push_back(ring);
+        }
+
+        return !pending.empty();
+    }
+};
+
+LogWriter &writer()
+{
+    static LogWriter logWriter;
+    return logWriter;
+}
+
+/* marks the ring of a thread as free when the thread exits */
+struct RingOwner
+{
+    LogRing *ring = { nullptr };
+
+    ~RingOwner()
+    {
+        if (ring)
+            ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+thread_local RingOwner ringOwner;
+
+} // namespace
 
 Logger::Logger()
 {
+}
 
+LogRing *Logger::threadRing()
+{
+    if (!ringOwner.ring)
+        ringOwner.ring = writer().acquire();
+    return ringOwner.ring;
+}
+
+uint64_t Logger::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-void Logger::LogMessage(std::string &&message, std::string fName, int line, std::string date, std::string time)
+void Logger::flush()
 {
-    fprintf(stderr, "%s %s %s:%d - %s\n", date.c_str(), time.c_str(), fName.c_str(), line, message.c_str());
+    writer().drain();
 }
@@ -1,64 +1,145 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-#include <string>
-#include <cstring>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
+#include <new>
+#include <tuple>
+#include <type_traits>
 
 #pragma GCC system_header
 
-#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-#define DEBUG_INFO 1
-#define DEBUG_ERROR 1
-#define DEBUG_WARNING 1
-#define DEBUG_DBG 1
-#define DEBUG_MESSAGE
+/* Log levels. Anything below LOG_LEVEL compiles to nothing (arguments are not even evaluated).
+ * Set it from the build: cmake -DSIMULATOR_LOG_LEVEL=DEBUG */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
 
-// with date, time, file:line
-#define log_info(fmt, ...) \
-    do { \
-            if ( DEBUG_INFO) { \
-                fprintf( stdout, "INFO: %s %s %s:%d: " fmt "\n", __DATE__, __TIME__, __FILENAME__, __LINE__, ##__VA_ARGS__ ); \
-            } \
-       } while(0)
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
 
-// with date, time, file:line
-#define log_error(fmt, ...) \
+/* Every log call site gets a static LogSite (level, format, file:line) - the format id.
+ * The call itself only copies the site pointer, a timestamp and the raw arguments into a per thread ring buffer;
+ * a background thread does the printf formatting.
+ * Arguments are copied as they are: strings (const char *) must outlive the call - use literals.
+ * The "if (false) fprintf" keeps the compiler's format checks and costs nothing. */
+#define LOG_ENTRY(level, fmt, ...) \
     do { \
-            if ( DEBUG_ERROR) { \
-                fprintf( stderr, "ERROR: %s %s %s:%d: " fmt "\n", __DATE__, __TIME__, __FILENAME__, __LINE__, ##__VA_ARGS__ ); \
-            } \
+            static constexpr LogSite logSite_ = { level, fmt, __FILE__, __LINE__ }; \
+            if (false) { fprintf( stdout, fmt, ##__VA_ARGS__ ); } \
+            Logger::log( logSite_, ##__VA_ARGS__ ); \
        } while(0)
 
-#define log_warning(fmt, ...) \
+#define LOG_DISABLED(fmt, ...) \
     do { \
-            if ( DEBUG_WARNING) { \
-                fprintf( stdout, "WARNING: %s %s %s:%d: " fmt "\n", __DATE__, __TIME__, __FILENAME__, __LINE__, ##__VA_ARGS__ ); \
-            } \
+            if (false) { fprintf( stdout, fmt, ##__VA_ARGS__ ); } \
        } while(0)
 
-// with date, time, file:line
-#define log_debug(fmt, ...) \
-    do { \
-            if ( DEBUG_DBG) { \
-                fprintf( stdout, "INFO: %s %s %s:%d: " fmt "\n", __DATE__, __TIME__, __FILENAME__, __LINE__, ##__VA_ARGS__ ); \
-            } \
-       } while(0)
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define log_info(fmt, ...) LOG_ENTRY(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define log_info(fmt, ...) LOG_DISABLED(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define log_error(fmt, ...) LOG_ENTRY(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define log_error(fmt, ...) LOG_DISABLED(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARNING
+#define log_warning(fmt, ...) LOG_ENTRY(LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+#else
+#define log_warning(fmt, ...) LOG_DISABLED(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define log_debug(fmt, ...) LOG_ENTRY(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define log_debug(fmt, ...) LOG_DISABLED(fmt, ##__VA_ARGS__)
+#endif
+
+struct LogSite
+{
+    int level;
+    const char *fmt;
+    const char *file;
+    int line;
+};
+
+/* One binary log record. The arguments live in args as a std::tuple, formatted later by format() */
+struct LogEntry
+{
+    static const unsigned argsSize = 96;
+
+    void (*format)(FILE *out, const LogEntry &entry);
+    const LogSite *site;
+    uint64_t timestamp;     // ns since epoch
+    alignas(8) unsigned char args[argsSize];
+};
 
-//#define log_info(fmt, ...) \
-//    do { \
-//            if ( DEBUG_INFO) { \
-//                fprintf( stderr, fmt "\n", ##__VA_ARGS__ ); \
-//            } \
-//       } while(0)
+/* Single producer (the owning thread) / single consumer (the logger thread) ring of entries */
+struct LogRing
+{
+    static const unsigned capacity = 1024; // power of two
 
+    std::atomic<uint64_t> head = { 0 };     // next entry to format - written by the logger thread
+    std::atomic<uint64_t> tail = { 0 };     // next free slot - written by the owner
+    std::atomic<uint64_t> dropped = { 0 };  // entries lost because the ring was full
+    std::atomic<bool> orphaned = { false }; // the owner thread has exited
+    LogEntry slots[capacity];
+};
 
 class Logger
 {
     Logger();
+
+    static LogRing *threadRing();
+    static uint64_t now();
+
+    template<typename... Args>
+    static void formatEntry(FILE *out, const LogEntry &entry)
+    {
+        const std::tuple<Args...> &args = *reinterpret_cast<const std::tuple<Args...> *>(entry.args);
+        std::apply([out, &entry](const Args&... values) {
+            if constexpr (sizeof...(Args) == 0)
+                fputs(entry.site->fmt, out);
+            else
+                fprintf(out, entry.site->fmt, values...);
+        }, args);
+    }
+
 public:
+    template<typename... Args>
+    static void log(const LogSite &site, Args... args)
+    {
+        static_assert(std::conjunction<std::is_trivially_copyable<Args>...>::value,
+                      "log arguments are copied raw - use scalars, enums and string literals");
+        static_assert(sizeof(std::tuple<Args...>) <= LogEntry::argsSize, "too many log arguments");
+
+        LogRing *ring = threadRing();
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail - ring->head.load(std::memory_order_acquire) >= LogRing::capacity) {
+            // never block the simulation on logging
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        LogEntry &entry = ring->slots[tail & (LogRing::capacity - 1)];
+        entry.format = &formatEntry<Args...>;
+        entry.site = &site;
+        entry.timestamp = now();
+        new (entry.args) std::tuple<Args...>(args...);
+
+        ring->tail.store(tail + 1, std::memory_order_release);
+    }
 
-    static void LogMessage( std::string&& message, std::string fName, int line, std::string date, std::string time);
+    // block until everything logged so far is written
+    static void flush();
 };
 
 #endif // LOGGER_H
@@ -3,6 +3,7 @@
 #include "tests/testintersection.h"
 
 #include <iostream>
+#include <utility>
 
 using namespace simulator;
 
@@ -12,7 +13,7 @@ int main( )
 
     std::vector<Road> roadMap = singleLaneIntersectionTest(); // semaphoreTest();// manyRandomVehicleTestMap(30);//laneChangeTest();
 
-    simulator.addRoadNetToMap( roadMap );
+    simulator.addRoadNetToMap(std::move(roadMap));
 
     simulator.runTestSimulator();
 
@@ -0,0 +1,215 @@
+#include "mobil.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace simulator
+{
+
+namespace
+{
+
+/* Vehicle::getNewAcceleration, operation for operation, behind a leader at nextPos with nextVelocity and
+ * nextLength. freeTerm: the vehicle's (velocity / v0) ^ delta, brake: its 2 * sqrt(a * b).
+ * Every operation runs, whatever the branch the scalar code takes, and the results are selected: branches keep
+ * a loop out of vector registers */
+inline real idm(real xPos, real velocity, real T, real a, real brake, real s0,
+                real freeRoadDistance, real freeTerm, real nextPos, real nextVelocity, real nextLength)
+{
+    real netDistance = nextPos + real(0) - xPos - nextLength;
+    bool freeRoad = (netDistance <= 0) | (netDistance >= freeRoadDistance);
+    real deltaV = velocity - nextVelocity;
+    real approach = velocity * T + (velocity*deltaV)/brake;
+    real sStar = s0 + std::max(real(0), approach);
+    real interaction = sStar/netDistance;
+    real squared = interaction * interaction;
+    return a * (real(1) - freeTerm - (freeRoad ? real(0) : squared));
+}
+
+} // namespace
+
+int MobilBatch::nextLaneLeaderPos(real xPos, const std::vector<Vehicle> &nextLane)
+{
+    if (nextLane.size() == 0)
+        return -1;
+
+    auto nextLeader = std::upper_bound(nextLane.rbegin(), nextLane.rend(), xPos,
+                                       [](real pos, const Vehicle &vehicle) { return pos < vehicle.xPos; });
+    return std::distance(nextLane.begin(), nextLeader.base()) - 1;
+}
+
+bool MobilBatch::hasGap(const Vehicle &vehicle, real xPos, const Vehicle *newLeader, const Vehicle *newFollower)
+{
+    bool hasGap = true;
+    if (newLeader && newLeader->length > 0)
+        hasGap = xPos < newLeader->xPos - newLeader->length - vehicle.s0;
+
+    if (newFollower && newFollower->length > 0)
+        hasGap = hasGap && (xPos - vehicle.length - vehicle.s0 > newFollower->xPos);
+
+    return hasGap;
+}
+
+void MobilBatch::Drivers::resize(size_t n)
+{
+    for (std::vector<real> *field : { &xPos, &velocity, &length, &acceleration, &T, &a, &brake, &s0,
+                                        &freeRoadDistance, &freeTerm })
+        field->resize(n);
+}
+
+void MobilBatch::Drivers::set(size_t i, const Vehicle &v, const Vehicle::Motion &motion)
+{
+    xPos[i] = motion.xPos;
+    velocity[i] = motion.velocity;
+    length[i] = v.length;
+    acceleration[i] = motion.acceleration;
+    T[i] = v.T;
+    a[i] = v.a;
+    brake[i] = 2*std::sqrt(v.a*v.b);
+    s0[i] = v.s0;
+    freeRoadDistance[i] = v.freeRoadDistance;
+    freeTerm[i] = std::pow(motion.velocity/v.v0, v.delta);
+}
+
+void MobilBatch::Drivers::copy(size_t i, size_t from)
+{
+    for (std::vector<real> *field : { &xPos, &velocity, &length, &acceleration, &T, &a, &brake, &s0,
+                                        &freeRoadDistance, &freeTerm })
+        (*field)[i] = (*field)[from];
+}
+
+void MobilBatch::Drivers::setNone(size_t i)
+{
+    for (std::vector<real> *field : { &xPos, &velocity, &length, &acceleration, &T, &a, &brake, &s0,
+                                        &freeRoadDistance, &freeTerm })
+        (*field)[i] = 0.0;
+}
+
+void MobilBatch::Leaders::resize(size_t n)
+{
+    xPos.resize(n);
+    velocity.resize(n);
+    length.resize(n);
+}
+
+void MobilBatch::Leaders::set(size_t i, const Vehicle *v)
+{
+    xPos[i] = v ? v->xPos : 0.0;
+    velocity[i] = v ? v->velocity : 0.0;
+    length[i] = v ? v->length : 0.0;
+}
+
+void MobilBatch::clear()
+{
+    count = 0;
+    lastFollower[left] = lastFollower[right] = nullptr;
+}
+
+void MobilBatch::reserve(size_t n)
+{
+    self.resize(n);
+    politeness.resize(n);
+    bSafe.resize(n);
+    aThr.resize(n);
+    leader.resize(n);
+    for (unsigned t = 0; t < 2; ++t) {
+        newLeader[t].resize(n);
+        newFollower[t].resize(n);
+        considered[t].resize(n);
+        newLeaderPos[t].resize(n);
+        changes[t].resize(n);
+    }
+    accCurrentLeader.resize(n);
+    capacity = n;
+}
+
+bool MobilBatch::add(const Vehicle &vehicle, const Vehicle::Motion &before, const Vehicle &leaderVehicle,
+                     const std::vector<Vehicle> *const targetLanes[2])
+{
+    int pos[2];
+    const Vehicle *leaders[2], *followers[2];
+    bool gap[2];
+    for (unsigned t = 0; t < 2; ++t) {
+        const std::vector<Vehicle> *lane = targetLanes[t];
+        pos[t] = lane ? nextLaneLeaderPos(before.xPos, *lane) : -1;
+        leaders[t] = pos[t] >= 0 ? &(*lane)[pos[t]] : nullptr;
+        followers[t] = lane && (unsigned)(pos[t] + 1) < lane->size() ? &(*lane)[pos[t] + 1] : nullptr;
+        gap[t] = lane && hasGap(vehicle, before.xPos, leaders[t], followers[t]);
+    }
+    if (!gap[left] && !gap[right])
+        return false;
+
+    if (count == capacity)
+        reserve(capacity ? 2 * capacity : 64);
+    const size_t i = count++;
+    self.set(i, vehicle, before);
+    politeness[i] = vehicle.politeness;
+    bSafe[i] = vehicle.bSafe;
+    aThr[i] = vehicle.aThr;
+    leader.set(i, &leaderVehicle);
+
+    for (unsigned t = 0; t < 2; ++t) {
+        const Vehicle *follower = gap[t] ? followers[t] : nullptr;
+        newLeader[t].set(i, gap[t] ? leaders[t] : nullptr);
+        if (!follower)
+            newFollower[t].setNone(i);
+        else if (follower == lastFollower[t])
+            newFollower[t].copy(i, i - 1);
+        else
+            newFollower[t].set(i, *follower, follower->getMotion());
+        lastFollower[t] = follower;
+        considered[t][i] = gap[t] ? 1.0 : 0.0;
+        newLeaderPos[t][i] = pos[t];
+        changes[t][i] = 0.0;
+    }
+    return true;
+}
+
+void MobilBatch::evaluate()
+{
+    const size_t n = count;
+    const real *x = self.xPos.data(), *v = self.velocity.data(), *len = self.length.data();
+    const real *T = self.T.data(), *a = self.a.data(), *brake = self.brake.data(), *s0 = self.s0.data();
+    const real *freeDist = self.freeRoadDistance.data(), *freeTerm = self.freeTerm.data();
+    const real *p = politeness.data(), *safe = bSafe.data(), *thr = aThr.data();
+    const real *lx = leader.xPos.data(), *lv = leader.velocity.data(), *llen = leader.length.data();
+
+    // Vehicle::accelerationBehind the current leader: the same for both targets
+    real *accCl = accCurrentLeader.data();
+    #pragma omp simd
+    for (size_t i = 0; i < n; ++i) {
+        real behind = idm(x[i], v[i], T[i], a[i], brake[i], s0[i], freeDist[i], freeTerm[i], lx[i], lv[i], llen[i]);
+        accCl[i] = llen[i] > 0 ? behind : a[i];
+    }
+
+    for (unsigned t = 0; t < 2; ++t) {
+        const real *nlx = newLeader[t].xPos.data(), *nlv = newLeader[t].velocity.data();
+        const real *nllen = newLeader[t].length.data();
+        const Drivers &f = newFollower[t];
+        const real *fx = f.xPos.data(), *fv = f.velocity.data(), *flen = f.length.data();
+        const real *facc = f.acceleration.data(), *fT = f.T.data(), *fa = f.a.data(), *fBrake = f.brake.data();
+        const real *fs0 = f.s0.data(), *fFreeDist = f.freeRoadDistance.data(), *fFreeTerm = f.freeTerm.data();
+        const real *on = considered[t].data();
+        real *out = changes[t].data();
+
+        #pragma omp simd
+        for (size_t i = 0; i < n; ++i) {
+            // Vehicle::accelerationBehind the new leader
+            real behind = idm(x[i], v[i], T[i], a[i], brake[i], s0[i], freeDist[i], freeTerm[i],
+                                nlx[i], nlv[i], nllen[i]);
+            real accNl = nllen[i] > 0 ? behind : a[i];
+
+            // Vehicle::wantsLane. The follower counts for the incentive from a meter long on, like an unsigned
+            real following = idm(fx[i], fv[i], fT[i], fa[i], fBrake[i], fs0[i], fFreeDist[i], fFreeTerm[i],
+                                   x[i], v[i], len[i]);
+            real followerAcc = flen[i] > 0 ? following : real(0);
+            bool isSafe = !(flen[i] > 0) | (followerAcc > -safe[i]);
+            real incentiveFollowerAcc = flen[i] >= 1 ? followerAcc : real(0);
+            bool wanted = (accNl - accCl[i]) > (p[i] * (facc[i] - incentiveFollowerAcc) + thr[i]);
+
+            out[i] = (on[i] > 0) & isSafe & wanted ? 1.0 : 0.0;
+        }
+    }
+}
+
+} // namespace simulator
@@ -0,0 +1,103 @@
+#ifndef MOBIL_H
+#define MOBIL_H
+
+#include "vehicle.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace simulator
+{
+
+/* MobilBatch
+ * MOBIL (Vehicle::canChangeLane) for all the followers of a lane at once, toward both neighbouring lanes.
+ * The gap check - a few comparisons - is made while gathering: only the vehicles with a gap on a target lane
+ * make it into the batch, most of them in dense traffic don't. Those and their neighbours are gathered into an
+ * array per quantity, and the IDM accelerations and the criteria run over all of them in vector registers
+ * (#pragma omp simd), down to a change mask per target lane.
+ *
+ * It decides bit for bit what canChangeLane does: the same operations in the same order. What is a vehicle's own
+ * in an IDM acceleration - the free road power and the braking square root - is taken while gathering, with
+ * std::pow and std::sqrt like Vehicle::getNewAcceleration. The lane change parameters come from each vehicle's
+ * driver profile.
+ *
+ * Road::updateFollowers gathers the followers of a lane once they moved, from their motion before, and
+ * evaluates. Buffers are kept between batches: in a steady state nothing is allocated.
+ */
+class MobilBatch
+{
+public:
+    enum Target { left, right };
+
+private:
+    // a vehicle as MOBIL sees it: the one changing lane, or a new follower
+    struct Drivers
+    {
+        std::vector<real> xPos, velocity, length, acceleration;
+        std::vector<real> T, a, s0, freeRoadDistance;
+        std::vector<real> brake;        // 2 * sqrt(a * b)
+        std::vector<real> freeTerm;     // (velocity / v0) ^ delta
+
+        void resize(size_t n);
+        // v with motion in place of its own
+        void set(size_t i, const Vehicle &v, const Vehicle::Motion &motion);
+        void copy(size_t i, size_t from);
+        // none: length 0, like Road's noVehicle
+        void setNone(size_t i);
+    };
+
+    // a vehicle that may lead: position, velocity and length - 0 for none
+    struct Leaders
+    {
+        std::vector<real> xPos, velocity, length;
+
+        void resize(size_t n);
+        void set(size_t i, const Vehicle *v);
+    };
+
+    // the arrays only grow: vehicles are written in place, without a size to keep
+    size_t count = { 0 };
+    size_t capacity = { 0 };
+
+    Drivers self;
+    std::vector<real> politeness, bSafe, aThr;
+    Leaders leader;                         // on the vehicle's lane, once it moved
+    Leaders newLeader[2];                   // by Target
+    Drivers newFollower[2];
+    // of the vehicle added last: the next one often has the same, and its pow is taken already
+    const Vehicle *lastFollower[2] = { nullptr, nullptr };
+    // masks are 1.0 or 0.0: reals, to share vector registers with what they select
+    std::vector<real> considered[2];      // the vehicle considers a change and has a gap on the target lane
+    std::vector<int> newLeaderPos[2];       // index on the target lane of the new leader, -1 - none
+    std::vector<real> changes[2];
+    std::vector<real> accCurrentLeader;
+
+    void reserve(size_t n);
+
+    // getNextLaneLeaderPos and Vehicle::hasGap for the vehicle at xPos, null for no neighbour
+    static int nextLaneLeaderPos(real xPos, const std::vector<Vehicle> &nextLane);
+    static bool hasGap(const Vehicle &vehicle, real xPos, const Vehicle *newLeader, const Vehicle *newFollower);
+
+public:
+    void clear();
+
+    /* a vehicle as it was before it moved - before - with its leader on its lane after it moved, and its
+     * neighbours on the target lanes. targetLanes: by Target, null where there's no lane or the vehicle doesn't
+     * consider a change (lanechange.h). The target lanes must stay as they are until evaluate.
+     * False, and nothing added, without a gap on any target lane: the vehicle stays where it is */
+    bool add(const Vehicle &vehicle, const Vehicle::Motion &before, const Vehicle &leader,
+             const std::vector<Vehicle> *const targetLanes[2]);
+
+    // the kernel: the change mask of every vehicle added
+    void evaluate();
+
+    // MOBIL wants vehicle i on target. Both may be true: the left lane is preferred
+    bool wantsChange(size_t i, Target target) const { return changes[target][i] != 0; }
+    int getNewLeaderPos(size_t i, Target target) const { return newLeaderPos[target][i]; }
+
+    size_t size() const { return count; }
+};
+
+} // namespace simulator
+
+#endif // MOBIL_H
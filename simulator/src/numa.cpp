@@ -0,0 +1,167 @@
+#include "numa.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace simulator
+{
+
+namespace
+{
+
+#ifdef __linux__
+std::vector<unsigned> cpusOf(const cpu_set_t &set)
+{
+    std::vector<unsigned> cpus;
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    return cpus;
+}
+#endif
+
+// cpus the process may run on, in order
+std::vector<unsigned> allowedCpus()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return cpusOf(set);
+#endif
+    std::vector<unsigned> cpus;
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+        cpus.push_back(cpu);
+    return cpus;
+}
+
+} // namespace
+
+std::vector<unsigned> parseCpuList(const char *text)
+{
+    std::vector<unsigned> cpus;
+    while (*text) {
+        char *end = nullptr;
+        unsigned long first = strtoul(text, &end, 10);
+        if (end == text)
+            break;
+        unsigned long last = first;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+        text = *end == ',' ? end + 1 : end;
+        if (*text == '\n')
+            break;
+    }
+    return cpus;
+}
+
+std::vector<std::vector<unsigned>> numaNodes()
+{
+    std::vector<unsigned> allowed = allowedCpus();
+    std::vector<std::vector<unsigned>> nodes;
+
+#ifdef __linux__
+    const char *root = "/sys/devices/system/node";
+    std::vector<unsigned> nodeIds;
+    if (DIR *dir = opendir(root)) {
+        while (dirent *entry = readdir(dir)) {
+            unsigned id;
+            char rest;
+            if (sscanf(entry->d_name, "node%u%c", &id, &rest) == 1)
+                nodeIds.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(nodeIds.begin(), nodeIds.end());
+
+    for (unsigned id : nodeIds) {
+        std::string fileName = std::string(root) + "/node" + std::to_string(id) + "/cpulist";
+        FILE *file = fopen(fileName.c_str(), "r");
+        if (!file)
+            continue;
+        char line[4096] = "";
+        if (!fgets(line, sizeof(line), file))
+            line[0] = 0;
+        fclose(file);
+
+        // memory only nodes and cpus outside the affinity mask don't take workers
+        std::vector<unsigned> cpus;
+        for (unsigned cpu : parseCpuList(line))
+            if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                cpus.push_back(cpu);
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+#endif
+
+    if (nodes.empty())
+        nodes.push_back(allowed);
+    return nodes;
+}
+
+std::vector<unsigned> workerCpus(unsigned workersNo)
+{
+    std::vector<unsigned> cpus;
+    for (const std::vector<unsigned> &node : numaNodes())
+        cpus.insert(cpus.end(), node.begin(), node.end());
+
+    std::vector<unsigned> assigned;
+    for (unsigned worker = 0; worker < workersNo; ++worker)
+        assigned.push_back(cpus[worker % cpus.size()]);
+    return assigned;
+}
+
+unsigned numaNodeOf(unsigned cpu)
+{
+    std::vector<std::vector<unsigned>> nodes = numaNodes();
+    for (unsigned node = 0; node < nodes.size(); ++node)
+        if (std::find(nodes[node].begin(), nodes[node].end(), cpu) != nodes[node].end())
+            return node;
+    return 0;
+}
+
+bool pinCurrentThread(const std::vector<unsigned> &cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus)
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error == 0)
+        return true;
+    log_warning("Cannot pin thread to %zu cpu(s) from cpu %u: %s", cpus.size(), cpus.empty() ? 0 : cpus[0],
+                strerror(error));
+    return false;
+#else
+    log_warning("Cannot pin thread to %zu cpu(s): not supported on this system", cpus.size());
+    return false;
+#endif
+}
+
+std::vector<unsigned> currentThreadCpus()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        return cpusOf(set);
+#endif
+    return allowedCpus();
+}
+
+} // namespace simulator
@@ -0,0 +1,34 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+
+namespace simulator
+{
+
+/* NUMA placement for pinned workers (WorkerPool, Simulator::setWorkerThreads).
+ * The topology comes from /sys/devices/system/node - no libnuma. Memory is placed by first touch: a page lands on
+ * the node of the thread that first writes it, so data a pinned worker allocates and fills stays on its node.
+ */
+
+// cpus of every NUMA node the process may run on. One node with all of them without NUMA information
+std::vector<std::vector<unsigned>> numaNodes();
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11 (a /sys cpulist)
+std::vector<unsigned> parseCpuList(const char *text);
+
+// a cpu for every worker: node by node, so neighbouring workers share a node. Wraps around past the last cpu
+std::vector<unsigned> workerCpus(unsigned workersNo);
+
+// node of a cpu, as numbered by numaNodes. 0 if unknown
+unsigned numaNodeOf(unsigned cpu);
+
+// pins the calling thread to cpus. False, with a warning, if the system doesn't let it
+bool pinCurrentThread(const std::vector<unsigned> &cpus);
+
+// cpus the calling thread may run on
+std::vector<unsigned> currentThreadCpus();
+
+} // namespace simulator
+
+#endif // NUMA_H
@@ -0,0 +1,91 @@
+#include "partition.h"
+#include "road.h"
+#include "roadorder.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace simulator
+{
+
+double Partition::imbalance() const
+{
+    if (cost.empty())
+        return 1.0;
+    double total = std::accumulate(cost.begin(), cost.end(), 0.0);
+    double heaviest = *std::max_element(cost.begin(), cost.end());
+    return total > 0 ? heaviest * cost.size() / total : 1.0;
+}
+
+Partition partitionRoads(const std::vector<const Road *> &roads, const std::vector<double> &weights,
+                         unsigned partsNo, double imbalance)
+{
+    const unsigned maxSweeps = 16;
+    partsNo = std::max(1u, partsNo);
+
+    Partition result;
+    result.part.assign(roads.size(), 0);
+    result.cost.assign(partsNo, 0.0);
+
+    RoadGraph graph = connectionGraph(roads);
+    result.connections = graph.edgesNo();
+
+    double average = std::accumulate(weights.begin(), weights.end(), 0.0) / partsNo;
+    std::vector<size_t> roadsIn(partsNo, 0);
+
+    // start: runs of equal cost along a BFS walk. A road goes to the run its middle falls in
+    std::vector<size_t> order = layoutOrder(roads, bfs);
+    double walked = 0.0;
+    for (size_t road : order) {
+        unsigned part = average > 0 ? std::min<unsigned>(partsNo - 1, (walked + weights[road] / 2) / average) : 0;
+        result.part[road] = part;
+        result.cost[part] += weights[road];
+        ++roadsIn[part];
+        walked += weights[road];
+    }
+
+    /* refine: every move takes a road to a part it has strictly more connections with, so the cut shrinks with
+     * every move and the sweeps end. Ties stay where they are */
+    double limit = (1.0 + imbalance) * average;
+    std::vector<unsigned long> links(partsNo, 0);
+    std::vector<unsigned> touched;
+    for (unsigned sweep = 0; sweep < maxSweeps; ++sweep) {
+        unsigned long moved = 0;
+        for (size_t road : order) {
+            unsigned current = result.part[road];
+            touched.clear();
+            for (size_t e = graph.first[road]; e < graph.first[road + 1]; ++e) {
+                unsigned part = result.part[graph.neighbours[e]];
+                if (links[part]++ == 0)
+                    touched.push_back(part);
+            }
+
+            unsigned best = current;
+            for (unsigned part : touched)
+                if (links[part] > links[best] && result.cost[part] + weights[road] <= limit && roadsIn[current] > 1)
+                    best = part;
+            for (unsigned part : touched)
+                links[part] = 0;
+
+            if (best != current) {
+                result.part[road] = best;
+                result.cost[current] -= weights[road];
+                result.cost[best] += weights[road];
+                --roadsIn[current];
+                ++roadsIn[best];
+                ++moved;
+            }
+        }
+        if (!moved)
+            break;
+    }
+
+    for (size_t road = 0; road < roads.size(); ++road)
+        for (size_t e = graph.first[road]; e < graph.first[road + 1]; ++e)
+            result.cut += result.part[road] != result.part[graph.neighbours[e]];
+    // every connection was seen from both ends
+    result.cut /= 2;
+    return result;
+}
+
+} // namespace simulator
@@ -0,0 +1,40 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <vector>
+
+namespace simulator
+{
+
+class Road;
+
+/* Road network partitioning for partitioned updates (Simulator::setPartitioned): partsNo parts of about the
+ * same cost, with as few lane connections between parts as possible - every connection between parts is
+ * traffic one worker hands to another, across sockets if the workers sit on different NUMA nodes.
+ *
+ * Size constrained label propagation, no external dependencies:
+ *  - start: the roads in BFS order over the connections (roadorder.h), cut into partsNo runs of equal cost.
+ *    Runs are connected and numbered along the walk, so neighbouring parts get neighbouring numbers - and
+ *    workers with neighbouring numbers share a node (workerCpus)
+ *  - refine: sweeps over the roads; a road joins the part most of its connections lead to, if that part
+ *    stays under (1 + imbalance) times the average cost. Until a sweep moves no road, 16 sweeps at most
+ * The same roads and weights always give the same parts.
+ */
+struct Partition
+{
+    std::vector<unsigned> part;         // of every road, by its index in the roads partitioned
+    std::vector<double> cost;           // of every part: the weights of its roads
+    unsigned long connections = { 0 };  // lane connections between the roads partitioned
+    unsigned long cut = { 0 };          // of them, between different parts
+
+    // heaviest part over the average part. 1 - perfectly balanced
+    double imbalance() const;
+};
+
+// weights: cost of every road, positive
+Partition partitionRoads(const std::vector<const Road *> &roads, const std::vector<double> &weights,
+                         unsigned partsNo, double imbalance = 0.05);
+
+} // namespace simulator
+
+#endif // PARTITION_H
@@ -0,0 +1,430 @@
+#include "profiler.h"
+#include "config.h"
+
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace simulator
+{
+
+namespace
+{
+
+const unsigned histogramBuckets = 64; // log2 buckets of ticks per step
+
+struct ProfilerState
+{
+    std::mutex lock;
+
+    // counters of every thread that ever had a phase. Never freed: a thread ending after static destruction
+    // still marks its counters free
+    std::deque<Profiler::ThreadPhases> *phasesStore = { new std::deque<Profiler::ThreadPhases>() };
+    std::vector<Profiler::ThreadPhases *> threads;
+    // what was already harvested from each thread: ticks then calls
+    std::vector<std::array<uint64_t, 2 * Profiler::phases_no>> seen;
+
+    uint64_t totalTicks[Profiler::phases_no] = {};
+    uint64_t totalCalls[Profiler::phases_no] = {};
+    uint64_t totalCounters[Profiler::phases_no][Profiler::counters_no] = {};
+    // harvested counters of each thread
+    std::vector<std::array<uint64_t, Profiler::phases_no * Profiler::counters_no>> seenCounters;
+    uint64_t histogram[Profiler::phases_no][histogramBuckets] = {};
+    uint64_t steps = { 0 };
+
+    FILE *stepOutput = { nullptr };
+    bool stepOutputOpened = { false };
+    bool binaryOutput = { false };
+
+    ~ProfilerState()
+    {
+        if (stepOutput)
+            fclose(stepOutput);
+    }
+
+    // everything threads measured since the last harvest
+    void harvest(uint64_t ticks[], uint64_t calls[])
+    {
+        for (size_t i = 0; i < threads.size(); ++i)
+            for (unsigned phase = 0; phase < Profiler::phases_no; ++phase) {
+                uint64_t t = threads[i]->ticks[phase].load(std::memory_order_relaxed);
+                uint64_t c = threads[i]->calls[phase].load(std::memory_order_relaxed);
+                ticks[phase] += t - seen[i][phase];
+                calls[phase] += c - seen[i][Profiler::phases_no + phase];
+                seen[i][phase] = t;
+                seen[i][Profiler::phases_no + phase] = c;
+
+                for (unsigned counter = 0; counter < Profiler::counters_no; ++counter) {
+                    uint64_t v = threads[i]->counters[phase][counter].load(std::memory_order_relaxed);
+                    uint64_t &last = seenCounters[i][phase * Profiler::counters_no + counter];
+                    totalCounters[phase][counter] += v - last;
+                    last = v;
+                }
+            }
+    }
+
+    void openStepOutput()
+    {
+        stepOutputOpened = true;
+        if (Config::profileOutput.empty())
+            return;
+
+        const std::string &name = Config::profileOutput;
+        binaryOutput = name.size() < 4 || name.compare(name.size() - 4, 4, ".csv") != 0;
+        stepOutput = fopen(name.c_str(), binaryOutput ? "wb" : "w");
+        if (!stepOutput) {
+            fprintf(stderr, "Profiler: cannot open %s\n", name.c_str());
+            return;
+        }
+
+        if (!binaryOutput) {
+            fprintf(stepOutput, "step");
+            for (unsigned phase = 0; phase < Profiler::phases_no; ++phase)
+                fprintf(stepOutput, ",%s_ns", Profiler::phaseName((Profiler::Phase)phase));
+            fprintf(stepOutput, "\n");
+        }
+    }
+};
+
+ProfilerState &state()
+{
+    static ProfilerState profilerState;
+    return profilerState;
+}
+
+unsigned bucket(uint64_t ticks)
+{
+    return ticks ? 64 - __builtin_clzll(ticks) : 0;
+}
+
+/* frees the thread's counters for reuse when the thread exits. The counters keep their values */
+struct ThreadRelease
+{
+    Profiler::ThreadPhases *phases = { nullptr };
+
+    ~ThreadRelease()
+    {
+        if (phases)
+            phases->inUse.store(false, std::memory_order_release);
+    }
+};
+
+thread_local ThreadRelease threadRelease;
+
+/* perf_event group of one thread: cycles lead, the others follow so they are scheduled together.
+ * Each counter is mapped so it can be read with rdpmc from user space. */
+struct PerfGroup
+{
+    enum Status { closed, open, unavailable };
+
+    Status status = { closed };
+    int fd[Profiler::counters_no];
+    perf_event_mmap_page *page[Profiler::counters_no];
+
+    PerfGroup()
+    {
+        for (unsigned counter = 0; counter < Profiler::counters_no; ++counter) {
+            fd[counter] = -1;
+            page[counter] = nullptr;
+        }
+    }
+
+    ~PerfGroup()
+    {
+        for (unsigned counter = 0; counter < Profiler::counters_no; ++counter) {
+            if (page[counter])
+                munmap(page[counter], sysconf(_SC_PAGESIZE));
+            if (fd[counter] >= 0)
+                close(fd[counter]);
+        }
+    }
+
+    bool openGroup()
+    {
+        static const uint64_t configs[Profiler::counters_no] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (unsigned counter = 0; counter < Profiler::counters_no; ++counter) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[counter];
+            attr.exclude_kernel = 1;    // allowed up to perf_event_paranoid 2
+            attr.exclude_hv = 1;
+
+            int leader = counter ? fd[Profiler::cycles] : -1;
+            fd[counter] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd[counter] < 0) {
+                if (counter == Profiler::cycles) {
+                    warnUnavailable(errno);
+                    return false;
+                }
+                // this PMU doesn't have it - the counter reads 0
+                continue;
+            }
+
+            void *mapped = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd[counter], 0);
+            if (mapped != MAP_FAILED)
+                page[counter] = (perf_event_mmap_page *)mapped;
+        }
+        return true;
+    }
+
+    static void warnUnavailable(int error)
+    {
+        static std::atomic<bool> warned(false);
+        if (warned.exchange(true))
+            return;
+        fprintf(stderr, "Profiler: hardware counters unavailable (%s)%s, timing phases only\n", strerror(error),
+                error == EACCES || error == EPERM ? " - see /proc/sys/kernel/perf_event_paranoid" : "");
+    }
+
+    uint64_t readCounter(unsigned counter) const
+    {
+        if (fd[counter] < 0)
+            return 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+        // the seqlock protocol of perf_event_mmap_page: the counter is live in the PMU while index != 0
+        if (const perf_event_mmap_page *pc = page[counter]) {
+            uint32_t seq;
+            uint64_t count;
+            bool direct;
+            do {
+                seq = pc->lock;
+                __atomic_signal_fence(__ATOMIC_SEQ_CST);
+                uint32_t index = pc->index;
+                count = pc->offset;
+                direct = pc->cap_user_rdpmc && index;
+                if (direct) {
+                    unsigned shift = 64 - pc->pmc_width;
+                    count += (int64_t)(__rdpmc(index - 1) << shift) >> shift;
+                }
+                __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            } while (pc->lock != seq);
+
+            if (direct)
+                return count;
+        }
+#endif
+
+        uint64_t count = 0;
+        if (read(fd[counter], &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count;
+    }
+};
+
+thread_local PerfGroup perfGroup;
+
+} // namespace
+
+thread_local Profiler::ThreadPhases *Profiler::threadPhases = nullptr;
+std::atomic<bool> Profiler::countersOn(false);
+
+const char *Profiler::phaseName(Phase phase)
+{
+    static const char *names[] = { "step", "index_road", "lane_change", "idm_update", "signals", "transfers", "serialize" };
+    return phase < phases_no ? names[phase] : "unknown";
+}
+
+const char *Profiler::counterName(Counter counter)
+{
+    static const char *names[] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+    return counter < counters_no ? names[counter] : "unknown";
+}
+
+void Profiler::enableCounters(bool on)
+{
+    countersOn.store(on, std::memory_order_relaxed);
+}
+
+bool Profiler::readCounters(uint64_t values[counters_no])
+{
+    if (perfGroup.status == PerfGroup::closed)
+        perfGroup.status = perfGroup.openGroup() ? PerfGroup::open : PerfGroup::unavailable;
+    if (perfGroup.status != PerfGroup::open)
+        return false;
+
+    for (unsigned counter = 0; counter < counters_no; ++counter)
+        values[counter] = perfGroup.readCounter(counter);
+    return true;
+}
+
+Profiler::ThreadPhases *Profiler::registerThread()
+{
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    for (ThreadPhases *phases : s.threads)
+        if (!phases->inUse.load(std::memory_order_acquire)) {
+            threadPhases = phases;
+            break;
+        }
+
+    if (!threadPhases) {
+        s.phasesStore->emplace_back();
+        s.threads.push_back(&s.phasesStore->back());
+        s.seen.push_back({});
+        s.seenCounters.push_back({});
+        threadPhases = s.threads.back();
+    }
+
+    threadPhases->inUse.store(true, std::memory_order_relaxed);
+    threadRelease.phases = threadPhases;
+    return threadPhases;
+}
+
+double Profiler::ticksPerNs()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double rate = []() {
+        auto c0 = std::chrono::steady_clock::now();
+        uint64_t t0 = ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t t1 = ticks();
+        auto c1 = std::chrono::steady_clock::now();
+        return (double)(t1 - t0) / std::chrono::duration_cast<std::chrono::nanoseconds>(c1 - c0).count();
+    }();
+    return rate;
+#else
+    return 1.0;
+#endif
+}
+
+void Profiler::endStep()
+{
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    uint64_t stepTicks[phases_no] = {};
+    uint64_t stepCalls[phases_no] = {};
+    s.harvest(stepTicks, stepCalls);
+
+    for (unsigned phase = 0; phase < phases_no; ++phase) {
+        s.totalTicks[phase] += stepTicks[phase];
+        s.totalCalls[phase] += stepCalls[phase];
+        ++s.histogram[phase][bucket(stepTicks[phase])];
+    }
+
+    if (!s.stepOutputOpened)
+        s.openStepOutput();
+
+    if (s.stepOutput) {
+        uint64_t stepNs[phases_no];
+        for (unsigned phase = 0; phase < phases_no; ++phase)
+            stepNs[phase] = stepTicks[phase] / ticksPerNs();
+
+        if (s.binaryOutput) {
+            fwrite(&s.steps, sizeof(s.steps), 1, s.stepOutput);
+            fwrite(stepNs, sizeof(stepNs), 1, s.stepOutput);
+        } else {
+            fprintf(s.stepOutput, "%lu", (unsigned long)s.steps);
+            for (unsigned phase = 0; phase < phases_no; ++phase)
+                fprintf(s.stepOutput, ",%lu", (unsigned long)stepNs[phase]);
+            fprintf(s.stepOutput, "\n");
+        }
+    }
+
+    ++s.steps;
+}
+
+/* per step percentile, from the log2 histogram: upper bound of the bucket, in microseconds */
+static double percentileUs(const uint64_t histogram[], uint64_t steps, double p)
+{
+    uint64_t rank = (uint64_t)(p * steps);
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < histogramBuckets; ++b) {
+        seen += histogram[b];
+        if (seen > rank)
+            return (b ? std::ldexp(1.0, b) : 0.0) / Profiler::ticksPerNs() / 1000.0;
+    }
+    return 0.0;
+}
+
+void Profiler::printSummary(FILE *out)
+{
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    // whatever was measured after the last step still counts for the run
+    s.harvest(s.totalTicks, s.totalCalls);
+
+    double stepTicks = s.totalTicks[step] ? s.totalTicks[step] : 1;
+
+    fprintf(out, "Profile: %lu steps, %.3f ticks/ns\n", (unsigned long)s.steps, ticksPerNs());
+    fprintf(out, "%-12s %12s %12s %8s %14s %12s %12s\n",
+            "phase", "calls", "total ms", "% step", "mean us/step", "p50 us", "p99 us");
+    for (unsigned phase = 0; phase < phases_no; ++phase) {
+        double totalMs = s.totalTicks[phase] / ticksPerNs() / 1e6;
+        double meanUs = s.steps ? totalMs * 1000.0 / s.steps : 0.0;
+        fprintf(out, "%-12s %12lu %12.3f %8.1f %14.3f %12.3f %12.3f\n",
+                phaseName((Phase)phase), (unsigned long)s.totalCalls[phase], totalMs,
+                100.0 * s.totalTicks[phase] / stepTicks, meanUs,
+                percentileUs(s.histogram[phase], s.steps, 0.5), percentileUs(s.histogram[phase], s.steps, 0.99));
+    }
+
+    bool counted = false;
+    for (unsigned phase = 0; phase < phases_no; ++phase)
+        counted = counted || s.totalCounters[phase][cycles];
+
+    if (counted) {
+        fprintf(out, "%-12s %14s %14s %8s %18s %18s\n",
+                "phase", "Mcycles", "Minstructions", "IPC", "cache miss/kinst", "branch miss/kinst");
+        for (unsigned phase = 0; phase < phases_no; ++phase) {
+            const uint64_t *c = s.totalCounters[phase];
+            double kinst = c[instructions] ? c[instructions] / 1000.0 : 1.0;
+            fprintf(out, "%-12s %14.3f %14.3f %8.2f %18.3f %18.3f\n",
+                    phaseName((Phase)phase), c[cycles] / 1e6, c[instructions] / 1e6,
+                    c[cycles] ? (double)c[instructions] / c[cycles] : 0.0,
+                    c[cache_misses] / kinst, c[branch_misses] / kinst);
+        }
+    }
+    fflush(out);
+}
+
+void Profiler::totals(uint64_t ticks[phases_no], uint64_t calls[phases_no])
+{
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    s.harvest(s.totalTicks, s.totalCalls);
+    for (unsigned phase = 0; phase < phases_no; ++phase) {
+        ticks[phase] = s.totalTicks[phase];
+        calls[phase] = s.totalCalls[phase];
+    }
+}
+
+void Profiler::reset()
+{
+    ProfilerState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    uint64_t discard[2][phases_no] = {};
+    s.harvest(discard[0], discard[1]);
+
+    for (unsigned phase = 0; phase < phases_no; ++phase) {
+        s.totalTicks[phase] = 0;
+        s.totalCalls[phase] = 0;
+        for (unsigned counter = 0; counter < counters_no; ++counter)
+            s.totalCounters[phase][counter] = 0;
+        for (unsigned b = 0; b < histogramBuckets; ++b)
+            s.histogram[phase][b] = 0;
+    }
+    s.steps = 0;
+}
+
+} // namespace simulator
@@ -0,0 +1,168 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace simulator
+{
+
+/* Profiler
+ * Phase level timing of the step loop.
+ *
+ * PROFILE_SCOPE(phase) times the enclosing block with the TSC (two rdtsc per scope) and adds it to
+ * the calling thread's counters - no locks, no allocation after the thread's first scope.
+ * A scope costs about as much as a vehicle's IDM step: scopes go around a lane or a phase, never around a vehicle.
+ * PROFILE_END_STEP() closes a step: the time each phase took in this step, summed over all threads,
+ * goes into a per run histogram and, if Config::profileOutput is set, into a per step CSV (or binary) file.
+ * printSummary() reports the run.
+ *
+ * Hardware counters: after Profiler::enableCounters(true) every scope also reads the thread's perf_event
+ * group (cycles, instructions, cache misses, branch mispredicts) at entry and exit - rdpmc when the kernel
+ * allows it, a read() per counter otherwise - and printSummary() adds IPC and misses per 1000 instructions
+ * for each phase. If the counters can't be opened (perf_event_paranoid, no PMU in a VM) a warning is
+ * logged once and phases are timed as before.
+ *
+ * Build with -DSIMULATOR_PROFILE=OFF and both macros expand to nothing.
+ */
+class Profiler
+{
+public:
+    enum Phase {
+        step,           // Simulator::update - whole step
+        index_road,     // sorting lanes (Road::indexRoad)
+        lane_change,    // MOBIL evaluation and lane change
+        idm_update,     // IDM car following (Vehicle::update)
+        signals,        // traffic lights update
+        transfers,      // vehicles entering the road they drove on to (enterTransfers)
+        serialize,      // output
+        phases_no
+    };
+
+    enum Counter {
+        cycles,
+        instructions,
+        cache_misses,
+        branch_misses,
+        counters_no
+    };
+
+    // monotonic counters of one thread. Only the owner thread writes them
+    struct ThreadPhases
+    {
+        std::atomic<uint64_t> ticks[phases_no];
+        std::atomic<uint64_t> calls[phases_no];
+        std::atomic<uint64_t> counters[phases_no][counters_no];
+        std::atomic<bool> inUse;
+    };
+
+private:
+    static ThreadPhases *registerThread();
+    static thread_local ThreadPhases *threadPhases;
+    static std::atomic<bool> countersOn;
+
+    static inline void accumulate(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+public:
+    static const char *phaseName(Phase phase);
+    static const char *counterName(Counter counter);
+
+    static inline uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static inline void add(Phase phase, uint64_t elapsed)
+    {
+        ThreadPhases *local = threadPhases ? threadPhases : registerThread();
+        accumulate(local->ticks[phase], elapsed);
+        accumulate(local->calls[phase], 1);
+    }
+
+    static inline void addCounters(Phase phase, const uint64_t start[], const uint64_t end[])
+    {
+        ThreadPhases *local = threadPhases ? threadPhases : registerThread();
+        for (unsigned counter = 0; counter < counters_no; ++counter)
+            accumulate(local->counters[phase][counter], end[counter] - start[counter]);
+    }
+
+    // sample hardware counters in every scope from now on. Off by default - a scope costs a few rdpmc more
+    static void enableCounters(bool on);
+
+    static inline bool countersEnabled()
+    {
+        return countersOn.load(std::memory_order_relaxed);
+    }
+
+    // current counter values of the calling thread, opening its group on first use.
+    // False if counters are unavailable; counters the PMU doesn't have read 0
+    static bool readCounters(uint64_t values[counters_no]);
+
+    // close the current step. Call it when no worker is inside a phase
+    static void endStep();
+
+    // run totals and per step distribution of every phase
+    static void printSummary(FILE *out);
+
+    // run totals of every phase, in ticks (see ticksPerNs) and calls
+    static void totals(uint64_t ticks[phases_no], uint64_t calls[phases_no]);
+
+    // forget everything measured so far
+    static void reset();
+
+    static double ticksPerNs();
+};
+
+class ScopedPhaseTimer
+{
+    Profiler::Phase phase;
+    bool counting;
+    uint64_t counterStart[Profiler::counters_no];
+    uint64_t start;
+
+public:
+    explicit ScopedPhaseTimer(Profiler::Phase p) :
+        phase(p), counting(Profiler::countersEnabled() && Profiler::readCounters(counterStart))
+    {
+        start = Profiler::ticks();
+    }
+
+    ~ScopedPhaseTimer()
+    {
+        Profiler::add(phase, Profiler::ticks() - start);
+        if (counting) {
+            uint64_t counterEnd[Profiler::counters_no];
+            if (Profiler::readCounters(counterEnd))
+                Profiler::addCounters(phase, counterStart, counterEnd);
+        }
+    }
+};
+
+} // namespace simulator
+
+#ifdef SIMULATOR_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) \
+    ::simulator::ScopedPhaseTimer PROFILE_CONCAT(phaseTimer_, __LINE__)(::simulator::Profiler::phase)
+#define PROFILE_END_STEP() ::simulator::Profiler::endStep()
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_END_STEP()
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,562 @@
+#include "reference.h"
+#include "binaryio.h"
+#include "config.h"
+#include "rng.h"
+#include "road.h"
+#include "trafficlight.h"
+#include "vehicle.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace simulator
+{
+
+namespace reference
+{
+
+// the state format stores the enums as they are
+static_assert(sizeof(simulator::Vehicle::ElementType) == sizeof(int32_t), "Vehicle::ElementType size changed");
+static_assert(sizeof(simulator::TrafficLight::LightColor) == sizeof(int32_t), "LightColor size changed");
+static_assert(sizeof(simulator::Road::Boundary) == sizeof(int32_t), "Road::Boundary size changed");
+
+namespace
+{
+
+Vehicle makeVehicle(double pos, double length, double v0)
+{
+    Vehicle v;
+    v.id = -1;
+    v.type = length > 0 ? 0 : 1;
+    v.length = length;
+    v.xOrig = pos;
+    v.velocity = 0.0;
+    v.xPos = pos;
+    v.s = -1.0;
+    v.acceleration = 0.0;
+    v.aggressivity = 0.5;
+    v.v0 = v0;
+    v.T = 1.0;
+    v.a = 1.5;
+    v.b = 3.0;
+    v.s0 = 1.0;
+    v.delta = 4.0;
+    v.freeRoadDistance = 100.0;
+    v.politeness = 0.3;
+    v.bSafe = 4.0;
+    v.aThr = 0.2;
+    v.roadTime = 0.0;
+    v.laneChangeSteps = 0;
+    return v;
+}
+
+const Vehicle noVehicle = makeVehicle(0.0, 0.0, 0.0);
+
+} // namespace
+
+double Vehicle::newAcceleration(const Vehicle &next, double nextOffset) const
+{
+    double netDistance = next.xPos + nextOffset - xPos - next.length;
+    bool freeRoad = netDistance <= 0 || netDistance >= freeRoadDistance;
+
+    double deltaV = velocity - next.velocity;
+    double sStar = s0 + std::max(0.0, velocity * T + (velocity * deltaV) / (2 * std::sqrt(a * b)));
+
+    double interaction = sStar / netDistance;
+    return a * (1.0 - std::pow(velocity / v0, delta) - (freeRoad ? 0 : interaction * interaction));
+}
+
+void Vehicle::update(double dt, const Vehicle &next, double nextOffset)
+{
+    roadTime += dt;
+    ++laneChangeSteps;
+    if (length <= 0)
+        return;
+
+    acceleration = newAcceleration(next, nextOffset);
+    // part of the model, as Vehicle::update: a vehicle that would stop within dt stops where it stops, it doesn't
+    // reverse - hard braking ends here, not in negative speeds
+    if (velocity + acceleration * dt < 0) {
+        xPos -= velocity * velocity / (2 * acceleration);
+        velocity = 0;
+        return;
+    }
+    xPos += velocity * dt + (acceleration * std::pow(dt, 2)) / 2;
+    velocity += acceleration * dt;
+}
+
+bool Vehicle::canChangeLane(const Vehicle &currentLeader, const Vehicle &newLeader, const Vehicle &newFollower) const
+{
+    bool hasGap = true;
+    if (newLeader.length > 0)
+        hasGap = xPos < newLeader.xPos - newLeader.length - s0;
+    if (newFollower.length > 0)
+        hasGap = hasGap && (xPos - length - s0 > newFollower.xPos);
+    if (!hasGap)
+        return false;
+
+    if (newFollower.length > 0 && !(newFollower.newAcceleration(*this) > -bSafe))
+        return false;
+
+    double accNl = newLeader.length > 0 ? newAcceleration(newLeader) : a;
+    double accCl = currentLeader.length > 0 ? newAcceleration(currentLeader) : a;
+    // the follower counts only if its length is at least a meter (the length goes through an unsigned)
+    double newFollowerNewAcc = (unsigned)newFollower.length > 0 ? newFollower.newAcceleration(*this) : 0;
+
+    return (accNl - accCl) > (politeness * (newFollower.acceleration - newFollowerNewAcc) + aThr);
+}
+
+void TrafficLight::update(double dt)
+{
+    if (counter >= times[color]) {
+        counter = 0;
+        color = color == green ? yellow : color == yellow ? red : green;
+    }
+    counter += dt;
+}
+
+void Road::index()
+{
+    for (std::vector<Vehicle> &lane : lanes)
+        std::sort(lane.begin(), lane.end(), [](const Vehicle &lhs, const Vehicle &rhs) { return lhs.xPos > rhs.xPos; });
+}
+
+int Road::chooseLane(unsigned laneIndex, const Vehicle &current, unsigned vehicleIndex, int &leader) const
+{
+    if (lanesNo == 1)
+        return -1;
+
+    const Vehicle &currentLeader = lanes[laneIndex][vehicleIndex - 1];
+
+    // not in the cooldown after a change, in the vehicle's turn, with the leader close enough
+    const LaneChangePolicy &policy = Config::laneChangePolicy;
+    if (current.laneChangeSteps < policy.cooldownSteps)
+        return -1;
+    if (policy.stagger > 1 && (current.laneChangeSteps + (uint32_t)current.id) % policy.stagger != 0)
+        return -1;
+    if (policy.pruneDistance > 0 && currentLeader.xPos - current.xPos > policy.pruneDistance)
+        return -1;
+
+    // left first, then right
+    int targets[2] = { laneIndex + 1 < lanesNo ? (int)laneIndex + 1 : -1, (int)laneIndex - 1 };
+    for (int target : targets) {
+        if (target < 0)
+            continue;
+        const std::vector<Vehicle> &nextLane = lanes[target];
+
+        /* new leader: the closest vehicle strictly ahead, found by bisection from the back of the lane.
+         * A lane that already moved this step needn't be sorted any more - the bisection decides then, so it's
+         * spelled out: first k of the lane read backwards with current.xPos < xPos */
+        int n = nextLane.size();
+        int first = 0;
+        int count = n;
+        while (count > 0) {
+            int half = count / 2;
+            if (current.xPos < nextLane[n - 1 - (first + half)].xPos) {
+                count = half;
+            } else {
+                first += half + 1;
+                count -= half + 1;
+            }
+        }
+        leader = n - 1 - first;
+
+        const Vehicle &newLeader = leader == -1 ? noVehicle : nextLane[leader];
+        const Vehicle &newFollower = (unsigned)(leader + 1) < nextLane.size() ? nextLane[leader + 1] : noVehicle;
+
+        if (current.canChangeLane(currentLeader, newLeader, newFollower))
+            return target;
+    }
+    return -1;
+}
+
+bool Road::changeLane(unsigned laneIndex, const Vehicle &current, unsigned vehicleIndex)
+{
+    int leader = -1;
+    int target = chooseLane(laneIndex, current, vehicleIndex, leader);
+    if (target < 0)
+        return false;
+    std::vector<Vehicle> &nextLane = lanes[target];
+    nextLane.insert(nextLane.begin() + leader + 1, current)->laneChangeSteps = 0;
+    return true;
+}
+
+namespace
+{
+
+// the road with an id, null if the network has none
+const Road *findRoad(const std::vector<Road> &roads, roadID id)
+{
+    auto found = std::lower_bound(roads.begin(), roads.end(), id, [](const Road &road, roadID key) { return road.id < key; });
+    return found != roads.end() && found->id == id ? &*found : nullptr;
+}
+
+} // namespace
+
+bool Road::updateFirst(unsigned laneIndex, Vehicle &current, const Vehicle &ringLeader, double dt,
+                       const std::vector<Road> &roads, std::vector<Transfer> *transfers, const CounterRng &routes)
+{
+    if (boundary == periodic) {
+        // ring: the last vehicle, a lap ahead, leads
+        current.update(dt, ringLeader, length);
+        return false;
+    }
+
+    // past the end it crosses whatever the light shows
+    bool stop = lights[laneIndex].color != TrafficLight::green;
+    if (transfers && current.xPos >= length) {
+        // the next road: drawn among the connections of the lane by usage, none - off the network
+        double usage = 0.0;
+        for (roadID next : connections[laneIndex])
+            if (const Road *road = findRoad(roads, next))
+                usage += road->usageProb;
+        if (usage > 0.0) {
+            double draw = usage * routes.uniform(id, current.id, current.itinerary.size());
+            roadID chosen = id;
+            for (roadID next : connections[laneIndex]) {
+                const Road *road = findRoad(roads, next);
+                if (!road)
+                    continue;
+                chosen = next;
+                draw -= road->usageProb;
+                if (draw < 0.0)
+                    break;
+            }
+            Vehicle moved = current;
+            moved.xPos -= length;
+            transfers->push_back(Transfer{ id, chosen, laneIndex, moved });
+        }
+        return true;
+    }
+    current.update(dt, stop ? makeVehicle(length - Config::trafficLightDistToRoadEnd, 0.0, 0.0) : noVehicle);
+    return false;
+}
+
+void Road::update(double dt, const std::vector<Road> &roads, std::vector<Transfer> *transfers,
+                  const CounterRng &routes)
+{
+    if (Config::laneChangePolicy.simultaneous && (lanesNo > 1 || segments() > 1)) {
+        updateSimultaneous(dt, roads, transfers, routes);
+        return;
+    }
+
+    index();
+
+    for (unsigned laneIndex = 0; laneIndex < lanes.size(); ++laneIndex) {
+        lights[laneIndex].update(dt);
+
+        std::vector<Vehicle> &lane = lanes[laneIndex];
+        for (unsigned i = 0; i < lane.size(); ) {
+            Vehicle &current = lane[i];
+            if (i == 0) {
+                if (updateFirst(laneIndex, current, lane.back(), dt, roads, transfers, routes)) {
+                    // one vehicle leaves a lane per step, the next one follows it as it left
+                    if (lane.size() > 1)
+                        lane[1].update(dt, lane[0]);
+                    lane.erase(lane.begin());
+                    i = 1;
+                    continue;
+                }
+            } else {
+                if (changeLane(laneIndex, current, i)) {
+                    lane.erase(lane.begin() + i);
+                    continue;
+                }
+                current.update(dt, lane[i - 1]);
+            }
+            ++i;
+        }
+    }
+
+    if (boundary == periodic)
+        for (std::vector<Vehicle> &lane : lanes)
+            for (Vehicle &v : lane)
+                if (v.xPos >= length)
+                    v.xPos -= length;
+}
+
+void Road::updateSimultaneous(double dt, const std::vector<Road> &roads, std::vector<Transfer> *transfers,
+                              const CounterRng &routes)
+{
+    index();
+    for (TrafficLight &light : lights)
+        light.update(dt);
+
+    // every vehicle decides on the road as it is now
+    struct Change
+    {
+        unsigned from, index, to;
+        int leader;
+    };
+    std::vector<Change> changes;
+    for (unsigned laneIndex = 0; laneIndex < lanes.size(); ++laneIndex)
+        for (unsigned i = 1; i < lanes[laneIndex].size(); ++i) {
+            int leader = -1;
+            int target = chooseLane(laneIndex, lanes[laneIndex][i], i, leader);
+            if (target >= 0)
+                changes.push_back(Change{ laneIndex, i, (unsigned)target, leader });
+        }
+
+    // of two changes into the same gap only the vehicle further ahead makes it - on a tie the lower id
+    std::vector<bool> made(changes.size(), true);
+    for (size_t c = 0; c < changes.size(); ++c)
+        for (size_t other = 0; other < changes.size(); ++other) {
+            if (other == c || changes[other].to != changes[c].to || changes[other].leader != changes[c].leader)
+                continue;
+            const Vehicle &mine = lanes[changes[c].from][changes[c].index];
+            const Vehicle &theirs = lanes[changes[other].from][changes[other].index];
+            if (theirs.xPos > mine.xPos || (theirs.xPos == mine.xPos && theirs.id < mine.id))
+                made[c] = false;
+        }
+
+    // the new lanes: who stays, in order, and every vehicle changing in right behind its new leader
+    std::vector<std::vector<Vehicle>> changed(lanes.size());
+    for (unsigned laneIndex = 0; laneIndex < lanes.size(); ++laneIndex) {
+        auto enter = [&](int leader) {
+            for (size_t c = 0; c < changes.size(); ++c)
+                if (made[c] && changes[c].to == laneIndex && changes[c].leader == leader) {
+                    changed[laneIndex].push_back(lanes[changes[c].from][changes[c].index]);
+                    changed[laneIndex].back().laneChangeSteps = 0;
+                }
+        };
+        enter(-1);
+        for (unsigned i = 0; i < lanes[laneIndex].size(); ++i) {
+            bool leaves = false;
+            for (size_t c = 0; c < changes.size(); ++c)
+                leaves = leaves || (made[c] && changes[c].from == laneIndex && changes[c].index == i);
+            if (!leaves)
+                changed[laneIndex].push_back(lanes[laneIndex][i]);
+            enter(i);
+        }
+    }
+    lanes = changed;
+
+    /* then everyone moves, front to back, behind the leader that moved already - but for the first vehicle of a
+     * segment, which follows its leader as it was before anyone moved, moved on at its acceleration. The first
+     * vehicle of the lane may drive off the road, and leads the next one where it left */
+    unsigned segmentsNo = segments();
+    for (unsigned laneIndex = 0; laneIndex < lanes.size(); ++laneIndex) {
+        std::vector<Vehicle> &lane = lanes[laneIndex];
+        if (lane.empty())
+            continue;
+        const std::vector<Vehicle> before = lane;
+        std::vector<unsigned> segment(lane.size(), 0);
+        for (unsigned i = 0; i < lane.size(); ++i)
+            for (unsigned cut = 1; cut < segmentsNo; ++cut)
+                if (lane[i].xPos < length * (segmentsNo - cut) / segmentsNo)
+                    segment[i] = cut;
+
+        unsigned left = 0;
+        for (unsigned i = 0; i < lane.size(); ++i) {
+            if (i == 0) {
+                if (updateFirst(laneIndex, lane[i], before.back(), dt, roads, transfers, routes))
+                    left = 1;
+            } else if (segment[i] != segment[i - 1]) {
+                Vehicle halo = before[i - 1];
+                if (halo.length > 0 && halo.velocity + halo.acceleration * dt < 0) {
+                    halo.xPos -= halo.velocity * halo.velocity / (2 * halo.acceleration);
+                    halo.velocity = 0;
+                } else if (halo.length > 0) {
+                    halo.xPos += halo.velocity * dt + (halo.acceleration * std::pow(dt, 2)) / 2;
+                    halo.velocity += halo.acceleration * dt;
+                }
+                lane[i].update(dt, halo);
+            } else {
+                lane[i].update(dt, lane[i - 1]);
+            }
+        }
+        lane.erase(lane.begin(), lane.begin() + left);
+
+        if (boundary == periodic)
+            for (Vehicle &v : lane)
+                if (v.xPos >= length)
+                    v.xPos -= length;
+    }
+}
+
+unsigned Road::segments() const
+{
+    double segmentLength = Config::roadSegmentLength;
+    return segmentLength > 0 && length >= 2 * segmentLength ? (unsigned)(length / segmentLength) : 1;
+}
+
+bool Engine::loadState(std::istream &in)
+{
+    uint64_t roadsNo = 0;
+    if (!readBinary(in, runTime) || !readBinary(in, seed) || !readBinary(in, steps) || !readBinary(in, roadsNo))
+        return false;
+
+    roads.assign(roadsNo, Road());
+    for (Road &road : roads) {
+        uint64_t size = 0;
+        if (!(readBinary(in, road.id) && readBinary(in, road.length) &&
+              readBinary(in, road.startPosGeo) && readBinary(in, road.endPosGeo) &&
+              readBinary(in, road.startPosCard) && readBinary(in, road.endPosCard) &&
+              readBinary(in, road.usageProb) && readBinary(in, road.lanesNo) && readBinary(in, road.maxSpeed) &&
+              readBinary(in, road.boundary) && readBinary(in, size)))
+            return false;
+
+        road.connections.resize(size);
+        for (auto &laneConnections : road.connections)
+            if (!readBinary(in, laneConnections))
+                return false;
+
+        if (!readBinary(in, size))
+            return false;
+        road.lanes.assign(size, std::vector<Vehicle>());
+        for (auto &lane : road.lanes) {
+            if (!readBinary(in, size))
+                return false;
+            lane.resize(size);
+            for (Vehicle &v : lane)
+                if (!(readBinary(in, v.id) && readBinary(in, v.type) && readBinary(in, v.length) &&
+                      readBinary(in, v.xOrig) && readBinary(in, v.velocity) && readBinary(in, v.xPos) &&
+                      readBinary(in, v.s) && readBinary(in, v.acceleration) && readBinary(in, v.aggressivity) &&
+                      readBinary(in, v.v0) && readBinary(in, v.T) && readBinary(in, v.a) && readBinary(in, v.b) &&
+                      readBinary(in, v.s0) && readBinary(in, v.delta) && readBinary(in, v.freeRoadDistance) &&
+                      readBinary(in, v.politeness) && readBinary(in, v.bSafe) && readBinary(in, v.aThr) &&
+                      readBinary(in, v.itinerary) && readBinary(in, v.roadTime) &&
+                      readBinary(in, v.laneChangeSteps)))
+                    return false;
+        }
+
+        if (!readBinary(in, size))
+            return false;
+        road.lights.resize(size);
+        for (TrafficLight &light : road.lights)
+            if (!(readBinary(in, light.counter) && readBinary(in, light.color) &&
+                  readBinary(in, light.cycle) && readBinary(in, light.times)))
+                return false;
+    }
+    return true;
+}
+
+void Engine::saveState(std::ostream &out) const
+{
+    writeBinary(out, runTime);
+    writeBinary(out, seed);
+    writeBinary(out, steps);
+    writeBinary(out, (uint64_t)roads.size());
+    for (const Road &road : roads) {
+        writeBinary(out, road.id);
+        writeBinary(out, road.length);
+        writeBinary(out, road.startPosGeo);
+        writeBinary(out, road.endPosGeo);
+        writeBinary(out, road.startPosCard);
+        writeBinary(out, road.endPosCard);
+        writeBinary(out, road.usageProb);
+        writeBinary(out, road.lanesNo);
+        writeBinary(out, road.maxSpeed);
+        writeBinary(out, road.boundary);
+
+        writeBinary(out, (uint64_t)road.connections.size());
+        for (auto &laneConnections : road.connections)
+            writeBinary(out, laneConnections);
+
+        writeBinary(out, (uint64_t)road.lanes.size());
+        for (auto &lane : road.lanes) {
+            writeBinary(out, (uint64_t)lane.size());
+            for (const Vehicle &v : lane) {
+                writeBinary(out, v.id);
+                writeBinary(out, v.type);
+                writeBinary(out, v.length);
+                writeBinary(out, v.xOrig);
+                writeBinary(out, v.velocity);
+                writeBinary(out, v.xPos);
+                writeBinary(out, v.s);
+                writeBinary(out, v.acceleration);
+                writeBinary(out, v.aggressivity);
+                writeBinary(out, v.v0);
+                writeBinary(out, v.T);
+                writeBinary(out, v.a);
+                writeBinary(out, v.b);
+                writeBinary(out, v.s0);
+                writeBinary(out, v.delta);
+                writeBinary(out, v.freeRoadDistance);
+                writeBinary(out, v.politeness);
+                writeBinary(out, v.bSafe);
+                writeBinary(out, v.aThr);
+                writeBinary(out, v.itinerary);
+                writeBinary(out, v.roadTime);
+                writeBinary(out, v.laneChangeSteps);
+            }
+        }
+
+        writeBinary(out, (uint64_t)road.lights.size());
+        for (const TrafficLight &light : road.lights) {
+            writeBinary(out, light.counter);
+            writeBinary(out, light.color);
+            writeBinary(out, light.cycle);
+            writeBinary(out, light.times);
+        }
+    }
+}
+
+void Engine::setTransfers(bool on)
+{
+    transfers = on;
+}
+
+void Engine::update(double dt)
+{
+    std::vector<Transfer> moving;
+    CounterRng routes = CounterRng::forStream(seed, steps);
+    for (Road &road : roads)
+        road.update(dt, roads, transfers ? &moving : nullptr, routes);
+
+    // by road entered, road left, vehicle id
+    std::sort(moving.begin(), moving.end(), [](const Transfer &lhs, const Transfer &rhs)
+    { return lhs.to != rhs.to ? lhs.to < rhs.to : lhs.from != rhs.from ? lhs.from < rhs.from : lhs.vehicle.id < rhs.vehicle.id; });
+    std::vector<Transfer> held;
+    for (Transfer &transfer : moving) {
+        auto next = std::lower_bound(roads.begin(), roads.end(), transfer.to,
+                                     [](const Road &road, roadID key) { return road.id < key; });
+        if (next == roads.end() || next->id != transfer.to)
+            continue;
+        // it enters behind the last vehicle of the lane with its minimum gap, or not at all
+        std::vector<Vehicle> &lane = next->lanes[std::min(transfer.lane, next->lanesNo - 1)];
+        if (!lane.empty() && lane.back().length > 0 &&
+            !(transfer.vehicle.xPos < lane.back().xPos - lane.back().length - transfer.vehicle.s0)) {
+            held.push_back(transfer);
+            continue;
+        }
+        transfer.vehicle.itinerary.push_back(next->id);
+        lane.push_back(transfer.vehicle);
+    }
+
+    /* the ones that didn't fit: back at the front of the lane they left, stopped there - or just ahead of the vehicle
+     * behind, if it closed in past their tail - once every road took its vehicles in */
+    for (Transfer &transfer : held) {
+        auto from = std::lower_bound(roads.begin(), roads.end(), transfer.from,
+                                     [](const Road &road, roadID key) { return road.id < key; });
+        std::vector<Vehicle> &lane = from->lanes[transfer.lane];
+        Vehicle &v = transfer.vehicle;
+        v.xPos += from->length;
+        if (!lane.empty())
+            v.xPos = std::max(v.xPos, lane.front().xPos + v.length);
+        v.velocity = 0.0;
+        v.acceleration = 0.0;
+        lane.insert(lane.begin(), v);
+    }
+    runTime += dt;
+    ++steps;
+}
+
+double Engine::getRunTime() const
+{
+    return runTime;
+}
+
+std::vector<Road>& Engine::getRoads()
+{
+    return roads;
+}
+
+const std::vector<Road>& Engine::getRoads() const
+{
+    return roads;
+}
+
+} // namespace reference
+
+} // namespace simulator
@@ -0,0 +1,142 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include "defs.h"
+#include "rng.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace simulator
+{
+
+/* Reference engine
+ * A frozen, plain scalar copy of the model semantics: IDM car following (with the stop at zero velocity),
+ * MOBIL lane changes, the road update order and traffic light cycles - as Vehicle, Road and TrafficLight
+ * implemented them when it was written - and the transfers of vehicles between roads, with their route draws
+ * (rng.h, part of the model), which vehicles consider a lane change and whether the changes of a road are made
+ * all at once (Config::laneChangePolicy, but for the exact prefilter). It shares no other code with them, so
+ * optimized paths (threads, SoA, SIMD, partitions, ...) can be checked against it step by step - see
+ * bench/difftest.cpp.
+ *
+ * Keep it simple and slow on purpose. Change it only when the model itself changes, never for speed.
+ * It reads and writes the Simulator::saveState format, so any engine state can be run on both sides.
+ */
+namespace reference
+{
+
+struct Vehicle
+{
+    int32_t id;
+    int32_t type;           // Vehicle::ElementType
+    double length;
+    double xOrig;
+    double velocity;
+    double xPos;
+    double s;
+    double acceleration;
+    double aggressivity;
+    double v0;
+    double T;
+    double a;
+    double b;
+    double s0;
+    double delta;
+    double freeRoadDistance;
+    double politeness;
+    double bSafe;
+    double aThr;
+    std::vector<roadID> itinerary;
+    double roadTime;
+    uint32_t laneChangeSteps;
+
+    double newAcceleration(const Vehicle &next, double nextOffset = 0.0) const;
+    void update(double dt, const Vehicle &next, double nextOffset = 0.0);
+    bool canChangeLane(const Vehicle &currentLeader, const Vehicle &newLeader, const Vehicle &newFollower) const;
+};
+
+struct TrafficLight
+{
+    enum { green, yellow, red };
+
+    double counter;
+    int32_t color;
+    std::vector<int32_t> cycle;
+    std::vector<double> times;  // by color
+
+    void update(double dt);
+};
+
+// a vehicle that drove past the end of its road, on its way to the next (Simulator::setTransfers)
+struct Transfer
+{
+    roadID from;
+    roadID to;
+    unsigned lane;
+    Vehicle vehicle;
+};
+
+struct Road
+{
+    enum { open, periodic };
+
+    roadID id;
+    double length;
+    roadPosGeo startPosGeo;
+    roadPosGeo endPosGeo;
+    roadPosCard startPosCard;
+    roadPosCard endPosCard;
+    float usageProb;
+    unsigned lanesNo;
+    unsigned maxSpeed;
+    int32_t boundary;           // Road::Boundary
+    std::vector<std::vector<roadID>> connections;
+    std::vector<std::vector<Vehicle>> lanes;    // sorted by position, descending, after index()
+    std::vector<TrafficLight> lights;
+
+    void index();
+    /* roads: the network, by id. transfers: where vehicles passing the end go, null - they drive on.
+     * routes: the step's route draws, CounterRng::forStream(seed, step) */
+    void update(double dt, const std::vector<Road> &roads, std::vector<Transfer> *transfers, const CounterRng &routes);
+    // LaneChangePolicy::simultaneous: every lane change decided first, on the road as the step found it
+    void updateSimultaneous(double dt, const std::vector<Road> &roads, std::vector<Transfer> *transfers,
+                            const CounterRng &routes);
+    // the lane current would change to, -1 - none. leader: its new leader there, -1 - none
+    int chooseLane(unsigned laneIndex, const Vehicle &current, unsigned vehicleIndex, int &leader) const;
+    bool changeLane(unsigned laneIndex, const Vehicle &current, unsigned vehicleIndex);
+    // current, the first vehicle of a lane - behind ringLeader on a ring: true if it left the road, to be erased
+    bool updateFirst(unsigned laneIndex, Vehicle &current, const Vehicle &ringLeader, double dt,
+                     const std::vector<Road> &roads, std::vector<Transfer> *transfers, const CounterRng &routes);
+    // segments of a lane with simultaneous lane changes (Config::roadSegmentLength)
+    unsigned segments() const;
+};
+
+class Engine
+{
+    double runTime = { 0 };
+    uint64_t seed = { 0 };      // of the route draws, like Simulator::setSeed
+    uint64_t steps = { 0 };
+    std::vector<Road> roads;    // by id, like the city map
+    bool transfers = { false };
+
+public:
+    // vehicles drive on from road to road, like Simulator::setTransfers
+    void setTransfers(bool on);
+
+    bool loadState(std::istream &in);
+    void saveState(std::ostream &out) const;
+
+    void update(double dt);
+
+    double getRunTime() const;
+    std::vector<Road>& getRoads();
+    const std::vector<Road>& getRoads() const;
+};
+
+} // namespace reference
+
+} // namespace simulator
+
+#endif // REFERENCE_H
@@ -0,0 +1,290 @@
+#include "replay.h"
+#include "binaryio.h"
+#include "config.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+namespace simulator
+{
+
+namespace
+{
+
+void writePolicy(std::ostream &out, const LaneChangePolicy &policy)
+{
+    writeBinary(out, policy.pruneDistance);
+    writeBinary(out, policy.cooldownSteps);
+    writeBinary(out, policy.stagger);
+    writeBinary(out, policy.prefilter);
+    writeBinary(out, policy.simultaneous);
+    writeBinary(out, policy.batched);
+}
+
+bool readPolicy(std::istream &in, LaneChangePolicy &policy)
+{
+    return readBinary(in, policy.pruneDistance) && readBinary(in, policy.cooldownSteps) &&
+           readBinary(in, policy.stagger) && readBinary(in, policy.prefilter) &&
+           readBinary(in, policy.simultaneous) && readBinary(in, policy.batched);
+}
+
+/* the model of the recorded run, for every simulator of the process while it lives. The settings the process had
+ * come back when it goes */
+class ScopedModel
+{
+    LaneChangePolicy laneChangePolicy;
+    double roadSegmentLength;
+
+public:
+    explicit ScopedModel(const ReplayLog &log) :
+        laneChangePolicy(Config::laneChangePolicy), roadSegmentLength(Config::roadSegmentLength)
+    {
+        Config::laneChangePolicy = log.laneChangePolicy;
+        Config::roadSegmentLength = log.roadSegmentLength;
+    }
+
+    ~ScopedModel()
+    {
+        Config::laneChangePolicy = laneChangePolicy;
+        Config::roadSegmentLength = roadSegmentLength;
+    }
+
+    ScopedModel(const ScopedModel &) = delete;
+    ScopedModel &operator=(const ScopedModel &) = delete;
+};
+
+// replayWindow with the model applied already
+bool replayModelWindow(const ReplayLog &log, uint32_t fromStep, uint32_t toStep,
+                       const std::function<void(uint32_t step, const Simulator &state)> &visit)
+{
+    if (log.checkpoints.empty() || toStep > log.steps || fromStep > toStep) {
+        log_error("Cannot replay steps %u - %u of a %u steps log", fromStep, toStep, log.steps);
+        return false;
+    }
+
+    // closest checkpoint at or before the window
+    auto checkpoint = std::upper_bound(log.checkpoints.begin(), log.checkpoints.end(), fromStep,
+                                       [](uint32_t step, const ReplayLog::Checkpoint &c) { return step < c.step; });
+    --checkpoint;
+
+    Simulator simulator;
+    simulator.setTransfers(log.transfers);
+    std::istringstream state(checkpoint->state);
+    if (!simulator.loadState(state))
+        return false;
+
+    uint32_t step = checkpoint->step;
+    auto event = std::lower_bound(log.events.begin(), log.events.end(), step,
+                                  [](const ReplayLog::Event &e, uint32_t s) { return e.step < s; });
+
+    for (; step < toStep; ++step) {
+        for (; event != log.events.end() && event->step == step; ++event)
+            applyReplayEvent(simulator, *event);
+
+        simulator.update(log.dt);
+
+        uint32_t done = step + 1;
+        if (done % log.hashInterval == 0 && done / log.hashInterval <= log.hashes.size() &&
+                simulator.stateHash() != log.hashes[done / log.hashInterval - 1]) {
+            log_error("Replay diverged from the recorded run at step %u", done);
+            return false;
+        }
+
+        if (step >= fromStep)
+            visit(step, simulator);
+    }
+    return true;
+}
+
+} // namespace
+
+void ReplayLog::save(std::ostream &out) const
+{
+    writeBinary(out, dt);
+    writeBinary(out, steps);
+    writeBinary(out, hashInterval);
+    writeBinary(out, transfers);
+    writePolicy(out, laneChangePolicy);
+    writeBinary(out, roadSegmentLength);
+
+    writeBinary(out, (uint64_t)checkpoints.size());
+    for (const Checkpoint &checkpoint : checkpoints) {
+        writeBinary(out, checkpoint.step);
+        writeBinary(out, checkpoint.state);
+    }
+
+    writeBinary(out, (uint64_t)events.size());
+    for (const Event &event : events) {
+        writeBinary(out, event.step);
+        writeBinary(out, event.type);
+        writeBinary(out, event.road);
+        writeBinary(out, event.lane);
+        writeBinary(out, event.pos);
+        writeBinary(out, event.color);
+        writeBinary(out, event.vehicle);
+    }
+
+    writeBinary(out, hashes);
+}
+
+bool ReplayLog::load(std::istream &in)
+{
+    uint64_t size = 0;
+    if (!(readBinary(in, dt) && readBinary(in, steps) && readBinary(in, hashInterval) &&
+          readBinary(in, transfers) && readPolicy(in, laneChangePolicy) && readBinary(in, roadSegmentLength) &&
+          readBinary(in, size)))
+        return false;
+
+    checkpoints.resize(size);
+    for (Checkpoint &checkpoint : checkpoints)
+        if (!(readBinary(in, checkpoint.step) && readBinary(in, checkpoint.state)))
+            return false;
+
+    if (!readBinary(in, size))
+        return false;
+
+    events.resize(size);
+    for (Event &event : events)
+        if (!(readBinary(in, event.step) &&
+              readBinary(in, event.type) &&
+              readBinary(in, event.road) &&
+              readBinary(in, event.lane) &&
+              readBinary(in, event.pos) &&
+              readBinary(in, event.color) &&
+              readBinary(in, event.vehicle)))
+            return false;
+
+    return readBinary(in, hashes);
+}
+
+size_t ReplayLog::size() const
+{
+    std::ostringstream out;
+    save(out);
+    return out.str().size();
+}
+
+void applyReplayEvent(Simulator &simulator, const ReplayLog::Event &event)
+{
+    auto roadIt = simulator.cityMap.find(event.road);
+    if (roadIt == simulator.cityMap.end()) {
+        log_error("Replay event for unknown road %lu at step %u", event.road, event.step);
+        return;
+    }
+    Road &road = roadIt->second;
+
+    switch (event.type) {
+    case ReplayLog::Event::spawn:
+    case ReplayLog::Event::incident: {
+        // the vehicle is restored with its recorded id - a new Vehicle would get a different one
+        std::istringstream in(event.vehicle);
+        Vehicle vehicle(0.0, 0.0, 0.0);
+        if (vehicle.loadState(in))
+            road.addVehicle(std::move(vehicle), event.lane);
+        else
+            log_error("Corrupted vehicle in replay event at step %u", event.step);
+        break;
+    }
+    case ReplayLog::Event::signal_override:
+        road.setTrafficLightColor(event.lane, event.color);
+        break;
+    }
+}
+
+ReplayRecorder::ReplayRecorder(Simulator &sim, double dt, uint32_t hashInterval, uint32_t checkpointInterval) :
+    simulator(sim), checkpointInterval(checkpointInterval)
+{
+    replayLog.dt = dt;
+    replayLog.hashInterval = hashInterval ? hashInterval : 1;
+    replayLog.transfers = simulator.hasTransfers();
+    replayLog.laneChangePolicy = Config::laneChangePolicy;
+    replayLog.roadSegmentLength = Config::roadSegmentLength;
+
+    std::ostringstream state;
+    simulator.saveState(state);
+    replayLog.checkpoints.push_back(ReplayLog::Checkpoint{ 0, state.str() });
+}
+
+void ReplayRecorder::apply(const ReplayLog::Event &event)
+{
+    applyReplayEvent(simulator, event);
+    replayLog.events.push_back(event);
+}
+
+void ReplayRecorder::spawnVehicle(roadID road, unsigned lane, const Vehicle &vehicle)
+{
+    std::ostringstream state;
+    vehicle.saveState(state);
+    apply(ReplayLog::Event{ replayLog.steps, ReplayLog::Event::spawn, road, lane, vehicle.getPos(),
+                            TrafficLight::green_light, state.str() });
+}
+
+void ReplayRecorder::overrideSignal(roadID road, unsigned lane, TrafficLight::LightColor color)
+{
+    apply(ReplayLog::Event{ replayLog.steps, ReplayLog::Event::signal_override, road, lane, 0.0, color, "" });
+}
+
+void ReplayRecorder::addIncident(roadID road, unsigned lane, double pos)
+{
+    // standing obstacle - zero speed, negative length, like the test obstacles
+    Vehicle obstacle(pos, -1.0, 0.0, Vehicle::obstacle);
+
+    std::ostringstream state;
+    obstacle.saveState(state);
+    apply(ReplayLog::Event{ replayLog.steps, ReplayLog::Event::incident, road, lane, pos,
+                            TrafficLight::red_light, state.str() });
+}
+
+void ReplayRecorder::update()
+{
+    simulator.update(replayLog.dt);
+    ++replayLog.steps;
+
+    if (replayLog.steps % replayLog.hashInterval == 0)
+        replayLog.hashes.push_back(simulator.stateHash());
+
+    if (checkpointInterval && replayLog.steps % checkpointInterval == 0) {
+        std::ostringstream state;
+        simulator.saveState(state);
+        replayLog.checkpoints.push_back(ReplayLog::Checkpoint{ replayLog.steps, state.str() });
+    }
+}
+
+const ReplayLog &ReplayRecorder::getLog() const
+{
+    return replayLog;
+}
+
+bool replayWindow(const ReplayLog &log, uint32_t fromStep, uint32_t toStep,
+                  const std::function<void(uint32_t step, const Simulator &state)> &visit)
+{
+    ScopedModel model(log);
+    return replayModelWindow(log, fromStep, toStep, visit);
+}
+
+bool replayWindows(const ReplayLog &log, const std::vector<std::pair<uint32_t, uint32_t>> &windows,
+                   const std::function<void(uint32_t step, const Simulator &state)> &visit)
+{
+    // once, before the threads read it, and back after they're joined
+    ScopedModel model(log);
+
+    std::atomic<bool> ok(true);
+
+    std::vector<std::thread> workers;
+    for (auto &window : windows)
+        workers.emplace_back([&log, &visit, &ok, window]() {
+            if (!replayModelWindow(log, window.first, window.second, visit))
+                ok = false;
+        });
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    return ok;
+}
+
+} // namespace simulator
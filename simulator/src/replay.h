@@ -0,0 +1,123 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "lanechange.h"
+#include "simulator.h"
+#include "trafficlight.h"
+#include "defs.h"
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace simulator
+{
+
+/* ReplayLog
+ * Event sourced record of a run. Stepping is deterministic, so instead of every vehicle's trajectory we keep:
+ *      - the initial state (and optionally sparse checkpoints)
+ *      - the exogenous inputs: spawned vehicles, signal overrides and incidents, with the step they happened at
+ *      - a state hash every hashInterval steps, to prove a recomputed window matches the original run
+ *      - the settings that are part of the model: transfers, the lane change policy and the road segments
+ * Any window can then be recomputed on demand from the closest checkpoint before it.
+ */
+struct ReplayLog
+{
+    struct Event
+    {
+        enum Type { spawn, signal_override, incident };
+
+        uint32_t step;      // applied before this step is computed
+        Type type;
+        roadID road;
+        uint32_t lane;
+        double pos;         // vehicle/incident position
+        TrafficLight::LightColor color;
+        std::string vehicle; // binary state of the spawned vehicle or incident obstacle
+    };
+
+    struct Checkpoint
+    {
+        uint32_t step;
+        std::string state;
+    };
+
+    double dt = { 0.5 };
+    uint32_t steps = { 0 };
+    uint32_t hashInterval = { 20 };
+
+    // of the recorded run - a replay runs with them
+    bool transfers = { false };                 // Simulator::hasTransfers
+    LaneChangePolicy laneChangePolicy;          // Config::laneChangePolicy
+    double roadSegmentLength = { 0.0 };         // Config::roadSegmentLength
+
+    std::vector<Checkpoint> checkpoints; // sorted by step. checkpoints[0] is the initial state
+    std::vector<Event> events;           // sorted by step
+    std::vector<uint64_t> hashes;        // hashes[i] - state hash after step (i + 1) * hashInterval
+
+    void save(std::ostream &out) const;
+    bool load(std::istream &in);
+
+    // storage needed by this log, in bytes
+    size_t size() const;
+};
+
+/* ReplayRecorder
+ * Drive a simulator through the recorder so every exogenous input ends up in the log.
+ */
+class ReplayRecorder
+{
+    Simulator &simulator;
+    ReplayLog replayLog;
+    uint32_t checkpointInterval;
+
+    void apply(const ReplayLog::Event &event);
+
+public:
+    /**
+     * @param sim                - simulator to record. Its current state is the initial state of the log, its
+     *                             transfers and the current Config the model of the log
+     * @param dt                 - update time
+     * @param hashInterval       - steps between state hashes
+     * @param checkpointInterval - steps between full state checkpoints. 0 - initial state only
+     */
+    ReplayRecorder(Simulator &sim, double dt, uint32_t hashInterval, uint32_t checkpointInterval = 0);
+
+    void spawnVehicle(roadID road, unsigned lane, const Vehicle &vehicle);
+    void overrideSignal(roadID road, unsigned lane, TrafficLight::LightColor color);
+    // standing obstacle on a lane - accident, road works
+    void addIncident(roadID road, unsigned lane, double pos);
+
+    // step the simulator and record the hash/checkpoint when due
+    void update();
+
+    const ReplayLog &getLog() const;
+};
+
+// apply a recorded input to a simulator
+void applyReplayEvent(Simulator &simulator, const ReplayLog::Event &event);
+
+/**
+ * @brief replayWindow - recompute steps [fromStep, toStep) of a recorded run, starting from the closest checkpoint.
+ *                       Hashes met on the way are checked against the log. Config::laneChangePolicy and
+ *                       Config::roadSegmentLength are the log's while it runs - for the whole process - and the
+ *                       process's again when it returns. Not thread safe: nothing else may step a simulator or
+ *                       replay meanwhile
+ * @param visit        - called with the state after each step of the window
+ * @return false if the log is corrupt or the recomputed run diverged from the recorded hashes
+ */
+bool replayWindow(const ReplayLog &log, uint32_t fromStep, uint32_t toStep,
+                  const std::function<void(uint32_t step, const Simulator &state)> &visit);
+
+// recompute several windows in parallel, one thread per window - visit must be thread safe. The model as for
+// replayWindow, with the same restriction. Returns false if any of them failed
+bool replayWindows(const ReplayLog &log, const std::vector<std::pair<uint32_t, uint32_t>> &windows,
+                   const std::function<void(uint32_t step, const Simulator &state)> &visit);
+
+} // namespace simulator
+
+#endif // REPLAY_H
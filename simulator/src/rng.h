@@ -0,0 +1,125 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include "defs.h"
+
+#include <cstdint>
+
+namespace simulator
+{
+
+/* CounterRng
+ * Counter based random numbers (Philox4x32-10, Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+ *
+ * There is no generator state: a draw is a pure function of (seed, road, vehicle, step, index).
+ * The same draw gives the same number no matter which thread makes it or in which order roads are updated,
+ * so a parallel run reproduces the serial run exactly.
+ *
+ *      - seed  - the key. One per simulation run or per ensemble replication (see forStream)
+ *      - road  - road the draw belongs to (low 32 bits of the id)
+ *      - vehicle, step - who draws and when
+ *      - index - several independent numbers for the same (road, vehicle, step)
+ *
+ * Each draw gives 4 independent 32 bit words; uniform() uses two of them for a 53 bit double.
+ */
+class CounterRng
+{
+public:
+    struct Block
+    {
+        uint32_t v[4];
+    };
+
+private:
+    uint32_t key[2];
+
+    static const uint32_t M0 = 0xD2511F53;
+    static const uint32_t M1 = 0xCD9E8D57;
+    static const uint32_t W0 = 0x9E3779B9; // golden ratio
+    static const uint32_t W1 = 0xBB67AE85; // sqrt(3) - 1
+
+    static inline Block philox(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1)
+    {
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = (uint64_t)M0 * c0;
+            uint64_t p1 = (uint64_t)M1 * c2;
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (uint32_t)p1;
+            c3 = (uint32_t)p0;
+            c0 = n0;
+            c2 = n2;
+            k0 += W0;
+            k1 += W1;
+        }
+        return Block{ { c0, c1, c2, c3 } };
+    }
+
+    static inline double toUniform(uint32_t hi, uint32_t lo)
+    {
+        return (double)((((uint64_t)hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0); // 2^-53
+    }
+
+public:
+    explicit CounterRng(uint64_t seed = 0)
+    {
+        key[0] = (uint32_t)seed;
+        key[1] = (uint32_t)(seed >> 32);
+    }
+
+    // the seed of stream (ensemble replication, step of a run, ...) of a seed
+    static uint64_t streamSeed(uint64_t seed, uint64_t stream)
+    {
+        // splitmix64 finalizer, so neighbour streams get unrelated keys
+        uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // independent generator for stream of a seed
+    static CounterRng forStream(uint64_t seed, uint64_t stream)
+    {
+        return CounterRng(streamSeed(seed, stream));
+    }
+
+    Block draw(roadID road, uint32_t vehicle, uint32_t step, uint32_t index = 0) const
+    {
+        return philox((uint32_t)road, vehicle, step, index, key[0], key[1]);
+    }
+
+    // uniform double in [0, 1)
+    double uniform(roadID road, uint32_t vehicle, uint32_t step, uint32_t index = 0) const
+    {
+        Block b = draw(road, vehicle, step, index);
+        return toUniform(b.v[0], b.v[1]);
+    }
+
+    // uniform integer in [lo, hi]
+    int uniformInt(int lo, int hi, roadID road, uint32_t vehicle, uint32_t step, uint32_t index = 0) const
+    {
+        uint64_t range = (uint64_t)((int64_t)hi - lo + 1);
+        return lo + (int)((draw(road, vehicle, step, index).v[0] * range) >> 32);
+    }
+
+    /**
+     * @brief uniformBlock - bulk draws for vehicles firstVehicle .. firstVehicle + count - 1.
+     *                       out[i] == uniform(road, firstVehicle + i, step, index).
+     *                       No branches and no state carried between iterations, so the compiler can vectorize it.
+     */
+    void uniformBlock(roadID road, uint32_t firstVehicle, uint32_t step, uint32_t index,
+                      unsigned count, double *out) const
+    {
+        const uint32_t k0 = key[0];
+        const uint32_t k1 = key[1];
+        #pragma omp simd
+        for (unsigned i = 0; i < count; ++i) {
+            Block b = philox((uint32_t)road, firstVehicle + i, step, index, k0, k1);
+            out[i] = toUniform(b.v[0], b.v[1]);
+        }
+    }
+};
+
+} // namespace simulator
+
+#endif // RNG_H
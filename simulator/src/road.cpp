@@ -1,16 +1,19 @@
 #include "road.h"
 #include "config.h"
 #include "logger.h"
+#include "mobil.h"
+#include "binaryio.h"
+#include "profiler.h"
+#include "rng.h"
 
 #include <algorithm>
+#include <iterator>
+#include <utility>
 
 namespace simulator
 {
 
 const Vehicle Road::noVehicle(0.0, 0.0, 0.0);
-Vehicle Road::trafficLightObject(0.0, 1.0, 0.0);
-const double Road::minChangeLaneDist = 0.5;
-const double Road::maxChangeLaneDist = 25.0;
 
 Road::Road()
 {
@@ -19,11 +22,11 @@ Road::Road()
 Road::Road( roadID id, double rLength, unsigned lanes, double maxSpeed_mps ) :
     id (id), length(rLength), usageProb(0.5), lanesNo(lanes), maxSpeed(maxSpeed_mps)
 {
-    log_info("New road added: \n"
-             "\t ID: %u \n"
+    log_debug("New road added: \n"
+             "\t ID: %lu \n"
              "\t length: %.2f m\n"
-             "\t lanes: %d \n"
-             "\t max_speed: %.2f km/h \n",
+             "\t lanes: %u \n"
+             "\t max_speed: %u m/s \n",
              id, length, lanesNo, maxSpeed);
 
     for(unsigned i = 0; i < lanesNo; ++i) {
@@ -31,7 +34,13 @@ Road::Road( roadID id, double rLength, unsigned lanes, double maxSpeed_mps ) :
         trafficLights.push_back(TrafficLight(10, 1, 30, TrafficLight::red_light));
 
     }
+    connections.resize(lanesNo);
 
+    placeStopLine();
+}
+
+void Road::placeStopLine()
+{
     trafficLightObject = Vehicle(length - Config::trafficLightDistToRoadEnd, 0.0, 0.0, Vehicle::traffic_light);
 }
 
@@ -40,27 +49,127 @@ Road::Road( roadID id, double rLength, unsigned lanes, double maxSpeed_mps ) :
 void Road::addVehicle(Vehicle v, unsigned lane)
 {
     if(lane >= lanesNo) {
-        log_warning("Assigned vehicle to road %u on lane %d, where the road has only %d lanes.", id, lane, lanesNo);
+        log_warning("Assigned vehicle to road %lu on lane %u, where the road has only %u lanes.", id, lane, lanesNo);
         lane = 0; //TODO: throw exception?
     }
-    vehicles[lane].push_back(v);
+    // the itinerary of the vehicle on the lane - it used to go to the local copy
     v.addRoadToItinerary(id);
+    vehicles[lane].push_back(std::move(v));
+    ++cost.inserts;
+}
+
+bool Road::enterVehicle(Vehicle &v, unsigned lane)
+{
+    std::vector<Vehicle> &target = vehicles[lane];
+    if (!target.empty() && !v.hasGap(target.back(), noVehicle))
+        return false;
+    addVehicle(std::move(v), lane);
+    return true;
+}
+
+void Road::holdVehicle(Vehicle &&v, unsigned lane)
+{
+    /* where it left: the vehicle behind followed it there for the step, as if it drove on - and may have closed
+     * in past its tail. Then it stops just ahead of that one */
+    std::vector<Vehicle> &target = vehicles[lane];
+    v.shift(length);
+    v.stopAt(target.empty() ? v.getPos() : std::max(v.getPos(), target.front().getPos() + v.getLength()));
+    target.insert(target.begin(), std::move(v));
+    ++cost.inserts;
+}
+
+void Road::addVehicles(std::vector<Vehicle> &&laneVehicles, unsigned lane)
+{
+    if(lane >= lanesNo) {
+        log_warning("Assigned %zu vehicles to road %lu on lane %u, where the road has only %u lanes.",
+                    laneVehicles.size(), id, lane, lanesNo);
+        lane = 0;
+    }
+
+    // take the whole buffer over, unless the lane has vehicles or room already (reserveVehicles)
+    std::vector<Vehicle> &target = vehicles[lane];
+    size_t first = target.size();
+    if (target.empty() && target.capacity() < laneVehicles.size()) {
+        target = std::move(laneVehicles);
+    } else {
+        target.reserve(target.size() + laneVehicles.size());
+        std::move(laneVehicles.begin(), laneVehicles.end(), std::back_inserter(target));
+    }
+    laneVehicles.clear();
+
+    for (size_t i = first; i < target.size(); ++i)
+        target[i].addRoadToItinerary(id);
+    cost.inserts += target.size() - first;
+}
+
+void Road::setBoundary(Boundary b)
+{
+    boundary = b;
+}
+
+Road::Boundary Road::getBoundary() const
+{
+    return boundary;
 }
 
 void Road::addLaneConnection(unsigned lane, roadID road)
 {
     if (lane >= lanesNo) {
-        log_error("Cannot connect road %u with lane %d. Max lanes: %d", road, lane, lanesNo);
+        log_error("Cannot connect road %lu with lane %u. Max lanes: %u", road, lane, lanesNo);
         return;
     }
     connections[lane].push_back(road);
 }
 
+void Road::setTrafficLight(unsigned lane, const TrafficLight &light)
+{
+    if (lane >= lanesNo) {
+        log_error("Cannot set traffic light of road %lu on lane %u. Max lanes: %u", id, lane, lanesNo);
+        return;
+    }
+    trafficLights[lane] = light;
+}
+
+void Road::setTrafficLightColor(unsigned lane, TrafficLight::LightColor color)
+{
+    if (lane >= lanesNo) {
+        log_error("Cannot set traffic light of road %lu on lane %u. Max lanes: %u", id, lane, lanesNo);
+        return;
+    }
+    trafficLights[lane].setColor(color);
+}
+
+const std::vector<TrafficLight>& Road::getTrafficLights() const
+{
+    return trafficLights;
+}
+
+void Road::setCoordinates(roadPosCard start, roadPosCard end)
+{
+    startPosCard = start;
+    endPosCard = end;
+}
+
+roadPosCard Road::getStartPosCard() const
+{
+    return startPosCard;
+}
+
+roadPosCard Road::getEndPosCard() const
+{
+    return endPosCard;
+}
+
 roadID Road::getId() const
 {
     return id;
 }
 
+const std::vector<std::vector<roadID>>& Road::getConnections() const
+{
+    return connections;
+}
+
 unsigned Road::getMaxSpeed() const
 {
     return maxSpeed;
@@ -76,6 +185,22 @@ unsigned Road::getLength() const
     return length;
 }
 
+int Road::numberVehicles(int firstId)
+{
+    for (auto &lane : vehicles)
+        for (Vehicle &v : lane)
+            v.setId(firstId++);
+    return firstId;
+}
+
+unsigned Road::getVehiclesNo() const
+{
+    unsigned vehiclesNo = 0;
+    for (auto &lane : vehicles)
+        vehiclesNo += lane.size();
+    return vehiclesNo;
+}
+
 const std::vector<std::vector<Vehicle>>& Road::getVehicles() const
 {
     return vehicles;
@@ -88,6 +213,83 @@ void Road::indexRoad()
     for(std::vector<Vehicle> &lane : vehicles)
         std::sort(lane.begin(), lane.end(), [](const auto &lhs, const auto &rhs)
         { return lhs.getPos() > rhs.getPos(); });
+
+    reserveLanes(nullptr);
+}
+
+void Road::reserveVehicles(const std::vector<size_t> &vehiclesPerLane)
+{
+    if (vehiclesPerLane.size() != vehicles.size()) {
+        log_warning("Road %lu: room asked for %zu lanes, the road has %u", id, vehiclesPerLane.size(), lanesNo);
+        return;
+    }
+    reserveLanes(vehiclesPerLane.data());
+}
+
+void Road::reserveTransfers(size_t itineraryRoads)
+{
+    std::vector<size_t> added;
+    for (std::vector<Vehicle> &lane : vehicles) {
+        added.push_back(lane.size());
+        for (Vehicle &vehicle : lane)
+            vehicle.reserveItinerary(itineraryRoads);
+    }
+    reserveLanes(added.data());
+}
+
+void Road::clearVehicles()
+{
+    for (std::vector<Vehicle> &lane : vehicles)
+        std::vector<Vehicle>().swap(lane);
+}
+
+void Road::relocate(Released &released)
+{
+    std::vector<TrafficLight> lights(trafficLights.begin(), trafficLights.end());
+    std::swap(trafficLights, lights);
+    released.lights.push_back(std::move(lights));
+
+    // with the lane change room indexRoad would make, so the first step doesn't move the lanes again
+    for (size_t l = 0; l < vehicles.size(); ++l) {
+        std::vector<Vehicle> moved;
+        moved.reserve(laneCapacity(l, nullptr));
+        std::move(vehicles[l].begin(), vehicles[l].end(), std::back_inserter(moved));
+        std::swap(vehicles[l], moved);
+        released.lanes.push_back(std::move(moved));
+    }
+}
+
+/* During a step a lane only takes vehicles from its neighbours, so it never holds more than the three lanes
+ * had at the start. Reserving that - rounded up to a power of two - keeps lane changes from reallocating: after a
+ * few steps lanes stop growing and a step allocates nothing. Not capped at the vehicles of the road: with
+ * transfers that count creeps up a vehicle at a time, and every step would reallocate */
+size_t Road::laneCapacity(size_t lane, const size_t *added) const
+{
+    auto count = [&](size_t l) { return vehicles[l].size() + (added ? added[l] : 0); };
+    if (lanesNo == 1)
+        return std::max(vehicles[lane].capacity(), count(lane));
+
+    size_t most = count(lane);
+    if (lane > 0)
+        most += count(lane - 1);
+    if (lane + 1 < vehicles.size())
+        most += count(lane + 1);
+    if (most <= vehicles[lane].capacity())
+        return vehicles[lane].capacity();
+
+    size_t capacity = 1;
+    while (capacity < most)
+        capacity *= 2;
+    return capacity;
+}
+
+void Road::reserveLanes(const size_t *added)
+{
+    if (lanesNo == 1 && !added)
+        return;
+
+    for (size_t l = 0; l < vehicles.size(); ++l)
+        vehicles[l].reserve(laneCapacity(l, added));
 }
 
 /**
@@ -111,27 +313,34 @@ int getNextLaneLeaderPos(const Vehicle &current, const std::vector<Vehicle> &nex
 /* Lane change model:
  * http://traffic-simulation.de/MOBIL.html
  */
-bool Road::performLaneChange(unsigned laneIndex, const Vehicle &currentVehicle, unsigned vehicleIndex)
+int Road::chooseLaneChange(unsigned laneIndex, const Vehicle &currentVehicle, unsigned vehicleIndex,
+                           int &newLeaderPos, Cost &counts) const
 {
     if (lanesNo == 1)
-        return false;
+        return -1;
 
     const Vehicle &currentLaneLeader = vehicleIndex == 0 ? noVehicle : vehicles[laneIndex][vehicleIndex - 1];
 
-    // quick exit condition - don't change lane before maxChangeLaneDist
-    if(currentLaneLeader.getPos() - currentLaneLeader.getPos() > maxChangeLaneDist) {
-        return false;
+    // quick exit conditions - cooldown, stagger, a leader too far ahead to make another lane worth it
+    const LaneChangePolicy &policy = Config::laneChangePolicy;
+    if (!considersLaneChange(policy, currentVehicle.getStepsSinceLaneChange(), currentVehicle.getId(),
+                             currentLaneLeader.getPos() - currentVehicle.getPos())) {
+        return -1;
     }
 
     // prefer overtaking on the left
     int nextLanesIdxs[2] = { laneIndex + 1 < lanesNo  ? (int)laneIndex + 1 : -1,
                              (int)laneIndex - 1  >= 0 ? (int)laneIndex - 1 : -1 };
 
+    // behind the current leader: the same for both target lanes, worked out for the first that has a gap
+    real accCurrentLeader = 0.0;
+    bool accCurrentLeaderKnown = false;
+
     for(int nextLaneIdx : nextLanesIdxs ) {
         if ( nextLaneIdx < 0 )
             continue;
 
-        std::vector<Vehicle> &nextLane = vehicles[nextLaneIdx];
+        const std::vector<Vehicle> &nextLane = vehicles[nextLaneIdx];
 
         int nextLeaderPos = getNextLaneLeaderPos(currentVehicle, nextLane);
         const Vehicle &nextLaneLeader    = nextLeaderPos == -1 ? noVehicle : nextLane[nextLeaderPos];
@@ -139,12 +348,141 @@ bool Road::performLaneChange(unsigned laneIndex, const Vehicle &currentVehicle,
                                             ((unsigned)nextLeaderPos + 1 < nextLane.size())) ?
                     nextLane[nextLeaderPos + 1] : noVehicle;
 
-        if (currentVehicle.canChangeLane(currentLaneLeader, nextLaneLeader, nextLaneFollower)) {
-            nextLane.insert(nextLane.begin() + nextLeaderPos + 1, currentVehicle);
-            log_debug("Road %u: vehicle %d change from lane %d to lane %d", id, currentVehicle.getId(), laneIndex, nextLaneIdx);
-            return true;
+        ++counts.laneChangeEvaluations;
+        if (!currentVehicle.hasGap(nextLaneLeader, nextLaneFollower))
+            continue;
+        if (!accCurrentLeaderKnown) {
+            accCurrentLeader = currentVehicle.accelerationBehind(currentLaneLeader);
+            accCurrentLeaderKnown = true;
+        }
+        real accNewLeader = currentVehicle.accelerationBehind(nextLaneLeader);
+        if (policy.prefilter && !currentVehicle.mayWantLane(accCurrentLeader, accNewLeader, nextLaneFollower))
+            continue;
+
+        if (currentVehicle.wantsLane(accCurrentLeader, accNewLeader, nextLaneFollower)) {
+            newLeaderPos = nextLeaderPos;
+            return nextLaneIdx;
+        }
+    }
+    return -1;
+}
+
+bool Road::performLaneChange(unsigned laneIndex, Vehicle &currentVehicle, unsigned vehicleIndex)
+{
+    int nextLeaderPos = -1;
+    int nextLaneIdx = chooseLaneChange(laneIndex, currentVehicle, vehicleIndex, nextLeaderPos, cost);
+    if (nextLaneIdx < 0)
+        return false;
+
+    log_debug("Road %lu: vehicle %d change from lane %u to lane %d", id, currentVehicle.getId(), laneIndex, nextLaneIdx);
+    currentVehicle.laneChanged();
+    // moved, not copied: the itinerary goes along without an allocation. The caller erases what's left
+    std::vector<Vehicle> &nextLane = vehicles[nextLaneIdx];
+    nextLane.insert(nextLane.begin() + nextLeaderPos + 1, std::move(currentVehicle));
+    ++cost.laneChanges;
+    ++cost.inserts;
+    return true;
+}
+
+unsigned Road::updateFollowers(unsigned laneIndex, unsigned first, double dt)
+{
+    // per thread, kept between lanes: no allocation once they're large enough
+    static thread_local MobilBatch batch;
+    static thread_local std::vector<Vehicle::Motion> motions;
+    static thread_local std::vector<unsigned> candidates;   // lane index of each vehicle in the batch
+    static thread_local std::vector<unsigned> evaluations;  // laneChangeEvaluations before each vehicle, and all
+    static const std::vector<Vehicle> *const noTargetLanes[2] = { nullptr, nullptr };
+
+    std::vector<Vehicle> &lane = vehicles[laneIndex];
+    const std::vector<Vehicle> *targetLanes[2] = { laneIndex + 1 < lanesNo ? &vehicles[laneIndex + 1] : nullptr,
+                                                   laneIndex > 0 ? &vehicles[laneIndex - 1] : nullptr };
+    const unsigned targetsNo = (targetLanes[0] != nullptr) + (targetLanes[1] != nullptr);
+    {
+        PROFILE_SCOPE(idm_update);
+        motions.clear();
+        for (unsigned i = first; i < lane.size(); ++i) {
+            motions.push_back(lane[i].getMotion());
+            lane[i].update(dt, lane[i - 1]);
         }
+    }
+
+    // MOBIL sees each vehicle as it was before it moved, and its leader after
+    PROFILE_SCOPE(lane_change);
+    const LaneChangePolicy &policy = Config::laneChangePolicy;
+    batch.clear();
+    candidates.clear();
+    evaluations.clear();
+    unsigned evaluated = 0;
+    for (unsigned i = first; i < lane.size(); ++i) {
+        const Vehicle::Motion &before = motions[i - first];
+        bool considers = considersLaneChange(policy, before.laneChangeSteps, lane[i].getId(),
+                                             lane[i - 1].getPos() - before.xPos);
+        evaluations.push_back(evaluated);
+        evaluated += considers ? targetsNo : 0;
+        if (batch.add(lane[i], before, lane[i - 1], considers ? targetLanes : noTargetLanes))
+            candidates.push_back(i);
+    }
+    evaluations.push_back(evaluated);
+    batch.evaluate();
+
+    // the first to change lane, the left lane first. The ones before it moved as they would have one by one
+    size_t changing = 0;
+    MobilBatch::Target target = MobilBatch::left;
+    for (; changing < batch.size(); ++changing) {
+        if (batch.wantsChange(changing, MobilBatch::left))
+            break;
+        if (batch.wantsChange(changing, MobilBatch::right)) {
+            target = MobilBatch::right;
+            break;
+        }
+    }
+    if (changing == batch.size()) {
+        cost.laneChangeEvaluations += evaluated;
+        cost.idmEvaluations += lane.size() - first;
+        return lane.size();
+    }
+
+    unsigned index = candidates[changing];
+    unsigned offset = index - first;
+    // one by one, a change to the left is made before the right lane is looked at
+    unsigned changerEvaluations = evaluations[offset + 1] - evaluations[offset];
+    cost.laneChangeEvaluations += evaluations[offset] + (target == MobilBatch::left ? 1 : changerEvaluations);
+    cost.idmEvaluations += offset;
+    for (size_t i = offset; i < motions.size(); ++i)
+        lane[first + i].setMotion(motions[i]);
+
+    int nextLaneIdx = target == MobilBatch::left ? laneIndex + 1 : laneIndex - 1;
+    std::vector<Vehicle> &nextLane = vehicles[nextLaneIdx];
+    Vehicle &currentVehicle = lane[index];
+    log_debug("Road %lu: vehicle %d change from lane %u to lane %d", id, currentVehicle.getId(), laneIndex, nextLaneIdx);
+    currentVehicle.laneChanged();
+    nextLane.insert(nextLane.begin() + batch.getNewLeaderPos(changing, target) + 1, std::move(currentVehicle));
+    ++cost.laneChanges;
+    ++cost.inserts;
+    lane.erase(lane.begin() + index);
+    return index;
+}
 
+bool Road::updateFirst(unsigned laneIndex, Vehicle &current, const Vehicle &ringLeader, double dt,
+                       const std::map<roadID, Road> &cityMap, std::vector<Transfer> *transfers,
+                       const CounterRng &routes, Cost &counts)
+{
+    if(boundary == periodic) {
+        PROFILE_SCOPE(idm_update);
+        ++counts.idmEvaluations;
+        current.update(dt, ringLeader, length);
+    } else if(performRoadChange(current, laneIndex, cityMap, transfers, routes)) {
+        /* past the stop line it crosses whatever the light shows - with the next road full it comes back, stopped
+         * where it left (holdTransfers) */
+        return true;
+    } else if(trafficLights[laneIndex].isRed() || trafficLights[laneIndex].isYellow()) {
+        PROFILE_SCOPE(idm_update);
+        ++counts.idmEvaluations;
+        current.update(dt, trafficLightObject);
+    } else {
+        PROFILE_SCOPE(idm_update);
+        ++counts.idmEvaluations;
+        current.update(dt, noVehicle);
     }
     return false;
 }
@@ -155,68 +493,512 @@ bool Road::performLaneChange(unsigned laneIndex, const Vehicle &currentVehicle,
  * @param dt - update time
  * @param cityMap - all the roads from the city
  */
-void Road::update(double dt, const std::map<roadID, Road> &cityMap)
+void Road::update(double dt, const std::map<roadID, Road> &cityMap, std::vector<Transfer> *transfers,
+                  const CounterRng &routes)
 {
-    indexRoad();
+    if (Config::laneChangePolicy.simultaneous && (lanesNo > 1 || getSegmentsNo() > 1)) {
+        unsigned segments = beginLanes();
+        for (unsigned laneIndex = 0; laneIndex < lanesNo; ++laneIndex)
+            prepareLane(laneIndex, dt);
+        for (unsigned laneIndex = 0; laneIndex < lanesNo; ++laneIndex)
+            for (unsigned segment = 0; segment < segments; ++segment)
+                decideLaneChanges(laneIndex, segment);
+        commitLaneChanges(dt);
+        for (unsigned laneIndex = 0; laneIndex < lanesNo; ++laneIndex)
+            for (unsigned segment = 0; segment < segments; ++segment)
+                moveLane(laneIndex, segment, dt, cityMap, transfers, routes);
+        finishLanes();
+        return;
+    }
+
+    {
+        PROFILE_SCOPE(index_road);
+        indexRoad();
+    }
 
     unsigned laneIndex = 0;
     for(auto &lane : vehicles) {
+        {
+            PROFILE_SCOPE(signals);
+            trafficLights[laneIndex].update(dt);
+        }
 
-        trafficLights[laneIndex].update(dt);
-
-        unsigned vIndex = 0;
-        for(Vehicle &current : lane) {
+        // vehicles leave the lane while it's updated - index it, a range-for would skip the vehicle after each erase
+        for(unsigned vIndex = 0; vIndex < lane.size(); ) {
+            Vehicle &current = lane[vIndex];
             if(vIndex == 0) {
-                if(trafficLights[laneIndex].isRed() || trafficLights[laneIndex].isYellow()) {
-                    current.update(dt, trafficLightObject);
-                } else {
-                    // TODO: determine which road this vehicle will choose
-                    if(performRoadChange(current, laneIndex, cityMap)) {
+                if(updateFirst(laneIndex, current, lane.back(), dt, cityMap, transfers, routes, cost)) {
+                    // one vehicle leaves a lane per step: the next one follows it as it left, and waits its turn
+                    if (lane.size() > 1) {
+                        PROFILE_SCOPE(idm_update);
+                        ++cost.idmEvaluations;
+                        lane[1].update(dt, lane[0]);
+                    }
+                    lane.erase(lane.begin());
+                    vIndex = 1;
+                    continue;
+                }
+            } else if (lanesNo > 1 && Config::laneChangePolicy.batched) {
+                vIndex = updateFollowers(laneIndex, vIndex, dt);
+                continue;
+            } else if (lanesNo > 1) {
+                /* MOBIL and IDM take turns vehicle by vehicle: timed together, as lane_change - a timer per vehicle
+                 * would cost more than the step it measures */
+                PROFILE_SCOPE(lane_change);
+                while (vIndex < lane.size()) {
+                    if (performLaneChange(laneIndex, lane[vIndex], vIndex)) {
                         lane.erase(lane.begin() + vIndex);
                         continue;
                     }
-
-                    // TODO: Even if we have a green light, check if next road is full.
-                    current.update(dt, noVehicle);
+                    ++cost.idmEvaluations;
+                    lane[vIndex].update(dt, lane[vIndex - 1]);
+                    ++vIndex;
                 }
+                break;
             } else {
-                if (performLaneChange(laneIndex, current, vIndex) ) {
-                    lane.erase(lane.begin() + vIndex);
-                    continue;
-                }
-                current.update(dt, lane[vIndex - 1]);
+                // a single lane: car following only
+                PROFILE_SCOPE(idm_update);
+                cost.idmEvaluations += lane.size() - vIndex;
+                for (; vIndex < lane.size(); ++vIndex)
+                    lane[vIndex].update(dt, lane[vIndex - 1]);
+                break;
             }
             ++vIndex;
         }
         ++laneIndex;
     }
+
+    if (boundary == periodic)
+        wrapAround();
 }
 
-bool Road::performRoadChange(const Vehicle &currentVehicle, unsigned laneIndex, const std::map<roadID, Road> &cityMap)
+unsigned Road::getSegmentsNo() const
 {
-    if(currentVehicle.getPos() >= length) {
+    // at least two segments of the length, or none: a segment is never much shorter
+    double segmentLength = Config::roadSegmentLength;
+    return segmentLength > 0 && length >= 2 * segmentLength ? (unsigned)(length / segmentLength) : 1;
+}
+
+unsigned Road::beginLanes()
+{
+    segmentsNo = getSegmentsNo();
+    size_t parts = (size_t)lanesNo * segmentsNo;
+    if (laneIntents.size() != parts) {
+        laneIntents.resize(parts);
+        laneCosts.resize(parts);
+        halos.resize(parts, noVehicle);
+        segmentBegins.resize(lanesNo * (segmentsNo + 1));
     }
-    return false;
+    leftNo.assign(lanesNo, 0);
+    return segmentsNo;
+}
+
+void Road::findSegments(unsigned laneIndex)
+{
+    // segment s from length * (segmentsNo - s - 1) / segmentsNo up; the first and the last open ended
+    const std::vector<Vehicle> &lane = vehicles[laneIndex];
+    unsigned *begins = &segmentBegins[laneIndex * (segmentsNo + 1)];
+    begins[0] = 0;
+    for (unsigned segment = 1; segment < segmentsNo; ++segment) {
+        double cut = length * (segmentsNo - segment) / segmentsNo;
+        begins[segment] = std::partition_point(lane.begin() + begins[segment - 1], lane.end(),
+                                               [cut](const Vehicle &v) { return v.getPos() >= cut; }) - lane.begin();
+    }
+    begins[segmentsNo] = lane.size();
+}
+
+void Road::prepareLane(unsigned laneIndex, double dt)
+{
+    {
+        PROFILE_SCOPE(index_road);
+        std::vector<Vehicle> &lane = vehicles[laneIndex];
+        std::sort(lane.begin(), lane.end(), [](const auto &lhs, const auto &rhs)
+        { return lhs.getPos() > rhs.getPos(); });
+        findSegments(laneIndex);
+    }
+
+    PROFILE_SCOPE(signals);
+    trafficLights[laneIndex].update(dt);
+}
+
+void Road::decideLaneChanges(unsigned laneIndex, unsigned segment)
+{
+    PROFILE_SCOPE(lane_change);
+    unsigned part = laneIndex * segmentsNo + segment;
+    std::vector<LaneChangeIntent> &intents = laneIntents[part];
+    Cost &counts = laneCosts[part];
+    const std::vector<Vehicle> &lane = vehicles[laneIndex];
+    // the first vehicle of the lane has no leader to overtake
+    const unsigned *begins = &segmentBegins[laneIndex * (segmentsNo + 1)];
+    unsigned first = std::max(1u, begins[segment]);
+    unsigned end = begins[segment + 1];
+    intents.clear();
+
+    if (!Config::laneChangePolicy.batched) {
+        for (unsigned i = first; i < end; ++i) {
+            int newLeaderPos = -1;
+            int target = chooseLaneChange(laneIndex, lane[i], i, newLeaderPos, counts);
+            if (target >= 0)
+                intents.push_back(LaneChangeIntent{ laneIndex, i, (unsigned)target, newLeaderPos, lane[i].getPos(),
+                                                    lane[i].getId() });
+        }
+        return;
+    }
+
+    // MOBIL at once for the whole segment: no vehicle moves before the changes are made
+    static thread_local MobilBatch batch;
+    static thread_local std::vector<unsigned> candidates;
+    static const std::vector<Vehicle> *const noTargetLanes[2] = { nullptr, nullptr };
+
+    const std::vector<Vehicle> *targetLanes[2] = { laneIndex + 1 < lanesNo ? &vehicles[laneIndex + 1] : nullptr,
+                                                   laneIndex > 0 ? &vehicles[laneIndex - 1] : nullptr };
+    const unsigned targetsNo = (targetLanes[0] != nullptr) + (targetLanes[1] != nullptr);
+    const LaneChangePolicy &policy = Config::laneChangePolicy;
+    batch.clear();
+    candidates.clear();
+    for (unsigned i = first; i < end; ++i) {
+        bool considers = considersLaneChange(policy, lane[i].getStepsSinceLaneChange(), lane[i].getId(),
+                                             lane[i - 1].getPos() - lane[i].getPos());
+        counts.laneChangeEvaluations += considers ? targetsNo : 0;
+        if (batch.add(lane[i], lane[i].getMotion(), lane[i - 1], considers ? targetLanes : noTargetLanes))
+            candidates.push_back(i);
+    }
+    batch.evaluate();
+
+    for (size_t c = 0; c < batch.size(); ++c) {
+        MobilBatch::Target target = MobilBatch::left;
+        if (batch.wantsChange(c, MobilBatch::left))
+            // one by one, the right lane isn't looked at after a change to the left
+            counts.laneChangeEvaluations -= targetsNo - 1;
+        else if (batch.wantsChange(c, MobilBatch::right))
+            target = MobilBatch::right;
+        else
+            continue;
+        unsigned i = candidates[c];
+        intents.push_back(LaneChangeIntent{ laneIndex, i, target == MobilBatch::left ? laneIndex + 1 : laneIndex - 1,
+                                            batch.getNewLeaderPos(c, target), lane[i].getPos(), lane[i].getId() });
+    }
+}
+
+void Road::commitLaneChanges(double dt)
+{
+    PROFILE_SCOPE(lane_change);
+    // the room indexRoad makes: lanes are only resized from here on
+    reserveLanes(nullptr);
+
+    changes.clear();
+    for (const std::vector<LaneChangeIntent> &intents : laneIntents)
+        changes.insert(changes.end(), intents.begin(), intents.end());
+    cost.laneChangeConflicts += resolveLaneChanges(changes);
+    if (!changes.empty())
+        makeLaneChanges();
+
+    // the cuts again, with the vehicles that changed lane, and the halos as the move will find them
+    for (unsigned laneIndex = 0; laneIndex < lanesNo; ++laneIndex) {
+        const std::vector<Vehicle> &lane = vehicles[laneIndex];
+        findSegments(laneIndex);
+        const unsigned *begins = &segmentBegins[laneIndex * (segmentsNo + 1)];
+        Vehicle *laneHalos = &halos[laneIndex * segmentsNo];
+        if (boundary == periodic && !lane.empty())
+            laneHalos[0] = lane.back();
+        for (unsigned segment = 1; segment < segmentsNo; ++segment)
+            if (begins[segment] > 0 && begins[segment] < begins[segment + 1]) {
+                laneHalos[segment] = lane[begins[segment] - 1];
+                laneHalos[segment].coast(dt);
+            }
+    }
+}
+
+void Road::makeLaneChanges()
+{
+
+    // out of their lanes, from the back of every lane: the indices of the others stay as they were decided on
+    changingVehicles.clear();
+    leaving.clear();
+    for (const LaneChangeIntent &change : changes) {
+        changingVehicles.push_back(std::move(vehicles[change.fromLane][change.index]));
+        leaving.push_back(std::make_pair(change.fromLane, change.index));
+    }
+    std::sort(leaving.begin(), leaving.end());
+    for (auto left = leaving.rbegin(); left != leaving.rend(); ++left)
+        vehicles[left->first].erase(vehicles[left->first].begin() + left->second);
+
+    // into theirs, the last gap first: right behind the new leader, less the vehicles that left ahead of it
+    for (size_t c = changes.size(); c-- > 0; ) {
+        const LaneChangeIntent &change = changes[c];
+        size_t pos = change.newLeaderPos + 1;
+        if (change.newLeaderPos >= 0)
+            pos -= std::upper_bound(leaving.begin(), leaving.end(),
+                                    std::make_pair(change.toLane, (unsigned)change.newLeaderPos)) -
+                   std::lower_bound(leaving.begin(), leaving.end(), std::make_pair(change.toLane, 0u));
+
+        Vehicle &vehicle = changingVehicles[c];
+        log_debug("Road %lu: vehicle %d change from lane %u to lane %u", id, vehicle.getId(), change.fromLane,
+                  change.toLane);
+        vehicle.laneChanged();
+        std::vector<Vehicle> &nextLane = vehicles[change.toLane];
+        nextLane.insert(nextLane.begin() + pos, std::move(vehicle));
+        ++cost.laneChanges;
+        ++cost.inserts;
+    }
+}
+
+void Road::moveLane(unsigned laneIndex, unsigned segment, double dt, const std::map<roadID, Road> &cityMap,
+                    std::vector<Transfer> *transfers, const CounterRng &routes)
+{
+    unsigned part = laneIndex * segmentsNo + segment;
+    Cost &counts = laneCosts[part];
+    std::vector<Vehicle> &lane = vehicles[laneIndex];
+    const unsigned *begins = &segmentBegins[laneIndex * (segmentsNo + 1)];
+    unsigned begin = begins[segment];
+    unsigned end = begins[segment + 1];
+    if (begin == end)
+        return;
+
+    unsigned i = begin;
+    if (begin == 0) {
+        // the first vehicle leaving the road leads the next one as it left. It's erased once every segment moved
+        const Vehicle &ringLeader = halos[laneIndex * segmentsNo];
+        bool left = updateFirst(laneIndex, lane[i], ringLeader, dt, cityMap, transfers, routes, counts);
+        leftNo[laneIndex] = left ? 1 : 0;
+    } else {
+        // behind the halo: the segment ahead is moving
+        PROFILE_SCOPE(idm_update);
+        ++counts.idmEvaluations;
+        lane[i].update(dt, halos[part]);
+    }
+
+    PROFILE_SCOPE(idm_update);
+    counts.idmEvaluations += i + 1 < end ? end - i - 1 : 0;
+    for (++i; i < end; ++i)
+        lane[i].update(dt, lane[i - 1]);
+
+    if (boundary == periodic)
+        for (unsigned v = begin; v < end; ++v)
+            if (lane[v].getPos() >= length)
+                lane[v].shift(-length);
+}
+
+void Road::finishLanes()
+{
+    for (unsigned laneIndex = 0; laneIndex < lanesNo; ++laneIndex)
+        vehicles[laneIndex].erase(vehicles[laneIndex].begin(), vehicles[laneIndex].begin() + leftNo[laneIndex]);
+
+    for (Cost &counts : laneCosts) {
+        cost.idmEvaluations += counts.idmEvaluations;
+        cost.laneChangeEvaluations += counts.laneChangeEvaluations;
+        counts = Cost();
+    }
+}
+
+void Road::wrapAround()
+{
+    for (auto &lane : vehicles)
+        for (Vehicle &v : lane)
+            if (v.getPos() >= length)
+                v.shift(-length);
+}
+
+const Road::Cost& Road::getCost() const
+{
+    return cost;
+}
+
+void Road::addUpdateCost(uint64_t updateTicks, unsigned vehiclesNo)
+{
+    // an exponential average over about the last 16 updates: follows the traffic, ignores a single slow step
+    const double smoothing = 1.0 / 16.0;
+
+    cost.weight = cost.updates ? cost.weight + smoothing * (updateTicks - cost.weight) : updateTicks;
+    cost.ticks += updateTicks;
+    cost.vehicleUpdates += vehiclesNo;
+    ++cost.updates;
+}
+
+void Road::resetCost()
+{
+    cost = Cost();
+}
+
+bool Road::performRoadChange(Vehicle &currentVehicle, unsigned laneIndex, const std::map<roadID, Road> &cityMap,
+                             std::vector<Transfer> *transfers, const CounterRng &routes)
+{
+    if(!transfers || currentVehicle.getPos() < length)
+        return false;
+
+    double usage = 0.0;
+    for (roadID next : connections[laneIndex]) {
+        auto road = cityMap.find(next);
+        if (road != cityMap.end())
+            usage += road->second.usageProb;
+    }
+    if (usage <= 0.0) {
+        log_debug("Road %lu: vehicle %d leaves the network", id, currentVehicle.getId());
+        return true;
+    }
+
+    // a pure function of the run's seed, the step, the road and the vehicle: every engine and thread draws the same
+    double draw = usage * routes.uniform(id, currentVehicle.getId(), currentVehicle.getItinerarySize());
+    roadID chosen = id;
+    for (roadID next : connections[laneIndex]) {
+        auto road = cityMap.find(next);
+        if (road == cityMap.end())
+            continue;
+        chosen = next;
+        draw -= road->second.usageProb;
+        if (draw < 0.0)
+            break;
+    }
+
+    // what's left of currentVehicle stays where it was, to lead the vehicle behind for the rest of the step
+    transfers->push_back(Transfer{ id, chosen, laneIndex, std::move(currentVehicle) });
+    transfers->back().vehicle.shift(-length);
+    return true;
+}
+
+size_t enterTransfers(std::vector<Road::Transfer> &transfers, std::map<roadID, Road> &roads)
+{
+    std::sort(transfers.begin(), transfers.end(), [](const Road::Transfer &lhs, const Road::Transfer &rhs)
+    { return lhs.to != rhs.to ? lhs.to < rhs.to :
+             lhs.from != rhs.from ? lhs.from < rhs.from : lhs.vehicle.getId() < rhs.vehicle.getId(); });
+
+    size_t entered = 0;
+    size_t held = 0;
+    auto road = roads.end();
+    for (Road::Transfer &transfer : transfers) {
+        if (road == roads.end() || road->first != transfer.to)
+            road = roads.find(transfer.to);
+        if (road == roads.end())
+            continue;
+        Road &next = road->second;
+        if (next.enterVehicle(transfer.vehicle, std::min(transfer.lane, next.getLanesNo() - 1))) {
+            ++entered;
+            continue;
+        }
+        if (&transfers[held] != &transfer)
+            transfers[held] = std::move(transfer);
+        ++held;
+    }
+    transfers.erase(transfers.begin() + held, transfers.end());
+    return entered;
+}
+
+void holdTransfers(std::vector<Road::Transfer> &transfers, std::map<roadID, Road> &roads)
+{
+    // by road left: one vehicle a lane, the order of the lanes doesn't matter
+    std::sort(transfers.begin(), transfers.end(), [](const Road::Transfer &lhs, const Road::Transfer &rhs)
+    { return lhs.from != rhs.from ? lhs.from < rhs.from : lhs.lane < rhs.lane; });
+
+    size_t kept = 0;
+    auto road = roads.end();
+    for (Road::Transfer &transfer : transfers) {
+        if (road == roads.end() || road->first != transfer.from)
+            road = roads.find(transfer.from);
+        if (road != roads.end()) {
+            road->second.holdVehicle(std::move(transfer.vehicle), transfer.lane);
+            continue;
+        }
+        if (&transfers[kept] != &transfer)
+            transfers[kept] = std::move(transfer);
+        ++kept;
+    }
+    transfers.erase(transfers.begin() + kept, transfers.end());
 }
 
 void Road::printRoad() const
 {
 
-    log_info("Road ID:    %u\n"
-             "Length:       %d\n"
-             "Lanes:        %d\n"
-             "Max speed:    %d\n"
+    log_info("Road ID:    %lu\n"
+             "Length:       %.2f\n"
+             "Lanes:        %u\n"
+             "Max speed:    %u\n"
              "Usage:        %.2f\n"
-             "Vehicle No.:  %d\n"
+             "Vehicle No.:  %zu\n"
              "Start:        (%f, %f)\n"
-             "End:          (%f, %f)\n"
-             "Connections:  %s\n",
+             "End:          (%f, %f)\n",
              id, length, lanesNo, maxSpeed, usageProb, vehicles.size(),
-             startPosGeo.first, startPosGeo.second, endPosGeo.first, endPosGeo.second);//, connections_str.c_str());
+             startPosGeo.first, startPosGeo.second, endPosGeo.first, endPosGeo.second);
 
     for(auto lane : vehicles )
         for(auto v : lane)
             v.printVehicle();
 }
 
+void Road::saveState(std::ostream &out) const
+{
+    writeBinary(out, id);
+    writeBinary(out, length);
+    writeBinary(out, startPosGeo);
+    writeBinary(out, endPosGeo);
+    writeBinary(out, startPosCard);
+    writeBinary(out, endPosCard);
+    writeBinary(out, usageProb);
+    writeBinary(out, lanesNo);
+    writeBinary(out, maxSpeed);
+    writeBinary(out, boundary);
+
+    writeBinary(out, (uint64_t)connections.size());
+    for (auto &laneConnections : connections)
+        writeBinary(out, laneConnections);
+
+    writeBinary(out, (uint64_t)vehicles.size());
+    for (auto &lane : vehicles) {
+        writeBinary(out, (uint64_t)lane.size());
+        for (auto &vehicle : lane)
+            vehicle.saveState(out);
+    }
+
+    writeBinary(out, (uint64_t)trafficLights.size());
+    for (auto &light : trafficLights)
+        light.saveState(out);
+}
+
+bool Road::loadState(std::istream &in)
+{
+    if (!(readBinary(in, id) &&
+          readBinary(in, length) &&
+          readBinary(in, startPosGeo) &&
+          readBinary(in, endPosGeo) &&
+          readBinary(in, startPosCard) &&
+          readBinary(in, endPosCard) &&
+          readBinary(in, usageProb) &&
+          readBinary(in, lanesNo) &&
+          readBinary(in, maxSpeed) &&
+          readBinary(in, boundary)))
+        return false;
+    placeStopLine();
+
+    uint64_t size = 0;
+    if (!readBinary(in, size))
+        return false;
+    connections.resize(size);
+    for (auto &laneConnections : connections)
+        if (!readBinary(in, laneConnections))
+            return false;
+
+    if (!readBinary(in, size))
+        return false;
+    vehicles.assign(size, std::vector<Vehicle>());
+    for (auto &lane : vehicles) {
+        uint64_t laneSize = 0;
+        if (!readBinary(in, laneSize))
+            return false;
+        lane.reserve(laneSize);
+        for (uint64_t i = 0; i < laneSize; ++i) {
+            lane.push_back(noVehicle);
+            if (!lane.back().loadState(in))
+                return false;
+        }
+    }
+
+    if (!readBinary(in, size))
+        return false;
+    trafficLights.resize(size);
+    for (auto &light : trafficLights)
+        if (!light.loadState(in))
+            return false;
+
+    return true;
+}
+
 } // namespace simulator
@@ -3,8 +3,11 @@
 
 #include "vehicle.h"
 #include "defs.h"
+#include "lanechange.h"
+#include "rng.h"
 #include "trafficlight.h"
 
+#include <cstdint>
 #include <utility>
 #include <vector>
 #include <list>
@@ -15,6 +18,7 @@ namespace simulator
 
 class Road
 {
+private:
     /***
      * A road is the one-way section between two semaphores. If a real road (from OMS or else) determines that
      * a road has two ways, we will tread those separately.
@@ -37,6 +41,40 @@ class Road
      * Right and ahead are usually together; also, right turn can be always green, yielding vehicles comming from left.
      */
 
+public:
+    /* What updating this road costs - step time and operation counts, attributed to the road.
+     * Drives hotspot reports and the weights parallel updates balance with.
+     * Not part of the simulation state: not saved, not hashed, copied along with the road. */
+    struct Cost
+    {
+        uint64_t updates = { 0 };               // steps the road was updated in
+        uint64_t ticks = { 0 };                 // Profiler::ticks spent in Road::update
+        uint64_t vehicleUpdates = { 0 };        // vehicles on the road at update, summed over steps
+        uint64_t idmEvaluations = { 0 };        // Vehicle::update calls
+        uint64_t laneChangeEvaluations = { 0 }; // MOBIL evaluations of a target lane
+        uint64_t laneChanges = { 0 };
+        uint64_t laneChangeConflicts = { 0 };   // simultaneous lane changes dropped for another into the same gap
+        uint64_t inserts = { 0 };               // vehicles added to a lane: new ones and lane changes
+        double weight = { 0 };                  // ticks per update, smoothed over the last steps
+    };
+
+    /* What happens at the end of the road.
+     *  open     - vehicles stop at the light, or drive on to a connected road
+     *  periodic - a ring: vehicles passing the end re-enter at the start of their lane, so the number of vehicles
+     *             never changes. The last vehicle of a lane, a lap ahead, leads the first one. No stop line.
+     *             Steady workloads for benchmarks and stop-and-go wave studies (bench/ring.cpp) */
+    enum Boundary { open, periodic };
+
+    /* A vehicle that drove past the end of an open road onto a connected one during a step (performRoadChange).
+     * Roads don't touch each other during a step: whoever updates the roads collects the transfers and enters
+     * them afterwards (enterTransfers). One that doesn't fit on its new road goes back (holdTransfers) */
+    struct Transfer
+    {
+        roadID from;
+        roadID to;
+        unsigned lane;      // the lane it left - it keeps it on the new road, if there's one
+        Vehicle vehicle;    // its position already counted from the start of the new road
+    };
 
 private:
     /*
@@ -89,6 +127,8 @@ private:
      * this doesn't have to be strictly conformed by drivers */
     unsigned maxSpeed;
 
+    Boundary boundary = { open };
+
     /*
      * Right side driving only for now (left side steering wheel)
      *      lane 0 is the most right ("slow lane"), whilst lane n is the most left ("fast lane")
@@ -106,34 +146,98 @@ private:
      */
     std::vector<TrafficLight> trafficLights;
 
-    static Vehicle trafficLightObject;
-
-    /* Don't consider lane change when leader is more than minChangeLaneDist ahead.
-     * This is a minor optimization - we don't do all the math for lane change if it's no needed */
-    static const double maxChangeLaneDist; // 25 meters
-    static const double minChangeLaneDist; // 1 meters
+    /* stands at this road's stop line (length - Config::trafficLightDistToRoadEnd) and leads the first vehicle
+     * of a lane on red. Per road: roads have different lengths */
+    Vehicle trafficLightObject = { Vehicle(0.0, 0.0, 0.0, Vehicle::traffic_light) };
 
     static const Vehicle noVehicle; // we use this when no vehicle is on front - free road
 
+    Cost cost;
+
+    /* simultaneous lane changes (LaneChangePolicy::simultaneous): what every part of the road - a lane, or a
+     * segment of it - decided and what updating it cost, kept apart so parts can be worked on by several
+     * threads; and the buffers of the commit. Scratch, kept between steps so a step allocates nothing.
+     * Parts by [lane * segmentsNo + segment] */
+    std::vector<std::vector<LaneChangeIntent>> laneIntents;
+    std::vector<Cost> laneCosts;
+    std::vector<LaneChangeIntent> changes;
+    std::vector<Vehicle> changingVehicles;
+    std::vector<std::pair<unsigned, unsigned>> leaving;  // lane and index of the vehicles changing lane
+
+    /* segments (Config::roadSegmentLength): every lane of a long road is cut, at fixed positions, into stretches
+     * of about that length that move apart. A segment is the run of the sorted lane between two cuts, so vehicles
+     * cross from one to the next without being moved anywhere. The first vehicle of a segment follows the halo:
+     * a copy of its leader, the last vehicle of the segment ahead, coasted through the step (Vehicle::coast) -
+     * the segment ahead is moving at the same time. One by one it would follow its leader as moved; as it was,
+     * every cut would brake the traffic. MOBIL needs no halo: it reads the road as the step found it */
+    unsigned segmentsNo = { 1 };
+    std::vector<unsigned> segmentBegins;    // [lane * (segmentsNo + 1) + segment]: the lane's size last
+    std::vector<Vehicle> halos;             // by part. Segment 0: the leader of the first vehicle on a ring
+    std::vector<unsigned> leftNo;           // of every lane: the vehicle that drove off its front during the move, or none
+
 private:
 
+    void placeStopLine();
+
+    // periodic boundary: move the vehicles past the end back to the start
+    void wrapAround();
+
     /**
      * @brief changeLane     - perform a lane change of currentVehicle, if it's phisically possible and if can gain some acceleration
      * @param laneIndex      - the index of the lane that the current vehicle is driving on
-     * @param currentVehicle - a reference to currentVehicle object
+     * @param currentVehicle - a reference to currentVehicle object. Moved to the new lane on a lane change
      * @param vehicleIndex   - currentVehicle's index on the current lane
      * @return true if vehicle has changed lane or false if not
      */
-    bool performLaneChange(unsigned laneIndex, const Vehicle &currentVehicle, unsigned vehicleIndex);
+    bool performLaneChange(unsigned laneIndex, Vehicle &currentVehicle, unsigned vehicleIndex);
+
+    /* MOBIL for currentVehicle, without the change: the lane it would change to, -1 - none. newLeaderPos gets the
+     * index of its new leader there, as getNextLaneLeaderPos. The evaluations are counted in counts */
+    int chooseLaneChange(unsigned laneIndex, const Vehicle &currentVehicle, unsigned vehicleIndex, int &newLeaderPos,
+                         Cost &counts) const;
+
+    /* the step of current, the first vehicle of a lane: the light, the ring - behind ringLeader - or the next road.
+     * True if it left the road: moved to transfers, for the caller to erase. counts: where the IDM evaluations go */
+    bool updateFirst(unsigned laneIndex, Vehicle &current, const Vehicle &ringLeader, double dt,
+                     const std::map<roadID, Road> &cityMap, std::vector<Transfer> *transfers, const CounterRng &routes,
+                     Cost &counts);
+
+    // the lane changes left after the conflicts - in changes - out of their lanes and into the others
+    void makeLaneChanges();
+
+    // where the segments of a lane start, from the positions of its vehicles
+    void findSegments(unsigned laneIndex);
+
+    /**
+     * @brief updateFollowers - performLaneChange and the car following step of every vehicle of a lane from first on,
+     *                          up to the first that changes lane - with MOBIL evaluated for all of them at once
+     *                          (MobilBatch). They all move first, as if none changed lane, so every one has its
+     *                          leader where the one by one update leaves it. The vehicles behind the first to
+     *                          change lane are put back, and the caller goes on from there
+     * @param laneIndex - the lane being updated
+     * @param first     - the first vehicle to update, at least 1: its leader moved already
+     * @return the index of the vehicle to go on with, the lane's size when done
+     */
+    unsigned updateFollowers(unsigned laneIndex, unsigned first, double dt);
+
+    // lane capacity for the vehicles on the lanes, added more (per lane, may be null) and their lane changes
+    void reserveLanes(const size_t *added);
+    size_t laneCapacity(size_t lane, const size_t *added) const;
 
     /**
-     * @brief performRoadChange - change the road that currentVehicle is driving on, if necessary
-     * @param currentVehicle - current updated vehicle
+     * @brief performRoadChange - change the road that currentVehicle is driving on, if it passed the end of this one.
+     *                            The next road is one of the lane's connections found in cityMap, drawn by their
+     *                            usage probability; with none the vehicle leaves the network
+     * @param currentVehicle - current updated vehicle. Moved to transfers when it changes road - its position stays,
+     *                         the vehicle behind follows it for the rest of the step
      * @param laneIndex      - lane being processed
      * @param cityMap        - all roads from this city
-     * @return true if currentVehicle moved to another road, false otherwise
+     * @param transfers      - where vehicles changing road go. Null - vehicles stay on this road
+     * @param routes         - the route draws of this step: drawn for (road, vehicle, roads driven so far)
+     * @return true if currentVehicle left this road, false otherwise
      */
-    bool performRoadChange(const Vehicle &currentVehicle, unsigned laneIndex, const std::map<roadID, Road> &cityMap);
+    bool performRoadChange(Vehicle &currentVehicle, unsigned laneIndex, const std::map<roadID, Road> &cityMap,
+                           std::vector<Transfer> *transfers, const CounterRng &routes);
 
 public:
     Road();
@@ -141,6 +245,45 @@ public:
 
     void addVehicle(Vehicle v, unsigned lane);
 
+    /* a vehicle coming from another road, at the start of lane: it enters if it keeps its minimum gap to the last
+     * vehicle there (Vehicle::hasGap). False - it doesn't fit, and v is left as it was */
+    bool enterVehicle(Vehicle &v, unsigned lane);
+
+    /* a vehicle of this road that didn't fit on its next road: back at the front of lane, stopped where it
+     * left - the vehicle behind followed it there - or just ahead of that one, if it closed in past its tail */
+    void holdVehicle(Vehicle &&v, unsigned lane);
+
+    // bulk population of a lane: the vehicles are moved in, with room made for all of them up front
+    void addVehicles(std::vector<Vehicle> &&laneVehicles, unsigned lane);
+
+    /* room for vehiclesPerLane more vehicles on each lane, and for the lane changes they may make (see indexRoad).
+     * Before a bulk population: every lane is allocated once */
+    void reserveVehicles(const std::vector<size_t> &vehiclesPerLane);
+
+    /* room for the vehicles transfers bring in: every lane as much again as it holds (reserveVehicles), and in
+     * the itinerary of every vehicle on the road for this many roads (Vehicle::reserveItinerary) */
+    void reserveTransfers(size_t itineraryRoads);
+
+    /* ids firstId on for the vehicles of the road, lane by lane in the order they are stored. Returns the next
+     * free id. Ids take part in the model (lane change stagger and conflicts, transfer order, routes): a road net
+     * numbered this way steps the same whichever threads made its vehicles */
+    int numberVehicles(int firstId);
+
+    // buffers relocate() replaced. Freed before the last road is relocated, they'd be handed out again
+    struct Released
+    {
+        std::vector<std::vector<Vehicle>> lanes;
+        std::vector<std::vector<TrafficLight>> lights;
+    };
+
+    // drops every vehicle and frees the lanes: what's left is the layout of the road, its lights and its cost
+    void clearVehicles();
+
+    /* moves the lanes and lights into new buffers: what a step reads ends up where the allocator puts it now.
+     * Relocating roads one after the other lays them out in that order (roadorder.h). The old buffers go
+     * to released, for the caller to free after the last road */
+    void relocate(Released &released);
+
     /**
      * Each lane from a road has it's own connection to a road.
      * For example: for a road with 3 lanes, the most left lane might be forced to
@@ -152,26 +295,92 @@ public:
      */
     void addLaneConnection(unsigned lane, roadID road);
 
+    void setBoundary(Boundary b);
+    Boundary getBoundary() const;
+
+    // signal plan of a lane: its light's timings, initial color and phase
+    void setTrafficLight(unsigned lane, const TrafficLight &light);
+
+    // signal override: force the light of a lane to a color
+    void setTrafficLightColor(unsigned lane, TrafficLight::LightColor color);
+    const std::vector<TrafficLight>& getTrafficLights() const;
+
     // We need to sort vehicles on the road based on their position/lane
     // We need to to this every time before updating vehicle position,
     // because some vehicles might change lanes, some might arrive at their destination,
     // some may enter the road.
     void indexRoad();
 
+    // cartesian position of the road's ends, in meters - for drawing and spatial ordering
+    void setCoordinates(roadPosCard start, roadPosCard end);
+    roadPosCard getStartPosCard() const;
+    roadPosCard getEndPosCard() const;
+
     roadID getId() const;
+    const std::vector<std::vector<roadID>>& getConnections() const;
     unsigned getMaxSpeed() const;
     unsigned getLength() const;
     unsigned getLanesNo() const;
+    unsigned getVehiclesNo() const;
     const std::vector<std::vector<Vehicle>>& getVehicles() const;
 
-    void update(double dt, const std::map<roadID, Road> &cityMap );
+    /* transfers: vehicles that pass the end of the road on green move on to a connected road - appended here,
+     * for the caller to enter. Null - they drive on along this road.
+     * routes: where the next roads are drawn from - the run's seed and the step, CounterRng::forStream(seed, step),
+     * the same for every road of the step */
+    void update(double dt, const std::map<roadID, Road> &cityMap, std::vector<Transfer> *transfers = nullptr,
+                const CounterRng &routes = CounterRng());
+
+    /* update with simultaneous lane changes, phase by phase - what update does with the policy on a road with more
+     * than a lane or segment. The phases of a part may run on different threads for different parts, each phase
+     * done on every part before the next starts; the result is the same whichever thread took which part.
+     *  beginLanes        - one thread: makes room for the parts. Returns the segments of a lane
+     *  prepareLane       - sorts the lane and updates its light
+     *  decideLaneChanges - MOBIL for every vehicle of a segment of the lane, on the road as the step found it
+     *  commitLaneChanges - one thread: resolves the conflicts, makes the changes and takes the halos, dt ahead
+     *  moveLane          - car following on a segment of the lane. transfers: as update's - one per thread, routes:
+     *                      as update's
+     *  finishLanes       - one thread: drops the vehicles that left and adds the parts' operation counts */
+    unsigned beginLanes();
+    void prepareLane(unsigned laneIndex, double dt);
+    void decideLaneChanges(unsigned laneIndex, unsigned segment = 0);
+    void commitLaneChanges(double dt);
+    void moveLane(unsigned laneIndex, unsigned segment, double dt, const std::map<roadID, Road> &cityMap,
+                  std::vector<Transfer> *transfers = nullptr, const CounterRng &routes = CounterRng());
+    void finishLanes();
+
+    /* the segments a lane of this road is cut into now (Config::roadSegmentLength) - by the simultaneous lane
+     * change update only. 1 - none */
+    unsigned getSegmentsNo() const;
 
     void printRoad() const;
 
+    const Cost& getCost() const;
+    // account one update of the road that took updateTicks
+    void addUpdateCost(uint64_t updateTicks, unsigned vehiclesNo);
+    void resetCost();
+
+    // complete binary state of the road and its vehicles - for checkpoints and replay
+    void saveState(std::ostream &out) const;
+    bool loadState(std::istream &in);
+
 private:
 
 };
 
+/* enters the vehicles of a step's transfers into their roads (Road::enterVehicle), in the same order whoever
+ * updated the roads they came from: by road entered, road left and vehicle id. Vehicles heading for a road that
+ * isn't in roads leave the network. transfers is left with the vehicles that didn't fit - for holdTransfers, once
+ * every road took its vehicles in. Returns the vehicles entered */
+size_t enterTransfers(std::vector<Road::Transfer> &transfers, std::map<roadID, Road> &roads);
+
+/* the vehicles enterTransfers left: back on the roads they came from, stopped where they left (Road::holdVehicle).
+ * Vehicles of a road that isn't in roads are left in transfers, the rest is taken out */
+void holdTransfers(std::vector<Road::Transfer> &transfers, std::map<roadID, Road> &roads);
+
+// index of the vehicle on nextLane (sorted by indexRoad) that would lead current after a lane change. -1 - none
+int getNextLaneLeaderPos(const Vehicle &current, const std::vector<Vehicle> &nextLane);
+
 } // namespae simulator
 
 #endif // ROAD_H
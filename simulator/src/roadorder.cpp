@@ -0,0 +1,182 @@
+#include "roadorder.h"
+#include "road.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace simulator
+{
+
+namespace
+{
+
+const uint32_t hilbertSide = 1u << 16;
+
+std::vector<size_t> byId(const std::vector<const Road *> &roads)
+{
+    std::vector<size_t> order(roads.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&roads](size_t lhs, size_t rhs)
+    { return roads[lhs]->getId() < roads[rhs]->getId(); });
+    return order;
+}
+
+// the midpoint of every road, scaled to the Hilbert grid over the bounding box of all of them
+std::vector<size_t> byHilbert(const std::vector<const Road *> &roads)
+{
+    std::vector<std::pair<double, double>> midpoints;
+    midpoints.reserve(roads.size());
+    double minX = std::numeric_limits<double>::max(), minY = minX;
+    double maxX = std::numeric_limits<double>::lowest(), maxY = maxX;
+    for (const Road *road : roads) {
+        roadPosCard start = road->getStartPosCard();
+        roadPosCard end = road->getEndPosCard();
+        double x = (start.first + (double)end.first) / 2;
+        double y = (start.second + (double)end.second) / 2;
+        midpoints.push_back(std::make_pair(x, y));
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+    }
+
+    double extent = std::max(maxX - minX, maxY - minY);
+    double scale = extent > 0 ? (hilbertSide - 1) / extent : 0.0;
+
+    std::vector<std::pair<uint64_t, roadID>> keys(roads.size());
+    for (size_t i = 0; i < roads.size(); ++i)
+        keys[i] = std::make_pair(hilbertIndex((uint32_t)((midpoints[i].first - minX) * scale),
+                                              (uint32_t)((midpoints[i].second - minY) * scale)),
+                                 roads[i]->getId());
+
+    std::vector<size_t> order(roads.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&keys](size_t lhs, size_t rhs) { return keys[lhs] < keys[rhs]; });
+    return order;
+}
+
+std::vector<size_t> byBfs(const std::vector<const Road *> &roads)
+{
+    RoadGraph graph = connectionGraph(roads);
+
+    std::vector<size_t> order;
+    order.reserve(roads.size());
+    std::vector<bool> visited(roads.size(), false);
+    // every connected part is started from the lowest id left
+    for (size_t start : byId(roads)) {
+        if (visited[start])
+            continue;
+        visited[start] = true;
+        order.push_back(start);
+        // order doubles as the queue: what's past head is still to be expanded
+        for (size_t head = order.size() - 1; head < order.size(); ++head) {
+            size_t road = order[head];
+            for (size_t e = graph.first[road]; e < graph.first[road + 1]; ++e) {
+                size_t next = graph.neighbours[e];
+                if (!visited[next]) {
+                    visited[next] = true;
+                    order.push_back(next);
+                }
+            }
+        }
+    }
+    return order;
+}
+
+} // namespace
+
+const char *roadOrderName(RoadOrder order)
+{
+    static const char *names[] = { "id", "hilbert", "bfs" };
+    return names[order];
+}
+
+bool parseRoadOrder(const std::string &name, RoadOrder &order)
+{
+    for (RoadOrder candidate : { by_id, hilbert, bfs })
+        if (name == roadOrderName(candidate)) {
+            order = candidate;
+            return true;
+        }
+    return false;
+}
+
+/* https://en.wikipedia.org/wiki/Hilbert_curve - xy2d: the quadrant of every level, from the top one down,
+ * with the lower levels rotated into the orientation the curve enters their quadrant with */
+uint64_t hilbertIndex(uint32_t x, uint32_t y)
+{
+    x &= hilbertSide - 1;
+    y &= hilbertSide - 1;
+
+    uint64_t d = 0;
+    for (uint32_t s = hilbertSide / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = hilbertSide - 1 - x;
+                y = hilbertSide - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<size_t> layoutOrder(const std::vector<const Road *> &roads, RoadOrder order)
+{
+    switch (order) {
+    case hilbert:
+        return byHilbert(roads);
+    case bfs:
+        return byBfs(roads);
+    case by_id:
+        break;
+    }
+    return byId(roads);
+}
+
+RoadGraph connectionGraph(const std::vector<const Road *> &roads)
+{
+    // roads by id - connections name ids
+    std::vector<size_t> sorted = byId(roads);
+    auto indexOf = [&](roadID id) -> size_t {
+        auto found = std::lower_bound(sorted.begin(), sorted.end(), id,
+                                      [&roads](size_t index, roadID key) { return roads[index]->getId() < key; });
+        return found != sorted.end() && roads[*found]->getId() == id ? *found : roads.size();
+    };
+
+    std::vector<std::pair<size_t, size_t>> edges;
+    for (size_t i = 0; i < roads.size(); ++i)
+        for (const std::vector<roadID> &laneConnections : roads[i]->getConnections())
+            for (roadID next : laneConnections) {
+                size_t j = indexOf(next);
+                if (j < roads.size() && j != i) {
+                    edges.push_back(std::make_pair(i, j));
+                    edges.push_back(std::make_pair(j, i));
+                }
+            }
+    // neighbours of a road in id order, so walks don't depend on the order roads were given in
+    std::sort(edges.begin(), edges.end(), [&roads](const std::pair<size_t, size_t> &lhs,
+                                                   const std::pair<size_t, size_t> &rhs)
+    {
+        return lhs.first != rhs.first ? lhs.first < rhs.first : roads[lhs.second]->getId() < roads[rhs.second]->getId();
+    });
+
+    RoadGraph graph;
+    graph.first.assign(roads.size() + 1, 0);
+    graph.neighbours.reserve(edges.size());
+    for (const auto &edge : edges) {
+        ++graph.first[edge.first + 1];
+        graph.neighbours.push_back(edge.second);
+    }
+    for (size_t i = 0; i < roads.size(); ++i)
+        graph.first[i + 1] += graph.first[i];
+    return graph;
+}
+
+} // namespace simulator
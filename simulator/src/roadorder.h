@@ -0,0 +1,55 @@
+#ifndef ROADORDER_H
+#define ROADORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace simulator
+{
+
+class Road;
+
+/* The order roads are laid out in memory and updated in (Simulator::setRoadOrder).
+ * Road ids come from map data and say nothing about where a road is, so in id order consecutive roads are
+ * scattered over the city, and so are their vehicles in memory.
+ *
+ *  by_id   - map key order
+ *  hilbert - along a Hilbert curve over the midpoints of the roads (startPosCard, endPosCard): roads close in
+ *            the plane are close in memory
+ *  bfs     - breadth first over lane connections, both ways, from the lowest id of every connected part:
+ *            a road sits next to the roads its traffic comes from and goes to. Needs no coordinates
+ *
+ * The order changes only where roads are and when they're updated, never the result: roads don't share state
+ * during a step.
+ */
+enum RoadOrder { by_id, hilbert, bfs };
+
+const char *roadOrderName(RoadOrder order);
+
+// false if name is none of roadOrderName's
+bool parseRoadOrder(const std::string &name, RoadOrder &order);
+
+// position of a point on the Hilbert curve filling a 65536 x 65536 grid
+uint64_t hilbertIndex(uint32_t x, uint32_t y);
+
+// indices into roads, in order. Ties - and the roads bfs doesn't reach - go by id
+std::vector<size_t> layoutOrder(const std::vector<const Road *> &roads, RoadOrder order);
+
+/* lane connections between roads, both ways, as indices into the roads they were built from.
+ * A lane connection is one edge: roads connected by several lanes are neighbours several times */
+struct RoadGraph
+{
+    std::vector<size_t> first;          // neighbours of road i: neighbours[first[i]] .. neighbours[first[i + 1]]
+    std::vector<size_t> neighbours;     // of a road, in id order
+
+    size_t edgesNo() const { return neighbours.size() / 2; }
+};
+
+// connections to roads that aren't in roads are left out
+RoadGraph connectionGraph(const std::vector<const Road *> &roads);
+
+} // namespace simulator
+
+#endif // ROADORDER_H
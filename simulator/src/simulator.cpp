@@ -2,15 +2,27 @@
 #include "logger.h"
 #include "road.h"
 #include "config.h"
+#include "binaryio.h"
+#include "numa.h"
+#include "partition.h"
+#include "profiler.h"
+#include "trace.h"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <utility>
 
 namespace simulator
 {
 
-Simulator::Simulator()
+Simulator::Simulator() :
+    roadOrder(Config::roadOrder), partitioned(Config::partitionedUpdates), transfers(Config::roadTransfers)
 {
     initSimulatorTestState();
 }
@@ -23,14 +35,111 @@ void Simulator::addRoadToMap(Road &r)
 {
     r.indexRoad();
     cityMap[r.getId()] = r;
+    roadsChanged();
+}
+
+void Simulator::addRoadToMap(Road &&r)
+{
+    r.indexRoad();
+    cityMap[r.getId()] = std::move(r);
+    roadsChanged();
 }
 
 void Simulator::addRoadNetToMap(std::vector<Road> &roadNet)
 {
-    for( Road r : roadNet ) {
-        r.indexRoad();
-        cityMap[r.getId()] = r;
+    // one copy per road: straight into the map, indexed there
+    for (const Road &r : roadNet)
+        (cityMap[r.getId()] = r).indexRoad();
+    roadsChanged();
+}
+
+void Simulator::addRoadNetToMap(std::vector<Road> &&roadNet)
+{
+    placeRoads(roadNet, true);
+}
+
+void Simulator::placeRoads(std::vector<Road> &roads, bool index)
+{
+    // by id first: indices are sorted, roads are big to move around. The last road of an id is kept
+    std::vector<size_t> sorted(roads.size());
+    for (size_t i = 0; i < sorted.size(); ++i)
+        sorted[i] = i;
+    auto byId = [&roads](size_t lhs, size_t rhs) { return roads[lhs].getId() < roads[rhs].getId(); };
+    if (!std::is_sorted(sorted.begin(), sorted.end(), byId))
+        std::stable_sort(sorted.begin(), sorted.end(), byId);
+
+    std::vector<size_t> kept;
+    std::vector<const Road *> keptRoads;
+    for (size_t k = 0; k < sorted.size(); ++k)
+        if (k + 1 == sorted.size() || roads[sorted[k + 1]].getId() != roads[sorted[k]].getId()) {
+            kept.push_back(sorted[k]);
+            keptRoads.push_back(&roads[sorted[k]]);
+        }
+
+    // then in the road order: each road's node and lanes are allocated after the ones before it
+    std::vector<size_t> order;
+    if (roadOrder == by_id) {
+        order.resize(kept.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+    } else {
+        order = layoutOrder(keptRoads, roadOrder);
+    }
+
+    Road::Released released;
+    if (roadOrder != by_id) {
+        size_t lanesNo = 0;
+        for (const Road *road : keptRoads)
+            lanesNo += road->getLanesNo();
+        released.lanes.reserve(lanesNo);
+        released.lights.reserve(keptRoads.size());
+    }
+    for (size_t i : order) {
+        Road &road = roads[kept[i]];
+        if (index)
+            road.indexRoad();
+        if (roadOrder != by_id)
+            road.relocate(released);
+        roadID id = road.getId();
+        // ids past the end of the map are appended without a search - every road, when they come by id
+        if (cityMap.empty() || cityMap.rbegin()->first < id)
+            cityMap.emplace_hint(cityMap.end(), id, std::move(road));
+        else
+            cityMap.insert_or_assign(id, std::move(road));
+    }
+    roads.clear();
+    roadsChanged();
+}
+
+void Simulator::roadsChanged()
+{
+    orderedRoads.clear();
+    stepRoads.clear();
+    laneRoads.clear();
+    partRoads.clear();
+    partitionedRoadsNo = 0;
+}
+
+void Simulator::orderRoads()
+{
+    std::vector<Road *> roads;
+    roads.reserve(cityMap.size());
+    for (auto &mapEl : cityMap)
+        roads.push_back(&mapEl.second);
+
+    std::vector<size_t> order = layoutOrder(std::vector<const Road *>(roads.begin(), roads.end()), roadOrder);
+    orderedRoads.clear();
+    for (size_t i : order)
+        orderedRoads.push_back(roads[i]);
+}
+
+ForkGroup Simulator::fork(unsigned branchesNo) const
+{
+    if (transfers) {
+        log_error("Fork: branches are stepped without transfers, turn them off first (setTransfers)");
+        return ForkGroup(cityMap, 0);
     }
+    return ForkGroup(cityMap, branchesNo);
 }
 
 void Simulator::runTestSimulator()
@@ -40,16 +149,428 @@ void Simulator::runTestSimulator()
 
     std::ofstream output(Config::simulatorOuput);
 
+    setWorkerThreads(Config::workerThreads, Config::pinWorkers);
+    Profiler::enableCounters(Config::profileCounters);
+    if (!Config::traceOutput.empty())
+        Trace::start(Config::traceOutput);
+
     while (!terminate && iter < Config::simulationTime) {
         ++iter;
-        for( auto &mapEl : cityMap )
-            mapEl.second.update(dt, cityMap);
+        update(dt);
 
-        runTime += dt;
-
-        serialize_v1(runTime, output);
+        {
+            PROFILE_SCOPE(serialize);
+            TRACE_SCOPE("serialize");
+            serialize_v1(runTime, output);
+        }
+        PROFILE_END_STEP();
     }
     output.close();
+    Trace::stop();
+
+#ifdef SIMULATOR_PROFILE
+    Logger::flush();
+    Profiler::printSummary(stdout);
+    printCostReport(stdout);
+#endif
+}
+
+void Simulator::setWorkerThreads(unsigned threadsNo, bool pinned)
+{
+    // the old pool goes first: it gives the caller its cpus back
+    workers.reset();
+    if (threadsNo > 1)
+        workers.reset(new WorkerPool(threadsNo, pinned ? workerCpus(threadsNo) : std::vector<unsigned>()));
+    // parts belong to workers, and their lanes to the workers' nodes
+    partRoads.clear();
+    partitionedRoadsNo = 0;
+}
+
+unsigned Simulator::getWorkerThreads() const
+{
+    return workers ? workers->size() : 1;
+}
+
+void Simulator::setRoadOrder(RoadOrder order)
+{
+    roadOrder = order;
+    orderedRoads.clear();
+}
+
+RoadOrder Simulator::getRoadOrder() const
+{
+    return roadOrder;
+}
+
+void Simulator::setPartitioned(bool on)
+{
+    partitioned = on;
+    partRoads.clear();
+    partitionedRoadsNo = 0;
+}
+
+bool Simulator::isPartitioned() const
+{
+    return partitioned;
+}
+
+void Simulator::setTransfers(bool on)
+{
+    transfers = on;
+    // partitioned workers make room for transfers when they take their parts
+    if (on)
+        partitionedRoadsNo = 0;
+}
+
+bool Simulator::hasTransfers() const
+{
+    return transfers;
+}
+
+void Simulator::partition()
+{
+    std::vector<Road *> roads;
+    roads.reserve(cityMap.size());
+    bool measured = true;
+    for (auto &mapEl : cityMap) {
+        roads.push_back(&mapEl.second);
+        measured = measured && mapEl.second.getCost().updates > 0;
+    }
+    std::vector<const Road *> view(roads.begin(), roads.end());
+
+    // measured costs once every road has some, vehicles until then - the two don't mix
+    std::vector<double> weights;
+    weights.reserve(roads.size());
+    for (const Road *road : roads)
+        weights.push_back(measured ? std::max(1.0, road->getCost().weight) : 1.0 + road->getVehiclesNo());
+
+    unsigned partsNo = workers->size();
+    Partition parts = partitionRoads(view, weights, partsNo);
+    partRoads.assign(partsNo, std::vector<Road *>());
+    for (size_t i : layoutOrder(view, roadOrder))
+        partRoads[parts.part[i]].push_back(roads[i]);
+
+    // room in a queue for a vehicle from every lane connection between the two parts, twice over
+    partOf.clear();
+    for (size_t i = 0; i < roads.size(); ++i)
+        partOf[roads[i]->getId()] = parts.part[i];
+    std::vector<std::vector<size_t>> crossings(partsNo, std::vector<size_t>(partsNo, 0));
+    for (size_t i = 0; i < roads.size(); ++i)
+        for (auto &laneConnections : roads[i]->getConnections())
+            for (roadID next : laneConnections) {
+                auto nextPart = partOf.find(next);
+                if (nextPart != partOf.end() && nextPart->second != parts.part[i])
+                    ++crossings[parts.part[i]][nextPart->second];
+            }
+    handoffs.clear();
+    handoffs.resize(partsNo);
+    for (std::vector<Handoff> &from : handoffs)
+        from.resize(partsNo);
+    partsProduced.reset(new std::atomic<uint64_t>[partsNo]);
+    for (unsigned part = 0; part < partsNo; ++part)
+        partsProduced[part] = 0;
+    partitionedSteps = 0;
+
+    /* first touch: every worker moves the lanes of its part into memory it allocates and writes itself, and
+     * allocates the queues it takes vehicles from and its transfer buffer */
+    workers->run([this, &crossings](unsigned worker) {
+        Road::Released released;
+        for (Road *road : partRoads[worker])
+            road->relocate(released);
+        for (unsigned from = 0; from < handoffs.size(); ++from)
+            if (crossings[from][worker])
+                handoffs[from][worker].queue.reset(
+                    new SpscQueue<Road::Transfer>(std::max<size_t>(16, 2 * crossings[from][worker])));
+        if (transfers)
+            workerTransfers[worker].reserve(transferLanesNo);
+    });
+
+    log_info("Partitioned %zu roads for %u%s workers by %s: %lu of %lu connections cut, heaviest part %.2f x average",
+             roads.size(), workers->size(), workers->isPinned() ? " pinned" : "",
+             measured ? "measured cost" : "vehicles", parts.cut, parts.connections, parts.imbalance());
+
+    partitionedRoadsNo = cityMap.size();
+    costsPartitioned = measured;
+    stepsSincePartition = 0;
+}
+
+void Simulator::updateRoad(Road &road, double dt, unsigned worker)
+{
+    unsigned vehiclesNo = road.getVehiclesNo();
+    TRACE_SCOPE_ARGS("road_update", road.getId(), vehiclesNo);
+
+    uint64_t start = Profiler::ticks();
+    road.update(dt, cityMap, transfers ? &workerTransfers[worker] : nullptr, routes);
+    road.addUpdateCost(Profiler::ticks() - start, vehiclesNo);
+}
+
+void Simulator::handOff(unsigned part, size_t first)
+{
+    std::vector<Road::Transfer> &produced = workerTransfers[part];
+    size_t kept = first;
+    for (size_t i = first; i < produced.size(); ++i) {
+        auto nextPart = partOf.find(produced[i].to);
+        // no part: the vehicle left the network
+        if (nextPart == partOf.end())
+            continue;
+        if (nextPart->second == part) {
+            if (kept != i)
+                produced[kept] = std::move(produced[i]);
+            ++kept;
+            continue;
+        }
+        Handoff &handoff = handoffs[part][nextPart->second];
+        if (!handoff.queue || !handoff.queue->push(std::move(produced[i])))
+            handoff.spill.push_back(std::move(produced[i]));
+    }
+    produced.erase(produced.begin() + kept, produced.end());
+}
+
+void Simulator::takeOver(unsigned part)
+{
+    PROFILE_SCOPE(transfers);
+    TRACE_SCOPE("transfers");
+
+    partsProduced[part].store(partitionedSteps + 1, std::memory_order_release);
+
+    // the part's own vehicles are there already; the others come in while their producers still work
+    std::vector<Road::Transfer> &entering = workerTransfers[part];
+    auto take = [&entering](Road::Transfer &&transfer) { entering.push_back(std::move(transfer)); };
+    unsigned waiting = handoffs.size() - 1;
+    while (waiting > 0) {
+        bool moved = false;
+        waiting = 0;
+        for (unsigned from = 0; from < handoffs.size(); ++from) {
+            if (from == part)
+                continue;
+            Handoff &handoff = handoffs[from][part];
+            // the flag first: a producer that's done pushed everything before it, its spill included
+            bool done = partsProduced[from].load(std::memory_order_acquire) > partitionedSteps;
+            if (handoff.queue)
+                moved = handoff.queue->drain(take) > 0 || moved;
+            if (!done) {
+                ++waiting;
+            } else if (!handoff.spill.empty()) {
+                std::move(handoff.spill.begin(), handoff.spill.end(), std::back_inserter(entering));
+                handoff.spill.clear();
+            }
+        }
+        if (waiting > 0 && !moved)
+            std::this_thread::yield();
+    }
+    enterTransfers(entering, cityMap);
+}
+
+void Simulator::enterWorkerTransfers()
+{
+    PROFILE_SCOPE(transfers);
+    TRACE_SCOPE("transfers");
+
+    // into the first worker's buffer: enterTransfers puts them in order whoever updated which road
+    std::vector<Road::Transfer> &all = workerTransfers[0];
+    for (size_t worker = 1; worker < workerTransfers.size(); ++worker) {
+        std::move(workerTransfers[worker].begin(), workerTransfers[worker].end(), std::back_inserter(all));
+        workerTransfers[worker].clear();
+    }
+    // partitioned workers entered theirs already: what's left didn't fit
+    if (!(workers && partitioned))
+        enterTransfers(all, cityMap);
+    holdTransfers(all, cityMap);
+}
+
+void Simulator::reserveTransfers()
+{
+    // roads a vehicle drives on before its itinerary grows
+    const size_t itineraryRoads = 64;
+
+    transferLanesNo = 0;
+    for (auto &roadElement : cityMap) {
+        transferLanesNo += roadElement.second.getLanesNo();
+        roadElement.second.reserveTransfers(itineraryRoads);
+    }
+    transferRoadsNo = cityMap.size();
+
+    if (workerTransfers.size() < getWorkerThreads())
+        workerTransfers.resize(getWorkerThreads());
+    if (!(workers && partitioned))
+        for (std::vector<Road::Transfer> &buffer : workerTransfers)
+            buffer.reserve(transferLanesNo);
+}
+
+void Simulator::balanceStepRoads()
+{
+    stepRoads.clear();
+    for( auto &mapEl : cityMap )
+        stepRoads.push_back(&mapEl.second);
+
+    /* the order doesn't change the result - roads are independent during update - only how well it's shared.
+     * Ties by id keep it deterministic without stable_sort, whose buffer would be an allocation every rebalance */
+    std::sort(stepRoads.begin(), stepRoads.end(), [](const Road *lhs, const Road *rhs)
+    { return lhs->getCost().weight != rhs->getCost().weight ? lhs->getCost().weight > rhs->getCost().weight
+                                                            : lhs->getId() < rhs->getId(); });
+    stepsSinceBalance = 0;
+
+    // the roads that alone take more than a worker's share: their lanes and segments are shared instead
+    laneRoads.clear();
+    laneItems.clear();
+    laneRoadsSimultaneous = Config::laneChangePolicy.simultaneous;
+    if (!laneRoadsSimultaneous)
+        return;
+    double total = 0;
+    for (const Road *road : stepRoads)
+        total += road->getCost().weight;
+    auto ownLanes = [this, total](const Road *road)
+    { return (road->getLanesNo() > 1 || road->getSegmentsNo() > 1) && total > 0 &&
+             road->getCost().weight * getWorkerThreads() > total; };
+    std::copy_if(stepRoads.begin(), stepRoads.end(), std::back_inserter(laneRoads), ownLanes);
+    stepRoads.erase(std::remove_if(stepRoads.begin(), stepRoads.end(), ownLanes), stepRoads.end());
+    roadTicks.assign(laneRoads.size(), 0);
+    laneRoadVehicles.assign(laneRoads.size(), 0);
+}
+
+void Simulator::updateLaneRoads(double dt)
+{
+    laneItems.clear();
+    for (unsigned r = 0; r < laneRoads.size(); ++r) {
+        Road &road = *laneRoads[r];
+        laneRoadVehicles[r] = road.getVehiclesNo();
+        unsigned segments = road.beginLanes();
+        for (unsigned lane = 0; lane < road.getLanesNo(); ++lane)
+            for (unsigned segment = 0; segment < segments; ++segment)
+                laneItems.push_back(LaneItem{ &road, r, lane, segment });
+    }
+    laneTicks.assign(laneItems.size(), 0);
+
+    struct Step
+    {
+        std::atomic<size_t> nextItem;
+        double dt;
+        int phase;
+    } step;
+    step.dt = dt;
+
+    /* a run of the workers per phase: a phase reads the neighbour lanes and segments as the one before left them.
+     * Lanes are prepared once, by the item of their first segment */
+    for (step.phase = 0; step.phase < 3; ++step.phase) {
+        step.nextItem = 0;
+        workers->run([this, &step](unsigned worker) {
+            size_t i;
+            while ((i = step.nextItem.fetch_add(1)) < laneItems.size()) {
+                const LaneItem &item = laneItems[i];
+                if (step.phase == 0 && item.segment > 0)
+                    continue;
+                TRACE_SCOPE_ARGS("lane_update", item.road->getId(), item.road->getVehicles()[item.lane].size());
+                uint64_t start = Profiler::ticks();
+                if (step.phase == 0)
+                    item.road->prepareLane(item.lane, step.dt);
+                else if (step.phase == 1)
+                    item.road->decideLaneChanges(item.lane, item.segment);
+                else
+                    item.road->moveLane(item.lane, item.segment, step.dt, cityMap,
+                                        transfers ? &workerTransfers[worker] : nullptr, routes);
+                laneTicks[i] += Profiler::ticks() - start;
+            }
+        });
+
+        // a few roads: their commits are quick next to a run of the workers
+        if (step.phase == 1)
+            for (size_t r = 0; r < laneRoads.size(); ++r) {
+                uint64_t start = Profiler::ticks();
+                laneRoads[r]->commitLaneChanges(dt);
+                roadTicks[r] = Profiler::ticks() - start;
+            }
+    }
+
+    for (size_t i = 0; i < laneItems.size(); ++i)
+        roadTicks[laneItems[i].laneRoad] += laneTicks[i];
+    for (size_t r = 0; r < laneRoads.size(); ++r) {
+        laneRoads[r]->finishLanes();
+        laneRoads[r]->addUpdateCost(roadTicks[r], laneRoadVehicles[r]);
+    }
+}
+
+void Simulator::update(double dt)
+{
+    PROFILE_SCOPE(step);
+    TRACE_SCOPE("step");
+
+    if (transfers && (transferRoadsNo != cityMap.size() || workerTransfers.size() < getWorkerThreads()))
+        reserveTransfers();
+    routes = CounterRng::forStream(seed, steps);
+
+    if (!workers) {
+        if (orderedRoads.size() != cityMap.size())
+            orderRoads();
+        for (Road *road : orderedRoads)
+            updateRoad(*road, dt, 0);
+    } else if (partitioned) {
+        if (partitionedRoadsNo != cityMap.size() || (!costsPartitioned && ++stepsSincePartition >= rebalanceSteps))
+            partition();
+
+        workers->run([this, &dt](unsigned worker) {
+            for (Road *road : partRoads[worker]) {
+                size_t first = transfers ? workerTransfers[worker].size() : 0;
+                updateRoad(*road, dt, worker);
+                if (transfers && workerTransfers[worker].size() > first)
+                    handOff(worker, first);
+            }
+            if (transfers)
+                takeOver(worker);
+        });
+        ++partitionedSteps;
+    } else {
+        if (stepRoads.size() + laneRoads.size() != cityMap.size() ||
+            laneRoadsSimultaneous != Config::laneChangePolicy.simultaneous || ++stepsSinceBalance >= rebalanceSteps)
+            balanceStepRoads();
+        if (!laneRoads.empty())
+            updateLaneRoads(dt);
+
+        // workers claim small runs of roads, so a slow road doesn't hold back a whole static share
+        const size_t roadsPerClaim = 8;
+        struct Step
+        {
+            std::atomic<size_t> nextRoad;
+            double dt;
+        } step;
+        step.nextRoad = 0;
+        step.dt = dt;
+
+        // two pointers: small enough for std::function to keep inline, no allocation per step
+        workers->run([this, &step](unsigned worker) {
+            size_t begin;
+            while ((begin = step.nextRoad.fetch_add(roadsPerClaim)) < stepRoads.size()) {
+                size_t end = std::min(begin + roadsPerClaim, stepRoads.size());
+                for (size_t i = begin; i < end; ++i)
+                    updateRoad(*stepRoads[i], step.dt, worker);
+            }
+        });
+    }
+
+    if (transfers)
+        enterWorkerTransfers();
+
+    runTime += dt;
+    ++steps;
+}
+
+double Simulator::getRunTime() const
+{
+    return runTime;
+}
+
+void Simulator::setSeed(uint64_t newSeed)
+{
+    seed = newSeed;
+}
+
+uint64_t Simulator::getSeed() const
+{
+    return seed;
+}
+
+uint64_t Simulator::getSteps() const
+{
+    return steps;
 }
 
 void Simulator::serialize(double time, std::ostream &output)
@@ -87,6 +608,101 @@ void Simulator::serialize_v1(double time, std::ostream &output)
     output << "\n";
 }
 
+void Simulator::saveState(std::ostream &out) const
+{
+    writeBinary(out, runTime);
+    writeBinary(out, seed);
+    writeBinary(out, steps);
+    writeBinary(out, (uint64_t)cityMap.size());
+    for (auto &roadElement : cityMap)
+        roadElement.second.saveState(out);
+}
+
+bool Simulator::loadState(std::istream &in)
+{
+    cityMap.clear();
+    roadsChanged();
+
+    uint64_t roadsNo = 0;
+    if (!readBinary(in, runTime) || !readBinary(in, seed) || !readBinary(in, steps) || !readBinary(in, roadsNo))
+        return false;
+
+    // the saved lanes go back as they were - not indexed, the next update does that
+    std::vector<Road> roads;
+    for (uint64_t i = 0; i < roadsNo; ++i) {
+        roads.emplace_back();
+        if (!roads.back().loadState(in)) {
+            log_error("Corrupted simulator state: road %lu of %lu", i, roadsNo);
+            return false;
+        }
+    }
+    placeRoads(roads, false);
+    return true;
+}
+
+uint64_t Simulator::stateHash() const
+{
+    std::ostringstream state;
+    saveState(state);
+    return fnv1a(state.str());
+}
+
+void Simulator::printCostReport(FILE *out, CostOrder order, unsigned roadsNo) const
+{
+    auto key = [order](const Road::Cost &cost) -> double {
+        switch (order) {
+        case by_time_per_vehicle:
+            return cost.vehicleUpdates ? (double)cost.ticks / cost.vehicleUpdates : 0.0;
+        case by_idm:
+            return cost.idmEvaluations;
+        case by_lane_change:
+            return cost.laneChangeEvaluations;
+        case by_inserts:
+            return cost.inserts;
+        case by_time:
+        default:
+            return cost.ticks;
+        }
+    };
+
+    std::vector<const Road *> roads;
+    uint64_t totalTicks = 0;
+    for (auto &roadElement : cityMap) {
+        roads.push_back(&roadElement.second);
+        totalTicks += roadElement.second.getCost().ticks;
+    }
+    std::stable_sort(roads.begin(), roads.end(), [&key](const Road *lhs, const Road *rhs)
+    { return key(lhs->getCost()) > key(rhs->getCost()); });
+    if (roads.size() > roadsNo)
+        roads.resize(roadsNo);
+
+    double ticksPerNs = Profiler::ticksPerNs();
+    fprintf(out, "Road cost: %lu roads, %.3f ms in road updates\n", (unsigned long)cityMap.size(),
+            totalTicks / ticksPerNs / 1e6);
+    fprintf(out, "%10s %5s %8s %8s %10s %7s %10s %10s %12s %12s %10s %10s %10s\n",
+            "road", "lanes", "length", "updates", "total ms", "% time", "us/update", "ns/vehicle",
+            "IDM evals", "MOBIL evals", "changes", "conflicts", "inserts");
+    for (const Road *road : roads) {
+        const Road::Cost &cost = road->getCost();
+        double totalNs = cost.ticks / ticksPerNs;
+        fprintf(out, "%10lu %5u %8u %8lu %10.3f %7.1f %10.3f %10.1f %12lu %12lu %10lu %10lu %10lu\n",
+                road->getId(), road->getLanesNo(), road->getLength(), (unsigned long)cost.updates,
+                totalNs / 1e6, totalTicks ? 100.0 * cost.ticks / totalTicks : 0.0,
+                cost.updates ? totalNs / cost.updates / 1000.0 : 0.0,
+                cost.vehicleUpdates ? totalNs / cost.vehicleUpdates : 0.0,
+                (unsigned long)cost.idmEvaluations, (unsigned long)cost.laneChangeEvaluations,
+                (unsigned long)cost.laneChanges, (unsigned long)cost.laneChangeConflicts,
+                (unsigned long)cost.inserts);
+    }
+    fflush(out);
+}
+
+void Simulator::resetCosts()
+{
+    for (auto &roadElement : cityMap)
+        roadElement.second.resetCost();
+}
+
 void Simulator::runSimulator()
 {
     log_info("Running the simulator");
@@ -2,8 +2,19 @@
 #define SIMULATOR_H
 
 #include "road.h"
+#include "fork.h"
+#include "roadorder.h"
+#include "spscqueue.h"
+#include "workerpool.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
 #include <map>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
 
 namespace simulator
 {
@@ -21,17 +32,164 @@ class Simulator
     // simulator run time
     double runTime = {0};
 
+    /* the route draws of vehicles changing road (Road::performRoadChange): step steps is drawn from
+     * CounterRng::forStream(seed, steps). Both are part of the saved state */
+    uint64_t seed = {0};
+    uint64_t steps = {0};
+    CounterRng routes;
+
+    // where roads are placed when they're loaded, and the order a single thread updates them in
+    RoadOrder roadOrder;
+
+    // every road, in roadOrder. Rebuilt when roads are added
+    std::vector<Road *> orderedRoads;
+
+    void orderRoads();
+
+    /* moves roads into the map, laid out in roadOrder - indexed first if index. Of roads with the same id
+     * the last one is kept. roads is left empty */
+    void placeRoads(std::vector<Road> &roads, bool index);
+
+    // parallel road updates. No pool - update on the calling thread
+    std::unique_ptr<WorkerPool> workers;
+
+    /* partitioned updates: the roads are split into a part per worker (partition.h), and a worker updates its
+     * part only, from lanes it allocated itself - on its NUMA node when the pool is pinned.
+     * Parts are cut by vehicles at first, then again by measured costs after rebalanceSteps, and again when
+     * roads are added or the pool changes */
+    bool partitioned;
+    std::vector<std::vector<Road *>> partRoads;     // of every worker
+    size_t partitionedRoadsNo = { 0 };
+    bool costsPartitioned = { false };
+    unsigned stepsSincePartition = { 0 };
+
+    /* moves between parts, when vehicles change roads: a lock-free queue for every pair of parts with a
+     * connection between them, from the producing part's worker to the receiving part's. A worker updates its
+     * part, handing the vehicles that leave it to the queues as it goes, then takes in the vehicles coming into
+     * its part and enters them into its own roads: no lock, lanes stay with their worker, and the only serial
+     * commit is for the few that don't fit (holdTransfers). A full queue spills into a vector only its producer
+     * writes, read once the producer is done */
+    struct Handoff
+    {
+        std::unique_ptr<SpscQueue<Road::Transfer>> queue;
+        std::vector<Road::Transfer> spill;
+    };
+    std::vector<std::vector<Handoff>> handoffs;             // [from part][to part]
+    std::unordered_map<roadID, unsigned> partOf;
+    std::unique_ptr<std::atomic<uint64_t>[]> partsProduced; // steps every part has handed off its vehicles in
+    uint64_t partitionedSteps = { 0 };
+
+    void partition();
+
+    // the vehicles the part's roads produced from first on: the ones for other parts go to their queues
+    void handOff(unsigned part, size_t first);
+
+    // waits for the vehicles coming into the part and enters them, with the part's own, into its roads
+    void takeOver(unsigned part);
+
+    // roads were added or replaced: every list of roads built over the map is stale
+    void roadsChanged();
+
+    /* roads in the order workers claim them: heaviest first (Road::Cost::weight), so an expensive road
+     * doesn't start last and hold the whole step. Rebuilt every rebalanceSteps and when roads are added */
+    std::vector<Road *> stepRoads;
+    unsigned stepsSinceBalance = { 0 };
+    static const unsigned rebalanceSteps = 64;
+
+    /* simultaneous lane changes (lanechange.h): a road with more than a lane or segment (Road::getSegmentsNo)
+     * that would hold a worker longer than its share of the step is taken out of stepRoads and updated a part -
+     * a lane, or a segment of it - per claim, on all the workers, phase by phase (Road::prepareLane).
+     * Chosen by balanceStepRoads, from the measured weights; the parts are listed again every step */
+    struct LaneItem
+    {
+        Road *road;
+        unsigned laneRoad;  // index in laneRoads
+        unsigned lane;
+        unsigned segment;
+    };
+    std::vector<Road *> laneRoads;
+    std::vector<LaneItem> laneItems;        // the parts of laneRoads, road by road
+    std::vector<uint64_t> laneTicks;        // spent on every part this step
+    std::vector<uint64_t> roadTicks;        // and on every lane road
+    std::vector<unsigned> laneRoadVehicles; // on every lane road when the step started
+    bool laneRoadsSimultaneous = { false }; // the policy laneRoads were chosen under
+
+    void balanceStepRoads();
+
+    void updateLaneRoads(double dt);
+
+    /* vehicles move on to connected roads (Road::performRoadChange). Every worker collects the vehicles leaving
+     * the roads it updates; they enter their next roads after all roads are updated (enterTransfers), and the
+     * ones that don't fit go back to theirs once every road took its vehicles in (holdTransfers) */
+    bool transfers;
+    std::vector<std::vector<Road::Transfer>> workerTransfers;  // of every worker
+    size_t transferRoadsNo = { 0 };     // of cityMap when the room for transfers was made
+    size_t transferLanesNo = { 0 };     // and its lanes
+
+    /* room for the transfers of a step, made once for the roads loaded: no more than a vehicle leaves a lane in
+     * a step, so every worker's buffer takes one from every lane - they're all gathered into the first - and
+     * every vehicle's itinerary has room for the next few roads. Partitioned workers make their own room, on
+     * their node (partition) */
+    void reserveTransfers();
+
+    void updateRoad(Road &road, double dt, unsigned worker);
+    void enterWorkerTransfers();
+
 public:
     typedef std::map<roadID, Road> CityMap;
+
+    // what the cost report is sorted by, descending
+    enum CostOrder { by_time, by_time_per_vehicle, by_idm, by_lane_change, by_inserts };
+
     CityMap cityMap;
 public:
     Simulator();
 
     void runSimulator();
     void runTestSimulator();
+
+    // advance every road of the city by dt
+    void update(double dt);
+
+    /* update roads on threadsNo threads (the caller included). Roads don't share state during update.
+     * pinned: every worker - the caller too, while the pool lives - is kept on a cpu, node by node (numa.h) */
+    void setWorkerThreads(unsigned threadsNo, bool pinned = false);
+    unsigned getWorkerThreads() const;
+
+    /* memory layout and update order of the roads (roadorder.h). Roads loaded from now on are placed in this
+     * order, the update order changes at once. Default: Config::roadOrder */
+    void setRoadOrder(RoadOrder order);
+    RoadOrder getRoadOrder() const;
+
+    // partitioned updates on the worker threads (see partitioned) instead of roads claimed as workers go
+    void setPartitioned(bool on);
+    bool isPartitioned() const;
+
+    /* vehicles passing the end of an open road on green drive on to a connected road, or leave the network if it
+     * has none. Off: they drive on along the road, and the number of vehicles never changes.
+     * Default: Config::roadTransfers */
+    void setTransfers(bool on);
+    bool hasTransfers() const;
+
+    double getRunTime() const;
+
+    // seed of the route draws (see routes). Default 0
+    void setSeed(uint64_t newSeed);
+    uint64_t getSeed() const;
+    uint64_t getSteps() const;
     void addRoadToMap(Road &r);
+    void addRoadToMap(Road &&r);
     void addRoadNetToMap(std::vector<Road> &roadNet);
 
+    /* bulk loading: takes the roads over, roadNet is left empty. Roads go into the map in a single pass, in
+     * the road order, each lane sorted once. A later road replaces an earlier one with the same id */
+    void addRoadNetToMap(std::vector<Road> &&roadNet);
+
+    /* fork the current state into what-if branches. Roads are shared until a branch modifies them.
+     * The simulator must not be updated while the returned group is used.
+     * Branches run without transfers (fork.h): with transfers on this fails - the group has no branches */
+    ForkGroup fork(unsigned branchesNo) const;
+
     /* there will probably several serialization versions, as the project develops
      * Keep all versions so we can run older python tests at later times
      * !! Final serialization version should be implemented using sockets
@@ -40,6 +198,17 @@ public:
 
     // output the current layout of this road - version 1
     void serialize(double time, std::ostream &output);
+
+    // complete binary state: run time, seed, steps and every road - for checkpoints and replay
+    void saveState(std::ostream &out) const;
+    bool loadState(std::istream &in);
+
+    // fingerprint of the complete state. Equal hashes - (almost surely) equal states
+    uint64_t stateHash() const;
+
+    // roads that dominate the run: the top roadsNo roads by order, with their time and operation counts
+    void printCostReport(FILE *out, CostOrder order = by_time, unsigned roadsNo = 20) const;
+    void resetCosts();
 };
 
 } // namespace simulator
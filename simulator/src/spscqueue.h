@@ -0,0 +1,88 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace simulator
+{
+
+/* SpscQueue
+ * Bounded lock-free queue for one producer thread and one consumer thread: a ring of capacity slots, rounded up
+ * to a power of two. push and drain never block and never allocate - push fails when the ring is full.
+ * The indices sit on their own cache lines, so the two threads only share a line when one of them looks at the
+ * other's index.
+ *
+ * Moves between road parts in partitioned updates (Simulator::setPartitioned) go through one of these per pair
+ * of parts.
+ */
+template<typename T>
+class SpscQueue
+{
+    struct Slot
+    {
+        alignas(T) unsigned char bytes[sizeof(T)];
+
+        T *item() { return std::launder(reinterpret_cast<T *>(bytes)); }
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head = { 0 };   // next to drain - written by the consumer
+    alignas(64) std::atomic<size_t> tail = { 0 };   // next to push - written by the producer
+
+public:
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+    }
+
+    ~SpscQueue()
+    {
+        for (size_t h = head.load(); h != tail.load(); ++h)
+            slots[h & mask].item()->~T();
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // producer only. False if full - item is left as it was
+    bool push(T &&item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+            return false;
+        new (slots[t & mask].bytes) T(std::move(item));
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only: hands every item in the ring to consume(T &&), oldest first. Returns how many
+    template<typename Consume>
+    size_t drain(Consume &&consume)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        for (size_t i = h; i != t; ++i) {
+            T *slot = slots[i & mask].item();
+            consume(std::move(*slot));
+            slot->~T();
+        }
+        head.store(t, std::memory_order_release);
+        return t - h;
+    }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+} // namespace simulator
+
+#endif // SPSCQUEUE_H
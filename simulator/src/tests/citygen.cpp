@@ -0,0 +1,364 @@
+#include "citygen.h"
+#include "../logger.h"
+#include "../rng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace simulator
+{
+
+namespace
+{
+
+const double pi = 3.14159265358979323846;
+const double minRoadLength = 30.0;          // meters - short arcs of the inner rings are stretched
+const double maxDemand = 150.0;             // vehicles per km and lane - a 6.6 m headway
+const double alwaysGreen = 1e12;            // seconds of green: a light that never stops anyone
+const unsigned motorwaySpeed = 30;          // m/s
+const unsigned rampSpeed = 20;
+const double rampLength = 300.0;
+
+/* Network under construction: junctions (nodes) and the one-way roads between them.
+ * Roads are kept by index. Their id is the index, or with scatterIds the index scrambled (idOf) */
+class CityBuilder
+{
+    struct Node
+    {
+        double x, y;
+        std::vector<unsigned> incoming;
+        std::vector<unsigned> outgoing;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<unsigned> roadFrom;
+    std::vector<unsigned> roadTo;
+    std::vector<unsigned> roadPhase;    // signal phase of the road at its end junction
+
+public:
+    std::vector<Road> roads;
+    bool scatterIds = { false };
+
+    // an odd multiplier is a bijection on 32 bits: ids stay unique, neighbours get ids far apart
+    roadID idOf(unsigned road) const
+    {
+        return scatterIds ? (roadID)(uint32_t)(road * 2654435761u) : road;
+    }
+
+    unsigned addNode(double x, double y)
+    {
+        nodes.push_back(Node{ x, y, {}, {} });
+        return nodes.size() - 1;
+    }
+
+    unsigned addRoad(unsigned from, unsigned to, unsigned lanes, unsigned speed, unsigned phase, double length = 0.0)
+    {
+        const Node &a = nodes[from];
+        const Node &b = nodes[to];
+        if (length <= 0.0)
+            length = std::max(minRoadLength, std::hypot(b.x - a.x, b.y - a.y));
+
+        unsigned id = roads.size();
+        roads.push_back(Road(idOf(id), length, lanes, speed));
+        roads.back().setCoordinates(roadPosCard((int)std::lround(a.x), (int)std::lround(a.y)),
+                                    roadPosCard((int)std::lround(b.x), (int)std::lround(b.y)));
+        roadFrom.push_back(from);
+        roadTo.push_back(to);
+        roadPhase.push_back(phase);
+        nodes[from].outgoing.push_back(id);
+        nodes[to].incoming.push_back(id);
+        return id;
+    }
+
+    // a two-way street: a road each way, both in the same phase
+    void addStreet(unsigned a, unsigned b, unsigned lanes, unsigned speed, unsigned phase)
+    {
+        addRoad(a, b, lanes, speed, phase);
+        addRoad(b, a, lanes, speed, phase);
+    }
+
+    double heading(unsigned road) const
+    {
+        const Node &a = nodes[roadFrom[road]];
+        const Node &b = nodes[roadTo[road]];
+        return std::atan2(b.y - a.y, b.x - a.x);
+    }
+
+    /* turns at every junction, by angle: the right lane turns right or goes ahead, the left lane turns left
+     * or goes ahead, middle lanes go ahead. A lane left without a move takes every move. No U-turns. */
+    void connectTurns()
+    {
+        for (unsigned road = 0; road < roads.size(); ++road) {
+            std::vector<unsigned> right, ahead, left;
+            for (unsigned next : nodes[roadTo[road]].outgoing) {
+                if (roadTo[next] == roadFrom[road])
+                    continue;
+                double turn = std::remainder(heading(next) - heading(road), 2 * pi);
+                if (turn < -pi / 4)
+                    right.push_back(next);
+                else if (turn > pi / 4)
+                    left.push_back(next);
+                else
+                    ahead.push_back(next);
+            }
+
+            unsigned lanes = roads[road].getLanesNo();
+            for (unsigned lane = 0; lane < lanes; ++lane) {
+                std::vector<unsigned> moves = ahead;
+                if (lane == 0)
+                    moves.insert(moves.end(), right.begin(), right.end());
+                if (lane == lanes - 1)
+                    moves.insert(moves.end(), left.begin(), left.end());
+                if (moves.empty()) {
+                    moves = right;
+                    moves.insert(moves.end(), ahead.begin(), ahead.end());
+                    moves.insert(moves.end(), left.begin(), left.end());
+                }
+                for (unsigned next : moves)
+                    roads[road].addLaneConnection(lane, idOf(next));
+            }
+        }
+    }
+
+    /* two phase plan at every junction, with a random offset. A junction reached by one phase only
+     * doesn't need a signal */
+    void setSignals(double green, double yellow, const CounterRng &rng)
+    {
+        for (unsigned node = 0; node < nodes.size(); ++node) {
+            const std::vector<unsigned> &incoming = nodes[node].incoming;
+            bool twoPhases = std::any_of(incoming.begin(), incoming.end(),
+                                         [&](unsigned road) { return roadPhase[road] != roadPhase[incoming[0]]; });
+
+            // time already spent in the first color: phase 0 starts green, phase 1 red
+            double offset = green * rng.uniform(node, 0, 0);
+            for (unsigned road : incoming) {
+                TrafficLight light = !twoPhases ?
+                            TrafficLight(alwaysGreen, 0, 0, TrafficLight::green_light) :
+                            TrafficLight(green, yellow, green + yellow,
+                                         roadPhase[road] == 0 ? TrafficLight::green_light : TrafficLight::red_light,
+                                         offset);
+                setTrafficLight(road, light);
+            }
+        }
+    }
+
+    void setTrafficLight(unsigned road, const TrafficLight &light)
+    {
+        for (unsigned lane = 0; lane < roads[road].getLanesNo(); ++lane)
+            roads[road].setTrafficLight(lane, light);
+    }
+};
+
+void buildGrid(CityBuilder &city, const CitySpec &spec)
+{
+    unsigned n = std::max(2u, spec.size);
+    for (unsigned row = 0; row < n; ++row)
+        for (unsigned column = 0; column < n; ++column)
+            city.addNode(column * spec.blockLength, row * spec.blockLength);
+
+    // phase 0 - east/west streets, phase 1 - north/south
+    for (unsigned row = 0; row < n; ++row)
+        for (unsigned column = 0; column < n; ++column) {
+            unsigned node = row * n + column;
+            if (column + 1 < n)
+                city.addStreet(node, node + 1, spec.lanes, spec.maxSpeed, 0);
+            if (row + 1 < n)
+                city.addStreet(node, node + n, spec.lanes, spec.maxSpeed, 1);
+        }
+
+    city.connectTurns();
+}
+
+unsigned radialSpokes(unsigned rings)
+{
+    return std::max(8u, rings);
+}
+
+void buildRadial(CityBuilder &city, const CitySpec &spec)
+{
+    unsigned rings = std::max(1u, spec.size);
+    unsigned spokes = radialSpokes(rings);
+
+    unsigned center = city.addNode(0.0, 0.0);
+    for (unsigned ring = 1; ring <= rings; ++ring)
+        for (unsigned spoke = 0; spoke < spokes; ++spoke) {
+            double angle = 2 * pi * spoke / spokes;
+            city.addNode(ring * spec.blockLength * std::cos(angle), ring * spec.blockLength * std::sin(angle));
+        }
+    auto node = [&](unsigned ring, unsigned spoke) { return 1 + (ring - 1) * spokes + spoke % spokes; };
+
+    // phase 0 - ring roads, phase 1 - spokes. At the center spokes alternate, so it runs two phases too
+    for (unsigned spoke = 0; spoke < spokes; ++spoke) {
+        city.addRoad(center, node(1, spoke), spec.lanes, spec.maxSpeed, 1);
+        city.addRoad(node(1, spoke), center, spec.lanes, spec.maxSpeed, spoke % 2);
+    }
+    for (unsigned ring = 1; ring <= rings; ++ring)
+        for (unsigned spoke = 0; spoke < spokes; ++spoke) {
+            city.addStreet(node(ring, spoke), node(ring, spoke + 1), spec.lanes, spec.maxSpeed, 0);
+            if (ring < rings)
+                city.addStreet(node(ring, spoke), node(ring + 1, spoke), spec.lanes, spec.maxSpeed, 1);
+        }
+
+    city.connectTurns();
+}
+
+/* eastbound carriageway on y = 0, westbound on y = 40, segments of 5 blocks. At every inner junction the right
+ * lane can take an off-ramp, and a metered on-ramp joins the right lane of the next segment. */
+void buildMotorway(CityBuilder &city, const CitySpec &spec, const CounterRng &rng)
+{
+    const TrafficLight free(alwaysGreen, 0, 0, TrafficLight::green_light);
+
+    unsigned segments = std::max(1u, spec.size);
+    unsigned lanes = spec.lanes + 1;
+    double segmentLength = 5 * spec.blockLength;
+
+    for (int direction : { 1, -1 }) {
+        double y = direction > 0 ? 0.0 : 40.0;
+        double rampY = direction > 0 ? -60.0 : 100.0;
+        auto x = [&](unsigned junction) {
+            return (direction > 0 ? junction : segments - junction) * segmentLength;
+        };
+
+        std::vector<unsigned> junctions;
+        for (unsigned junction = 0; junction <= segments; ++junction)
+            junctions.push_back(city.addNode(x(junction), y));
+
+        std::vector<unsigned> mainline;
+        for (unsigned segment = 0; segment < segments; ++segment) {
+            mainline.push_back(city.addRoad(junctions[segment], junctions[segment + 1], lanes, motorwaySpeed, 0));
+            city.setTrafficLight(mainline.back(), free);
+        }
+
+        for (unsigned junction = 1; junction < segments; ++junction) {
+            unsigned before = mainline[junction - 1];
+            unsigned after = mainline[junction];
+            for (unsigned lane = 0; lane < lanes; ++lane)
+                city.roads[before].addLaneConnection(lane, city.idOf(after));
+
+            unsigned exitNode = city.addNode(x(junction) + direction * rampLength / 2, rampY);
+            unsigned offRamp = city.addRoad(junctions[junction], exitNode, 1, rampSpeed, 0, rampLength);
+            city.roads[before].addLaneConnection(0, city.idOf(offRamp));
+            city.setTrafficLight(offRamp, free);
+
+            unsigned entryNode = city.addNode(x(junction) - direction * rampLength / 2, rampY);
+            unsigned onRamp = city.addRoad(entryNode, junctions[junction], 1, rampSpeed, 1, rampLength);
+            city.roads[onRamp].addLaneConnection(0, city.idOf(after));
+            // ramp meter: a vehicle or two per cycle
+            city.setTrafficLight(onRamp, TrafficLight(2.0, 1.0, 8.0, TrafficLight::red_light,
+                                                      8.0 * rng.uniform(onRamp, 0, 0)));
+        }
+    }
+}
+
+/* demand vehicles per km on every lane: evenly spread, a little jitter, desired speed around the limit.
+ * Draws are keyed by road, vehicle and lane, so a road's population doesn't depend on the others.
+ * Lanes are built front to back - already in indexRoad order - and moved into the road in one go */
+void populate(std::vector<Road> &roads, double demand, const CounterRng &rng)
+{
+    demand = std::min(demand, maxDemand);
+
+    std::vector<Vehicle> laneVehicles;
+    std::vector<size_t> counts;
+    for (Road &road : roads) {
+        double expected = road.getLength() * demand / 1000.0;
+        counts.assign(road.getLanesNo(), 0);
+        for (unsigned lane = 0; lane < road.getLanesNo(); ++lane)
+            counts[lane] = (unsigned)(expected + rng.uniform(road.getId(), 0, 0, 4 * lane));
+        road.reserveVehicles(counts);
+
+        for (unsigned lane = 0; lane < road.getLanesNo(); ++lane) {
+            uint32_t draw = 4 * lane;
+            unsigned count = counts[lane];
+            if (!count)
+                continue;
+
+            double spacing = (double)road.getLength() / count;
+            laneVehicles.reserve(count);
+            for (unsigned i = count; i-- > 0; ) {
+                double pos = (i + 0.3 * rng.uniform(road.getId(), i, 0, draw + 1)) * spacing;
+                double desiredSpeed = road.getMaxSpeed() * (0.8 + 0.4 * rng.uniform(road.getId(), i, 0, draw + 2));
+                laneVehicles.push_back(Vehicle(pos, 5.0, desiredSpeed));
+            }
+            road.addVehicles(std::move(laneVehicles), lane);
+        }
+    }
+}
+
+} // namespace
+
+std::vector<Road> generateCity(const CitySpec &spec)
+{
+    static const char *layoutNames[] = { "grid", "radial", "motorway" };
+
+    CounterRng demandRng = CounterRng::forStream(spec.seed, 0);
+    CounterRng signalRng = CounterRng::forStream(spec.seed, 1);
+
+    CityBuilder city;
+    city.scatterIds = spec.scatterIds;
+    switch (spec.layout) {
+    case CitySpec::grid:
+        buildGrid(city, spec);
+        city.setSignals(spec.green, spec.yellow, signalRng);
+        break;
+    case CitySpec::radial:
+        buildRadial(city, spec);
+        city.setSignals(spec.green, spec.yellow, signalRng);
+        break;
+    case CitySpec::motorway:
+        buildMotorway(city, spec, signalRng);
+        break;
+    }
+
+    populate(city.roads, spec.demand, demandRng);
+
+    unsigned long vehiclesNo = 0;
+    for (const Road &road : city.roads)
+        vehiclesNo += road.getVehiclesNo();
+    log_info("City %s, size %u: %lu roads, %lu lanes, %lu vehicles, seed %lu", layoutNames[spec.layout], spec.size,
+             (unsigned long)city.roads.size(), countLanes(city.roads), vehiclesNo, spec.seed);
+
+    return std::move(city.roads);
+}
+
+CitySpec citySpecForLanes(CitySpec::Layout layout, unsigned long lanesNo, unsigned long seed)
+{
+    CitySpec spec;
+    spec.layout = layout;
+    spec.seed = seed;
+
+    double lanes = std::max(10ul, lanesNo);
+    switch (layout) {
+    case CitySpec::grid:
+        // 4 n (n - 1) roads of spec.lanes lanes
+        if (lanes < 16)
+            spec.lanes = 1;
+        spec.size = std::max(2l, std::lround((1.0 + std::sqrt(1.0 + lanes / spec.lanes)) / 2.0));
+        break;
+    case CitySpec::radial: {
+        // 4 rings spokes roads, spokes = max(8, rings)
+        if (lanes < 64)
+            spec.lanes = 1;
+        double rings = lanes / (32.0 * spec.lanes);
+        if (rings > 8)
+            rings = std::sqrt(lanes / (4.0 * spec.lanes));
+        spec.size = std::max(1l, std::lround(rings));
+        break;
+    }
+    case CitySpec::motorway:
+        // 2 n carriageway segments of lanes + 1 lanes and 4 (n - 1) ramps
+        spec.size = std::max(1l, std::lround((lanes + 4) / (2.0 * (spec.lanes + 1) + 4)));
+        break;
+    }
+    return spec;
+}
+
+unsigned long countLanes(const std::vector<Road> &roads)
+{
+    unsigned long lanesNo = 0;
+    for (const Road &road : roads)
+        lanesNo += road.getLanesNo();
+    return lanesNo;
+}
+
+} // namespace simulator
@@ -0,0 +1,49 @@
+#ifndef CITYGEN_H
+#define CITYGEN_H
+
+#include "../road.h"
+
+#include <vector>
+
+namespace simulator
+{
+
+/* Synthetic cities for macro benchmarks and scaling runs - no map data needed.
+ *
+ *  grid     - Manhattan grid of size x size intersections, two-way streets between neighbours
+ *  radial   - size rings around a center, crossed by spokes (at least 8, more on large cities)
+ *  motorway - two carriageways of size segments, an on-ramp and an off-ramp at every junction
+ *
+ * Every street is two one-way roads with lane connections at both ends (right lane: right and ahead,
+ * left lane: left and ahead). Junctions run a two phase signal plan (green, yellow, red = the other phase's
+ * green + yellow) with a random offset; motorway lanes are never stopped, on-ramps are metered.
+ * Roads are populated with demand vehicles per km and lane.
+ *
+ * The same spec and seed always give the same city: ids, geometry, plans and vehicles.
+ */
+struct CitySpec
+{
+    enum Layout { grid, radial, motorway };
+
+    Layout layout = { grid };
+    unsigned size = { 4 };              // grid: intersections per side, radial: rings, motorway: segments
+    unsigned lanes = { 2 };             // lanes of a street. Motorway: lanes + 1, ramps: 1
+    double blockLength = { 200.0 };     // meters: grid block, ring spacing. Motorway segments are 5 blocks
+    unsigned maxSpeed = { 14 };         // m/s on streets. Motorway: 30
+    double demand = { 20.0 };           // vehicles per km and lane when the run starts. Capped at 150
+    double green = { 30.0 };            // seconds, signal plan of every junction
+    double yellow = { 3.0 };
+    unsigned long seed = { 1 };
+    bool scatterIds = { false };        // ids in no spatial order, like map data ids. Off: ids follow the layout
+};
+
+std::vector<Road> generateCity(const CitySpec &spec);
+
+// spec of a city with about lanesNo lanes (10 - 1,000,000): other fields keep their defaults
+CitySpec citySpecForLanes(CitySpec::Layout layout, unsigned long lanesNo, unsigned long seed = 1);
+
+unsigned long countLanes(const std::vector<Road> &roads);
+
+} // namespace simulator
+
+#endif // CITYGEN_H
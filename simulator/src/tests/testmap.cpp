@@ -124,35 +124,67 @@ std::vector<Road> twoLanesTestMap()
 }
 
 
+/*
+ * Network used by the random vehicle tests: one 3 lanes road, no vehicles.
+ * Road:
+ *      - length: 2000 m
+ *      - max speed: 20 meters/second (app. 70 km/h)
+ */
+std::vector<Road> randomVehicleTestNetwork()
+{
+    std::vector<Road> smap = {
+        Road(0, 2000, 3, 20)
+    };
+    return smap;
+}
+
+/*
+ * Add numVehicles vehicles with random positions, speeds and lanes on each road of the network.
+ * Vehicle i of road r draws from (r, i, step 0), so the population doesn't depend on the roads order.
+ */
+void addRandomVehicles(std::vector<Road> &roadNet, int numVehicles, const CounterRng &rng)
+{
+    std::vector<double> pos(numVehicles);
+    std::vector<double> speed(numVehicles);
+    std::vector<double> lane(numVehicles);
+
+    for(Road &r : roadNet) {
+        rng.uniformBlock(r.getId(), 0, 0, 0, numVehicles, pos.data());
+        rng.uniformBlock(r.getId(), 0, 0, 1, numVehicles, speed.data());
+        rng.uniformBlock(r.getId(), 0, 0, 2, numVehicles, lane.data());
+
+        for(int i = 0; i < numVehicles; ++i) {
+            int vPos = 1 + (int)(pos[i] * 500);     // 1 - 500 m
+            int vSpeed = 10 + (int)(speed[i] * 6);  // 10 - 15 m/s
+            r.addVehicle(Vehicle(vPos, 5.0, vSpeed), (unsigned)(lane[i] * r.getLanesNo()));
+        }
+    }
+}
+
 /* TODO:
  * Add random number of vehicles with random positions and random speeds
  */
 std::vector<Road> manyRandomVehicleTestMap(int numVehicles)
+{
+    // not reproducible, but the seed is logged: use the seeded version to replay it
+    std::random_device rd;
+    return manyRandomVehicleTestMap(numVehicles, ((unsigned long)rd() << 32) | rd());
+}
+
+std::vector<Road> manyRandomVehicleTestMap(int numVehicles, unsigned long seed)
 {
     Config::simulatorOuput = Config::simpleRoadTestFName;
 
-    std::random_device rd;
-    std::mt19937 rng(rd());
-
-    std::uniform_int_distribution<int> posRnd(1, 500);
-    std::uniform_int_distribution<int> speedRnd(10, 15);
-    std::uniform_int_distribution<int> laneRnd(0, 2);
-
-    Road r(0, 2000, 3, 20);
-    log_info("Random test - vehicles: %d", numVehicles);
-    for(int i = 0; i < numVehicles; ++i) {
-
-        int pos = posRnd(rng);
-        int speed = speedRnd(rng);
-        int lane = laneRnd(rng);
-        Vehicle v(pos, 5.0, speed);
-        v.log();
-        r.addVehicle(v, lane);
-    }
+    CounterRng rng(seed);
+
+    std::vector<Road> smap = randomVehicleTestNetwork();
+    log_info("Random test - vehicles: %d seed: %lu", numVehicles, seed);
+    addRandomVehicles(smap, numVehicles, rng);
+
+    for(auto &lane : smap[0].getVehicles())
+        for(auto &v : lane)
+            v.log();
 
-    std::vector<Road> smap = {
-        r
-    };
     return smap;
 }
 
@@ -3,6 +3,7 @@
 
 #include "../road.h"
 #include "../vehicle.h"
+#include "../rng.h"
 
 #include <vector>
 
@@ -10,6 +11,10 @@ namespace simulator
 {
 std::vector<Road> semaphoreTest();
 std::vector<Road> manyRandomVehicleTestMap(int numVehicles);
+std::vector<Road> manyRandomVehicleTestMap(int numVehicles, unsigned long seed);
+
+std::vector<Road> randomVehicleTestNetwork();
+void addRandomVehicles(std::vector<Road> &roadNet, int numVehicles, const CounterRng &rng);
 
 std::vector<Road> laneChangeTest();
 
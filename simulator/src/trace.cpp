@@ -0,0 +1,265 @@
+#include "trace.h"
+#include "logger.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simulator
+{
+
+namespace
+{
+
+const unsigned chunkEvents = 4096;
+const unsigned maxChunks = 256; // 256 * 4096 spans buffered at most - about 40 MB
+
+struct Chunk
+{
+    uint32_t tid;
+    unsigned size;
+    Trace::Event events[chunkEvents];
+};
+
+struct TraceThread
+{
+    Chunk *chunk = { nullptr };
+    uint32_t tid = { 0 };
+    std::string name;
+    bool alive = { true };
+};
+
+struct TraceState
+{
+    std::mutex lock;
+    std::condition_variable wake;
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::vector<Chunk *> freeChunks;
+    std::deque<Chunk *> fullChunks;     // waiting for the writer
+
+    std::vector<std::unique_ptr<TraceThread>> threads;
+    uint32_t nextTid = { 1 };
+
+    FILE *out = { nullptr };
+    std::thread writer;
+    bool stopWriter = { false };
+    bool firstEvent = { true };
+    uint64_t startTicks = { 0 };
+    std::atomic<uint64_t> dropped = { 0 };
+
+    void writeChunk(const Chunk &chunk)
+    {
+        double ticksPerUs = Profiler::ticksPerNs() * 1000.0;
+        for (unsigned i = 0; i < chunk.size; ++i) {
+            const Trace::Event &e = chunk.events[i];
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    firstEvent ? "" : ",\n", e.name, chunk.tid,
+                    (e.start - startTicks) / ticksPerUs, (e.end - e.start) / ticksPerUs);
+            if (e.road >= 0 || e.vehicles >= 0)
+                fprintf(out, ",\"args\":{\"road\":%ld,\"vehicles\":%ld}", (long)e.road, (long)e.vehicles);
+            fputc('}', out);
+            firstEvent = false;
+        }
+    }
+
+    void writerLoop()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&]() { return stopWriter || !fullChunks.empty(); });
+            if (fullChunks.empty() && stopWriter)
+                return;
+
+            std::deque<Chunk *> batch;
+            batch.swap(fullChunks);
+
+            // format without blocking the producers
+            guard.unlock();
+            for (Chunk *chunk : batch)
+                writeChunk(*chunk);
+            guard.lock();
+
+            for (Chunk *chunk : batch)
+                freeChunks.push_back(chunk);
+        }
+    }
+
+    // called with the lock held
+    Chunk *takeChunk(uint32_t tid)
+    {
+        Chunk *chunk = nullptr;
+        if (!freeChunks.empty()) {
+            chunk = freeChunks.back();
+            freeChunks.pop_back();
+        } else if (chunks.size() < maxChunks) {
+            chunks.push_back(std::unique_ptr<Chunk>(new Chunk()));
+            chunk = chunks.back().get();
+        } else {
+            return nullptr;
+        }
+        chunk->tid = tid;
+        chunk->size = 0;
+        return chunk;
+    }
+
+    // called with the lock held
+    void handOver(TraceThread &thread)
+    {
+        if (thread.chunk && thread.chunk->size)
+            fullChunks.push_back(thread.chunk);
+        else if (thread.chunk)
+            freeChunks.push_back(thread.chunk);
+        thread.chunk = nullptr;
+    }
+};
+
+TraceState &state()
+{
+    // never destroyed: threads ending after static destruction (the logger's) still hand their chunk back
+    static TraceState *traceState = new TraceState();
+    return *traceState;
+}
+
+struct ThreadRelease
+{
+    TraceThread *thread = { nullptr };
+
+    ~ThreadRelease()
+    {
+        if (!thread)
+            return;
+        TraceState &s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.handOver(*thread);
+        thread->alive = false;
+        s.wake.notify_one();
+    }
+};
+
+thread_local TraceThread *traceThread = nullptr;
+thread_local ThreadRelease threadRelease;
+
+TraceThread &currentThread()
+{
+    if (traceThread)
+        return *traceThread;
+
+    TraceState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    for (auto &thread : s.threads)
+        if (!thread->alive) {
+            traceThread = thread.get();
+            break;
+        }
+    if (!traceThread) {
+        s.threads.push_back(std::unique_ptr<TraceThread>(new TraceThread()));
+        traceThread = s.threads.back().get();
+    }
+
+    traceThread->alive = true;
+    traceThread->tid = s.nextTid++;
+    traceThread->name = "thread " + std::to_string(traceThread->tid);
+    threadRelease.thread = traceThread;
+    return *traceThread;
+}
+
+} // namespace
+
+std::atomic<bool> Trace::active(false);
+
+bool Trace::start(const std::string &fileName)
+{
+    FILE *out = fopen(fileName.c_str(), "w");
+    if (!out) {
+        log_error("Cannot create trace file %s", fileName.c_str());
+        Logger::flush(); // the message refers to fileName
+        return false;
+    }
+
+    TraceState &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (s.out) {
+        fclose(out);
+        log_error("Trace already running");
+        return false;
+    }
+    s.out = out;
+
+    // calibrate before the first span, not in the middle of the window
+    Profiler::ticksPerNs();
+
+    fprintf(s.out, "{\"traceEvents\":[\n");
+    s.firstEvent = true;
+    s.stopWriter = false;
+    s.dropped = 0;
+    s.startTicks = Profiler::ticks();
+    s.writer = std::thread(&TraceState::writerLoop, &s);
+
+    active.store(true, std::memory_order_release);
+    return true;
+}
+
+void Trace::stop()
+{
+    TraceState &s = state();
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (!s.out)
+            return;
+
+        active.store(false, std::memory_order_release);
+        for (auto &thread : s.threads)
+            s.handOver(*thread);
+        s.stopWriter = true;
+    }
+    s.wake.notify_one();
+    s.writer.join();
+
+    std::lock_guard<std::mutex> guard(s.lock);
+    for (auto &thread : s.threads)
+        fprintf(s.out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                s.firstEvent ? "" : ",\n", thread->tid, thread->name.c_str());
+    fprintf(s.out, "\n]}\n");
+    fclose(s.out);
+    s.out = nullptr;
+
+    if (s.dropped)
+        log_warning("Trace: writer fell behind, %lu spans dropped", (unsigned long)s.dropped);
+}
+
+void Trace::setThreadName(const char *name, int index)
+{
+    TraceThread &thread = currentThread();
+    std::lock_guard<std::mutex> guard(state().lock);
+    thread.name = index < 0 ? name : std::string(name) + " " + std::to_string(index);
+}
+
+void Trace::record(const char *name, uint64_t start, uint64_t end, int64_t road, int64_t vehicles)
+{
+    if (!enabled())
+        return;
+
+    TraceThread &thread = currentThread();
+    if (!thread.chunk || thread.chunk->size == chunkEvents) {
+        TraceState &s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (thread.chunk) {
+            s.fullChunks.push_back(thread.chunk);
+            s.wake.notify_one();
+        }
+        thread.chunk = s.takeChunk(thread.tid);
+        if (!thread.chunk) {
+            s.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    thread.chunk->events[thread.chunk->size++] = Event{ name, start, end, road, vehicles };
+}
+
+} // namespace simulator
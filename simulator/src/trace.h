@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "profiler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace simulator
+{
+
+/* Trace
+ * Chrome trace event export (chrome://tracing, ui.perfetto.dev) of simulation phases, per thread.
+ *
+ * A span is recorded into the calling thread's buffer: a chunk of fixed size events, no formatting, no locks.
+ * Full chunks are handed to a writer thread that formats the JSON and writes the file, then recycles them.
+ * The number of chunks is bounded: if the writer falls behind, spans are dropped (and counted) rather than
+ * slowing the simulation or growing memory. It is safe to switch on for a window of a long run:
+ *      Trace::start("window.json"); ... Trace::stop();
+ * While stopped, a TRACE_SCOPE costs one relaxed atomic load.
+ */
+class Trace
+{
+    static std::atomic<bool> active;
+
+public:
+    struct Event
+    {
+        const char *name;       // string literal
+        uint64_t start;         // ticks (Profiler::ticks)
+        uint64_t end;
+        int64_t road;           // -1 - no argument
+        int64_t vehicles;       // -1 - no argument
+    };
+
+    // start writing a trace file. Returns false if it can't be created or a trace is already running
+    static bool start(const std::string &fileName);
+
+    // flush every buffered span and close the file. Call it when no worker is inside a traced scope
+    static void stop();
+
+    static inline bool enabled()
+    {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // name of the calling thread in the trace, e.g. ("worker", 3)
+    static void setThreadName(const char *name, int index = -1);
+
+    static void record(const char *name, uint64_t start, uint64_t end, int64_t road = -1, int64_t vehicles = -1);
+};
+
+class ScopedTrace
+{
+    const char *name;
+    int64_t road;
+    int64_t vehicles;
+    uint64_t start;
+    bool on;
+
+public:
+    explicit ScopedTrace(const char *spanName, int64_t roadId = -1, int64_t vehiclesNo = -1) :
+        name(spanName), road(roadId), vehicles(vehiclesNo), start(0), on(Trace::enabled())
+    {
+        if (on)
+            start = Profiler::ticks();
+    }
+
+    ~ScopedTrace()
+    {
+        if (on)
+            Trace::record(name, start, Profiler::ticks(), road, vehicles);
+    }
+};
+
+} // namespace simulator
+
+#ifdef SIMULATOR_PROFILE
+#define TRACE_SCOPE(name) \
+    ::simulator::ScopedTrace PROFILE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_SCOPE_ARGS(name, road, vehicles) \
+    ::simulator::ScopedTrace PROFILE_CONCAT(traceScope_, __LINE__)(name, road, vehicles)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARGS(name, road, vehicles)
+#endif
+
+#endif // TRACE_H
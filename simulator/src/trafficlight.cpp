@@ -1,4 +1,5 @@
 #include "trafficlight.h"
+#include "binaryio.h"
 
 namespace simulator {
 
@@ -50,4 +51,31 @@ bool TrafficLight::isGreen() const
     return currentLightColor == green_light;
 }
 
+void TrafficLight::setColor(LightColor color)
+{
+    currentLightColor = color;
+    counter = 0;
+}
+
+TrafficLight::LightColor TrafficLight::getColor() const
+{
+    return currentLightColor;
+}
+
+void TrafficLight::saveState(std::ostream &out) const
+{
+    writeBinary(out, counter);
+    writeBinary(out, currentLightColor);
+    writeBinary(out, lightCycle);
+    writeBinary(out, lightsTime);
+}
+
+bool TrafficLight::loadState(std::istream &in)
+{
+    return readBinary(in, counter) &&
+            readBinary(in, currentLightColor) &&
+            readBinary(in, lightCycle) &&
+            readBinary(in, lightsTime);
+}
+
 } // namespace simulator
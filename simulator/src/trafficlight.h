@@ -1,7 +1,9 @@
 #ifndef TRAFFICLIGHT_H
 #define TRAFFICLIGHT_H
 
-#include <vector>
+#include <array>
+#include <istream>
+#include <ostream>
 
 namespace simulator
 {
@@ -29,8 +31,8 @@ private:
     // current color
     LightColor currentLightColor;
 
-    std::vector<LightColor> lightCycle = {green_light, yellow_light, red_light};
-    std::vector<double> lightsTime = {0.0, 0.0, 0.0};
+    std::array<LightColor, 3> lightCycle = {{green_light, yellow_light, red_light}};
+    std::array<double, 3> lightsTime = {{0.0, 0.0, 0.0}};
 public:
     TrafficLight();
     TrafficLight(double g, double y, double r, LightColor initialColor = green_light, double startTime = 0);
@@ -39,6 +41,13 @@ public:
     bool isRed() const;
     bool isGreen() const;
     void update(double dt);
+
+    // force the light to a color (signal override). The color's timer starts from zero
+    void setColor(LightColor color);
+    LightColor getColor() const;
+
+    void saveState(std::ostream &out) const;
+    bool loadState(std::istream &in);
 };
 
 } // namespace simulator
@@ -3,16 +3,37 @@
 #include "vehicle.h"
 #include "logger.h"
 #include "utils.h"
+#include "binaryio.h"
 
 namespace simulator
 {
 
-int Vehicle::idGen = 0;
+std::atomic<int> Vehicle::idGen(0);
+
+namespace
+{
+
+// the state is saved in double whatever the precision of real (defs.h): one format for every build
+void writeReal(std::ostream &out, real value)
+{
+    writeBinary(out, (double)value);
+}
+
+bool readReal(std::istream &in, real &value)
+{
+    double stored = 0.0;
+    if (!readBinary(in, stored))
+        return false;
+    value = (real)stored;
+    return true;
+}
+
+} // namespace
 
 Vehicle::Vehicle( double _x_orig, double _length, double maxV, ElementType vType ) :
     length(_length), xOrig(_x_orig), xPos(_x_orig), v0(maxV), type(vType)
 {
-    id = idGen++;
+    id = idGen.fetch_add(1, std::memory_order_relaxed);
     // log_info("New vehicle: ID: %d Pos: %2.f V: %.2f L: %.2f", id, xOrig, v0, length);
 }
 
@@ -21,11 +42,11 @@ Vehicle::Vehicle( double _x_orig, double _length, double maxV, ElementType vType
  * for lane changing.
  */
 
-double Vehicle::getNewAcceleration(const Vehicle &nextVehicle) const
+real Vehicle::getNewAcceleration(const Vehicle &nextVehicle, double nextOffset) const
 {
     // ODE here
     // s alfa - net distance to vehicle directly on front
-    double netDistance = nextVehicle.xPos - xPos - nextVehicle.length;
+    real netDistance = nextVehicle.xPos + real(nextOffset) - xPos - nextVehicle.length;
 
     bool freeRoad = false;
 
@@ -38,21 +59,23 @@ double Vehicle::getNewAcceleration(const Vehicle &nextVehicle) const
         freeRoad = false;
 
     // delta v - approaching rate
-    double deltaV = velocity - nextVehicle.velocity;
+    real deltaV = velocity - nextVehicle.velocity;
 
     // S* - equation parameter
-    double sStar = s0 + std::max(0.0, velocity * T + (velocity*deltaV)/(2*std::sqrt(a*b)));
+    real sStar = s0 + std::max(real(0), velocity * T + (velocity*deltaV)/(2*std::sqrt(a*b)));
 
-    // calculate acceleration
-    double newAcceleration = (a * (1.0 - std::pow(velocity/v0, delta) -
-                          (freeRoad ? 0 : std::pow(sStar/netDistance,2))));
+    // calculate acceleration. The square multiplied out: what a vector unit computes the same (MobilBatch)
+    real interaction = sStar/netDistance;
+    real newAcceleration = (a * (real(1) - std::pow(velocity/v0, delta) -
+                          (freeRoad ? 0 : interaction * interaction)));
 
     return newAcceleration;
 }
 
-void Vehicle::update(double dt, const Vehicle &nextVehicle)
+void Vehicle::update(double dt, const Vehicle &nextVehicle, double nextOffset)
 {
     roadTime += dt;
+    ++laneChangeSteps;
 
     // treat traffic lights as standing vehicles for now.
     // We identify traffic lights as zero length vehicles.
@@ -60,7 +83,14 @@ void Vehicle::update(double dt, const Vehicle &nextVehicle)
     if (length <= 0)
         return;
 
-    acceleration = getNewAcceleration(nextVehicle);
+    acceleration = getNewAcceleration(nextVehicle, nextOffset);
+
+    // a vehicle braking hard enough to stop within dt stops - it doesn't reverse
+    if (velocity + acceleration * dt < 0) {
+        xPos -= velocity * velocity / (2 * acceleration);
+        velocity = 0;
+        return;
+    }
 
     // advance
     xPos += velocity * dt + (acceleration * std::pow(dt, 2)) / 2;
@@ -81,55 +111,126 @@ bool Vehicle::canChangeLane(const Vehicle &currentLeader, const Vehicle &newLead
 //    if (currentLeader.getLength() <= 0 )
 //        return false;
 
-    // gap check
+    return hasGap(newLeader, newFollower) &&
+            wantsLane(accelerationBehind(currentLeader), accelerationBehind(newLeader), newFollower);
+}
+
+bool Vehicle::hasGap(const Vehicle &newLeader, const Vehicle &newFollower) const
+{
     bool hasGap = true;
-    if (newLeader.getLength() > 0)
-        hasGap = xPos < newLeader.getPos() - newLeader.getLength() - s0;
+    if (newLeader.length > 0)
+        hasGap = xPos < newLeader.xPos - newLeader.length - s0;
 
-    if (newFollower.getLength() > 0)
-            hasGap = hasGap && (xPos - length - s0 > newFollower.getPos());
+    if (newFollower.length > 0)
+            hasGap = hasGap && (xPos - length - s0 > newFollower.xPos);
 
-    if (!hasGap)
-        return false;
+    return hasGap;
+}
 
-    // MOBIL
-    double p = 0.3; // politeness factor TODO: make this the same as aggresivity
-    double b_safe = 4.0; // maximum safe deceleration
-    double a_thr = 0.2; // acceleration threshold: To avoid lane-change maneoeuvres triggered by marginal advantages
+real Vehicle::accelerationBehind(const Vehicle &leader) const
+{
+    return leader.getLength() > 0 ? getNewAcceleration(leader) : a; // a = max acceleration
+}
 
-    // safety criterion
-    bool isSafe = true;
-    if (newFollower.getLength() > 0 ) {
-        double nfacc = newFollower.getNewAcceleration(*this);
-        isSafe = newFollower.getLength() > 0 ? (nfacc > -b_safe) : true;
-    }
+bool Vehicle::wantsLane(real accCurrentLeader, real accNewLeader, const Vehicle &newFollower) const
+{
+    // the new follower's acceleration behind this vehicle - for both criteria
+    real newFollowerNewAcc = newFollower.getLength() > 0 ? newFollower.getNewAcceleration(*this) : 0;
 
-    if (!isSafe)
+    // safety criterion
+    if (newFollower.getLength() > 0 && !(newFollowerNewAcc > -bSafe))
         return false;
 
-    // incentive criterion
-    double accNl = newLeader.getLength() > 0 ? getNewAcceleration(newLeader) : a; // a = max acceleration
-    double accCl = currentLeader.getLength() > 0 ? getNewAcceleration(currentLeader) : a; // a = max acceleration
+    // incentive criterion. The follower counts from a meter long on: its length goes through an unsigned
     unsigned ll = newFollower.getLength();
-    double newFollowerNewAcc = ll > 0 ? newFollower.getNewAcceleration(*this) : 0;
+    if (ll == 0)
+        newFollowerNewAcc = 0;
 
     bool changeWanted =
-            ((accNl - accCl) >
-            ( p * (newFollower.getAcceleration() - newFollowerNewAcc) + a_thr) );
+            ((accNewLeader - accCurrentLeader) >
+            ( politeness * (newFollower.acceleration - newFollowerNewAcc) + aThr) );
 
     return changeWanted;
 }
 
+bool Vehicle::mayWantLane(real accCurrentLeader, real accNewLeader, const Vehicle &newFollower) const
+{
+    /* an IDM acceleration is never above the free road one - the interaction term only takes away - and the bound
+     * rounds the same way the acceleration it stands for does */
+    unsigned ll = newFollower.getLength();
+    real bestNewFollowerNewAcc = ll > 0 ? newFollower.getFreeAcceleration() : 0;
+
+    return (accNewLeader - accCurrentLeader) >
+            (politeness * (newFollower.acceleration - bestNewFollowerNewAcc) + aThr);
+}
+
+real Vehicle::getFreeAcceleration() const
+{
+    return a * (real(1) - std::pow(velocity/v0, delta));
+}
+
+void Vehicle::setMotion(const Motion &motion)
+{
+    xPos = motion.xPos;
+    velocity = motion.velocity;
+    acceleration = motion.acceleration;
+    roadTime = motion.roadTime;
+    laneChangeSteps = motion.laneChangeSteps;
+}
+
+void Vehicle::setLaneChangeProfile(double p, double b_safe, double a_thr)
+{
+    politeness = p;
+    bSafe = b_safe;
+    aThr = a_thr;
+}
+
 void Vehicle::addRoadToItinerary(roadID rId)
 {
     itinerary.push_back(rId);
 }
 
+void Vehicle::reserveItinerary(size_t roads)
+{
+    itinerary.reserve(roads);
+}
+
+void Vehicle::shift(double dx)
+{
+    xPos += dx;
+}
+
+void Vehicle::coast(double dt)
+{
+    if (length <= 0)
+        return;
+    // as update: it stops rather than reverse
+    if (velocity + acceleration * dt < 0) {
+        xPos -= velocity * velocity / (2 * acceleration);
+        velocity = 0;
+        return;
+    }
+    xPos += velocity * dt + (acceleration * std::pow(dt, 2)) / 2;
+    velocity += acceleration * dt;
+}
+
+void Vehicle::stopAt(double pos)
+{
+    xPos = pos;
+    velocity = 0;
+    acceleration = 0;
+}
+
 roadID Vehicle::getCurrentRoad() const
 {
     return itinerary.back();
 }
 
+size_t Vehicle::getItinerarySize() const
+{
+    return itinerary.size();
+}
+
 double Vehicle::getVelocity() const
 {
     return velocity;
@@ -179,6 +280,58 @@ void Vehicle::serialize_v1(std::ostream &out) const
 
 }
 
+void Vehicle::saveState(std::ostream &out) const
+{
+    writeBinary(out, id);
+    writeBinary(out, type);
+    writeReal(out, length);
+    writeBinary(out, xOrig);
+    writeReal(out, velocity);
+    writeReal(out, xPos);
+    writeBinary(out, s);
+    writeReal(out, acceleration);
+    writeBinary(out, aggressivity);
+    writeReal(out, v0);
+    writeReal(out, T);
+    writeReal(out, a);
+    writeReal(out, b);
+    writeReal(out, s0);
+    writeReal(out, delta);
+    writeReal(out, freeRoadDistance);
+    writeReal(out, politeness);
+    writeReal(out, bSafe);
+    writeReal(out, aThr);
+    writeBinary(out, itinerary);
+    writeBinary(out, roadTime);
+    writeBinary(out, laneChangeSteps);
+}
+
+bool Vehicle::loadState(std::istream &in)
+{
+    return readBinary(in, id) &&
+            readBinary(in, type) &&
+            readReal(in, length) &&
+            readBinary(in, xOrig) &&
+            readReal(in, velocity) &&
+            readReal(in, xPos) &&
+            readBinary(in, s) &&
+            readReal(in, acceleration) &&
+            readBinary(in, aggressivity) &&
+            readReal(in, v0) &&
+            readReal(in, T) &&
+            readReal(in, a) &&
+            readReal(in, b) &&
+            readReal(in, s0) &&
+            readReal(in, delta) &&
+            readReal(in, freeRoadDistance) &&
+            readReal(in, politeness) &&
+            readReal(in, bSafe) &&
+            readReal(in, aThr) &&
+            readBinary(in, itinerary) &&
+            readBinary(in, roadTime) &&
+            readBinary(in, laneChangeSteps);
+}
+
 void Vehicle::printVehicle() const
 {
     log_info("Vehicle:\n"
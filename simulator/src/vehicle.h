@@ -3,6 +3,9 @@
 
 #include "defs.h"
 
+#include <atomic>
+#include <cstdint>
+#include <istream>
 #include <ostream>
 #include <vector>
 
@@ -14,8 +17,20 @@ class Vehicle
 public:
     enum ElementType{ vehicle, traffic_light, obstacle };
 
+    // what update changes - to take a speculative update back (Road::updateFollowers)
+    struct Motion
+    {
+        real xPos;
+        real velocity;
+        real acceleration;
+        double roadTime;
+        uint32_t laneChangeSteps;
+    };
+
 private:
-    static int idGen;
+    // ids of new vehicles. Shared by every thread that makes vehicles - a simulator that needs ids that don't
+    // depend on the other threads numbers its own (Road::numberVehicles)
+    static std::atomic<int> idGen;
     int id;
     /* the length of the car.
      * We can have:
@@ -31,14 +46,14 @@ private:
      *       We identify them as zero or negavice length vehicles with zero speed.
      *
      */
-    double  length = { 5.0 };   // vechile length - see above
+    real    length = { 5.0 };   // vechile length - see above
     double  xOrig = { 0.0 };    // when a vechicle is created, it has to start(appear) somewhere
-    double  velocity = { 0.0 }; // current velocity. It will be updated through IDM equations
-    double  xPos = { 0.0 };     // current position on the road. It will be updated through IDM equations
+    real    velocity = { 0.0 }; // current velocity. It will be updated through IDM equations
+    real    xPos = { 0.0 };     // current position on the road. It will be updated through IDM equations
 
     double  s = { -1.0 };       // net distance to vehicle in front of this one (0 = accident, -1 = no vehicle in front
                                 // for large values of net distance, we should enter in free road mode
-    double acceleration = { 0 };// vehicle acceleration (meters per second square)
+    real acceleration = { 0 };  // vehicle acceleration (meters per second square)
 
     /* Model parameters are here, as we make most of it dependent on this driver's aggressivity */
     double aggressivity = { 0.5 };  // aggressivity factor of this driver.
@@ -46,43 +61,90 @@ private:
                                     // < 0.5 altruist/prudent driver
                                     // > 0.5 aggressive/selfish driver
 
-    double v0 = { 20.0 };   // Desired velocity - initialize to road's max speed
+    real v0 = { 20.0 };     // Desired velocity - initialize to road's max speed
                             // Adjust depending on aggressivity - some drivers would want to go above speed limit,
                             //                                    while others will want to go lower than speed limit, determined by statistics
 
     ElementType type;
 
-    double T = { 1.0 };     // Safe time headway - aggressivity dependent
-    double a = { 1.5 };     // Maximum acceleration - linked to agressivity
-    double b = { 3.0 };     // Desired deceleration - linked to agressivity
-    double s0 = { 1.0 };    // Minimum distance - Some drivers are more agressive, while others are less agressive
+    real T = { 1.0 };       // Safe time headway - aggressivity dependent
+    real a = { 1.5 };       // Maximum acceleration - linked to agressivity
+    real b = { 3.0 };       // Desired deceleration - linked to agressivity
+    real s0 = { 1.0 };      // Minimum distance - Some drivers are more agressive, while others are less agressive
                             //
-    double delta = { 4.0 }; // Acceleration exponent
+    real delta = { 4.0 };   // Acceleration exponent
+
+    real freeRoadDistance = { 100.0 }; // if net distance to vehicle ahead is larger, turn free road on
 
-    double freeRoadDistance = { 100.0 }; // if net distance to vehicle ahead is larger, turn free road on
+    /* MOBIL lane changes, as this driver makes them */
+    real politeness = { 0.3 };      // p: how much the new follower's disadvantage counts - 0 selfish, 1 altruist
+    real bSafe = { 4.0 };           // maximum safe deceleration it imposes on the new follower
+    real aThr = { 0.2 };            // acceleration threshold: no lane change for a marginal advantage
 
     /* Keep some stats about this vehicle.
      * We can compare itineraries and travel time between vehicles for performance measures */
     std::vector<roadID> itinerary; // itinerary of this vehicle.
-    double roadTime; // time spent in traffic by this car
+    double roadTime = { 0.0 }; // time spent in traffic by this car
+    uint32_t laneChangeSteps = { 0 }; // updates since its last lane change, or since it was created (lanechange.h)
 
-private:
-    /* compute new acceleration considering next vehicle */
-    double getNewAcceleration(const Vehicle &nextVehicle) const;
 public:
     Vehicle( double _x_orig, double _length, double maxV, ElementType vType = vehicle );
 
-    void update(double dt, const Vehicle &nextVehicle); // update position, acceleration and velocity
+    /* update position, acceleration and velocity.
+     * nextOffset - added to the leader's position: on a periodic road the leader of the first vehicle is a lap ahead */
+    void update(double dt, const Vehicle &nextVehicle, double nextOffset = 0.0);
+
+    /* compute new acceleration considering next vehicle */
+    real getNewAcceleration(const Vehicle &nextVehicle, double nextOffset = 0.0) const;
 
     bool canChangeLane(const Vehicle &currentLeader, const Vehicle &newLeader, const Vehicle &newFollower) const;
 
+    /* canChangeLane in parts, for a vehicle that looks at both neighbouring lanes: its acceleration behind the
+     * current leader is worked out once.
+     * hasGap && wantsLane(accelerationBehind(currentLeader), accelerationBehind(newLeader), ...) is canChangeLane */
+    bool hasGap(const Vehicle &newLeader, const Vehicle &newFollower) const;
+    // behind leader. a - maximum acceleration - with none
+    real accelerationBehind(const Vehicle &leader) const;
+    // MOBIL's safety and incentive criteria
+    bool wantsLane(real accCurrentLeader, real accNewLeader, const Vehicle &newFollower) const;
+
+    /* necessary for wantsLane, without the new follower's IDM evaluation: the incentive with the follower at its
+     * free road acceleration behind this vehicle - more than it can get. False - wantsLane is false */
+    bool mayWantLane(real accCurrentLeader, real accNewLeader, const Vehicle &newFollower) const;
+
+    // acceleration on a free road
+    real getFreeAcceleration() const;
+
+    uint32_t getStepsSinceLaneChange() const { return laneChangeSteps; }
+    void laneChanged() { laneChangeSteps = 0; }
+
+    Motion getMotion() const { return Motion{ xPos, velocity, acceleration, roadTime, laneChangeSteps }; }
+    void setMotion(const Motion &motion);
+
+    // politeness, safe deceleration and threshold of MOBIL
+    void setLaneChangeProfile(double p, double b_safe, double a_thr);
+
     void addRoadToItinerary(roadID rId);
+    // room for this many roads in the itinerary, so driving on doesn't allocate
+    void reserveItinerary(size_t roads);
+
+    // move along the road without driving: periodic roads wrap vehicles from the end back to the start
+    void shift(double dx);
+
+    /* dt ahead at the acceleration it has, without a leader to react to: where a follower updated after it would
+     * find it - for a copy standing in for a leader that moves at the same time (Road's segment halos) */
+    void coast(double dt);
+
+    // stands still at pos: held back where it meant to leave its road
+    void stopAt(double pos);
 
     double getPos() const;
     double getAcceleration() const;
     double getLength() const;
     double getVelocity() const;
     roadID getCurrentRoad() const;
+    // roads driven on so far, the current one included
+    size_t getItinerarySize() const;
 
     bool isTrafficLight() const;
     bool isVehicle() const;
@@ -92,9 +154,17 @@ public:
 
     void serialize_v1(std::ostream &out) const;
 
+    // complete binary state, including id and model parameters - for checkpoints and replay
+    void saveState(std::ostream &out) const;
+    bool loadState(std::istream &in);
+
     void printVehicle() const;
     void log() const;
     int getId() const { return id; }
+    void setId(int newId) { id = newId; }
+
+    // gathers the model parameters
+    friend class MobilBatch;
 };
 
 } // simulator
@@ -0,0 +1,93 @@
+#include "workerpool.h"
+#include "numa.h"
+#include "trace.h"
+
+namespace simulator
+{
+
+WorkerPool::WorkerPool(unsigned workersNo, const std::vector<unsigned> &workerCpus) :
+    cpus(workerCpus)
+{
+    if (!cpus.empty())
+        cpus.resize(workersNo, cpus.back());
+
+    // the owner runs worker 0's share
+    Trace::setThreadName("worker", 0);
+    if (!cpus.empty()) {
+        ownerCpus = currentThreadCpus();
+        pinCurrentThread({ cpus[0] });
+    }
+    for (unsigned worker = 1; worker < workersNo; ++worker)
+        threads.emplace_back(&WorkerPool::workerLoop, this, worker);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    startCondition.notify_all();
+
+    for (std::thread &thread : threads)
+        thread.join();
+
+    if (!ownerCpus.empty())
+        pinCurrentThread(ownerCpus);
+}
+
+unsigned WorkerPool::size() const
+{
+    return threads.size() + 1;
+}
+
+bool WorkerPool::isPinned() const
+{
+    return !cpus.empty();
+}
+
+void WorkerPool::workerLoop(unsigned worker)
+{
+    Trace::setThreadName("worker", worker);
+    if (!cpus.empty())
+        pinCurrentThread({ cpus[worker] });
+
+    unsigned long seen = 0;
+    while (true) {
+        const std::function<void(unsigned)> *current = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            startCondition.wait(guard, [&]() { return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+            current = job;
+        }
+
+        (*current)(worker);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--running == 0)
+            doneCondition.notify_one();
+    }
+}
+
+void WorkerPool::run(const std::function<void(unsigned worker)> &fn)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        job = &fn;
+        running = threads.size();
+        ++generation;
+    }
+    startCondition.notify_all();
+
+    fn(0);
+
+    // the time the caller waits here is the step's straggler cost
+    TRACE_SCOPE("barrier_wait");
+    std::unique_lock<std::mutex> guard(lock);
+    doneCondition.wait(guard, [&]() { return running == 0; });
+}
+
+} // namespace simulator
@@ -0,0 +1,52 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simulator
+{
+
+/* WorkerPool
+ * A fixed set of threads that run the same job and wait for each other - the parallel part of a step.
+ * The calling thread is worker 0, so a pool of n workers starts n - 1 threads.
+ * Pinned pools (cpus given) keep every worker on its cpu - the caller too, for as long as the pool lives - so
+ * what a worker allocates and touches stays on its NUMA node (numa.h).
+ */
+class WorkerPool
+{
+    std::vector<std::thread> threads;
+    std::vector<unsigned> cpus;         // of every worker. Empty - not pinned
+    std::vector<unsigned> ownerCpus;    // the caller's, given back when the pool goes
+
+    std::mutex lock;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+
+    const std::function<void(unsigned worker)> *job = { nullptr };
+    unsigned long generation = { 0 };   // incremented for every job
+    unsigned running = { 0 };           // workers still busy with the current job
+    bool stop = { false };
+
+    void workerLoop(unsigned worker);
+
+public:
+    explicit WorkerPool(unsigned workersNo, const std::vector<unsigned> &workerCpus = std::vector<unsigned>());
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    unsigned size() const;
+    bool isPinned() const;
+
+    // run fn(worker) on every worker, worker 0 being the caller. Returns when all of them are done
+    void run(const std::function<void(unsigned worker)> &fn);
+};
+
+} // namespace simulator
+
+#endif // WORKERPOOL_H